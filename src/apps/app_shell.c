@@ -1,11 +1,24 @@
 // Nordic modules
 #include <zephyr/zephyr.h>
 #include <stdlib.h> 
+#include <string.h>
 #include <zephyr/shell/shell.h>
 
 // Citysage modules
 #include "lte_connect_mgr.h"    // need LTE connection mgr to display/clear stats
 #include "bsp/modem.h"       // need modem to fetch important  debug info
+#include "config/config.h"   // need config datastore to display stats & force a commit
+#include "storage/tele_log.h"   // need telemetry log to display stats & the sample history
+#include "connectors/aws_connector.h"  // need AWS connector to publish history again, raise alarms & display lane stats
+#include "storage/sd_capture.h" // need SD capture to display stats, list captures & benchmark the card
+#include "bsp/spi_sched.h"      // need SPI scheduler to display & clear per device stats
+#include "bsp/ext_flash.h"      // need external flash power management to display wake & residency stats
+#include "encoding/aws_encoding.h"   // need encoding to benchmark JSON against CBOR & the shadow decoders
+
+#define HISTORY_PRINT_MAX       20      // records printed by the history commands unless told otherwise
+#define HISTORY_READ_BATCH      8       // records read from the log at a time
+#define ENCODE_BENCH_RECS       30      // records encoded by the encoding benchmark unless told otherwise
+#define REPORTED_BUF_LEN        512     // room for the reported state of all the shadow attributes
 
 /** 
 * @brief    Function to display the LTE connection statistics
@@ -39,6 +52,436 @@ static int app_lte_clear(const struct shell *shell, size_t argc, char *argv[])
     return 0;
 }
 
+/** 
+* @brief    Function to display the config datastore statistics
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_config_stats(const struct shell *shell, size_t argc, char *argv[])
+{
+    config_stats_print();
+    return 0;
+}
+
+/** 
+* @brief    Function to write any pending configuration changes to flash now
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_config_commit(const struct shell *shell, size_t argc, char *argv[])
+{
+    int err = config_commit();
+
+    printk("Config commit %s\n", err ? "failed" : "done");
+    return err;
+}
+
+#if defined(CONFIG_TELE_LOG)
+/** 
+* @brief    Function to display the telemetry log statistics
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_tele_stats(const struct shell *shell, size_t argc, char *argv[])
+{
+    tele_log_stats_print();
+    return 0;
+}
+
+/** 
+* @brief    Function to write the telemetry records buffered in RAM to flash now
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_tele_flush(const struct shell *shell, size_t argc, char *argv[])
+{
+    tele_log_flush();
+    printk("Telemetry log flush requested\n");
+    return 0;
+}
+
+/** 
+* @brief    Function to check that a reboot would recover the telemetry log as it is now
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_tele_check(const struct shell *shell, size_t argc, char *argv[])
+{
+    int bad;
+
+    bad = tele_log_check();
+    printk("%d tiers do not recover as they are\n", bad);
+    return 0;
+}
+
+/** 
+* @brief    Function to print the sample history from a cursor
+*
+* @param    curp        cursor positioned on the first record to print
+* @param    to_ts       stop at the first record after this time
+* @param    max_recs    max number of records to print
+*
+* @return   none
+*
+* @note      
+*/
+static void app_history_print(struct tele_log_cursor *curp, uint32_t to_ts, int max_recs)
+{
+    struct tele_record recs[HISTORY_READ_BATCH];
+    int printed = 0;
+    int num, i;
+
+    printk("%10s %10s %4s %10s %5s\n", "seq", "time", "type", "value", "count");
+
+    while (printed < max_recs)
+    {
+        num = tele_log_read(curp, recs, MIN(ARRAY_SIZE(recs), max_recs - printed));
+        if (num == 0)
+            break;
+
+        for (i = 0; i < num; i++)
+        {
+            if (recs[i].timestamp > to_ts)
+                return;
+
+            printk("%10u %10u %4u %10d %5u\n", recs[i].seq, recs[i].timestamp, recs[i].type, recs[i].value,
+                recs[i].count);
+        }
+        printed += num;
+    }
+}
+
+/** 
+* @brief    Function to parse the tier of the history to query
+*
+* @param    namep   tier name from the command line, NULL for the default
+*
+* @return   tier, raw if the name is not known
+*
+* @note      
+*/
+static enum tele_log_tier app_history_tier(const char *namep)
+{
+    if (namep != NULL && strcmp(namep, "minute") == 0)
+        return TELE_TIER_MINUTE;
+
+    if (namep != NULL && strcmp(namep, "hour") == 0)
+        return TELE_TIER_HOUR;
+
+    return TELE_TIER_RAW;
+}
+
+/** 
+* @brief    Function to display the sample history between two times
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_history_time(const struct shell *shell, size_t argc, char *argv[])
+{
+    struct tele_log_cursor cur;
+    uint32_t from_ts = strtoul(argv[1], NULL, 0);
+    uint32_t to_ts = strtoul(argv[2], NULL, 0);
+    int max_recs = argc > 3 ? atoi(argv[3]) : HISTORY_PRINT_MAX;
+    enum tele_log_tier tier = app_history_tier(argc > 4 ? argv[4] : NULL);
+
+    if (tele_log_seek_time(tier, from_ts, &cur))
+    {
+        printk("No records at or after %u\n", from_ts);
+        return 0;
+    }
+
+    app_history_print(&cur, to_ts, max_recs);
+    return 0;
+}
+
+/** 
+* @brief    Function to display the sample history from a sequence number
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_history_seq(const struct shell *shell, size_t argc, char *argv[])
+{
+    struct tele_log_cursor cur;
+    uint32_t seq = strtoul(argv[1], NULL, 0);
+    int max_recs = argc > 2 ? atoi(argv[2]) : HISTORY_PRINT_MAX;
+    enum tele_log_tier tier = app_history_tier(argc > 3 ? argv[3] : NULL);
+
+    if (tele_log_seek_seq(tier, seq, &cur))
+    {
+        printk("No records at or after seq %u\n", seq);
+        return 0;
+    }
+
+    app_history_print(&cur, UINT32_MAX, max_recs);
+    return 0;
+}
+
+/** 
+* @brief    Function to publish the sample history between two times again
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_history_send(const struct shell *shell, size_t argc, char *argv[])
+{
+    int err = aws_connector_replay(strtoul(argv[1], NULL, 0), strtoul(argv[2], NULL, 0));
+
+    printk("History replay %s: %d\n", err ? "failed" : "requested", err);
+    return err;
+}
+
+/** 
+* @brief    Function to benchmark the history index against a linear scan
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_history_bench(const struct shell *shell, size_t argc, char *argv[])
+{
+    tele_log_bench(strtoul(argv[1], NULL, 0));
+    return 0;
+}
+#endif
+
+/** 
+* @brief    Function to display the AWS connector lane & event queue statistics
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_aws_stats(const struct shell *shell, size_t argc, char *argv[])
+{
+    aws_connector_stats_print();
+    return 0;
+}
+
+/** 
+* @brief    Function to raise an alarm, published ahead of everything else
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_aws_alarm(const struct shell *shell, size_t argc, char *argv[])
+{
+    int err = aws_connector_alarm(strtoul(argv[1], NULL, 0), strtol(argv[2], NULL, 0));
+
+    printk("Alarm %s: %d\n", err ? "failed" : "queued", err);
+    return err;
+}
+
+/** 
+* @brief    Function to compare the size and encode time of JSON and CBOR telemetry
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_encode_bench(const struct shell *shell, size_t argc, char *argv[])
+{
+    aws_encode_bench(argc > 1 ? strtol(argv[1], NULL, 0) : ENCODE_BENCH_RECS);
+    return 0;
+}
+
+/** 
+* @brief    Function to compare the in-place shadow decoder with cJSON
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_encode_shadow(const struct shell *shell, size_t argc, char *argv[])
+{
+    aws_decode_bench();
+    return 0;
+}
+
+/** 
+* @brief    Function to display the reported state of all the shadow attributes of the config datastore
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_encode_reported(const struct shell *shell, size_t argc, char *argv[])
+{
+    static struct dev_config_values values;
+    static char buf[REPORTED_BUF_LEN];
+    int len;
+
+    config_snapshot(&values);
+    len = aws_encode_reported(&values, UINT32_MAX, NULL, 0, buf, sizeof(buf));
+    if (len < 0)
+    {
+        printk("Reported state does not fit: %d\n", len);
+        return len;
+    }
+
+    printk("%s\n%d bytes\n", buf, len);
+    return 0;
+}
+
+#if defined(CONFIG_SD_CAPTURE)
+/** 
+* @brief    Function to display the SD capture statistics
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_sdcap_stats(const struct shell *shell, size_t argc, char *argv[])
+{
+    sd_capture_stats_print();
+    return 0;
+}
+
+/** 
+* @brief    Function to list the captures on the SD card
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_sdcap_list(const struct shell *shell, size_t argc, char *argv[])
+{
+    sd_capture_list();
+    return 0;
+}
+
+/** 
+* @brief    Function to write an empty capture container to the SD card
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_sdcap_format(const struct shell *shell, size_t argc, char *argv[])
+{
+    int err = sd_capture_format();
+
+    printk("SD capture format %s: %d\n", err ? "failed" : "done", err);
+    return err;
+}
+
+/** 
+* @brief    Function to measure the sustained throughput & CPU load of capturing to the SD card
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_sdcap_bench(const struct shell *shell, size_t argc, char *argv[])
+{
+    int err = sd_capture_bench(strtoul(argv[1], NULL, 0));
+
+    if (err)
+        printk("SD capture benchmark failed: %d\n", err);
+    return err;
+}
+#endif
+
+#if defined(CONFIG_SPI_SCHED)
+/** 
+* @brief    Function to display the SPI scheduler statistics
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_spi_stats(const struct shell *shell, size_t argc, char *argv[])
+{
+    spi_sched_stats_print();
+    return 0;
+}
+
+/** 
+* @brief    Function to clear the SPI scheduler statistics
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_spi_clear(const struct shell *shell, size_t argc, char *argv[])
+{
+    spi_sched_stats_clear();
+    return 0;
+}
+#endif
+
+#if defined(CONFIG_EXT_FLASH_PM)
+/** 
+* @brief    Function to display the power statistics of the external flash
+*
+* @param    shell variable length parameter list
+*
+* @return   err
+*
+* @note      
+*/
+static int app_extflash_stats(const struct shell *shell, size_t argc, char *argv[])
+{
+    ext_flash_stats_print();
+    return 0;
+}
+#endif
+
 /** 
 * @brief    Function to clear the LTE connection statistics  
 *
@@ -66,4 +509,165 @@ SHELL_STATIC_SUBCMD_SET_CREATE(
         SHELL_SUBCMD_SET_END
         );
     SHELL_CMD_REGISTER(lte, &lte_display_statistics_cmds, "Shows & clears LTE connection statistics", NULL);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        config_cmds,
+        SHELL_CMD_ARG(stats, NULL,
+            "displays config datastore statistics\n"
+            "usage: config stats\n",
+            app_config_stats, 1, 0),
+
+        SHELL_CMD_ARG(commit, NULL,
+            "writes pending configuration changes to flash\n"
+            "usage: config commit\n",
+            app_config_commit, 1, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(config, &config_cmds, "Shows config datastore statistics & forces a commit", NULL);
+
+#if defined(CONFIG_TELE_LOG)
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        tele_cmds,
+        SHELL_CMD_ARG(stats, NULL,
+            "displays telemetry log statistics\n"
+            "usage: tele stats\n",
+            app_tele_stats, 1, 0),
+
+        SHELL_CMD_ARG(flush, NULL,
+            "writes the telemetry records buffered in RAM to flash\n"
+            "usage: tele flush\n",
+            app_tele_flush, 1, 0),
+
+        SHELL_CMD_ARG(check, NULL,
+            "checks that recovering the telemetry log from flash finds the head and tail it runs with\n"
+            "usage: tele check\n",
+            app_tele_check, 1, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(tele, &tele_cmds, "Shows telemetry log statistics", NULL);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        history_cmds,
+        SHELL_CMD_ARG(time, NULL,
+            "displays the samples logged between two unix times\n"
+            "usage: history time <from> <to> [max records] [raw|minute|hour]\n",
+            app_history_time, 3, 2),
+
+        SHELL_CMD_ARG(seq, NULL,
+            "displays the samples logged from a sequence number\n"
+            "usage: history seq <seq> [max records] [raw|minute|hour]\n",
+            app_history_seq, 2, 2),
+
+        SHELL_CMD_ARG(send, NULL,
+            "publishes the samples logged between two unix times again\n"
+            "usage: history send <from> <to>\n",
+            app_history_send, 3, 0),
+
+        SHELL_CMD_ARG(bench, NULL,
+            "times finding a unix time with the index and with a linear scan\n"
+            "usage: history bench <time>\n",
+            app_history_bench, 2, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(history, &history_cmds, "Queries the sample history in the telemetry log", NULL);
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        aws_cmds,
+        SHELL_CMD_ARG(stats, NULL,
+            "displays depth, latency & drops of the outbound lanes\n"
+            "usage: aws stats\n",
+            app_aws_stats, 1, 0),
+
+        SHELL_CMD_ARG(alarm, NULL,
+            "raises an alarm of a record type with a value\n"
+            "usage: aws alarm <type> <value>\n",
+            app_aws_alarm, 3, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(aws, &aws_cmds, "Shows AWS connector statistics & raises alarms", NULL);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        encode_cmds,
+        SHELL_CMD_ARG(bench, NULL,
+            "compares message size & encode time of JSON and CBOR telemetry\n"
+            "usage: encode bench [num_records]\n",
+            app_encode_bench, 1, 1),
+
+        SHELL_CMD_ARG(shadow, NULL,
+            "compares decode time & heap of the in-place shadow decoder and cJSON\n"
+            "usage: encode shadow\n",
+            app_encode_shadow, 1, 0),
+
+        SHELL_CMD_ARG(reported, NULL,
+            "shows the reported state of the shadow attributes\n"
+            "usage: encode reported\n",
+            app_encode_reported, 1, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(encode, &encode_cmds, "Benchmarks the telemetry encodings & the shadow decoder, shows the reported state", NULL);
+
+#if defined(CONFIG_SD_CAPTURE)
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        sdcap_cmds,
+        SHELL_CMD_ARG(stats, NULL,
+            "displays SD capture statistics, throughput & CPU load of the last capture\n"
+            "usage: sdcap stats\n",
+            app_sdcap_stats, 1, 0),
+
+        SHELL_CMD_ARG(list, NULL,
+            "lists the captures on the SD card\n"
+            "usage: sdcap list\n",
+            app_sdcap_list, 1, 0),
+
+        SHELL_CMD_ARG(format, NULL,
+            "erases every capture, the card is used raw\n"
+            "usage: sdcap format\n",
+            app_sdcap_format, 1, 0),
+
+        SHELL_CMD_ARG(bench, NULL,
+            "captures a synthetic stream as fast as the card takes it\n"
+            "usage: sdcap bench <seconds>\n",
+            app_sdcap_bench, 2, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(sdcap, &sdcap_cmds, "Raw data capture to the SD card", NULL);
+#endif
+
+#if defined(CONFIG_SPI_SCHED)
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        spi_cmds,
+        SHELL_CMD_ARG(stats, NULL,
+            "displays per device latency & utilisation of the shared SPI bus\n"
+            "usage: spi stats\n",
+            app_spi_stats, 1, 0),
+
+        SHELL_CMD_ARG(clear, NULL,
+            "clears the SPI scheduler statistics, utilisation is measured from here\n"
+            "usage: spi clear\n",
+            app_spi_clear, 1, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(spi, &spi_cmds, "Shows & clears shared SPI bus statistics", NULL);
+#endif
+
+#if defined(CONFIG_EXT_FLASH_PM)
+SHELL_STATIC_SUBCMD_SET_CREATE(
+        extflash_cmds,
+        SHELL_CMD_ARG(stats, NULL,
+            "displays wake count & awake time residency of the external flash\n"
+            "usage: extflash stats\n",
+            app_extflash_stats, 1, 0),
+
+        SHELL_SUBCMD_SET_END
+        );
+    SHELL_CMD_REGISTER(extflash, &extflash_cmds, "Shows external flash power statistics", NULL);
+#endif
 }
@@ -0,0 +1,215 @@
+/**
+ * @brief: 	ext_flash.c - Power management of the external flash
+ *
+ * @notes:  The W25Q32JV draws far more in standby than in deep power-down, and it is idle nearly all the time.
+ *          Every user of the flash brackets its I/O with ext_flash_get() and ext_flash_put(). The first get
+ *          wakes the flash, and once the last user has put it back and CONFIG_EXT_FLASH_IDLE_MS went by without
+ *          a new get, the flash goes back to deep power-down. A run of operations close together shares one
+ *          wake-up, an I/O window.
+ *
+ *          In deep power-down the flash ignores everything but the release command, so anything touching it
+ *          without a get reads garbage. The driver handles t-enter-dpd and t-exit-dpd from the devicetree.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr/zephyr.h>
+#include <zephyr/device.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/logging/log.h>
+
+// includes for application
+#include "sys_wrapper.h"
+#include "ext_flash.h"
+
+LOG_MODULE_REGISTER(ext_flash);     // register with logging package
+
+/*
+*   Statistics of the external flash power management
+*/
+struct ext_flash_stats
+{
+    uint32_t    gets;               // users bracketing I/O
+    uint32_t    wakes;              // times woken from deep power-down
+    uint32_t    pm_errors;          // failed power state changes
+    int64_t     awake_ms;           // time awake, not counting the current window
+};
+
+/*
+*   External flash control block
+*/
+struct ext_flash_blk
+{
+    const struct device *flashp;
+    struct k_mutex  pm_lock;        // protects the count and the power state
+    uint32_t        users;          // users between get and put
+    bool            awake;
+    int64_t         awake_since_ms; // start of the current window
+
+    struct ext_flash_stats stats;
+};
+
+// allocate storage for the control block
+static struct ext_flash_blk flash_cblk;
+
+static void ext_flash_idle_work_fn(struct k_work *workp);
+
+// delayed work to put the flash in deep power-down once it was idle long enough
+static K_WORK_DELAYABLE_DEFINE(ext_flash_idle_work, ext_flash_idle_work_fn);
+
+/**
+* @brief    ext_flash_idle_work_fn - Put the flash in deep power-down if nobody got it again meanwhile
+*
+* @param    workp   not used
+*
+* @return   none
+*
+* @note     Runs on the system work queue
+*/
+static void ext_flash_idle_work_fn(struct k_work *workp)
+{
+    struct ext_flash_blk *cblkp = &flash_cblk;
+    int err;
+
+    k_mutex_lock(&cblkp->pm_lock, K_FOREVER);
+
+    if (cblkp->users == 0 && cblkp->awake)
+    {
+        err = pm_device_action_run(cblkp->flashp, PM_DEVICE_ACTION_SUSPEND);
+        if (err && err != -EALREADY)
+        {
+            // stays awake, no harm done
+            cblkp->stats.pm_errors++;
+            LOG_ERR("Unable to put the external flash in deep power-down: %d", err);
+        }
+        else
+        {
+            cblkp->awake = false;
+            cblkp->stats.awake_ms += k_uptime_get() - cblkp->awake_since_ms;
+        }
+    }
+
+    k_mutex_unlock(&cblkp->pm_lock);
+}
+
+/**
+* @brief    ext_flash_get - Wake the flash up if need be and keep it awake until ext_flash_put()
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Nests, every get needs a put. Thread context only, waking the flash goes over SPI.
+*/
+void ext_flash_get(void)
+{
+    struct ext_flash_blk *cblkp = &flash_cblk;
+    int err;
+
+    k_mutex_lock(&cblkp->pm_lock, K_FOREVER);
+
+    cblkp->users++;
+    cblkp->stats.gets++;
+
+    if (!cblkp->awake)
+    {
+        err = pm_device_action_run(cblkp->flashp, PM_DEVICE_ACTION_RESUME);
+        if (err && err != -EALREADY)
+        {
+            // the I/O that follows fails and reports it
+            cblkp->stats.pm_errors++;
+            LOG_ERR("Unable to wake the external flash: %d", err);
+        }
+
+        cblkp->awake = true;
+        cblkp->awake_since_ms = k_uptime_get();
+        cblkp->stats.wakes++;
+    }
+
+    k_mutex_unlock(&cblkp->pm_lock);
+}
+
+/**
+* @brief    ext_flash_put - Done with the flash for now
+*
+* @param    none
+*
+* @return   none
+*
+* @note     The last put starts the idle time, the flash only goes to deep power-down once it ran out
+*/
+void ext_flash_put(void)
+{
+    struct ext_flash_blk *cblkp = &flash_cblk;
+
+    k_mutex_lock(&cblkp->pm_lock, K_FOREVER);
+
+    if (cblkp->users == 0)
+        erabort("ext_flash_put - put without get");
+
+    if (--cblkp->users == 0)
+        k_work_reschedule(&ext_flash_idle_work, K_MSEC(CONFIG_EXT_FLASH_IDLE_MS));
+
+    k_mutex_unlock(&cblkp->pm_lock);
+}
+
+/**
+* @brief    ext_flash_stats_print - Print the power statistics of the external flash
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Residency is the share of the time since boot the flash was awake
+*/
+void ext_flash_stats_print(void)
+{
+    struct ext_flash_blk *cblkp = &flash_cblk;
+    int64_t now_ms, awake_ms;
+    uint32_t permille;
+
+    k_mutex_lock(&cblkp->pm_lock, K_FOREVER);
+
+    now_ms = k_uptime_get();
+    awake_ms = cblkp->stats.awake_ms;
+    if (cblkp->awake)
+        awake_ms += now_ms - cblkp->awake_since_ms;
+    permille = now_ms ? (uint32_t)(awake_ms * 1000 / now_ms) : 0;
+
+    printk("\nExternal flash power statistics:\n\n");
+    printk("State: %s, Users: %u, Idle time: %u ms\n", cblkp->awake ? "awake" : "deep power-down", cblkp->users,
+        CONFIG_EXT_FLASH_IDLE_MS);
+    printk("Gets: %u, Wakes: %u, PM errors: %u\n", cblkp->stats.gets, cblkp->stats.wakes, cblkp->stats.pm_errors);
+    printk("Awake: %u ms of %u ms, residency %u.%u%%\n", (uint32_t)awake_ms, (uint32_t)now_ms, permille / 10,
+        permille % 10);
+
+    k_mutex_unlock(&cblkp->pm_lock);
+}
+
+/**
+* @brief    ext_flash_init - Init the power management of the external flash
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Call before anything uses the flash. Aborts if the flash is not available.
+*/
+void ext_flash_init(void)
+{
+    struct ext_flash_blk *cblkp = &flash_cblk;
+
+    k_mutex_init(&cblkp->pm_lock);
+
+    cblkp->flashp = DEVICE_DT_GET(DT_NODELABEL(w25q32jv));
+    if (!device_is_ready(cblkp->flashp))
+        erabort("ext_flash_init - external flash not ready");
+
+    // the driver leaves the flash awake after init, the first window lasts from boot
+    cblkp->awake = true;
+    cblkp->awake_since_ms = 0;
+
+    k_work_reschedule(&ext_flash_idle_work, K_MSEC(CONFIG_EXT_FLASH_IDLE_MS));
+}
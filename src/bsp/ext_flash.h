@@ -0,0 +1,29 @@
+/**
+ * @brief: 	ext_flash.h - External definitions for power management of the external flash
+ *
+ * @notes: 	See ext_flash.c for more information
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef EXT_FLASH_H_
+#define EXT_FLASH_H_
+
+#include <zephyr/zephyr.h>
+
+#if defined(CONFIG_EXT_FLASH_PM)
+
+void    ext_flash_init(void);
+void    ext_flash_get(void);
+void    ext_flash_put(void);
+void    ext_flash_stats_print(void);
+
+#else
+
+// the flash is left awake, nothing to track
+static inline void ext_flash_get(void) {}
+static inline void ext_flash_put(void) {}
+
+#endif
+
+#endif /* EXT_FLASH_H_ */
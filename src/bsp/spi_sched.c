@@ -0,0 +1,371 @@
+/**
+ * @brief: 	spi_sched.c - Transaction scheduler for the devices sharing spi3
+ *
+ * @notes:  The W25Q32JV and the SD card share spi3 with separate chip selects. Rather than each driver grabbing
+ *          the bus whenever its user calls it, every transaction is queued here and run by one thread, so the
+ *          users sleep instead of contending for the bus and the next transaction starts as soon as the last
+ *          one is done.
+ *
+ *          Transactions are queued per device and priority. A higher priority always goes first. Within a
+ *          priority the scheduler stays on one device for up to CONFIG_SPI_SCHED_BATCH transactions before the
+ *          other gets a turn, which saves reconfiguring the SPIM for every transaction while a stream is busy.
+ *
+ *          Flash transactions are bracketed with ext_flash_get() and ext_flash_put(), so a batch of them
+ *          shares one wake-up of the flash from deep power-down.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr/zephyr.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+// includes for application
+#include "ext_flash.h"
+#include "spi_sched.h"
+
+LOG_MODULE_REGISTER(spi_sched);     // register with logging package
+
+/*
+*   Internal defines for the scheduler thread
+*/
+#define SPI_SCHED_STACK_SIZE        1536    // runs the flash and SD card drivers
+#define SPI_SCHED_PRIORITY          3       // above every user, the bus never waits on the scheduler
+
+/*
+*   Statistics of one device
+*/
+struct spi_sched_dev_stats
+{
+    uint32_t    reqs;               // transactions run
+    uint32_t    errors;             // transactions that returned an error
+    uint32_t    batches;            // runs of back-to-back transactions to the device
+    uint32_t    max_depth;          // most transactions queued at once
+    uint32_t    max_wait_cyc;       // longest time from queued to started
+    uint64_t    wait_cyc;           // time from queued to started
+    uint64_t    busy_cyc;           // time the bus was busy with the device
+};
+
+/*
+*   SPI scheduler control block
+*/
+struct spi_sched_blk
+{
+    struct k_spinlock   lock;       // protects the queues and the batch state
+    sys_slist_t         queues[SPI_SCHED_DEV_NUM][SPI_SCHED_PRIO_NUM];
+    uint32_t            depth[SPI_SCHED_DEV_NUM];
+    struct k_sem        work_sem;   // one count per queued transaction
+
+    int                 cur_dev;    // device of the current batch
+    uint32_t            batch_count;// transactions run in the current batch, 0 once the scheduler went idle
+
+    int64_t             stats_start_ms;
+    struct spi_sched_dev_stats stats[SPI_SCHED_DEV_NUM];
+
+    bool                ready;
+};
+
+/*
+*   A transaction someone is blocked on
+*/
+struct spi_sched_sync
+{
+    struct spi_sched_req    req;
+    struct k_sem            done_sem;
+};
+
+// allocate storage for the control block
+static struct spi_sched_blk sched_cblk;
+
+static const char *dev_names[SPI_SCHED_DEV_NUM] = {"nor", "sd"};
+
+// scheduler thread and its stack
+static struct k_thread spi_sched_thread;
+K_THREAD_STACK_DEFINE(spi_sched_stack_area, SPI_SCHED_STACK_SIZE);
+
+/**
+* @brief    spi_sched_pick - Take the next transaction to run off the queues
+*
+* @param    cblkp   control block
+*
+* @return   the transaction, NULL if nothing is queued
+*
+* @note     Call with the lock held
+*/
+static struct spi_sched_req *spi_sched_pick(struct spi_sched_blk *cblkp)
+{
+    sys_snode_t *nodep;
+    int prio, dev, i;
+
+    for (prio = 0; prio < SPI_SCHED_PRIO_NUM; prio++)
+    {
+        // stay on the device of the current batch while it has work at this priority
+        if (cblkp->batch_count > 0 && cblkp->batch_count < CONFIG_SPI_SCHED_BATCH
+            && !sys_slist_is_empty(&cblkp->queues[cblkp->cur_dev][prio]))
+        {
+            dev = cblkp->cur_dev;
+        }
+        else
+        {
+            // otherwise the next device round robin, the current one last
+            for (i = 1; i <= SPI_SCHED_DEV_NUM; i++)
+            {
+                dev = (cblkp->cur_dev + i) % SPI_SCHED_DEV_NUM;
+                if (!sys_slist_is_empty(&cblkp->queues[dev][prio]))
+                    break;
+            }
+            if (i > SPI_SCHED_DEV_NUM)
+                continue;
+
+            cblkp->cur_dev = dev;
+            cblkp->batch_count = 0;
+            cblkp->stats[dev].batches++;
+        }
+
+        cblkp->batch_count++;
+        cblkp->depth[dev]--;
+        nodep = sys_slist_get_not_empty(&cblkp->queues[dev][prio]);
+        return CONTAINER_OF(nodep, struct spi_sched_req, node);
+    }
+
+    return NULL;
+}
+
+/**
+* @brief    spi_sched_task_entry - Scheduler thread, runs the queued transactions
+*
+* @param    p1  not used
+*
+* @return   never returns
+*/
+static void spi_sched_task_entry(void *p1, void *unused2, void *unused3)
+{
+    struct spi_sched_blk *cblkp = &sched_cblk;
+    struct spi_sched_dev_stats *statsp;
+    struct spi_sched_req *reqp;
+    k_spinlock_key_t key;
+    uint32_t start_cyc, wait_cyc;
+
+    while (1)
+    {
+        k_sem_take(&cblkp->work_sem, K_FOREVER);
+
+        key = k_spin_lock(&cblkp->lock);
+        reqp = spi_sched_pick(cblkp);
+        k_spin_unlock(&cblkp->lock, key);
+
+        // cannot happen, there is one count per queued transaction
+        if (reqp == NULL)
+            continue;
+
+        if (reqp->dev == SPI_SCHED_DEV_NOR)
+            ext_flash_get();
+
+        start_cyc = k_cycle_get_32();
+        wait_cyc = start_cyc - reqp->queued_cyc;
+
+        reqp->result = reqp->fn(reqp->argp);
+
+        statsp = &cblkp->stats[reqp->dev];
+        statsp->reqs++;
+        statsp->busy_cyc += k_cycle_get_32() - start_cyc;
+        statsp->wait_cyc += wait_cyc;
+        statsp->max_wait_cyc = MAX(statsp->max_wait_cyc, wait_cyc);
+        if (reqp->result < 0)
+            statsp->errors++;
+
+        if (reqp->dev == SPI_SCHED_DEV_NOR)
+            ext_flash_put();
+
+        key = k_spin_lock(&cblkp->lock);
+        if (k_sem_count_get(&cblkp->work_sem) == 0)
+            cblkp->batch_count = 0;
+        k_spin_unlock(&cblkp->lock, key);
+
+        // last, the owner may reuse or free the transaction from here on
+        if (reqp->done)
+            reqp->done(reqp);
+    }
+}
+
+/**
+* @brief    spi_sched_sync_done - Wake up the thread waiting on a transaction
+*
+* @param    reqp    the transaction
+*
+* @return   none
+*/
+static void spi_sched_sync_done(struct spi_sched_req *reqp)
+{
+    struct spi_sched_sync *syncp = CONTAINER_OF(reqp, struct spi_sched_sync, req);
+
+    k_sem_give(&syncp->done_sem);
+}
+
+/**
+* @brief    spi_sched_submit - Queue a transaction
+*
+* @param    reqp    transaction, dev, prio, fn, done and argp set by the caller
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Never blocks, can be called from an ISR. Transactions to the same device with the same priority
+*           run in the order they were queued.
+*/
+int spi_sched_submit(struct spi_sched_req *reqp)
+{
+    struct spi_sched_blk *cblkp = &sched_cblk;
+    k_spinlock_key_t key;
+
+    if (!cblkp->ready)
+        return -ENODEV;
+
+    if (reqp->dev >= SPI_SCHED_DEV_NUM || reqp->prio >= SPI_SCHED_PRIO_NUM || reqp->fn == NULL)
+        return -EINVAL;
+
+    reqp->queued_cyc = k_cycle_get_32();
+    reqp->result = 0;
+
+    key = k_spin_lock(&cblkp->lock);
+    sys_slist_append(&cblkp->queues[reqp->dev][reqp->prio], &reqp->node);
+    cblkp->depth[reqp->dev]++;
+    cblkp->stats[reqp->dev].max_depth = MAX(cblkp->stats[reqp->dev].max_depth, cblkp->depth[reqp->dev]);
+    k_spin_unlock(&cblkp->lock, key);
+
+    k_sem_give(&cblkp->work_sem);
+    return 0;
+}
+
+/**
+* @brief    spi_sched_run - Run a transaction and wait for it
+*
+* @param    dev     device the transaction is for
+* @param    prio    priority of the transaction
+* @param    fn      the I/O to do
+* @param    argp    passed to fn
+*
+* @return   what fn returned
+*
+* @note     Runs fn straight away if called before the scheduler is up or from a transaction
+*/
+int spi_sched_run(enum spi_sched_dev dev, enum spi_sched_prio prio, spi_sched_fn_t fn, void *argp)
+{
+    struct spi_sched_sync sync = {
+        .req = {
+            .dev = dev,
+            .prio = prio,
+            .fn = fn,
+            .done = spi_sched_sync_done,
+            .argp = argp
+        }
+    };
+    int err;
+
+    if (!sched_cblk.ready || k_current_get() == &spi_sched_thread)
+        return fn(argp);
+
+    k_sem_init(&sync.done_sem, 0, 1);
+
+    err = spi_sched_submit(&sync.req);
+    if (err)
+        return err;
+
+    k_sem_take(&sync.done_sem, K_FOREVER);
+    return sync.req.result;
+}
+
+/**
+* @brief    spi_sched_cpu_cycles - CPU time used by the scheduler thread
+*
+* @param    none
+*
+* @return   cycles the thread has run since boot, not counting the time it sleeps on the SPI
+*/
+uint64_t spi_sched_cpu_cycles(void)
+{
+    k_thread_runtime_stats_t rt_stats;
+
+    if (k_thread_runtime_stats_get(&spi_sched_thread, &rt_stats))
+        return 0;
+
+    return rt_stats.execution_cycles;
+}
+
+/**
+* @brief    spi_sched_stats_print - Print the statistics of the SPI scheduler
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Utilisation is the share of the time since the statistics were cleared the bus was busy with
+*           the device
+*/
+void spi_sched_stats_print(void)
+{
+    struct spi_sched_blk *cblkp = &sched_cblk;
+    struct spi_sched_dev_stats *statsp;
+    uint32_t elapsed_ms = (uint32_t)(k_uptime_get() - cblkp->stats_start_ms);
+    uint32_t busy_ms, util_permille;
+    int dev;
+
+    printk("\nSPI scheduler statistics over %u ms:\n\n", elapsed_ms);
+    printk("%-4s %8s %6s %8s %6s %10s %10s %8s %6s\n", "dev", "reqs", "errs", "batches", "depth",
+        "avg wait", "max wait", "busy ms", "util");
+
+    for (dev = 0; dev < SPI_SCHED_DEV_NUM; dev++)
+    {
+        statsp = &cblkp->stats[dev];
+        busy_ms = (uint32_t)(k_cyc_to_us_floor64(statsp->busy_cyc) / USEC_PER_MSEC);
+        util_permille = elapsed_ms ? (uint32_t)((uint64_t)busy_ms * 1000 / elapsed_ms) : 0;
+
+        printk("%-4s %8u %6u %8u %6u %8uus %8uus %8u %3u.%u%%\n", dev_names[dev], statsp->reqs, statsp->errors,
+            statsp->batches, statsp->max_depth,
+            statsp->reqs ? (uint32_t)(k_cyc_to_us_floor64(statsp->wait_cyc) / statsp->reqs) : 0,
+            k_cyc_to_us_floor32(statsp->max_wait_cyc), busy_ms, util_permille / 10, util_permille % 10);
+    }
+}
+
+/**
+* @brief    spi_sched_stats_clear - Clear the statistics of the SPI scheduler
+*
+* @param    none
+*
+* @return   none
+*/
+void spi_sched_stats_clear(void)
+{
+    memset(sched_cblk.stats, 0, sizeof(sched_cblk.stats));
+    sched_cblk.stats_start_ms = k_uptime_get();
+}
+
+/**
+* @brief    spi_sched_init - Init the SPI scheduler and start its thread
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Call before the users of the bus are initialised
+*/
+void spi_sched_init(void)
+{
+    struct spi_sched_blk *cblkp = &sched_cblk;
+    int dev, prio;
+
+    for (dev = 0; dev < SPI_SCHED_DEV_NUM; dev++)
+    {
+        for (prio = 0; prio < SPI_SCHED_PRIO_NUM; prio++)
+            sys_slist_init(&cblkp->queues[dev][prio]);
+    }
+    k_sem_init(&cblkp->work_sem, 0, K_SEM_MAX_LIMIT);
+
+    cblkp->stats_start_ms = k_uptime_get();
+    cblkp->ready = true;
+
+    k_thread_create(&spi_sched_thread, spi_sched_stack_area, K_THREAD_STACK_SIZEOF(spi_sched_stack_area),
+                    spi_sched_task_entry, NULL, NULL, NULL, SPI_SCHED_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&spi_sched_thread, "spi_sched");
+}
@@ -0,0 +1,64 @@
+/**
+ * @brief: 	spi_sched.h - External definitions for the transaction scheduler of the shared SPI bus
+ *
+ * @notes: 	See spi_sched.c for more information
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef SPI_SCHED_H_
+#define SPI_SCHED_H_
+
+#include <zephyr/zephyr.h>
+
+/*
+*   Devices on spi3
+*/
+enum spi_sched_dev
+{
+    SPI_SCHED_DEV_NOR = 0,      // W25Q32JV external flash
+    SPI_SCHED_DEV_SD,           // SD card
+    SPI_SCHED_DEV_NUM
+};
+
+/*
+*   Priority of a transaction, a higher priority one always goes first
+*/
+enum spi_sched_prio
+{
+    SPI_SCHED_PRIO_HIGH = 0,    // streams that drop data when they fall behind
+    SPI_SCHED_PRIO_NORMAL,
+    SPI_SCHED_PRIO_LOW,         // queries nobody is waiting on
+    SPI_SCHED_PRIO_NUM
+};
+
+struct spi_sched_req;
+
+typedef int     (*spi_sched_fn_t)(void *argp);
+typedef void    (*spi_sched_done_t)(struct spi_sched_req *reqp);
+
+/*
+*   One transaction. The caller owns it and must not touch it from spi_sched_submit() until done is called.
+*   fn does the I/O through the device driver and runs in the scheduler thread, so it must not take a lock
+*   that a thread waiting on the scheduler may hold.
+*/
+struct spi_sched_req
+{
+    sys_snode_t         node;       // private
+    uint32_t            queued_cyc; // private
+    uint8_t             dev;        // enum spi_sched_dev
+    uint8_t             prio;       // enum spi_sched_prio
+    spi_sched_fn_t      fn;         // the I/O to do
+    spi_sched_done_t    done;       // called in the scheduler thread after fn, may be NULL
+    void                *argp;      // passed to fn
+    int                 result;     // what fn returned
+};
+
+void        spi_sched_init(void);
+int         spi_sched_submit(struct spi_sched_req *reqp);
+int         spi_sched_run(enum spi_sched_dev dev, enum spi_sched_prio prio, spi_sched_fn_t fn, void *argp);
+uint64_t    spi_sched_cpu_cycles(void);
+void        spi_sched_stats_print(void);
+void        spi_sched_stats_clear(void);
+
+#endif /* SPI_SCHED_H_ */
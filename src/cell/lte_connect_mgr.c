@@ -11,6 +11,7 @@
 #include <zephyr/zephyr.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zephyr/sys/reboot.h>
 
 #include <modem/lte_lc.h>
@@ -71,10 +72,31 @@ struct modem_control_block {
 	int	link_down_total;	// all time count of total times app layer connectivity down
 	bool app_connectivity_up;	// flag to track if our application ever obtains connectivity
 
+	// time the radio spent RRC connected, the cost of keeping the cloud connection up
+	int64_t rrc_conn_ms;		// total of the past RRC connections
+	int64_t rrc_up_ms;			// uptime the current RRC connection came up, 0 if idle
+	int rrc_conn_cnt;			// count of RRC connections
+
+	// what the subscribers were told, see lte_subscribe()
+	bool registered;			// registered on the home network or roaming
+	int event_cnt;				// count of events delivered to subscribers
+
 	// TODO - store current staus of connection for gstatus command in Shell
 
 };
 
+/*
+*	Subscriber to LTE events, see lte_subscribe()
+*/
+struct lte_subscriber {
+	uint32_t		mask;		// events of interest, one bit per enum lte_event
+	lte_event_cb_t	cb;			// called in the context of the modem callback
+	void			*userp;		// handed back to the callback
+};
+
+static struct lte_subscriber lte_subscribers[CONFIG_LTE_MAX_SUBSCRIBERS];
+static int lte_num_subscribers;
+
 // forward references
 static  char * state_to_string(enum  modem_state state);
 
@@ -194,6 +216,30 @@ void lte_application_conn_up(bool app_up)
 	}	
 }
 
+/** 
+* @brief   Global interface function to read the time the radio spent RRC connected 
+*
+* @param    void
+*
+* @return   milliseconds since startup, the current RRC connection included
+*
+* @note     Meant to be called from the cloud module to measure what a session costs
+*/
+int64_t lte_radio_on_ms(void)
+{
+	unsigned int key;
+	int64_t on_ms;
+
+	// updated from the LTE handler
+	key = irq_lock();
+	on_ms = modem_cblk.rrc_conn_ms;
+	if (modem_cblk.rrc_up_ms != 0)
+		on_ms += k_uptime_get() - modem_cblk.rrc_up_ms;
+	irq_unlock(key);
+
+	return on_ms;
+}
+
 /** 
 * @brief   Global interface function to display network statistics to the UI Shell 
 *
@@ -226,6 +272,8 @@ void lte_stats_print(void)
 	printk("Searching attempts:   %d, Cell change: %d, Offline mode: %d\n",
 	 modem_cblk.scan_cnt, modem_cblk.cell_chg_cnt, modem_cblk.offline_cnt);
 	printk("PDP Context Activations: %d, Deactivations: %d\n", modem_cblk.pdp_context_up, modem_cblk.pdp_context_down);
+	printk("RRC connections: %d, Radio on: %lld ms\n", modem_cblk.rrc_conn_cnt, lte_radio_on_ms());
+	printk("Events to subscribers: %d (%d subscribers)\n", modem_cblk.event_cnt, lte_num_subscribers);
 	printk("Total AWS session down events detected by cloud module: %d\n", modem_cblk.link_down_total);
 	printk("Transient AWS session down events %d\n", modem_cblk.link_down_cnt);
 
@@ -262,6 +310,85 @@ void lte_stats_clear(void)
 	modem_cblk.link_down_total = 0;
 }
 
+/** 
+* @brief   Global interface function to read one of the network statistics counters 
+*
+* @param    counter	which counter
+*
+* @return   value of the counter, 0 for an unknown counter
+*
+* @note     Meant to be called from the cloud module to report the counters in the device shadow
+*/
+int lte_counter_get(enum lte_counter counter)
+{
+	switch (counter)
+	{
+		case LTE_COUNTER_HOME_REG:
+		return modem_cblk.home_reg_cnt;
+
+		case LTE_COUNTER_ROAM_REG:
+		return modem_cblk.roam_reg_cnt;
+
+		case LTE_COUNTER_LOST_REG:
+		return modem_cblk.lost_reg_cnt;
+
+		case LTE_COUNTER_CELL_CHG:
+		return modem_cblk.cell_chg_cnt;
+
+		case LTE_COUNTER_PDP_UP:
+		return modem_cblk.pdp_context_up;
+
+		case LTE_COUNTER_PDP_DOWN:
+		return modem_cblk.pdp_context_down;
+
+		case LTE_COUNTER_LINK_DOWN:
+		return modem_cblk.link_down_total;
+
+		default:
+		return 0;
+	}
+}
+
+/** 
+* @brief    Subscribe to LTE events (PDP context, registration, RRC)
+*
+* @param    mask - events of interest, use LTE_EVT_MASK() for each event
+* @param    cb - callback, gets the event and userp
+* @param    userp - user pointer handed back to the callback
+*
+* @return   0 on success, -ENOMEM if there is no room for another subscriber
+*
+* @note     The callback runs in the context of the modem callbacks and must not block, queue the event to
+*			your own thread. Only changes are reported, not the repeats the modem sends now and then.
+*/
+int lte_subscribe(uint32_t mask, lte_event_cb_t cb, void *userp)
+{
+	unsigned int key;
+	int err = 0;
+
+	if (cb == NULL || mask == 0)
+		erabort("lte_subscribe - bad subscriber");
+
+	key = irq_lock();
+	if (lte_num_subscribers < CONFIG_LTE_MAX_SUBSCRIBERS)
+	{
+		lte_subscribers[lte_num_subscribers].mask = mask;
+		lte_subscribers[lte_num_subscribers].cb = cb;
+		lte_subscribers[lte_num_subscribers].userp = userp;
+		lte_num_subscribers++;
+	}
+	else
+	{
+		err = -ENOMEM;
+	}
+	irq_unlock(key);
+
+	if (err)
+		LOG_ERR("No room for another LTE subscriber, increase CONFIG_LTE_MAX_SUBSCRIBERS");
+
+	return err;
+}
+
 		/*
 		 *	Utility functions for the LTE Connection manager module (string formatting routines for logging)
 		 */
@@ -303,6 +430,38 @@ static  char * state_to_string(enum  modem_state state)
 }
 
 
+/** 
+* @brief    Call the subscribers interested in an event
+*
+* @param    event - what happened
+*
+* @return   nothing
+*
+* @note     The subscribers are only added at startup, a copy is taken so one added meanwhile is missed at worst
+*/
+static void lte_notify(enum lte_event event)
+{
+	struct lte_subscriber subs[CONFIG_LTE_MAX_SUBSCRIBERS];
+	unsigned int key;
+	int num_subs;
+	int i;
+
+	key = irq_lock();
+	num_subs = lte_num_subscribers;
+	memcpy(subs, lte_subscribers, num_subs * sizeof(subs[0]));
+	irq_unlock(key);
+
+	for (i = 0; i < num_subs; i++)
+	{
+		if (subs[i].mask & LTE_EVT_MASK(event))
+		{
+			modem_cblk.event_cnt++;
+			subs[i].cb(event, subs[i].userp);
+		}
+	}
+}
+
+
 		/*
 		 *	Internal Event State Machine Processing functions (see state diagram)
 		 */
@@ -326,6 +485,7 @@ void proc_startup(bool pdp_context_flag)
 		modem_cblk.state = MODEM_PDP_UP;
 		modem_cblk.pdp_context_up++;
 		k_sem_give(&lte_connected); // because we are in the start-up state, unblock and let the system start-up
+		lte_notify(LTE_EVT_PDP_UP);
 	}
 
 	// Event is PDP context is DOWN
@@ -353,9 +513,9 @@ void proc_pdp_down(bool pdp_context_flag)
 	{
 		modem_cblk.state = MODEM_PDP_UP;
 		modem_cblk.pdp_context_up++;
-     	// tell cloud module we have active PDP context to cloud so it can reconnect
-       
-	   // lte_connection_change(true);
+
+     	// tell the subscribers (cloud module) we have active PDP context so they can reconnect
+		lte_notify(LTE_EVT_PDP_UP);
 	}
 
 	// Event is PDP context is DOWN
@@ -393,12 +553,39 @@ void proc_pdp_up(bool pdp_context_flag)
 		modem_cblk.pdp_context_down++;
 		modem_cblk.state = MODEM_PDP_DOWN;
 
-		// TODO - Removed for barebones build as Cloud module not included. Would be better to have function registered to reduce dependencies. 
-		// lte_connection_change(false);		
+		lte_notify(LTE_EVT_PDP_DOWN);
 	}
 
 }
 
+/** 
+* @brief    Process RRC mode changes, account for the time the radio is on
+*
+* @param    connected - true if the RRC connection came up, false if the radio went idle  
+*
+* @return   nothing
+*
+* @note     
+*/
+static void proc_rrc_update(bool connected)
+{
+	unsigned int key;
+	int64_t now_ms = k_uptime_get();
+
+	key = irq_lock();
+	if (connected && modem_cblk.rrc_up_ms == 0)
+	{
+		modem_cblk.rrc_up_ms = now_ms;
+		modem_cblk.rrc_conn_cnt++;
+	}
+	else if (!connected && modem_cblk.rrc_up_ms != 0)
+	{
+		modem_cblk.rrc_conn_ms += now_ms - modem_cblk.rrc_up_ms;
+		modem_cblk.rrc_up_ms = 0;
+	}
+	irq_unlock(key);
+}
+
 /** 
 * @brief    Process registration messages from the modem sub-system
 *
@@ -411,6 +598,7 @@ void proc_pdp_up(bool pdp_context_flag)
 */
 void proc_registration_msgs(const struct lte_lc_evt *const evt)
 {
+	bool registered;
 
 	switch(evt->nw_reg_status) {
 
@@ -463,6 +651,15 @@ void proc_registration_msgs(const struct lte_lc_evt *const evt)
         break;      // should abort/assert here, invalid registration event from nrf code
 
 	}
+
+	// only the changes go to the subscribers, the modem repeats itself
+	registered = evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_HOME ||
+				evt->nw_reg_status == LTE_LC_NW_REG_REGISTERED_ROAMING;
+	if (registered != modem_cblk.registered)
+	{
+		modem_cblk.registered = registered;
+		lte_notify(registered ? LTE_EVT_REGISTERED : LTE_EVT_NOT_REGISTERED);
+	}
 }
 
 /**
@@ -559,6 +756,11 @@ static void lte_handler(const struct lte_lc_evt *const evt)
 		LOG_INF("RRC mode: %s",
 			evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED ?
 			"Connected" : "Idle");
+
+		proc_rrc_update(evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED);
+
+		// the radio is up anyway, let the subscribers piggyback on it
+		lte_notify(evt->rrc_mode == LTE_LC_RRC_MODE_CONNECTED ? LTE_EVT_RRC_CONNECTED : LTE_EVT_RRC_IDLE);
 		break;
 
 	case LTE_LC_EVT_CELL_UPDATE:
@@ -9,6 +9,46 @@
 #ifndef LTECONN_H_
 #define LTECONN_H_
 
+/*
+*   Counters kept by the LTE connection manager, see lte_counter_get()
+*/
+enum lte_counter
+{
+    LTE_COUNTER_HOME_REG = 0,   // registrations on the home network
+    LTE_COUNTER_ROAM_REG,       // registrations roaming
+    LTE_COUNTER_LOST_REG,       // registrations lost
+    LTE_COUNTER_CELL_CHG,       // cell changes
+    LTE_COUNTER_PDP_UP,         // PDP context activations
+    LTE_COUNTER_PDP_DOWN,       // PDP context deactivations
+    LTE_COUNTER_LINK_DOWN,      // all time count of AWS sessions lost
+    LTE_COUNTER_NUM
+};
+
+/*
+*   Events fanned out to the subscribers, see lte_subscribe()
+*/
+enum lte_event
+{
+    LTE_EVT_PDP_UP = 0,         // PDP context activated, data can flow
+    LTE_EVT_PDP_DOWN,           // PDP context deactivated, nothing gets through
+    LTE_EVT_REGISTERED,         // registered on the home network or roaming
+    LTE_EVT_NOT_REGISTERED,     // registration lost, searching or denied
+    LTE_EVT_RRC_CONNECTED,      // the radio woke up
+    LTE_EVT_RRC_IDLE,           // the radio went idle
+    LTE_EVT_NUM
+};
+
+// mask bit of an event, used to subscribe to it
+#define LTE_EVT_MASK(event)     BIT(event)
+
+/**
+ * @brief Callback for LTE events
+ *
+ * @param event     what happened
+ * @param userp     user pointer given to lte_subscribe()
+ */
+typedef void (*lte_event_cb_t)(enum lte_event event, void *userp);
+
 /*
 *   LTE connection manager public functions
 */
@@ -18,6 +58,9 @@ void  lte_application_conn_up(bool aws_up);
 
 void lte_stats_print(void);
 void lte_stats_clear(void);
+int  lte_counter_get(enum lte_counter counter);
+int64_t lte_radio_on_ms(void);
+int  lte_subscribe(uint32_t mask, lte_event_cb_t cb, void *userp);
 
 
 #endif /* LTECONN_H_*/
\ No newline at end of file
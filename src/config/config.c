@@ -24,21 +24,512 @@
 
 LOG_MODULE_REGISTER(config);        // register with logging package
 
+// one bit per attribute is used to track values that need saving
+BUILD_ASSERT(DEV_CONFIG_NUM <= 32, "new_val_mask is too small for the number of attributes");
+
 /*
 *   Storage for structure holding the configuration datastore
 */
 static struct device_config_t device_config;
 
 /*
-*   This device configuration design needs to be rethought. In the current design, each one of the device attibutes is in it's own file. Those files are created 
-*   and initialized during the provisioning process. The problem is that when new attributes are defined, those files do not exist. I am not sure what the thinking 
-*   was ... to create the attibutre files later when missing? Why not just initialize all of them that are not present at boot-up. Default them in the application
-*   when not present. That would be much cleaner than the current solution. Added to the list of things to refactor. This would simplfy the device provisioning process
+*   Sequence of the value copies (a latch). Readers use copy (values_seq & 1) and retry if the sequence
+*   moved while they were reading. A writer bumps the sequence before updating each copy, so readers
+*   are always steered to the copy that is NOT being written and never wait on a writer.
+*/
+static atomic_t values_seq = ATOMIC_INIT(0);
+
+/*
+*   Statistics on flash writes, used to check how much flash wear the write-back caching saves
+*/
+struct config_stats {
+    uint32_t    save_requests;      // number of attribute saves requested by the application
+    uint32_t    identical_sets;     // number of sets with the value already in the datastore (nothing to save)
+    uint32_t    skipped_saves;      // saves with nothing changed to write
+    uint32_t    coalesced_saves;    // saves absorbed by a commit that was already scheduled
+    uint32_t    commits;            // number of config records actually written to flash
+    uint32_t    notifications;      // number of change callbacks delivered to subscribers
+    atomic_t    read_retries;       // reads that had to be retried because a writer got in the way
+};
+
+static struct config_stats config_stats;
+
+// serializes changes to the datastore with the commit of the config record
+static K_MUTEX_DEFINE(config_lock);
+
+/*
+*   Subscriber to attribute changes, see config_subscribe()
+*/
+struct config_subscriber {
+    uint32_t            mask;       // attributes of interest, one bit per dev_config_shadow_id_t
+    config_change_cb_t  cb;         // called on the system work queue with the changed attributes
+    void                *userp;     // handed back to the callback
+};
+
+static struct config_subscriber subscribers[CONFIG_DATASTORE_MAX_SUBSCRIBERS];
+static int num_subscribers;
+
+// attributes changed since the subscribers were last notified
+static atomic_t changed_mask = ATOMIC_INIT(0);
+
+static void config_notify_work_fn(struct k_work *workp);
+
+// work to notify the subscribers outside of the context that changed the value (e.g. the MQTT callback)
+static K_WORK_DEFINE(config_notify_work, config_notify_work_fn);
+
+#if defined(CONFIG_DATASTORE_WRITE_BACK)
+static void config_commit_work_fn(struct k_work *workp);
+
+// delayed work to commit the dirty attributes in one record
+static K_WORK_DELAYABLE_DEFINE(config_commit_work, config_commit_work_fn);
+#endif
+
+/*
+*   Constant descriptor table generated from the attribute table in config.h, stored in flash.
+*   Only the values themselves (struct dev_config_values) take RAM.
+*/
+#define DEV_CONFIG_DESC_ENTRY(id, field, type, str_len, def_int, def_str, min, max, attr_flags, shadow, file) \
+    [id] = {                                                                \
+        .name = #field,                                                     \
+        .shadow_key = shadow,                                               \
+        .file_name = file,                                                  \
+        .default_str = def_str,                                             \
+        .default_int = def_int,                                             \
+        .min_val = min,                                                     \
+        .max_val = max,                                                     \
+        .offset = offsetof(struct dev_config_values, field),                \
+        .size = sizeof(((struct dev_config_values *)0)->field),             \
+        .val_type = DEV_CONFIG_VAL_TYPE_##type,                             \
+        .flags = attr_flags,                                                \
+    },
+
+static const struct dev_config_attr_desc attr_desc[DEV_CONFIG_NUM] = {
+    DEV_CONFIG_ATTR_TABLE(DEV_CONFIG_DESC_ENTRY)
+};
+
+/*
+*   All the persistent attributes are saved together in a single config record (see config_store.c) instead of
+*   one file per attribute. Attributes missing from the record (ex: newly added ones) simply keep their default
+*   value, so provisioning no longer needs to create a file for each attribute. On the first boot after the
+*   change, the legacy attribute files are migrated into the record.
 *
 *   see issue: https://github.com/Reliance-Foundry/levaware_gen3/issues/12
 */
 
 
+/*
+*   Working storage for the payload of the config record (see config_store.c)
+*/
+static uint8_t rec_payload[CONFIG_REC_PAYLOAD_MAX];
+
+/**
+ * @brief config_value_ptr - Get a pointer to the storage of an attribute value (writer's view)
+ *
+ * @param idx   attribute index
+ *
+ * @return  pointer to the value in the first copy of the datastore
+ *
+ * @note    Only for use while holding config_lock or during init. Both copies hold the same values
+ *          outside of config_latch_write() so the first copy is as good as any for the writer.
+ */
+static inline void *config_value_ptr(enum dev_config_shadow_id_t idx)
+{
+    return (uint8_t *)&device_config.values[0] + attr_desc[idx].offset;
+}
+
+/**
+ * @brief config_latch_write - Update the value of an attribute in both copies of the datastore
+ *
+ * @param idx   attribute index
+ * @param srcp  new value
+ * @param len   number of bytes in the new value, the rest of the attribute storage is zeroed
+ *
+ * @return  none
+ *
+ * @note    Caller holds config_lock. Starting from an even sequence, the first bump sends readers to
+ *          copy 1 while copy 0 is written and the second bump sends them back to copy 0 while copy 1
+ *          is written. Each update bumps twice so the sequence is even again when done.
+ */
+static void config_latch_write(enum dev_config_shadow_id_t idx, const void *srcp, size_t len)
+{
+    uint8_t *dstp;
+    int copy;
+
+    for (copy = 0; copy < DEV_CONFIG_VALUE_COPIES; copy++)
+    {
+        // steer the readers to the other copy (atomics are full barriers)
+        atomic_inc(&values_seq);
+
+        dstp = (uint8_t *)&device_config.values[copy] + attr_desc[idx].offset;
+        memcpy(dstp, srcp, len);
+        memset(dstp + len, '\0', attr_desc[idx].size - len);
+    }
+}
+
+/**
+ * @brief config_read_value - Read a consistent copy of an attribute value
+ *
+ * @param idx   attribute index
+ * @param dstp  buffer to copy the value into, at least the size of the attribute
+ *
+ * @return  none
+ */
+static void config_read_value(enum dev_config_shadow_id_t idx, void *dstp)
+{
+    const struct dev_config_values *valuesp;
+    uint32_t seq;
+
+    do
+    {
+        valuesp = config_read_begin(&seq);
+        memcpy(dstp, (const uint8_t *)valuesp + attr_desc[idx].offset, attr_desc[idx].size);
+    } while (config_read_retry(seq));
+}
+
+/**
+ * @brief config_check_attr - Check the index and type of an attribute being accessed
+ *
+ * @param idx       attribute index
+ * @param val_type  type the caller expects
+ *
+ * @return  none
+ *
+ * @note    aborts if the index is out of range or the type doesn't match (coding error)
+ */
+static void config_check_attr(enum dev_config_shadow_id_t idx, enum dev_config_val_type_t val_type)
+{
+    if (idx >= DEV_CONFIG_NUM)
+        erabort("config - bad index value");
+
+    if (attr_desc[idx].val_type != val_type)
+        erabort("config - attribute type mismatch");
+}
+
+/**
+ * @brief config_load_default - Set an attribute to its default value
+ *
+ * @param idx   attribute index
+ *
+ * @return  none
+ */
+static void config_load_default(enum dev_config_shadow_id_t idx)
+{
+    const struct dev_config_attr_desc *descp = &attr_desc[idx];
+    void *valp = config_value_ptr(idx);
+
+    if (descp->val_type == DEV_CONFIG_VAL_TYPE_INT16)
+    {
+        *(int16_t *)valp = (int16_t)descp->default_int;
+    }
+    else if (descp->val_type == DEV_CONFIG_VAL_TYPE_INT)
+    {
+        *(int32_t *)valp = descp->default_int;
+    }
+    else
+    {
+        memset(valp, '\0', descp->size);
+        strncpy(valp, descp->default_str, descp->size - 1);
+    }
+}
+
+/**
+ * @brief config_load_value - Load a raw value read from flash into an attribute
+ *
+ * @param idx       attribute index
+ * @param datap     pointer to the raw value
+ * @param len       length of the raw value in bytes
+ *
+ * @return  none
+ *
+ * @note    Values with an unexpected length are ignored, the attribute keeps its current value
+ */
+static void config_load_value(enum dev_config_shadow_id_t idx, const uint8_t *datap, size_t len)
+{
+    const struct dev_config_attr_desc *descp = &attr_desc[idx];
+    void *valp = config_value_ptr(idx);
+
+    if (descp->val_type != DEV_CONFIG_VAL_TYPE_STRING && len == descp->size)
+    {
+        memcpy(valp, datap, len);
+    }
+    else if (descp->val_type == DEV_CONFIG_VAL_TYPE_STRING && len > 0 && len < descp->size)
+    {
+        memset(valp, '\0', descp->size);
+        memcpy(valp, datap, len);
+    }
+    else
+    {
+        LOG_ERR("Bad stored value for %s, len: %d", descp->name, len);
+    }
+}
+
+/**
+ * @brief config_encode_record - Serialize all persistent attributes into a config record payload
+ *
+ * @param bufp      buffer to encode into
+ * @param buf_len   size of the buffer
+ *
+ * @return  number of bytes encoded
+ *
+ * @note    aborts if the record does not fit (CONFIG_REC_PAYLOAD_MAX needs to grow)
+ */
+static size_t config_encode_record(uint8_t *bufp, size_t buf_len)
+{
+    enum dev_config_shadow_id_t idx;
+    const void *valp;
+    size_t len;
+    size_t pos = 0;
+
+    for (idx = 0; idx < DEV_CONFIG_NUM; idx++)
+    {
+        if (!(attr_desc[idx].flags & DEV_CONFIG_FLAG_PERSIST))
+            continue;
+
+        valp = config_value_ptr(idx);
+
+        // strings are saved without the NULL
+        if (attr_desc[idx].val_type == DEV_CONFIG_VAL_TYPE_STRING)
+            len = strlen(valp);
+        else
+            len = attr_desc[idx].size;
+
+        if (pos + 2 + len > buf_len)
+            erabort("config_encode_record - record overflow");
+
+        bufp[pos++] = (uint8_t)idx;
+        bufp[pos++] = (uint8_t)len;
+        memcpy(&bufp[pos], valp, len);
+        pos += len;
+    }
+
+    return pos;
+}
+
+/**
+ * @brief config_decode_record - Load all attributes found in a config record payload
+ *
+ * @param bufp      pointer to the payload
+ * @param len       length of the payload
+ *
+ * @return  none
+ *
+ * @note    Attributes missing from the record keep their default values
+ */
+static void config_decode_record(const uint8_t *bufp, size_t len)
+{
+    size_t pos = 0;
+    uint8_t tag, val_len;
+
+    while (pos + 2 <= len)
+    {
+        tag = bufp[pos++];
+        val_len = bufp[pos++];
+
+        if (pos + val_len > len)
+        {
+            LOG_ERR("Config record entry %d is truncated", tag);
+            break;
+        }
+
+        if (tag < DEV_CONFIG_NUM && (attr_desc[tag].flags & DEV_CONFIG_FLAG_PERSIST))
+            config_load_value(tag, &bufp[pos], val_len);
+
+        pos += val_len;
+    }
+}
+
+/**
+ * @brief config_load_legacy_files - Load attributes from the legacy one file per attribute layout
+ *
+ * @param  none
+ *
+ * @return  none
+ *
+ * @note    Only used to migrate to the config record, files that don't exist are skipped
+ */
+static void config_load_legacy_files(void)
+{
+    enum dev_config_shadow_id_t idx;
+    int num_bytes;
+
+    // nothing to migrate if the external flash filesystem is not there
+    if (false == config_store_legacy_available())
+        return;
+
+    for (idx = 0; idx < DEV_CONFIG_NUM; idx++)
+    {
+        char *filename = (char *)attr_desc[idx].file_name;
+
+        if (filename == NULL || false == is_file_exists(filename))
+            continue;
+
+        num_bytes = read_file((char *)rec_payload, sizeof(rec_payload), filename);
+        if (num_bytes > 0)
+        {
+            config_load_value(idx, rec_payload, num_bytes);
+            LOG_INF("Migrated %s from legacy file", filename);
+        }
+    }
+}
+
+/**
+ * @brief config_commit_record - Write all the attributes to flash as one record
+ *
+ * @param  none
+ *
+ * @return  0 on success
+ */
+static int config_commit_record(void)
+{
+    size_t len;
+    int err;
+
+    len = config_encode_record(rec_payload, sizeof(rec_payload));
+
+    err = config_store_write(rec_payload, len);
+    if (err)
+    {
+        LOG_ERR("Unable to commit config record: %d", err);
+        return err;
+    }
+
+    // everything is in flash now
+    device_config.new_val_mask = 0;
+    config_stats.commits++;
+
+    return 0;
+}
+
+#if defined(CONFIG_DATASTORE_WRITE_BACK)
+/**
+ * @brief config_commit_work_fn - Commit the dirty attributes once the commit delay expires
+ *
+ * @param workp     pointer to work item - not used
+ *
+ * @return  none
+ *
+ * @note    runs in the system work queue
+ */
+static void config_commit_work_fn(struct k_work *workp)
+{
+    config_commit();
+}
+#endif
+
+/**
+ * @brief config_request_commit - Commit the dirty attributes now or schedule it (write-back mode)
+ *
+ * @param  none
+ *
+ * @return  0 on success
+ */
+static int config_request_commit(void)
+{
+#if defined(CONFIG_DATASTORE_WRITE_BACK)
+    // only the first save starts the delay, the ones following it ride along with the same commit
+    if (k_work_schedule(&config_commit_work, K_MSEC(CONFIG_DATASTORE_COMMIT_DELAY_MS)) == 0)
+        config_stats.coalesced_saves++;
+
+    return 0;
+#else
+    return config_commit();
+#endif
+}
+
+/**
+ * @brief config_mark_new_val - Flag (or not) an attribute as needing to be saved
+ *
+ * @param idx           attribute index
+ * @param is_new_val    true if the value needs to be saved to flash
+ *
+ * @return  none
+ */
+static inline void config_mark_new_val(enum dev_config_shadow_id_t idx, bool is_new_val)
+{
+    if (is_new_val)
+        device_config.new_val_mask |= BIT(idx);
+    else
+        device_config.new_val_mask &= ~BIT(idx);
+}
+
+/**
+ * @brief config_notify_change - Queue the notification of the subscribers to an attribute change
+ *
+ * @param idx   attribute that changed value
+ *
+ * @return  none
+ *
+ * @note    changes made before the work runs are reported together in one callback
+ */
+static inline void config_notify_change(enum dev_config_shadow_id_t idx)
+{
+    atomic_or(&changed_mask, BIT(idx));
+    k_work_submit(&config_notify_work);
+}
+
+/**
+ * @brief config_notify_work_fn - Call the subscribers interested in the attributes that changed
+ *
+ * @param workp     pointer to work item - not used
+ *
+ * @return  none
+ *
+ * @note    runs in the system work queue. The callbacks are called without holding the datastore lock
+ *          so they are free to read (or set) attributes
+ */
+static void config_notify_work_fn(struct k_work *workp)
+{
+    struct config_subscriber subs[CONFIG_DATASTORE_MAX_SUBSCRIBERS];
+    uint32_t mask;
+    int num_subs;
+    int i;
+
+    mask = (uint32_t)atomic_clear(&changed_mask);
+    if (mask == 0)
+        return;
+
+    // take a copy so subscribing from a callback can't change the list under our feet
+    k_mutex_lock(&config_lock, K_FOREVER);
+    num_subs = num_subscribers;
+    memcpy(subs, subscribers, num_subs * sizeof(subs[0]));
+    k_mutex_unlock(&config_lock);
+
+    for (i = 0; i < num_subs; i++)
+    {
+        if (subs[i].mask & mask)
+        {
+            config_stats.notifications++;
+            subs[i].cb(subs[i].mask & mask, subs[i].userp);
+        }
+    }
+}
+
+/**
+ * @brief config_clamp - Peg a value to the range allowed for an attribute
+ *
+ * @param idx   attribute index
+ * @param val   value to check
+ *
+ * @return  value within [min_val, max_val]
+ */
+static int32_t config_clamp(enum dev_config_shadow_id_t idx, int32_t val)
+{
+    const struct dev_config_attr_desc *descp = &attr_desc[idx];
+
+    if (val < descp->min_val)
+    {
+        LOG_WRN("%s: %d below minimum, set to %d", descp->name, val, descp->min_val);
+        val = descp->min_val;
+    }
+    else if (val > descp->max_val)
+    {
+        LOG_WRN("%s: %d above maximum, set to %d", descp->name, val, descp->max_val);
+        val = descp->max_val;
+    }
+
+    return val;
+}
+
 /** 
 * @brief   config_get_fw_version_str - Get firmware version string
 * 
@@ -53,6 +544,43 @@ char *config_get_fw_version_str(void)
     return CONFIG_FIRMWARE_VERSION;
 }
 
+/**
+ * @brief config_get_attr_desc - Get the constant descriptor of an attribute
+ *
+ * @param attribute     attribute index
+ *
+ * @return  pointer to the descriptor (in flash)
+ *
+ * @note    aborts if index out of range
+ */
+const struct dev_config_attr_desc *config_get_attr_desc(enum dev_config_shadow_id_t attribute)
+{
+    if (attribute >= DEV_CONFIG_NUM)
+        erabort("config - bad index value");
+
+    return &attr_desc[attribute];
+}
+
+/**
+ * @brief config_log_attribute - Log the name and value of an attribute
+ *
+ * @param idx   attribute index
+ *
+ * @return  none
+ */
+static void config_log_attribute(enum dev_config_shadow_id_t idx)
+{
+    const struct dev_config_attr_desc *descp = &attr_desc[idx];
+    const void *valp = config_value_ptr(idx);
+
+    if (descp->val_type == DEV_CONFIG_VAL_TYPE_INT16)
+        LOG_INF("%s: %d", descp->name, *(const int16_t *)valp);
+    else if (descp->val_type == DEV_CONFIG_VAL_TYPE_INT)
+        LOG_INF("%s: %d", descp->name, *(const int32_t *)valp);
+    else
+        LOG_INF("%s: %s", descp->name, log_strdup(valp));
+}
+
 /**
  * @brief config_dev_shadow_attrib_init - Initializes the structure containing the device shadow attribute information
  * 
@@ -62,130 +590,36 @@ char *config_get_fw_version_str(void)
  */
 void config_dev_shadow_attrib_init(void)
 {
-
-int num_bytes;      // number of bytes read from file
-enum dev_config_shadow_id_t idx;        // index for walking thru all configuration values
+    int err;
+    size_t len;                         // length of the config record payload
+    enum dev_config_shadow_id_t idx;    // index for walking thru all configuration values
 
     // load defaults for each attribute from it's defined initial value
-
-    // first the DAQ interval
-    device_config.dev_shadow_attrib[DEV_CONFIG_DAQ_INTERVAL_S].dev_conf_shadow_id = DEV_CONFIG_DAQ_INTERVAL_S;
-    device_config.dev_shadow_attrib[DEV_CONFIG_DAQ_INTERVAL_S].val_type = DEV_CONFIG_VAL_TYPE_INT16;
-    device_config.dev_shadow_attrib[DEV_CONFIG_DAQ_INTERVAL_S].int16_val = DAQ_INTERVAL_DEFAULT_VAL_S;
-    device_config.dev_shadow_attrib[DEV_CONFIG_DAQ_INTERVAL_S].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_DAQ_INTERVAL_S].filename, DAQ_INTERVAL_FILE_NAME);
-    
-    // publish interval
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_INTERVAL_S].dev_conf_shadow_id = DEV_CONFIG_PUB_INTERVAL_S;
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_INTERVAL_S].val_type = DEV_CONFIG_VAL_TYPE_INT16;
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_INTERVAL_S].int16_val = PUB_INTERVAL_DEFAULT_VAL_S;
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_INTERVAL_S].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_PUB_INTERVAL_S].filename, PUB_INTERVAL_FILE_NAME);
-    
-    // iccid value
-    device_config.dev_shadow_attrib[DEV_CONFIG_ICCID].dev_conf_shadow_id = DEV_CONFIG_ICCID;
-    device_config.dev_shadow_attrib[DEV_CONFIG_ICCID].val_type = DEV_CONFIG_VAL_TYPE_STRING;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_ICCID].str_val, ICCID_DEFAULT_VAL);
-    device_config.dev_shadow_attrib[DEV_CONFIG_ICCID].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_ICCID].filename, ICCID_INTERNAL_FILE_NAME);
-
-    // config interval
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_UPDATE_INTERVAL_S].dev_conf_shadow_id = DEV_CONFIG_CONF_UPDATE_INTERVAL_S;
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_UPDATE_INTERVAL_S].val_type = DEV_CONFIG_VAL_TYPE_INT16;
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_UPDATE_INTERVAL_S].int16_val = CONFIG_INTERVAL_DEFAULT_VAL_S;
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_UPDATE_INTERVAL_S].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_CONF_UPDATE_INTERVAL_S].filename, CONFIG_INTERVAL_FILE_NAME);
-    
-    // sensor type
-    device_config.dev_shadow_attrib[DEV_CONFIG_SENSOR_TYPE].dev_conf_shadow_id = DEV_CONFIG_SENSOR_TYPE;
-    device_config.dev_shadow_attrib[DEV_CONFIG_SENSOR_TYPE].val_type = DEV_CONFIG_VAL_TYPE_INT16;
-    device_config.dev_shadow_attrib[DEV_CONFIG_SENSOR_TYPE].int16_val = EXT_SENSOR_TERABEE;
-    device_config.dev_shadow_attrib[DEV_CONFIG_SENSOR_TYPE].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_SENSOR_TYPE].filename, SENSOR_TYPE_FILE_NAME);
-
-    // application type
-    device_config.dev_shadow_attrib[DEV_CONFIG_APP_TYPE].dev_conf_shadow_id = DEV_CONFIG_APP_TYPE;
-    device_config.dev_shadow_attrib[DEV_CONFIG_APP_TYPE].val_type = DEV_CONFIG_VAL_TYPE_INT16;
-    device_config.dev_shadow_attrib[DEV_CONFIG_APP_TYPE].int16_val = APP_TYPE_DEFAULT_VAL;
-    device_config.dev_shadow_attrib[DEV_CONFIG_APP_TYPE].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_APP_TYPE].filename, APP_TYPE_FILE_NAME);
-
-    // configuration version
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_VERSION].dev_conf_shadow_id = DEV_CONFIG_CONF_VERSION;
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_VERSION].val_type = DEV_CONFIG_VAL_TYPE_INT;
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_VERSION].int_val = CONFIG_VERSION_DEFAULT_VAL;
-    device_config.dev_shadow_attrib[DEV_CONFIG_CONF_VERSION].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_CONF_VERSION].filename, CONFIG_VERSION_FILE_NAME);
-
-    // topic to publish data to
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].dev_conf_shadow_id = DEV_CONFIG_PUB_TOPIC;
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].val_type = DEV_CONFIG_VAL_TYPE_STRING;
-    memset(device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].str_val, '\0', sizeof(device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].str_val));
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].str_val, PUB_TOPIC_DEFAULT_VAL);
-    device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_PUB_TOPIC].filename, PUB_TOPIC_FILE_NAME);
-
-    // sub-topic? to publish to
-    device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].dev_conf_shadow_id = DEV_CONFIG_SUB_TOPIC;
-    device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].val_type = DEV_CONFIG_VAL_TYPE_STRING;
-    memset(device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].str_val, '\0', sizeof(device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].str_val));
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].str_val, SUB_TOPIC_DEFAULT_VAL);
-    device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].is_new_val = false;
-    strcpy(device_config.dev_shadow_attrib[DEV_CONFIG_SUB_TOPIC].filename, SUB_TOPIC_FILE_NAME);
-
-    // load from flash and overwrite defaults
     for (idx = 0; idx < DEV_CONFIG_NUM; idx++)
     {
-        char file_contents[256] = {'\0'};
+        config_load_default(idx);
+    }
+
+    // all values are now at their defaults and nothing needs saving
+    device_config.new_val_mask = 0;
 
+    // load the config record from flash and overwrite defaults
+    err = config_store_read(rec_payload, sizeof(rec_payload), &len);
+    if (!err)
+    {
+        config_decode_record(rec_payload, len);
+    }
+    else
+    {
         /*
-        *   We have a design issue with how the system was orginally designed in that these 
-        *   files are created during provisioning. The problem is that as we add new files, 
-        *   those files are not present. It would have been much cleaner/better to do that during bootup. 
-        *   This will take some more work to fix but for now, for new fields in the shadow, skip over them 
-        *   to not cause errors. 
-        * 
-        *   The ICCID field is new, so not it filesystem, skip over it
-        *   Actually it should even be here... TODO - fix this
-        * 
-        *   see issue: https://github.com/Reliance-Foundry/levaware_gen3/issues/11 
-        *       
+        *   No valid record, so this is the first boot after moving from one file per attribute
+        *   (or a freshly provisioned device). Pick up whatever legacy files exist and commit them
+        *   (plus defaults for the ones that are missing) as the first record. The legacy files are
+        *   left in place so that older firmware still boots if the image is reverted.
         */
-
-       if (idx != DEV_CONFIG_ICCID)
-       {
-            num_bytes = read_file(file_contents, sizeof(file_contents), device_config.dev_shadow_attrib[idx].filename);
-
-            /*
-            * If the file read was successful, save the file contents into the shadow table
-            */
-            if (num_bytes >= 0)
-            {
-             if (device_config.dev_shadow_attrib[idx].val_type == DEV_CONFIG_VAL_TYPE_INT16)
-                {
-                    device_config.dev_shadow_attrib[idx].int16_val = *(int16_t *)file_contents;
-                }
-            else if (device_config.dev_shadow_attrib[idx].val_type == DEV_CONFIG_VAL_TYPE_INT)
-                {
-                    device_config.dev_shadow_attrib[idx].int_val = *(int32_t *)file_contents;
-                }
-            else if (device_config.dev_shadow_attrib[idx].val_type == DEV_CONFIG_VAL_TYPE_STRING && strlen(file_contents) > 0)
-                {
-                    memset(device_config.dev_shadow_attrib[idx].str_val, '\0', sizeof(device_config.dev_shadow_attrib[idx].str_val));
-                    strcpy(device_config.dev_shadow_attrib[idx].str_val, file_contents);
-                }
-            else
-                {
-                    LOG_ERR("Unknown device shadow attribute type");
-                }
-            }
-            else
-            {
-                device_config.dev_shadow_attrib[idx].is_new_val = true;
-                LOG_DBG("%s file does not exist or is empty, value still set to default", log_strdup(device_config.dev_shadow_attrib[idx].filename));
-            }
-       }
-
+        LOG_WRN("No valid config record found, migrating legacy attribute files");
+        config_load_legacy_files();
+        config_commit_record();
     }
 }
 
@@ -200,132 +634,80 @@ enum dev_config_shadow_id_t idx;        // index for walking thru all configurat
  */
 void config_init(void)
 { 
+    enum dev_config_shadow_id_t idx;
     int err;
-    enum dev_config_shadow_id_t attr;       // attribute index value
 
     LOG_INF("Initializing device configuration");
 
-    // init the filesystem required for config datastore
-    config_fs_init();
+    // init the storage backend required for config datastore (migrates to internal flash if needed)
+    config_store_init();
 
-    if (false == is_file_exists(SERIAL_NUMBER_FILE_NAME))
+    // read serial number first, leave room for the terminating null
+    err = config_store_read_serial(device_config.serial_number, SERIAL_NUMBER_LEN - 1);
+    if (err == -ENOENT)
     {
         // should not get here except if not provisioned - ABORT?
-        LOG_ERR("The file for serial number does not exist");      
+        LOG_ERR("The serial number does not exist");
     }
-    else
+    else if (err < 0)
     {
-        // read serial number first
-        err = read_file(device_config.serial_number, SERIAL_NUMBER_LEN, SERIAL_NUMBER_FILE_NAME);
-        if (err < 0)
-            erabort("config_init - reading serial number");
+        erabort("config_init - reading serial number");
     }
     
     // Get IMEI 
     modem_get_imei(device_config.imei, IMEI_LEN);
 
-    // Getting ICCID
-    modem_get_iccid(device_config.iccid, ICCID_LEN);
-
     config_dev_shadow_attrib_init();
 
+    // the external flash is not needed by the datastore any more
+    config_store_init_done();
+
+    // Getting ICCID, it is not persisted, always read from the SIM card
+    modem_get_iccid(config_value_ptr(DEV_CONFIG_ICCID), attr_desc[DEV_CONFIG_ICCID].size);
+
+    // init only loaded the first copy, from now on every change goes to both
+    for (int copy = 1; copy < DEV_CONFIG_VALUE_COPIES; copy++)
+        device_config.values[copy] = device_config.values[0];
+
     LOG_INF("Serial number: %s", log_strdup(device_config.serial_number));
     LOG_INF("IMEI: %s", log_strdup(device_config.imei));
     LOG_INF("fw-version: %s", CONFIG_FIRMWARE_VERSION);
-    LOG_INF("ICCID: %s", log_strdup(device_config.iccid));
-    LOG_INF("daq_interval_s: %d s", config_get_int16(DEV_CONFIG_DAQ_INTERVAL_S));
-    LOG_INF("pub_interval_s: %d s", config_get_int16(DEV_CONFIG_PUB_INTERVAL_S));
-    LOG_INF("config_interval_s: %d s", config_get_int16(DEV_CONFIG_CONF_UPDATE_INTERVAL_S));
-    LOG_INF("sensor_type: %d", config_get_int16(DEV_CONFIG_SENSOR_TYPE));
-    LOG_INF("app_type: %d", config_get_int16(DEV_CONFIG_APP_TYPE));
-    LOG_INF("config_version: %d", config_get_int(DEV_CONFIG_CONF_VERSION));  
-    LOG_INF("pub_topic: %s", log_strdup(config_get_str(DEV_CONFIG_PUB_TOPIC)));
-    LOG_INF("sub_topic: %s", log_strdup(config_get_str(DEV_CONFIG_SUB_TOPIC)));
-
-    // ensure all the config files exist by walking through them and saving attributes??
-    for (attr = 0; attr < DEV_CONFIG_NUM; attr++)
-    {
-
-        /* check to ensure the attribute is not one of the newly added fields (because the file will not exist)
-        *  The ICCID seems to be the first new file but there will be many more over time. 
-        *  TODO - should create that file or any files that don't exist
-        */
 
-        if (attr != DEV_CONFIG_ICCID)
-        {
-            if (false == is_file_exists(device_config.dev_shadow_attrib[attr].filename))
-            {
-                config_save_attribute_to_file(attr);
-            }
-        }
-    }
+    for (idx = 0; idx < DEV_CONFIG_NUM; idx++)
+        config_log_attribute(idx);
+
+    LOG_DBG("Datastore RAM: %d bytes of values (x%d copies)", sizeof(struct dev_config_values), DEV_CONFIG_VALUE_COPIES);
 
-    // TODO: implmenet string based values in file contents - compat rewrite could happen here (imoon 20220904)
 }
 
 /**
- * @brief config_save_attribute_to_file - Saves the configuration value to a file 
+ * @brief config_save_attribute_to_file - Saves the configuration value to flash
  * 
  * @param idx Index of the desired attribute
  * 
  * @return Returns 0 if it is a success
  * 
- * @note    Only writes to file if value change flag is set (avoid wearing flash)
+ * @note    Only writes to flash if value change flag is set (avoid wearing flash). All attributes
+ *          live in one config record, so this commits every pending change, not just this attribute.
  */
 int config_save_attribute_to_file(enum dev_config_shadow_id_t idx)
 {
-    int err;
-    struct dev_shadow_attrib_t *dev_shadow_attrib;
+    if (idx >= DEV_CONFIG_NUM)
+        erabort("config - bad index value");
     
-    // set pointer to the attribute
-    dev_shadow_attrib = &device_config.dev_shadow_attrib[idx];
-
-    // clear and error code before running thru the chain of 'if's
-    err = 0;
-
-    if (dev_shadow_attrib->is_new_val)
-    {
-        // make this a warning level so that we can see how often we are writing files
-        LOG_WRN("Saving %s to file", log_strdup(dev_shadow_attrib->filename));
-
-        if (dev_shadow_attrib->val_type == DEV_CONFIG_VAL_TYPE_INT16)
-        {
-            int16_t data = dev_shadow_attrib->int16_val;
-
-            err = save_to_file((char *)&data, sizeof(data), dev_shadow_attrib->filename);
-
-        }
-        else if (dev_shadow_attrib->val_type == DEV_CONFIG_VAL_TYPE_INT)
-        {
-            int32_t data = dev_shadow_attrib->int_val;
-            err = save_to_file((char *)&data, sizeof(data), dev_shadow_attrib->filename);
-        }
-        else if (dev_shadow_attrib->val_type == DEV_CONFIG_VAL_TYPE_STRING)
-        {
-            err = save_to_file(dev_shadow_attrib->str_val, strlen(dev_shadow_attrib->str_val), dev_shadow_attrib->filename);
-        }
-        else
-        {
-            LOG_ERR("Value type is invalid when saving the file for %s", log_strdup(dev_shadow_attrib->filename));
-        }
+    config_stats.save_requests++;
 
-        if (!err)
-            {
-            LOG_ERR("Unable to save %s", log_strdup(dev_shadow_attrib->filename));
-            return err;
-            }
-
-        // LOG_INF("%s's value saved to file", log_strdup(dev_shadow_attrib->filename), );
-    }
-    else
+    if (!(device_config.new_val_mask & BIT(idx)))
     {
         LOG_INF("Attribute not saved to file -> is_new_val = false");
+        config_stats.skipped_saves++;
+        return 0;
     }
 
-    dev_shadow_attrib->is_new_val = false;
-
-    return 0;
+    // make this a warning level so that we can see how often we are writing flash
+    LOG_WRN("Saving %s to config record", attr_desc[idx].name);
 
+    return config_request_commit();
 }
 
 /**
@@ -334,23 +716,78 @@ int config_save_attribute_to_file(enum dev_config_shadow_id_t idx)
  * @param none
  * 
  * @return Returns 0 if it is a success
+ *
+ * @note    A single record commit covers all changed attributes
  */
 int config_save_all_attributes_to_file(void)
 {
-    enum dev_config_shadow_id_t idx;
-    int err;
-
     LOG_DBG("Saving all shadow attributes to file");
 
-    err = 0;    // assume success to begin with
-    for (idx = 0; idx < DEV_CONFIG_NUM; idx++)
+    config_stats.save_requests++;
+
+    if (device_config.new_val_mask == 0)
     {
-        err = config_save_attribute_to_file(idx);
+        config_stats.skipped_saves++;
+        return 0;
     }
 
+    return config_request_commit();
+}
+
+/**
+ * @brief config_commit - Commit all the dirty attributes to flash right away
+ *
+ * @param none
+ *
+ * @return Returns 0 if it is a success
+ *
+ * @note    Cancels a pending write-back commit. Call before a planned reboot so no change is lost.
+ */
+int config_commit(void)
+{
+    int err = 0;
+
+#if defined(CONFIG_DATASTORE_WRITE_BACK)
+    k_work_cancel_delayable(&config_commit_work);
+#endif
+
+    k_mutex_lock(&config_lock, K_FOREVER);
+
+    if (device_config.new_val_mask != 0)
+        err = config_commit_record();
+
+    k_mutex_unlock(&config_lock);
+
     return err;
 }
 
+/**
+ * @brief config_stats_print - Display the flash write statistics of the datastore
+ *
+ * @param none
+ *
+ * @return none
+ *
+ * @note    Meant to be called from the app_shell process/service
+ */
+void config_stats_print(void)
+{
+    uint32_t avoided;
+
+    // a save with nothing to write, or one riding along with a commit already scheduled, is a flash write avoided
+    avoided = config_stats.skipped_saves + config_stats.coalesced_saves;
+
+    printk("\nConfiguration datastore statistics:\n\n");
+    printk("Write-back caching: %s\n", IS_ENABLED(CONFIG_DATASTORE_WRITE_BACK) ? "enabled" : "disabled");
+    printk("Save requests: %u, Identical values: %u, Skipped saves: %u, Coalesced saves: %u\n",
+        config_stats.save_requests, config_stats.identical_sets, config_stats.skipped_saves,
+        config_stats.coalesced_saves);
+    printk("Config records committed: %u, Flash writes avoided: %u\n", config_stats.commits, avoided);
+    printk("Subscribers: %d, Change notifications: %u\n", num_subscribers, config_stats.notifications);
+    printk("Read retries: %u\n", (uint32_t)atomic_get(&config_stats.read_retries));
+    printk("Dirty attributes (mask): 0x%08x\n", device_config.new_val_mask);
+}
+
 /**
  * @brief config_get_int16 - Get config value for 16 bit field
  * 
@@ -362,36 +799,51 @@ int config_save_all_attributes_to_file(void)
  */
 int16_t config_get_int16(enum dev_config_shadow_id_t index)
 {
-    if (index < DEV_CONFIG_NUM)
-    {
-        return device_config.dev_shadow_attrib[index].int16_val;
-    }
+    int16_t val;
 
-    erabort("config - bad index value");
-    return 0;
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_INT16);
+
+    config_read_value(index, &val);
+    return val;
 }
 
 /**
  * @brief config_set_int16 - Set config value for 16 bit field
  * 
  * @param  dev_config_shadow_id_t  - configuration item index
- * @param  value                - value to set in the datastore
+ * @param  value                - value to set in the datastore, pegged to the attribute's range
  * @param  is_new_value        - used to force a file update
  * 
  * @return  none
  *
  * @note    aborts if index out of range
  */
-void config_set_int16(enum dev_config_shadow_id_t index, int16_t val, bool is_new_val)
+void config_set_int16(enum dev_config_shadow_id_t index, int32_t val, bool is_new_val)
 {
-    if (index < DEV_CONFIG_NUM)
+    int16_t *valp;
+
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_INT16);
+
+    valp = config_value_ptr(index);
+    val = config_clamp(index, val);
+
+    k_mutex_lock(&config_lock, K_FOREVER);
+
+    // nothing to save if the value is not changing
+    if (*valp == val)
     {
-        device_config.dev_shadow_attrib[index].int16_val = (int16_t)val;
-        device_config.dev_shadow_attrib[index].is_new_val = is_new_val;
+        config_stats.identical_sets++;
     }
     else
-        erabort("config - bad index value");
+    {
+        int16_t new_val = (int16_t)val;
+
+        config_latch_write(index, &new_val, sizeof(new_val));
+        config_mark_new_val(index, is_new_val);
+        config_notify_change(index);
+    }
 
+    k_mutex_unlock(&config_lock);
 }
 
 /**
@@ -405,22 +857,19 @@ void config_set_int16(enum dev_config_shadow_id_t index, int16_t val, bool is_ne
  */
 int32_t config_get_int(enum dev_config_shadow_id_t index)
 {
-    if (index < DEV_CONFIG_NUM)
-    {
-        return device_config.dev_shadow_attrib[index].int_val;
-    }
-    else
-    {
-        erabort("config - index out of range");
-        return 0;
-    }
+    int32_t val;
+
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_INT);
+
+    config_read_value(index, &val);
+    return val;
 }
 
 /**
  * @brief config_set_int - Set config value for 32 bit field
  * 
  * @param dev_config_shadow_id_t - configuration item index
- * @param value                 - value to write into datastore
+ * @param value                 - value to write into datastore, pegged to the attribute's range
  * @param is_new_value        - used to force a file update
  * 
  * @return  none
@@ -429,15 +878,28 @@ int32_t config_get_int(enum dev_config_shadow_id_t index)
  */
 void config_set_int(enum dev_config_shadow_id_t index, int32_t val, bool is_new_val)
 {
-    if (index < DEV_CONFIG_NUM)
+    int32_t *valp;
+
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_INT);
+
+    valp = config_value_ptr(index);
+    val = config_clamp(index, val);
+
+    k_mutex_lock(&config_lock, K_FOREVER);
+
+    // nothing to save if the value is not changing
+    if (*valp == val)
     {
-        device_config.dev_shadow_attrib[index].int_val = (int32_t)val;
-        device_config.dev_shadow_attrib[index].is_new_val = is_new_val;
+        config_stats.identical_sets++;
     }
     else
     {
-        erabort("config - index out of range");
+        config_latch_write(index, &val, sizeof(val));
+        config_mark_new_val(index, is_new_val);
+        config_notify_change(index);
     }
+
+    k_mutex_unlock(&config_lock);
 }
 
 /**
@@ -447,19 +909,109 @@ void config_set_int(enum dev_config_shadow_id_t index, int32_t val, bool is_new_
  * 
  * @return  pointer to string in the configuration store
  *
- * @note    aborts if index out of range
+ * @note    aborts if index out of range. The string is only stable until the attribute is set again,
+ *          use config_get_str_copy() (or config_read_begin()) from threads that can race a shadow update.
  */
 char * config_get_str(enum dev_config_shadow_id_t index)
 {
-    if (index < DEV_CONFIG_NUM && index != DEV_CONFIG_ICCID)
+    uint32_t seq;
+
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_STRING);
+
+    return (char *)config_read_begin(&seq) + attr_desc[index].offset;
+}
+
+/**
+ * @brief config_get_str_copy - Copy a configuration string out of the datastore
+ *
+ * @param dev_config_shadow_id_t configuration item index
+ * @param bufp      buffer to copy the string into
+ * @param buf_len   size of the buffer, the string is truncated to fit
+ *
+ * @return  length of the copied string
+ *
+ * @note    aborts if index out of range. The copy is consistent even if the string is set concurrently
+ */
+size_t config_get_str_copy(enum dev_config_shadow_id_t index, char *bufp, size_t buf_len)
+{
+    const struct dev_config_values *valuesp;
+    uint32_t seq;
+
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_STRING);
+
+    if (buf_len == 0)
+        return 0;
+
+    do
     {
-        return device_config.dev_shadow_attrib[index].str_val;
-    }
-    if (index == DEV_CONFIG_ICCID)
+        valuesp = config_read_begin(&seq);
+        strncpy(bufp, (const char *)valuesp + attr_desc[index].offset, buf_len - 1);
+    } while (config_read_retry(seq));
+
+    bufp[buf_len - 1] = '\0';
+    return strlen(bufp);
+}
+
+/**
+ * @brief config_read_begin - Start reading the attribute values without locking
+ *
+ * @param seqp  returns the sequence to hand to config_read_retry()
+ *
+ * @return  pointer to the copy of the values to read
+ *
+ * @note    Never blocks, safe from any thread or ISR. Read what is needed straight from the returned copy
+ *          then call config_read_retry(), if it returns true something changed while reading and the reads
+ *          must be done again:
+ *
+ *              do {
+ *                  valuesp = config_read_begin(&seq);
+ *                  interval = valuesp->daq_interval_s;
+ *                  strcpy(topic, valuesp->pub_topic);
+ *              } while (config_read_retry(seq));
+ */
+const struct dev_config_values *config_read_begin(uint32_t *seqp)
+{
+    *seqp = (uint32_t)atomic_get(&values_seq);
+
+    return &device_config.values[*seqp & 1];
+}
+
+/**
+ * @brief config_read_retry - Check if the values read since config_read_begin() are consistent
+ *
+ * @param seq   sequence returned by config_read_begin()
+ *
+ * @return  true if a writer got in the way and the read must be retried
+ */
+bool config_read_retry(uint32_t seq)
+{
+    // the value reads have to be done before looking at the sequence again
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if ((uint32_t)atomic_get(&values_seq) == seq)
+        return false;
+
+    atomic_inc(&config_stats.read_retries);
+    return true;
+}
+
+/**
+ * @brief config_snapshot - Take a consistent copy of all the attribute values
+ *
+ * @param snapshotp     structure to copy the values into
+ *
+ * @return  none
+ */
+void config_snapshot(struct dev_config_values *snapshotp)
+{
+    const struct dev_config_values *valuesp;
+    uint32_t seq;
+
+    do
     {
-        return device_config.iccid;
-    }
-    return NULL;
+        valuesp = config_read_begin(&seq);
+        memcpy(snapshotp, valuesp, sizeof(*snapshotp));
+    } while (config_read_retry(seq));
 }
 
 /**
@@ -471,42 +1023,48 @@ char * config_get_str(enum dev_config_shadow_id_t index)
  * 
  * @return  none
  *
- * @note    aborts if index out of range
+ * @note    aborts if index out of range. Empty strings are ignored, strings too long for
+ *          the attribute are truncated.
  */
 void config_set_str(enum dev_config_shadow_id_t index, char *val, bool is_new_val)
 {
-    if (index < DEV_CONFIG_NUM && strlen(val) > 0)
+    size_t size;
+    size_t len;
+    char *strp;
+
+    config_check_attr(index, DEV_CONFIG_VAL_TYPE_STRING);
+
+    len = strlen(val);
+    if (len == 0)
+        return;
+
+    size = attr_desc[index].size;
+    strp = config_value_ptr(index);
+
+    if (len >= size)
     {
-        // Nulls out the storage of string
-        memset(device_config.dev_shadow_attrib[index].str_val, '\0', sizeof(device_config.dev_shadow_attrib[index].str_val));
-        strcpy(device_config.dev_shadow_attrib[index].str_val, val);
-        device_config.dev_shadow_attrib[index].is_new_val = is_new_val;
+        LOG_WRN("%s: string too long, truncated to %d characters", attr_desc[index].name, size - 1);
+        len = size - 1;
     }
-    erabort("config.c - set_str range index");
-}
 
+    k_mutex_lock(&config_lock, K_FOREVER);
 
-/**
- * @brief config_diff_flash_int16 - Diff/compare file contents to a value 
- * 
- * @param  dev_config_shadow_id_t index of shadow item
- * @param  value to compare the datastore value
- * 
- * @return  true if values are the same
- *
- * @note    aborts if index out of range
- * 
- */
-bool config_diff_flash_int16(enum dev_config_shadow_id_t attribute, int16_t valid_val)
-{
-    char file_contents[16] = {'\0'};    // define a small amout of storage to read file into
-
-    read_file(file_contents, sizeof(file_contents), device_config.dev_shadow_attrib[attribute].filename);
-    int16_t read_val = (int16_t)file_contents[0];     
-   
-    return read_val == valid_val;
+    // nothing to save if the string is not changing
+    if (strncmp(strp, val, size - 1) == 0)
+    {
+        config_stats.identical_sets++;
+    }
+    else
+    {
+        // the rest of the storage is nulled out
+        config_latch_write(index, val, len);
+        config_mark_new_val(index, is_new_val);
+        config_notify_change(index);
+    }
 
+    k_mutex_unlock(&config_lock);
 }
+   
 
 /**
  * @brief config_get_serial_number - Get serial number string 
@@ -522,3 +1080,44 @@ char *config_get_serial_number(void)
 {
     return device_config.serial_number;
 }
+
+/**
+ * @brief config_subscribe - Ask to be told when attributes change value
+ *
+ * @param mask  attributes of interest, use DEV_CONFIG_MASK() for each attribute
+ * @param cb    callback, gets the subset of mask that changed and userp
+ * @param userp user pointer handed back to the callback
+ *
+ * @return  0 on success, -ENOMEM if there is no room for another subscriber
+ *
+ * @note    The callback runs on the system work queue, never in the context that set the value, so it
+ *          is safe to re-arm timers or restart a subsystem from it. Several changes that happen close
+ *          together (e.g. one shadow delta) are reported in a single call. Setting an attribute to the
+ *          value it already has is not a change.
+ */
+int config_subscribe(uint32_t mask, config_change_cb_t cb, void *userp)
+{
+    int err = 0;
+
+    if (cb == NULL || mask == 0)
+        erabort("config_subscribe - bad subscriber");
+
+    k_mutex_lock(&config_lock, K_FOREVER);
+
+    if (num_subscribers < CONFIG_DATASTORE_MAX_SUBSCRIBERS)
+    {
+        subscribers[num_subscribers].mask = mask;
+        subscribers[num_subscribers].cb = cb;
+        subscribers[num_subscribers].userp = userp;
+        num_subscribers++;
+    }
+    else
+    {
+        LOG_ERR("No room for another config subscriber, increase CONFIG_DATASTORE_MAX_SUBSCRIBERS");
+        err = -ENOMEM;
+    }
+
+    k_mutex_unlock(&config_lock);
+
+    return err;
+}
@@ -12,6 +12,7 @@
 // Nordic includes
 #include <stdbool.h>
 #include <zephyr/types.h>
+#include <sys/util.h>
 
 // Application includes
 #include "bsp/modem.h"
@@ -22,7 +23,6 @@
 #define CONFIG_INTERVAL_FILE_NAME           "config_interval"
 #define DAQ_INTERVAL_FILE_NAME              "daq_interval"
 #define PUB_INTERVAL_FILE_NAME              "pub_interval"
-#define ICCID_INTERNAL_FILE_NAME            "ICCID_value"   // see issue: https://github.com/Reliance-Foundry/levaware_gen3/issues/11
 #define SENSOR_TYPE_FILE_NAME               "sensor_type"
 #define APP_TYPE_FILE_NAME                  "app_type"
 #define PUB_TOPIC_FILE_NAME                 "pub_topic"
@@ -42,6 +42,7 @@
 #define APP_TYPE_DEFAULT_VAL                (1)
 #define PUB_TOPIC_DEFAULT_VAL               "dt/00000000-0000-0000-0000-000000000000"
 #define SUB_TOPIC_DEFAULT_VAL               "sub_topic"
+#define PUB_FORMAT_DEFAULT_VAL              PUB_FORMAT_JSON
 
 
 // device shadow attributes
@@ -52,6 +53,7 @@
 #define DEV_SHADOW_ATTR_SENSOR_TYPE         "sensor_type"
 #define DEV_SHADOW_ATTR_APP_TYPE            "app_type"
 #define DEV_SHADOW_ATTR_PUB_TOPIC           "topic"
+#define DEV_SHADOW_ATTR_PUB_FORMAT          "pub_format"
 
 // device shadow, other attributes
 #define DEV_SHADOW_ATTR_FW_V                "fw_version"
@@ -85,19 +87,88 @@ enum external_sensor
     EXT_SENSOR_INVALID
 };
 
-// When adding to the enumerated list, be sure to add the code in device_config.c where files are read and configured. 
+// Encoding of the messages published on the telemetry topic
+enum pub_format
+{
+    PUB_FORMAT_JSON = 0,
+    PUB_FORMAT_CBOR,        // integer keys, see encoding/cbor_encoding.c
+    PUB_FORMAT_NUM
+};
+
+/*
+*   Range limits applied when an attribute is set (values outside are pegged to the limit)
+*/
+#define CONFIG_INTERVAL_MINIMUM_S           (60)            // don't request the shadow more than once per minute
+#define CONFIG_INTERVAL_MAXIMUM_S           INT16_MAX       // intervals are stored as int16, ~9 hours is the longest that fits
+#define DAQ_INTERVAL_MAXIMUM_S              INT16_MAX
+#define PUB_INTERVAL_MAXIMUM_S              INT16_MAX
+
+// sizes of the string attributes (including the NULL)
+#define PUB_TOPIC_LEN                       (128)
+#define SUB_TOPIC_LEN                       (128)
+
+// attribute flags
+#define DEV_CONFIG_FLAG_NONE                (0)
+#define DEV_CONFIG_FLAG_PERSIST             BIT(0)      // saved in the config record in flash
+#define DEV_CONFIG_FLAG_DESIRED             BIT(1)      // set from the desired state of the device shadow
+#define DEV_CONFIG_FLAG_STRICT              BIT(2)      // shadow values out of [min, max] are refused, not pegged
+
+/*
+*   The attribute table - this is the ONE place an attribute of the configuration datastore is defined. 
+*   The enum of attribute ids, the RAM storage of the values and the constant descriptor table (in flash) 
+*   are all generated from it at compile time. The shadow decoder and the reported state encoder work from
+*   the descriptor table, adding a row is all it takes to add a shadow attribute.
+*
+*   X(id, field, type, str_len, default_int, default_str, min, max, flags, shadow_key, file_name)
+*
+*       id          - enum dev_config_shadow_id_t value
+*       field       - name of the value in struct dev_config_values
+*       type        - INT16, INT or STRING
+*       str_len     - storage size for STRING (including the NULL), 0 otherwise
+*       default_*   - default value (default_str for STRING, default_int otherwise)
+*       min, max    - range the value is pegged to when set (not used for STRING)
+*       flags       - DEV_CONFIG_FLAG_xxx
+*       shadow_key  - key of the attribute in the AWS device shadow (NULL if not in the shadow). Attributes with
+*                     a key are reported, the ones flagged DEV_CONFIG_FLAG_DESIRED are also decoded from the
+*                     shadow deltas (see aws_decoding.c)
+*       file_name   - name of the legacy per-attribute file, only used to migrate old devices (NULL if none)
+*
+*   The id is used as the tag of the attribute in the config record saved in flash, so ONLY ADD NEW ATTRIBUTES AT THE END.
+*/
+#define DEV_CONFIG_ATTR_TABLE(X) \
+    X(DEV_CONFIG_DAQ_INTERVAL_S, daq_interval_s, INT16, 0, DAQ_INTERVAL_DEFAULT_VAL_S, NULL, \
+        DAQ_INTERVAL_MINIMUM_S, DAQ_INTERVAL_MAXIMUM_S, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED, \
+        DEV_SHADOW_ATTR_DAQ_INTERVAL_S, DAQ_INTERVAL_FILE_NAME) \
+    X(DEV_CONFIG_PUB_INTERVAL_S, pub_interval_s, INT16, 0, PUB_INTERVAL_DEFAULT_VAL_S, NULL, \
+        PUB_INTERVAL_MINIMUM_S, PUB_INTERVAL_MAXIMUM_S, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED, \
+        DEV_SHADOW_ATTR_PUB_INTERVAL_S, PUB_INTERVAL_FILE_NAME) \
+    X(DEV_CONFIG_ICCID, iccid, STRING, ICCID_LEN, 0, ICCID_DEFAULT_VAL, \
+        0, 0, DEV_CONFIG_FLAG_NONE, NULL, NULL) \
+    X(DEV_CONFIG_CONF_UPDATE_INTERVAL_S, config_interval_s, INT16, 0, CONFIG_INTERVAL_DEFAULT_VAL_S, NULL, \
+        CONFIG_INTERVAL_MINIMUM_S, CONFIG_INTERVAL_MAXIMUM_S, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED, \
+        DEV_SHADOW_ATTR_CONF_INTERVAL_S, CONFIG_INTERVAL_FILE_NAME) \
+    X(DEV_CONFIG_SENSOR_TYPE, sensor_type, INT16, 0, SENSOR_TYPE_DEFAULT_VAL, NULL, \
+        EXT_SENSOR_UNKNOWN + 1, EXT_SENSOR_NUM - 1, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED | DEV_CONFIG_FLAG_STRICT, \
+        DEV_SHADOW_ATTR_SENSOR_TYPE, SENSOR_TYPE_FILE_NAME) \
+    X(DEV_CONFIG_APP_TYPE, app_type, INT16, 0, APP_TYPE_DEFAULT_VAL, NULL, \
+        APP_ID_UNKNOWN + 1, APP_ID_NUM - 1, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED | DEV_CONFIG_FLAG_STRICT, \
+        DEV_SHADOW_ATTR_APP_TYPE, APP_TYPE_FILE_NAME) \
+    X(DEV_CONFIG_CONF_VERSION, config_version, INT, 0, CONFIG_VERSION_DEFAULT_VAL, NULL, \
+        0, INT32_MAX, DEV_CONFIG_FLAG_PERSIST, DEV_SHADOW_ATTR_CONF_VERSION, CONFIG_VERSION_FILE_NAME) \
+    X(DEV_CONFIG_PUB_TOPIC, pub_topic, STRING, PUB_TOPIC_LEN, 0, PUB_TOPIC_DEFAULT_VAL, \
+        0, 0, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED, DEV_SHADOW_ATTR_PUB_TOPIC, PUB_TOPIC_FILE_NAME) \
+    X(DEV_CONFIG_SUB_TOPIC, sub_topic, STRING, SUB_TOPIC_LEN, 0, SUB_TOPIC_DEFAULT_VAL, \
+        0, 0, DEV_CONFIG_FLAG_PERSIST, NULL, SUB_TOPIC_FILE_NAME) \
+    X(DEV_CONFIG_PUB_FORMAT, pub_format, INT16, 0, PUB_FORMAT_DEFAULT_VAL, NULL, \
+        PUB_FORMAT_JSON, PUB_FORMAT_NUM - 1, DEV_CONFIG_FLAG_PERSIST | DEV_CONFIG_FLAG_DESIRED | DEV_CONFIG_FLAG_STRICT, \
+        DEV_SHADOW_ATTR_PUB_FORMAT, NULL)
+
+// generate the enumerated list of attribute ids
+#define DEV_CONFIG_ENUM_ID(id, ...)     id,
+
 enum dev_config_shadow_id_t
 {
-    // device shadow values for various setting
-    DEV_CONFIG_DAQ_INTERVAL_S = 0,
-    DEV_CONFIG_PUB_INTERVAL_S,
-    DEV_CONFIG_ICCID,
-    DEV_CONFIG_CONF_UPDATE_INTERVAL_S,
-    DEV_CONFIG_SENSOR_TYPE, // current implementation
-    DEV_CONFIG_APP_TYPE,
-    DEV_CONFIG_CONF_VERSION,
-    DEV_CONFIG_PUB_TOPIC,
-    DEV_CONFIG_SUB_TOPIC,
+    DEV_CONFIG_ATTR_TABLE(DEV_CONFIG_ENUM_ID)
     DEV_CONFIG_NUM,
     DEV_CONFIG_INVALID
 };
@@ -112,19 +183,55 @@ enum dev_config_val_type_t
     DEV_CONFIG_VAL_TYPE_INVALID
 };
 
-// A structure that contains all the information for the item in the datastore
-// It's a bit of RAM pig because it creates string storage even if a simple data type
-struct dev_shadow_attrib_t
+/*
+*   RAM storage for the attribute values. Generated from the attribute table so each attribute only 
+*   takes the space its type needs (2 bytes for an int16, str_len for a string).
+*/
+#define DEV_CONFIG_CTYPE_INT16(field, str_len)      int16_t field;
+#define DEV_CONFIG_CTYPE_INT(field, str_len)        int32_t field;
+#define DEV_CONFIG_CTYPE_STRING(field, str_len)     char field[str_len];
+#define DEV_CONFIG_VALUE_FIELD(id, field, type, str_len, ...)   DEV_CONFIG_CTYPE_##type(field, str_len)
+
+struct dev_config_values
 {
-    enum dev_config_shadow_id_t  dev_conf_shadow_id;
-    enum dev_config_val_type_t   val_type;
-    int16_t                 int16_val;
-    int32_t                 int_val;
-    char                    str_val[128];
-    bool                    is_new_val;
-    char                    filename[50];
+    DEV_CONFIG_ATTR_TABLE(DEV_CONFIG_VALUE_FIELD)
 };
 
+// size of the longest string attribute (including the NULL), for buffers that can hold any of them
+#define DEV_CONFIG_STRBUF_INT16(field, str_len)
+#define DEV_CONFIG_STRBUF_INT(field, str_len)
+#define DEV_CONFIG_STRBUF_STRING(field, str_len)    char field[str_len];
+#define DEV_CONFIG_STRBUF_FIELD(id, field, type, str_len, ...)  DEV_CONFIG_STRBUF_##type(field, str_len)
+
+union dev_config_strbuf
+{
+    DEV_CONFIG_ATTR_TABLE(DEV_CONFIG_STRBUF_FIELD)
+};
+
+#define DEV_CONFIG_STR_LEN_MAX      sizeof(union dev_config_strbuf)
+
+/*
+*   Constant information describing an attribute. The table of descriptors is generated from the 
+*   attribute table and lives in flash, see config.c
+*/
+struct dev_config_attr_desc
+{
+    const char  *name;          // name of the attribute (used for logging)
+    const char  *shadow_key;    // key in the AWS device shadow, NULL if not in the shadow
+    const char  *file_name;     // legacy file name, NULL if none
+    const char  *default_str;   // default value of a string attribute
+    int32_t     default_int;    // default value of an integer attribute
+    int32_t     min_val;        // values are pegged to [min_val, max_val] when set
+    int32_t     max_val;
+    uint16_t    offset;         // offset of the value in struct dev_config_values
+    uint8_t     size;           // size of the value storage in bytes
+    uint8_t     val_type;       // enum dev_config_val_type_t
+    uint8_t     flags;          // DEV_CONFIG_FLAG_xxx
+};
+
+// two copies of the values so readers always have one that is not being written
+#define DEV_CONFIG_VALUE_COPIES     2
+
 /**
  * @brief Cache memory for device configurations, i.e., non-persistent
  */
@@ -132,24 +239,44 @@ struct device_config_t
 {
     char                serial_number[SERIAL_NUMBER_LEN];
     char                imei[IMEI_LEN];
-    char                iccid[ICCID_LEN];
-    struct dev_shadow_attrib_t dev_shadow_attrib[DEV_CONFIG_NUM];
+    struct dev_config_values values[DEV_CONFIG_VALUE_COPIES];   // attribute values, see config_read_begin()
+    uint32_t            new_val_mask;   // bit per attribute, set when the value needs to be saved to flash
 };
 
 
+// mask bit of an attribute, used to subscribe to changes
+#define DEV_CONFIG_MASK(attribute)  BIT(attribute)
+
+/**
+ * @brief Callback for attribute changes
+ *
+ * @param changed_mask  attributes that changed value (only the ones subscribed to)
+ * @param userp         user pointer given to config_subscribe()
+ */
+typedef void (*config_change_cb_t)(uint32_t changed_mask, void *userp);
+
 void config_init(void);
 char *config_get_fw_version_str(void);
 void config_dev_shadow_attrib_init(void);
+const struct dev_config_attr_desc *config_get_attr_desc(enum dev_config_shadow_id_t attribute);
 int config_save_attribute_to_file(enum dev_config_shadow_id_t attribute);
 int config_save_all_attributes_to_file(void);
+int config_commit(void);
+void config_stats_print(void);
 int16_t config_get_int16(enum dev_config_shadow_id_t attribute);
-void config_set_int16(enum dev_config_shadow_id_t attribute, int16_t val, bool is_new_val);
+void config_set_int16(enum dev_config_shadow_id_t attribute, int32_t val, bool is_new_val);
 int32_t config_get_int(enum dev_config_shadow_id_t attribute);
 void config_set_int(enum dev_config_shadow_id_t attribute, int32_t val, bool is_new_val);
 char *config_get_str(enum dev_config_shadow_id_t attribute);
+size_t config_get_str_copy(enum dev_config_shadow_id_t attribute, char *bufp, size_t buf_len);
+const struct dev_config_values *config_read_begin(uint32_t *seqp);
+bool config_read_retry(uint32_t seq);
+void config_snapshot(struct dev_config_values *snapshotp);
 void config_set_str(enum dev_config_shadow_id_t attribute, char *val, bool is_new_val);
 char *config_get_serial_number(void);
-char *config_get_iccid(enum dev_config_shadow_id_t attribute);
-bool config_diff_flash_int16(enum dev_config_shadow_id_t attribute, int16_t valid_val);
+int config_subscribe(uint32_t mask, config_change_cb_t cb, void *userp);
+int config_blob_read(const char *name, void *bufp, size_t buf_len);
+void config_blob_write(const char *name, const void *bufp, size_t len);
+bool config_legacy_fs_retired(void);
 
-#endif // CONFIG_H_
\ No newline at end of file
+#endif // CONFIG_H_
@@ -13,8 +13,32 @@
 #define CONFIG_INTERN_H_
 
 void config_fs_init(void);
+int config_fs_mount(void);
+void config_fs_unmount(void);
 bool is_file_exists(char *file_name);
 int save_to_file(char *content, size_t content_len, char *file_name);
 int read_file(char *output_buf, int output_buf_len, char *file_name);
 
+// internal flash backend (see config_nvs.c)
+void config_nvs_init(void);
+int config_nvs_read(const char *name, void *bufp, size_t buf_len);
+int config_nvs_write(const char *name, const void *bufp, size_t len);
+
+/*
+*   Single record configuration store (see config_store.c)
+*
+*   The payload is a list of tag/length/value entries, one per persistent attribute:
+*       uint8_t tag (the dev_config_shadow_id_t), uint8_t len, uint8_t value[len]
+*   Unknown tags are skipped on load so records stay readable when attributes are added or retired.
+*/
+#define CONFIG_REC_LAYOUT       1       // payload layout version, bump when the TLV encoding changes
+#define CONFIG_REC_PAYLOAD_MAX  512     // max size of the record payload in bytes
+
+void config_store_init(void);
+void config_store_init_done(void);
+int config_store_read(uint8_t *payloadp, size_t payload_max, size_t *lenp);
+int config_store_write(const uint8_t *payloadp, size_t len);
+int config_store_read_serial(char *bufp, size_t buf_len);
+bool config_store_legacy_available(void);
+
 #endif  // CONFIG_INTERN_H_
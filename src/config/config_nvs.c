@@ -0,0 +1,153 @@
+/**
+ * @brief: 	config_nvs.c - Internal flash (NVS) backend for the configuration datastore
+ *
+ * @notes:  Keeps the configuration blobs as settings entries under the "config/" subtree. The settings
+ *          subsystem is backed by NVS on the internal flash of the nRF9160 so a config access does not need
+ *          the external SPI NOR, which can stay in deep power-down.
+ *
+ *          Only blobs (the config record slots and the serial number) are stored here, the framing and
+ *          contents are owned by config_store.c and config.c.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <stdio.h>
+#include <settings/settings.h>
+
+// includes for application
+#include "config_internal.h"
+#include "bsp/sys_wrapper.h"
+
+LOG_MODULE_REGISTER(config_nvs);        // register with logging package
+
+#define CONFIG_NVS_SUBTREE      "config"    // all config entries live under this settings subtree
+#define CONFIG_NVS_KEY_LEN      32          // max length of a full settings key
+
+/*
+*   Context handed to the settings loader while reading one entry
+*/
+struct config_nvs_read_ctx {
+    void    *bufp;          // buffer to read into
+    size_t  buf_len;        // size of the buffer
+    int     num_bytes;      // bytes read or negative error, -ENOENT if the entry was not found
+};
+
+/**
+* @brief    config_nvs_load_cb - Settings loader callback, copies the value of the entry into the read context
+*
+* @param    key     remaining part of the key below the requested subtree, NULL on an exact match
+* @param    len     length of the stored value
+* @param    read_cb settings function to read the value
+* @param    cb_arg  argument for read_cb
+* @param    param   pointer to the read context
+*
+* @return   0 to keep loading
+*/
+static int config_nvs_load_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg, void *param)
+{
+    struct config_nvs_read_ctx *ctxp = param;
+    ssize_t rc;
+
+    // only interested in the exact entry, not in anything nested below it
+    if (key != NULL)
+        return 0;
+
+    // a deleted entry shows up with length 0
+    if (len == 0)
+        return 0;
+
+    if (len > ctxp->buf_len)
+    {
+        ctxp->num_bytes = -ENOMEM;
+        return 0;
+    }
+
+    rc = read_cb(cb_arg, ctxp->bufp, len);
+    ctxp->num_bytes = (int)rc;
+
+    return 0;
+}
+
+/**
+* @brief    config_nvs_read - Read a config entry from internal flash
+*
+* @param    name    name of the entry (below the config subtree)
+* @param    bufp    buffer to read into
+* @param    buf_len size of the buffer
+*
+* @return   number of bytes read, -ENOENT if the entry does not exist, other negative error code on failure
+*/
+int config_nvs_read(const char *name, void *bufp, size_t buf_len)
+{
+    char key[CONFIG_NVS_KEY_LEN];
+    struct config_nvs_read_ctx ctx = {
+        .bufp = bufp,
+        .buf_len = buf_len,
+        .num_bytes = -ENOENT
+    };
+    int err;
+
+    snprintk(key, sizeof(key), "%s/%s", CONFIG_NVS_SUBTREE, name);
+
+    err = settings_load_subtree_direct(key, config_nvs_load_cb, &ctx);
+    if (err)
+    {
+        LOG_ERR("Unable to load %s: %d", log_strdup(key), err);
+        return err;
+    }
+
+    return ctx.num_bytes;
+}
+
+/**
+* @brief    config_nvs_write - Write a config entry to internal flash
+*
+* @param    name    name of the entry (below the config subtree)
+* @param    bufp    value to write
+* @param    len     number of bytes to write
+*
+* @return   0 on success
+*
+* @note     aborts if the write fails, same as the littlefs backend
+*/
+int config_nvs_write(const char *name, const void *bufp, size_t len)
+{
+    char key[CONFIG_NVS_KEY_LEN];
+    int err;
+
+    snprintk(key, sizeof(key), "%s/%s", CONFIG_NVS_SUBTREE, name);
+
+    err = settings_save_one(key, bufp, len);
+    if (err)
+    {
+        LOG_ERR("Unable to save %s: %d", log_strdup(key), err);
+        erabort("config_nvs_write - failed to save");
+    }
+
+    return 0;
+}
+
+/**
+* @brief    config_nvs_init - Init the internal flash storage used for the configuration datastore
+*
+* @param    void
+*
+* @return   none
+*
+* @note     will abort if fails to init properly. Safe to call if another module already initialized settings
+*/
+void config_nvs_init(void)
+{
+    int err;
+
+    err = settings_subsys_init();
+    if (err)
+    {
+        LOG_ERR("settings_subsys_init failed: %d", err);
+        erabort("config_nvs_init - failed to init settings");
+    }
+}
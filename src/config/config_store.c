@@ -0,0 +1,462 @@
+/**
+ * @brief: 	config_store.c - Single record, transactional storage for the configuration datastore
+ *
+ * @notes:  All the persistent configuration attributes are kept in ONE record instead of one file per
+ *          attribute. The record is versioned and CRC protected and is written alternately to two slots
+ *          (A/B) so that a power failure in the middle of a commit always leaves the previous record intact.
+ *          At boot the newest valid slot wins.
+ *
+ *          This module only deals with framing the record (header, CRC, slots) and with the storage backend
+ *          selected at build time: littlefs on the external SPI NOR or NVS on the internal flash. The contents
+ *          of the payload are owned by config.c.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+#include <sys/crc.h>
+
+// includes for application
+#include "config.h"
+#include "config_internal.h"
+#include "bsp/sys_wrapper.h"
+
+LOG_MODULE_REGISTER(config_store);      // register with logging package
+
+#define CONFIG_REC_MAGIC        0x31474643      // "CFG1" when viewed as bytes in flash
+#define CONFIG_REC_SLOT_NUM     2               // A/B slots
+#define CONFIG_REC_NO_SLOT      (-1)            // no valid record found in either slot
+#define CONFIG_FS_MIGRATED_NAME "lfs_migrated"  // NVS entry, the datastore is off littlefs for good
+
+/*
+*   Header in front of every configuration record. The CRC covers the header (up to the crc field) and the payload
+*/
+struct config_rec_hdr {
+    uint32_t    magic;          // identifies a config record
+    uint16_t    layout;         // layout version of the payload, allows future migrations
+    uint16_t    len;            // number of payload bytes following the header
+    uint32_t    seq;            // commit sequence number, the highest valid sequence is the current record
+    uint32_t    crc;            // crc32 (ieee) of the header fields above and the payload
+} __packed;
+
+// names of the two record slots (file names on littlefs, entry names on NVS)
+static const char * const slot_file_names[CONFIG_REC_SLOT_NUM] = {
+    "config_rec_a",
+    "config_rec_b"
+};
+
+/*
+*   config store control block
+*/
+struct config_store_blk {
+    int         slot;           // slot holding the current record (or CONFIG_REC_NO_SLOT)
+    uint32_t    seq;            // sequence number of the current record
+    bool        fs_mounted;     // littlefs on the external flash is mounted
+    bool        fs_retired;     // migrated off littlefs, it is never read again
+};
+
+static struct config_store_blk store_cblk = {
+    .slot = CONFIG_REC_NO_SLOT,
+    .seq = 0,
+    .fs_mounted = false,
+    .fs_retired = false
+};
+
+// working buffer for reading and writing a complete record
+static uint8_t __aligned(4) rec_buf[sizeof(struct config_rec_hdr) + CONFIG_REC_PAYLOAD_MAX];
+
+/**
+* @brief    config_rec_crc - Calculate the CRC of a record
+*
+* @param    hdrp    pointer to the record header (payload follows the header)
+*
+* @return   crc32 value
+*/
+static uint32_t config_rec_crc(const struct config_rec_hdr *hdrp)
+{
+    uint32_t crc;
+
+    crc = crc32_ieee((const uint8_t *)hdrp, offsetof(struct config_rec_hdr, crc));
+    crc = crc32_ieee_update(crc, (const uint8_t *)(hdrp + 1), hdrp->len);
+
+    return crc;
+}
+
+/**
+* @brief    config_store_backend_read - Read a blob from the storage backend
+*
+* @param    name    name of the blob
+* @param    bufp    buffer to read into
+* @param    buf_len size of the buffer
+*
+* @return   number of bytes read, -ENOENT if the blob does not exist
+*/
+static int config_store_backend_read(const char *name, uint8_t *bufp, size_t buf_len)
+{
+#if defined(CONFIG_DATASTORE_BACKEND_NVS)
+    return config_nvs_read(name, bufp, buf_len);
+#else
+    if (false == is_file_exists((char *)name))
+        return -ENOENT;
+
+    return read_file((char *)bufp, buf_len, (char *)name);
+#endif
+}
+
+/**
+* @brief    config_store_backend_write - Write a blob to the storage backend
+*
+* @param    name    name of the blob
+* @param    bufp    data to write
+* @param    len     number of bytes to write
+*
+* @return   none
+*
+* @note     both backends abort if the write fails
+*/
+static void config_store_backend_write(const char *name, const uint8_t *bufp, size_t len)
+{
+#if defined(CONFIG_DATASTORE_BACKEND_NVS)
+    config_nvs_write(name, bufp, len);
+#else
+    save_to_file((char *)bufp, len, (char *)name);
+#endif
+}
+
+/**
+* @brief    config_store_read_slot - Read and validate the record in one slot into the working buffer
+*
+* @param    slot    slot index to read
+*
+* @return   0 if the slot holds a valid record, negative error code otherwise
+*/
+static int config_store_read_slot(int slot)
+{
+    int num_bytes;
+    struct config_rec_hdr *hdrp = (struct config_rec_hdr *)rec_buf;
+
+    num_bytes = config_store_backend_read(slot_file_names[slot], rec_buf, sizeof(rec_buf));
+    if (num_bytes == -ENOENT)
+        return -ENOENT;
+
+    if (num_bytes < (int)sizeof(struct config_rec_hdr)
+        || hdrp->magic != CONFIG_REC_MAGIC
+        || hdrp->len > (num_bytes - sizeof(struct config_rec_hdr)))
+    {
+        LOG_WRN("%s is truncated or not a config record", slot_file_names[slot]);
+        return -EINVAL;
+    }
+
+    if (config_rec_crc(hdrp) != hdrp->crc)
+    {
+        LOG_WRN("%s failed crc check", slot_file_names[slot]);
+        return -EBADMSG;
+    }
+
+    // the TLV decoder only knows this layout, a record written in another one is not read at all
+    if (hdrp->layout != CONFIG_REC_LAYOUT)
+    {
+        LOG_WRN("%s has payload layout %u, expected %u", slot_file_names[slot], hdrp->layout, CONFIG_REC_LAYOUT);
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+/**
+* @brief    config_store_read - Read the payload of the newest valid configuration record
+*
+* @param    payloadp    buffer to copy the payload into
+* @param    payload_max size of the buffer
+* @param    lenp        returns the number of payload bytes copied
+*
+* @return   0 on success, -ENOENT if no valid record exists in either slot
+*
+* @note     Also establishes which slot the next commit will go to
+*/
+int config_store_read(uint8_t *payloadp, size_t payload_max, size_t *lenp)
+{
+    int slot;
+    struct config_rec_hdr *hdrp = (struct config_rec_hdr *)rec_buf;
+
+    store_cblk.slot = CONFIG_REC_NO_SLOT;
+    *lenp = 0;
+
+    for (slot = 0; slot < CONFIG_REC_SLOT_NUM; slot++)
+    {
+        if (config_store_read_slot(slot))
+            continue;
+
+        // keep this slot if it is the first valid one or newer than the one we have (sequence wrap safe)
+        if (store_cblk.slot == CONFIG_REC_NO_SLOT || (int32_t)(hdrp->seq - store_cblk.seq) > 0)
+        {
+            if (hdrp->len > payload_max)
+                erabort("config_store_read - payload too large");
+
+            memcpy(payloadp, hdrp + 1, hdrp->len);
+            *lenp = hdrp->len;
+
+            store_cblk.slot = slot;
+            store_cblk.seq = hdrp->seq;
+        }
+    }
+
+    if (store_cblk.slot == CONFIG_REC_NO_SLOT)
+        return -ENOENT;
+
+    LOG_DBG("Config record loaded from %s, seq: %u", slot_file_names[store_cblk.slot], store_cblk.seq);
+    return 0;
+}
+
+/**
+* @brief    config_store_write - Commit a new configuration record
+*
+* @param    payloadp    pointer to the payload to store
+* @param    len         number of payload bytes
+*
+* @return   0 on success
+*
+* @note     The record always goes to the slot NOT holding the current record so that the
+*           current record survives if power is lost during the write. Aborts if the write fails.
+*/
+int config_store_write(const uint8_t *payloadp, size_t len)
+{
+    int slot;
+    struct config_rec_hdr *hdrp = (struct config_rec_hdr *)rec_buf;
+
+    if (len > CONFIG_REC_PAYLOAD_MAX)
+        erabort("config_store_write - payload too large");
+
+    // pick the other slot, or slot A if nothing has been committed yet
+    slot = (store_cblk.slot == CONFIG_REC_NO_SLOT) ? 0 : (store_cblk.slot ^ 1);
+
+    hdrp->magic = CONFIG_REC_MAGIC;
+    hdrp->layout = CONFIG_REC_LAYOUT;
+    hdrp->len = len;
+    hdrp->seq = store_cblk.seq + 1;
+    memcpy(hdrp + 1, payloadp, len);
+    hdrp->crc = config_rec_crc(hdrp);
+
+    // the backend aborts on failure
+    config_store_backend_write(slot_file_names[slot], rec_buf, sizeof(struct config_rec_hdr) + len);
+
+    store_cblk.slot = slot;
+    store_cblk.seq = hdrp->seq;
+
+    LOG_DBG("Config record committed to %s, seq: %u", slot_file_names[slot], store_cblk.seq);
+    return 0;
+}
+
+/**
+* @brief    config_store_read_serial - Read the serial number written at provisioning
+*
+* @param    bufp    buffer to read the serial number into
+* @param    buf_len size of the buffer
+*
+* @return   number of bytes read, -ENOENT if the device has not been provisioned
+*/
+int config_store_read_serial(char *bufp, size_t buf_len)
+{
+    return config_store_backend_read(SERIAL_NUMBER_FILE_NAME, (uint8_t *)bufp, buf_len);
+}
+
+/**
+* @brief    config_blob_read - Read a blob kept by another module next to the config record
+*
+* @param    name    name of the blob
+* @param    bufp    buffer to read into
+* @param    buf_len size of the buffer
+*
+* @return   number of bytes read, -ENOENT if the blob does not exist
+*
+* @note     For small state that has to survive a reboot but is not a configuration attribute (not in
+*           the shadow, not one value per device). Lives in the same backend as the config record.
+*/
+int config_blob_read(const char *name, void *bufp, size_t buf_len)
+{
+    return config_store_backend_read(name, bufp, buf_len);
+}
+
+/**
+* @brief    config_blob_write - Write a blob kept by another module next to the config record
+*
+* @param    name    name of the blob, must not clash with the names used by the datastore
+* @param    bufp    data to write
+* @param    len     number of bytes to write
+*
+* @return   none
+*
+* @note     Aborts if the write fails (like the config record). Every call is a flash write, only
+*           write when the contents change.
+*/
+void config_blob_write(const char *name, const void *bufp, size_t len)
+{
+    config_store_backend_write(name, bufp, len);
+}
+
+/**
+* @brief    config_store_legacy_available - Check if the legacy one file per attribute layout can be read
+*
+* @param    none
+*
+* @return   true if the littlefs filesystem holding the legacy files is mounted
+*/
+bool config_store_legacy_available(void)
+{
+    return store_cblk.fs_mounted;
+}
+
+#if defined(CONFIG_DATASTORE_BACKEND_NVS)
+/**
+* @brief    config_store_migrate_blob - Copy one blob from littlefs to internal flash
+*
+* @param    name    name of the file / entry
+*
+* @return   none
+*/
+static void config_store_migrate_blob(const char *name)
+{
+    int num_bytes;
+
+    if (false == is_file_exists((char *)name))
+        return;
+
+    num_bytes = read_file((char *)rec_buf, sizeof(rec_buf), (char *)name);
+    if (num_bytes <= 0)
+        return;
+
+    config_nvs_write(name, rec_buf, num_bytes);
+    LOG_INF("Migrated %s to internal flash", name);
+}
+
+/**
+* @brief    config_store_migrate_from_fs - One-shot migration of the datastore from littlefs to internal flash
+*
+* @param    none
+*
+* @return   none
+*
+* @note     The record slots are copied as is (the framing does not depend on the backend), so the
+*           sequence numbers carry on. Legacy attribute files are migrated by config.c, which is why
+*           littlefs stays mounted until config_store_init_done(). Mounted read only, nothing is deleted
+*           from littlefs, but the telemetry log takes over most of it once the migration is done.
+*/
+static void config_store_migrate_from_fs(void)
+{
+    int slot;
+    int err;
+
+    err = config_fs_mount();
+    if (err)
+    {
+        // e.g. a blank external flash on a freshly built board, nothing to migrate
+        LOG_WRN("No config filesystem on external flash (%d), nothing to migrate", err);
+        return;
+    }
+    store_cblk.fs_mounted = true;
+
+    // serial first: a valid record in internal flash is what ends the migration, a reset in between must
+    // not leave one there without the serial
+    config_store_migrate_blob(SERIAL_NUMBER_FILE_NAME);
+
+    for (slot = 0; slot < CONFIG_REC_SLOT_NUM; slot++)
+    {
+        config_store_migrate_blob(slot_file_names[slot]);
+    }
+}
+#endif
+
+/**
+* @brief    config_store_init - Init the storage backend of the configuration datastore
+*
+* @param    none
+*
+* @return   none
+*
+* @note     With the NVS backend the external flash is only mounted if internal flash holds no config
+*           record or no serial yet (first boot after moving off littlefs), and never once the migration
+*           is recorded as done. Aborts if the backend fails to init.
+*/
+void config_store_init(void)
+{
+#if defined(CONFIG_DATASTORE_BACKEND_NVS)
+    char serial[SERIAL_NUMBER_LEN];
+    uint8_t migrated;
+    int slot;
+
+    config_nvs_init();
+
+    // the telemetry log may have overwritten littlefs since, it must not be mounted again
+    if (config_nvs_read(CONFIG_FS_MIGRATED_NAME, &migrated, sizeof(migrated)) == sizeof(migrated))
+    {
+        store_cblk.fs_retired = true;
+        return;
+    }
+
+    // done only once both made it, a reset in the middle of the migration may have left a record without
+    // the serial (littlefs is untouched until the migration is recorded, it is all still there)
+    if (config_nvs_read(SERIAL_NUMBER_FILE_NAME, serial, sizeof(serial)) > 0)
+    {
+        for (slot = 0; slot < CONFIG_REC_SLOT_NUM; slot++)
+        {
+            if (config_store_read_slot(slot) == 0)
+                return;
+        }
+    }
+
+    LOG_WRN("No config record or serial in internal flash, migrating from external flash");
+    config_store_migrate_from_fs();
+#else
+    config_fs_init();
+    store_cblk.fs_mounted = true;
+#endif
+}
+
+/**
+* @brief    config_store_init_done - Release what was only needed while initializing the datastore
+*
+* @param    none
+*
+* @return   none
+*
+* @note     With the NVS backend this unmounts littlefs after a migration so the external flash can go idle.
+*           Once a record is in internal flash (migrated or committed from the legacy files) the migration
+*           is recorded as done and the external flash is free for the telemetry log.
+*/
+void config_store_init_done(void)
+{
+#if defined(CONFIG_DATASTORE_BACKEND_NVS)
+    uint8_t migrated = 1;
+
+    if (store_cblk.fs_mounted)
+    {
+        config_fs_unmount();
+        store_cblk.fs_mounted = false;
+    }
+
+    if (!store_cblk.fs_retired && store_cblk.slot != CONFIG_REC_NO_SLOT)
+    {
+        config_nvs_write(CONFIG_FS_MIGRATED_NAME, &migrated, sizeof(migrated));
+        store_cblk.fs_retired = true;
+        LOG_INF("Migration off the external flash done, littlefs retired");
+    }
+#endif
+}
+
+/**
+* @brief    config_legacy_fs_retired - Check if the datastore is done with littlefs on the external flash
+*
+* @param    none
+*
+* @return   true once everything was migrated to internal flash, the old littlefs may then be overwritten
+*
+* @note     Always false with the littlefs backend. Valid after config_init().
+*/
+bool config_legacy_fs_retired(void)
+{
+    return store_cblk.fs_retired;
+}
@@ -3,6 +3,9 @@
  *
  * @notes:  Helper files for filesystem operations. Lifted, cleaned and pruned
  *          from Levaware Gen2 which intern was previously lifted from open source (see below)
+ *
+ *          Every filesystem operation is an I/O window on the external flash, it is woken for it and goes
+ *          back to deep power-down after.
  *  
  * 	Copyright (c) 2023 Reliance Foundry Co. Ltd.
  *  Copyright (c) 2019 Peter Bigot Consulting, LLC
@@ -15,10 +18,14 @@
 #include <zephyr.h>
 #include <fs/fs.h>
 #include <fs/littlefs.h>
+#include <logging/log.h>
 
 // includes for application
 #include  "config_internal.h"
 #include "bsp/sys_wrapper.h"
+#include "bsp/ext_flash.h"
+
+LOG_MODULE_REGISTER(config_utils);      // register with logging package
 
 // A change of the name of the littlefs storage symbol
 // This is to avoid compiler error on flash_map_pm.h, line#29
@@ -32,6 +39,10 @@ static struct fs_mount_t lfs_storage_mnt = {
     .fs_data = &storage,
     .storage_dev = (void *)FLASH_AREA_ID(littlefs_storage),
     .mnt_point = "/lfs",
+#if defined(CONFIG_DATASTORE_BACKEND_NVS)
+    // only read to migrate off it, a mount that fails must never format the config of a fielded unit
+    .flags = FS_MOUNT_FLAG_NO_FORMAT | FS_MOUNT_FLAG_READ_ONLY,
+#endif
 };
 
 // mp pointer is used as a mount flag
@@ -60,6 +71,8 @@ int save_to_file(char *content, size_t content_len, char *file_name)
     // init the file object
     fs_file_t_init(&file);
 
+    ext_flash_get();
+
     rc = fs_open(&file, fname, FS_O_CREATE | FS_O_WRITE);
     if (rc < 0)
     {
@@ -93,6 +106,7 @@ int save_to_file(char *content, size_t content_len, char *file_name)
     {
         // success 
         fs_close(&file);
+        ext_flash_put();
         return rc;
     }
     else
@@ -131,6 +145,8 @@ int read_file(char *output_buf, int output_buf_len, char *file_name)
     // init the file object
     fs_file_t_init(&file);
 
+    ext_flash_get();
+
     rc = fs_open(&file, fname, FS_O_READ);
     if (rc < 0)
     {
@@ -152,6 +168,7 @@ int read_file(char *output_buf, int output_buf_len, char *file_name)
         erabort("read_file - failed to read");
  
     fs_close(&file);
+    ext_flash_put();
 
     return bytesread;
 }
@@ -176,14 +193,17 @@ bool is_file_exists(char *file_name)
     exists = false;     // assume the file does not exist
     snprintk(fname, sizeof(fname), "%s/%s", mp->mnt_point, file_name);
 
+    ext_flash_get();
     rc = fs_stat(fname, &config_ent);
+    ext_flash_put();
+
     if (rc == 0)
     {
         // file exists if size > 0
         if (config_ent.size > 0)
             exists = true;
     }
-    else if (rc == ENOENT)
+    else if (rc == -ENOENT)
     {
         //return 0 if no config file exist
        exists = false;
@@ -199,26 +219,71 @@ bool is_file_exists(char *file_name)
 
 
 /** 
-* @brief    config_init_lfs - Init the filesystem used for the Configuration datastore
+* @brief    config_fs_mount - Mount the filesystem used for the Configuration datastore
 *
 * @param    void
 *
-* @return   none
+* @return   0 on success, negative error code if the mount failed
 *
-* @note     will abort if fails to init properly
+* @note     does not abort, used when the filesystem is optional (migrating to the internal flash backend)
 */
-void config_fs_init(void)
+int config_fs_mount(void)
 {
     int rc;
 
     // check if filesystem is mounted
+    if (mp != NULL)
+        return 0;
+
+    ext_flash_get();
+    rc = fs_mount(&lfs_storage_mnt);
+    ext_flash_put();
+
+    if (rc < 0)
+        return rc;
+
+    mp = &lfs_storage_mnt;
+    return 0;
+}
+
+/** 
+* @brief    config_fs_unmount - Unmount the filesystem used for the Configuration datastore
+*
+* @param    void
+*
+* @return   none
+*
+* @note     lets the external flash go idle once the datastore no longer needs it
+*/
+void config_fs_unmount(void)
+{
+    int rc;
+
     if (mp == NULL)
-    {
-        mp = &lfs_storage_mnt;
-    }  
+        return;
+
+    ext_flash_get();
+    rc = fs_unmount(mp);
+    ext_flash_put();
 
-    // mount filesystem
-    rc = fs_mount(mp);
     if (rc < 0)
+        LOG_WRN("config_fs_unmount - failed to unmount: %d", rc);
+
+    mp = NULL;
+}
+
+/** 
+* @brief    config_init_lfs - Init the filesystem used for the Configuration datastore
+*
+* @param    void
+*
+* @return   none
+*
+* @note     will abort if fails to init properly
+*/
+void config_fs_init(void)
+{
+    // mount filesystem
+    if (config_fs_mount() < 0)
         erabort("config_init_fs - failed to mount");
 }
@@ -12,6 +12,7 @@
 #include <zephyr.h>
 #include <logging/log.h>
 #include <net/aws_iot.h>
+#include <string.h>
 
 // includes for application
 #include "aws_connector.h"
@@ -20,6 +21,103 @@
 
 LOG_MODULE_REGISTER(aws_callbacks);
 
+/*
+*   Pool of receive buffers. Messages are only copied here in the mqtt callback, decoding them (and the flash
+*   writes of the config changes) happens in the connector thread so the mqtt client is never held up.
+*/
+K_MEM_SLAB_DEFINE(aws_rx_slab, sizeof(struct aws_rx_buf), CONFIG_AWS_RX_BUF_COUNT, 4);
+
+/*
+*   Statistics of the receive path
+*/
+struct aws_rx_stats {
+    uint32_t    msgs;               // messages handed to the connector thread
+    uint32_t    no_buf;             // messages dropped, no buffer free in the pool
+    uint32_t    too_big;            // messages dropped, larger than a buffer
+    uint32_t    no_event;           // messages dropped, the event queue was full
+    uint32_t    max_cb_cyc;         // longest time spent in the callback handing a message over
+    uint32_t    max_held_cyc;       // longest time a buffer was held, from receive to processed
+};
+
+static struct aws_rx_stats aws_rx_stats;
+
+/** 
+* @brief   aws_rx_handoff - Copy a received message in a buffer of the pool and hand it to the connector thread 
+*
+* @param    msgp    the message as the aws client received it
+*
+* @return   nothing
+*
+* @note     runs in the mqtt callback, only copies. The message is dropped (and counted) if it can't be handed over
+*/
+static void aws_rx_handoff(const struct aws_iot_data *msgp)
+{
+    uint32_t start_cyc = k_cycle_get_32();
+    struct aws_rx_buf *bufp;
+
+    if (msgp->len > CONFIG_AWS_RX_BUF_SIZE)
+    {
+        aws_rx_stats.too_big++;
+        LOG_ERR("Message of %d bytes too large, dropped", msgp->len);
+        return;
+    }
+
+    if (k_mem_slab_alloc(&aws_rx_slab, (void **)&bufp, K_NO_WAIT))
+    {
+        aws_rx_stats.no_buf++;
+        LOG_ERR("No receive buffer, message dropped");
+        return;
+    }
+
+    aws_session_rx(msgp->len);
+
+    bufp->rx_cyc = start_cyc;
+    bufp->len = msgp->len;
+    memcpy(bufp->data, msgp->ptr, msgp->len);
+    bufp->data[msgp->len] = '\0';
+
+    // the connector thread owns the buffer from here
+    if (aws_queue_event_data(AWS_IOT_SHADOW_RECEIVED, bufp))
+    {
+        aws_rx_stats.no_event++;
+        k_mem_slab_free(&aws_rx_slab, (void **)&bufp);
+        return;
+    }
+
+    aws_rx_stats.msgs++;
+    aws_rx_stats.max_cb_cyc = MAX(aws_rx_stats.max_cb_cyc, k_cycle_get_32() - start_cyc);
+}
+
+/** 
+* @brief   aws_rx_buf_free - Give a receive buffer back to the pool once the message is processed 
+*
+* @param    bufp    buffer handed over with the AWS_IOT_SHADOW_RECEIVED event
+*
+* @return   nothing
+*/
+void aws_rx_buf_free(struct aws_rx_buf *bufp)
+{
+    aws_rx_stats.max_held_cyc = MAX(aws_rx_stats.max_held_cyc, k_cycle_get_32() - bufp->rx_cyc);
+
+    k_mem_slab_free(&aws_rx_slab, (void **)&bufp);
+}
+
+/** 
+* @brief   aws_rx_stats_print - Print the statistics of the receive path 
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_rx_stats_print(void)
+{
+    printk("Received messages: %u, Dropped - no buffer: %u, too big: %u, event queue full: %u\n",
+        aws_rx_stats.msgs, aws_rx_stats.no_buf, aws_rx_stats.too_big, aws_rx_stats.no_event);
+    printk("Receive buffers in use: %u of %u, Longest callback: %u us, Longest held: %u us\n",
+        k_mem_slab_num_used_get(&aws_rx_slab), CONFIG_AWS_RX_BUF_COUNT, k_cyc_to_us_floor32(aws_rx_stats.max_cb_cyc),
+        k_cyc_to_us_floor32(aws_rx_stats.max_held_cyc));
+}
+
 /** 
 * @brief   aws_iot_event_handler - Callback event handler from the Nordic aws client 
 *
@@ -36,6 +134,14 @@ void aws_iot_event_handler(const struct aws_iot_evt *const evtp)
     switch (evtp->type)
     {
     case AWS_IOT_EVT_CONNECTING:
+        // the client also reports a failed attempt with this event, with the error
+        if (evtp->data.err)
+        {
+            LOG_ERR("AWS_IOT_EVT_CONNECTING, connect failed: %d", evtp->data.err);
+            aws_queue_event(AWS_EVENT_CONNECT_FAILED);
+            break;
+        }
+
         LOG_INF("AWS_IOT_EVT_CONNECTING");
 
         // queue the 'connecting event' to the aws connector task
@@ -70,23 +176,14 @@ void aws_iot_event_handler(const struct aws_iot_evt *const evtp)
     case AWS_IOT_EVT_DATA_RECEIVED:
         LOG_INF("AWS_IOT_EVT_DATA_RECEIVED");
 
-        printk("Data received from AWS IoT console:\r\nTopic: %.*s\r\nMessage[len: %d]: %s\r\n",
-                       evtp->data.msg.topic.len,
-                    evtp->data.msg.topic.str,
-                    evtp->data.msg.len,
-                    evtp->data.msg.ptr);
-
         /* 
         *   For now we are only expecting classic shadow data for topic & processing, but this will 
         *   need to be expanded in future if we wish to support additional topics.
         * 
-        *   So go process the shadow message in the callback context and the send event to complete the 
-        *   processing in our thread context 
+        *   The message is decoded (and the config changes saved) in our thread context, the callback only
+        *   copies it so the mqtt client gets back to servicing pings and PUBACKs right away
         */
-        aws_decode_shadow_msg(evtp->data.msg.ptr, evtp->data.msg.len);
-
-        // we have parsed and saved the shadow update, queue the event
-        aws_queue_event(AWS_IOT_SHADOW_RECEIVED);
+        aws_rx_handoff(&evtp->data.msg);
         break;
 
     case AWS_IOT_EVT_FOTA_START:
@@ -137,10 +234,20 @@ void aws_iot_event_handler(const struct aws_iot_evt *const evtp)
         
     case AWS_IOT_EVT_PINGRESP:
         LOG_INF("AWS_IOT_EVT_PINGRESP");
+#if defined(CONFIG_AWS_KEEPALIVE)
+        aws_keepalive_pingresp();
+#endif
     break;
 
     case AWS_IOT_EVT_PUBACK:
         LOG_INF("AWS_IOT_EVT_PUBACK");
+        aws_session_puback();
+#if defined(CONFIG_AWS_REPORTED)
+        aws_reported_puback(evtp->data.message_id);
+#endif
+#if defined(CONFIG_AWS_OUTBOX)
+        aws_outbox_puback(evtp->data.message_id);
+#endif
     break;
 
     case AWS_IOT_EVT_ERROR:
@@ -12,6 +12,24 @@
  *          provide the context for these operations. This allow us to defer processing our own thread instead of 
  *          callback functios from nRF subsystem. In addition, an message passing queue will be used to queue events 
  *          to a state machine in this thread. 
+ *
+ *          Telemetry is published in cycles so the radio wakes once per publish interval rather than once per
+ *          sample. Producers append records to the telemetry log at the DAQ interval; every pub_interval_s the
+ *          connector packs everything logged since the last cycle into as few messages as the payload buffer
+ *          allows and sends them back to back.
+ *
+ *          Alarms skip the wait, they go in the urgent lane and are published right away, ahead of the telemetry
+ *          log and of a history replay. See aws_lanes.c.
+ *
+ *          The changes of the shadow reported state go out at the start of each publish cycle. See aws_reported.c.
+ *
+ *          While ready, pings go out just often enough for the carrier NAT to keep the connection. See aws_keepalive.c.
+ *
+ *          When the connection can't be made or drops, the next attempt waits for the backoff of the reconnect
+ *          scheduler. See aws_reconnect.c.
+ *
+ *          With CONFIG_AWS_CONNECT_ON_DEMAND the connection is only opened when a publish cycle has something to
+ *          publish (or the shadow is due for a sync) and closed once the cycle is acknowledged. See aws_session.c.
  *  
  * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
  *
@@ -21,10 +39,15 @@
 #include <zephyr.h>
 #include <logging/log.h>
 #include <net/aws_iot.h>
+#include <date_time.h>
+#include <string.h>
 
 // includes for application
 #include "bsp/sys_wrapper.h"
+#include "cell/lte_connect_mgr.h"
 #include "config/config.h"
+#include "encoding/aws_encoding.h"
+#include "storage/tele_log.h"
 #include "aws_connector.h"
 #include "aws_internal.h"
 
@@ -33,11 +56,19 @@ LOG_MODULE_REGISTER(aws_connector); // set the logging package name
 /*
 * Internal defines for the AWS connector module thread
 */
-#define APP_CONNECTOR_STACK_SIZE    1024    // 1K stack size should be enough
+#define APP_CONNECTOR_STACK_SIZE    2048    // telemetry is published from this thread, mqtt/tls send needs the room
 
 #define APP_CONNECTOR_TASK_PRIORITY 5     // Thread priority - should leave room for data sampling threads
 
-#define MSG_QUEUE_SZ                5       // size of message queue feeding the thread. Thread never blocks so can be small
+/*
+*   Size of the message queue feeding the thread, room for everything its producers can have queued at once.
+*   The thread blocks in aws_iot_send() and the modem for a while, so the queue must not rely on being drained.
+*/
+#define MSG_QUEUE_ONE_SHOT_EVENTS   5       // drain, keepalive, reconnect, session end, pub interval: one of each
+#define MSG_QUEUE_AWS_EVENTS        5       // connecting, connected, ready, disconnected, connect failed
+#define MSG_QUEUE_LTE_EVENTS        (LTE_EVT_NUM - 1)   // all but RRC connected, which is not queued
+#define MSG_QUEUE_SZ                (CONFIG_AWS_RX_BUF_COUNT + MSG_QUEUE_ONE_SHOT_EVENTS + MSG_QUEUE_AWS_EVENTS \
+                                        + MSG_QUEUE_LTE_EVENTS)
 
 
 /*
@@ -80,11 +111,55 @@ struct  aws_control_blk  {
 
     // current state of the state machine
     enum  aws_state_code state;      
+
+    uint32_t event_drops;           // events lost because the event queue was full
+    bool pdp_down;                  // the PDP context went down, publishing is suspended until ready again
+
+#if defined(CONFIG_TELE_LOG)
+    // starts a publish cycle every pub_interval_s while READY
+    struct k_timer drain_timer;
+    atomic_t drain_pending;         // a drain event is queued, avoids flooding the event queue
+    atomic_t interval_pending;      // a pub interval event is queued
+    bool pub_active;                // a publish cycle is sending messages
+    uint32_t pub_msgs;              // messages sent in the current publish cycle
+
+    // working storage for publishing a batch from the telemetry log
+    struct tele_record drain_recs[CONFIG_TELE_LOG_DRAIN_BATCH];
+    char drain_topic[PUB_TOPIC_LEN];
+    char drain_payload[CONFIG_TELEMETRY_PAYLOAD_BUFFER_SIZE];
+
+    // time the connection became ready, splits the backlog between the tiers, 0 if the time is not known
+    uint32_t backfill_ref_ts;
+
+    // range of the history being published again on request, see aws_connector_replay()
+    atomic_t replay_state;
+    struct tele_log_cursor replay_cur;
+    uint32_t replay_start_ts;
+    uint32_t replay_end_ts;
+#endif
 };
 
 // allocate storage for the control block
 static struct aws_control_blk aws_cblk;
 
+/*
+*   states of a history replay, only the connector thread touches the cursor while running
+*/
+#define AWS_REPLAY_IDLE         0
+#define AWS_REPLAY_SETUP        1       // aws_connector_replay() is positioning the cursor
+#define AWS_REPLAY_RUNNING      2
+
+#if defined(CONFIG_TELE_LOG)
+BUILD_ASSERT(CONFIG_TELE_LOG_MINUTE_BACKFILL_S > CONFIG_TELE_LOG_RAW_BACKFILL_S, "minute backfill must reach further back");
+
+// period covered by one record of each tier of the telemetry log, 0 for raw
+static const uint32_t tier_period_s[TELE_TIER_NUM] = {
+    [TELE_TIER_RAW] = 0,
+    [TELE_TIER_MINUTE] = TELE_TIER_MINUTE_S,
+    [TELE_TIER_HOUR] = TELE_TIER_HOUR_S,
+};
+#endif
+
 // storage for aws_iot client control block
 static struct aws_iot_config aws_iot;
 
@@ -168,6 +243,30 @@ static  char * event_to_string(enum  event_code event)
         case AWS_IOT_SHADOW_RECEIVED:
         stringp = "Shadow received";
         break;
+
+        case AWS_EVENT_DRAIN_LOG:
+        stringp = "Drain log";
+        break;
+
+        case AWS_EVENT_KEEPALIVE:
+        stringp = "Keepalive";
+        break;
+
+        case AWS_EVENT_CONNECT_FAILED:
+        stringp = "Connect failed";
+        break;
+
+        case AWS_EVENT_RECONNECT:
+        stringp = "Reconnect";
+        break;
+
+        case AWS_EVENT_SESSION_END:
+        stringp = "Session end";
+        break;
+
+        case AWS_EVENT_PUB_INTERVAL:
+        stringp = "Pub interval";
+        break;
         
         case LTE_EVENT:
         stringp = "lte_event";
@@ -185,11 +284,26 @@ static  char * event_to_string(enum  event_code event)
 *
 * @param    event
 *
-* @return   nothing
+* @return   0 on success, -ENOMSG if the queue is full and the event was dropped
+*
+* @note     Never blocks, can be called from an ISR. A dropped event is counted, not fatal.
+*/
+int     aws_queue_event(enum event_code event)
+{
+    return aws_queue_event_data(event, NULL);
+}
+
+/**  
+* @brief    aws_queue_event_data - Queue an event message with its data to the aws_connector state machine
+*
+* @param    event
+* @param    msgp - data of the event, see enum event_code
+*
+* @return   0 on success, -ENOMSG if the queue is full and the event was dropped
 *
-* @abort:   aborts if error queuing message
+* @note     Never blocks, can be called from an ISR. If the event is dropped the data is still the caller's.
 */
-void    aws_queue_event(enum event_code event)
+int     aws_queue_event_data(enum event_code event, void *msgp)
 {
     int err;
 
@@ -197,13 +311,45 @@ void    aws_queue_event(enum event_code event)
     struct event_msg task_msg;
 
     task_msg.event = event; // load the event
+    task_msg.msgp = msgp;
 
     // and queue it to the message queue
     err = k_msgq_put(&aws_cblk.connector_event_queue, &task_msg, K_NO_WAIT); 
     if (err)
-        erabort("aws_queue_event");
+    {
+        aws_cblk.event_drops++;
+        LOG_WRN("Event queue full, %s dropped", event_to_string(event));
+        return -ENOMSG;
+    }
+
+    return 0;
 } 
 
+/**  
+* @brief    aws_send - Hand a message to the aws client, account for it
+*
+* @param    tx_datap - the message
+*
+* @return   0 on success, error of aws_iot_send() otherwise
+*
+* @note     Every message goes through here, the keepalive and the session statistics count on it
+*/
+int     aws_send(const struct aws_iot_data *tx_datap)
+{
+    int err;
+
+    err = aws_iot_send(tx_datap);
+    if (err)
+        return err;
+
+    aws_session_tx(tx_datap);
+#if defined(CONFIG_AWS_KEEPALIVE)
+    aws_keepalive_tx();
+#endif
+
+    return 0;
+}
+
 /**  
 * @brief    aws_shadow_request - Request shadow topic from AWS
 *
@@ -222,12 +368,831 @@ void    aws_shadow_request(void)
         .len = 0
     };
 
-    int err = aws_iot_send(&tx_data);
+    int err = aws_send(&tx_data);
     if (err) {
         LOG_ERR("aws_iot_send, error: %d", err);
     }
 }
 
+#if defined(CONFIG_TELE_LOG)
+/**  
+* @brief    aws_drain_request - Queue an event to publish the next message of telemetry
+*
+* @param    nothing
+*
+* @return   nothing
+*
+* @note     Can be called from ISR context. Only one drain event is queued at a time
+*/
+void aws_drain_request(void)
+{
+    if (atomic_set(&aws_cblk.drain_pending, 1))
+        return;
+
+    // if it did not fit the next request tries again
+    if (aws_queue_event(AWS_EVENT_DRAIN_LOG))
+        atomic_clear(&aws_cblk.drain_pending);
+}
+
+/**  
+* @brief    aws_drain_tmr_exp - Drain timer expiry, time for the next publish cycle
+*
+* @param    timerp - pointer to the timer
+*
+* @return   nothing
+*
+* @note     runs in ISR context
+*/
+static void aws_drain_tmr_exp(struct k_timer *timerp)
+{
+    aws_drain_request();
+}
+
+/**  
+* @brief    aws_pub_interval_changed - Config change callback, hand a new pub_interval_s to the thread
+*
+* @param    changed_mask - attributes that changed value, only pub_interval_s is subscribed to
+* @param    userp - not used
+*
+* @return   nothing
+*
+* @note     Runs on the system work queue. The drain timer belongs to the thread, it is started again there.
+*/
+static void aws_pub_interval_changed(uint32_t changed_mask, void *userp)
+{
+    if (atomic_set(&aws_cblk.interval_pending, 1))
+        return;
+
+    if (aws_queue_event(AWS_EVENT_PUB_INTERVAL))
+        atomic_clear(&aws_cblk.interval_pending);
+}
+
+/**  
+* @brief    aws_pub_interval_apply - Start the drain timer again if it is waiting out the old interval
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     The timer only runs that long between publish cycles, READY or offline between sessions. Stopped
+*           or about to expire right away it is left alone, whoever starts it next reads the new interval.
+*/
+static void aws_pub_interval_apply(struct aws_control_blk *cblkp)
+{
+    int16_t interval_s;
+
+    atomic_clear(&cblkp->interval_pending);
+
+    interval_s = config_get_int16(DEV_CONFIG_PUB_INTERVAL_S);
+    if (k_timer_remaining_get(&cblkp->drain_timer) == 0)
+        return;
+
+    LOG_INF("Publish interval now %d s", interval_s);
+    k_timer_start(&cblkp->drain_timer, K_SECONDS(interval_s), K_NO_WAIT);
+}
+
+/**  
+* @brief    aws_publish_telemetry - Encode and publish as many telemetry records as fit in one message
+*
+* @param    cblkp - control block pointer
+* @param    lane - lane the records come from
+* @param    tier - tier of the log the records come from
+* @param    num_recs - number of records in drain_recs
+* @param    msg_id - message id when published again from the outbox, 0 the first time
+* @param    format - enum pub_format it was first published in when published again, ignored the first time
+*
+* @return   number of records published, negative error code otherwise (-ENOBUFS, the outbox is full)
+*/
+static int aws_publish_telemetry(struct aws_control_blk *cblkp, enum aws_lane lane, enum tele_log_tier tier,
+        int num_recs, uint16_t msg_id, int format)
+{
+    struct aws_iot_data tx_data = { 0 };
+    int num_encoded;
+    int len;
+    int err;
+
+    // read every time so a new format from the shadow applies from the next message, not to one published again
+    if (msg_id == 0)
+        format = config_get_int16(DEV_CONFIG_PUB_FORMAT);
+
+    if (format == PUB_FORMAT_CBOR)
+        len = aws_encode_telemetry_cbor(cblkp->drain_recs, num_recs, tier_period_s[tier],
+                    (uint8_t *)cblkp->drain_payload, sizeof(cblkp->drain_payload), &num_encoded);
+    else
+        len = aws_encode_telemetry(cblkp->drain_recs, num_recs, tier_period_s[tier], cblkp->drain_payload,
+                    sizeof(cblkp->drain_payload), &num_encoded);
+    if (len < 0)
+    {
+        LOG_ERR("Unable to encode telemetry: %d", len);
+        return len;
+    }
+
+    // the PUBACK releases every record of the entry, they must all be in the message
+    if (msg_id != 0 && num_encoded != num_recs)
+    {
+        LOG_ERR("Only %d of %d records fit the message published again", num_encoded, num_recs);
+        return -EMSGSIZE;
+    }
+
+    config_get_str_copy(DEV_CONFIG_PUB_TOPIC, cblkp->drain_topic, sizeof(cblkp->drain_topic));
+
+    tx_data.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+    tx_data.topic.type = AWS_IOT_SHADOW_TOPIC_NONE;
+    tx_data.topic.str = cblkp->drain_topic;
+    tx_data.topic.len = strlen(cblkp->drain_topic);
+    tx_data.ptr = cblkp->drain_payload;
+    tx_data.len = len;
+    tx_data.message_id = msg_id;
+
+#if defined(CONFIG_AWS_OUTBOX)
+    // held until the PUBACK, the records are marked as sent as soon as it is handed over
+    if (msg_id == 0)
+    {
+        err = aws_outbox_add(lane, tier, cblkp->drain_recs, num_encoded, format);
+        if (err < 0)
+            return err;
+        tx_data.message_id = err;
+    }
+#endif
+
+    err = aws_send(&tx_data);
+    if (err)
+    {
+        LOG_ERR("aws_iot_send telemetry, error: %d", err);
+#if defined(CONFIG_AWS_OUTBOX)
+        // not marked as sent, it goes out again from the log. Published again it stays due in the outbox
+        if (msg_id == 0)
+            aws_outbox_cancel(tx_data.message_id);
+#endif
+        return err;
+    }
+
+    return num_encoded;
+}
+
+/**  
+* @brief    aws_replay_history - Publish the next batch of a history range requested by aws_connector_replay()
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     Records outside the range (logged before the time was known or around a clock step) are
+*           skipped. If a message only takes part of the batch the cursor is put back on the first record
+*           left out, so nothing in the range is skipped or published twice.
+*/
+static void aws_replay_history(struct aws_control_blk *cblkp)
+{
+    struct tele_log_cursor cur = cblkp->replay_cur;
+    struct tele_record *recsp = cblkp->drain_recs;
+    bool done = false;
+    int num_recs, num_sel = 0;
+    int num_pub;
+    int i;
+
+    num_recs = tele_log_read(&cur, recsp, ARRAY_SIZE(cblkp->drain_recs));
+    if (num_recs == 0)
+        done = true;
+
+    for (i = 0; i < num_recs; i++)
+    {
+        if (recsp[i].timestamp > cblkp->replay_end_ts)
+        {
+            done = true;
+            break;
+        }
+
+        if (recsp[i].timestamp >= cblkp->replay_start_ts)
+            recsp[num_sel++] = recsp[i];
+    }
+
+    if (num_sel > 0)
+    {
+        num_pub = aws_publish_telemetry(cblkp, AWS_LANE_BULK, TELE_TIER_RAW, num_sel, 0, 0);
+        if (num_pub < 0)
+            return;
+        aws_lane_sent(AWS_LANE_BULK, recsp, num_pub, 0);
+
+        if (num_pub < num_sel)
+        {
+            // resume with the first record that did not fit
+            done = tele_log_seek_seq(TELE_TIER_RAW, recsp[num_pub].seq, &cur) != 0;
+        }
+        LOG_DBG("Replayed %d telemetry records, last seq: %u", num_pub, recsp[num_pub - 1].seq);
+    }
+
+    cblkp->replay_cur = cur;
+
+    if (done)
+    {
+        LOG_INF("History replay done");
+        atomic_set(&cblkp->replay_state, AWS_REPLAY_IDLE);
+    }
+}
+
+/**  
+* @brief    aws_backfill_start - Split the telemetry backlog between the tiers of the log once ready
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     The last CONFIG_TELE_LOG_RAW_BACKFILL_S seconds are published raw, older data back to
+*           CONFIG_TELE_LOG_MINUTE_BACKFILL_S as minute rollups and anything older as hour rollups, so
+*           a long outage costs kilobytes rather than megabytes. The raw and minute records older than
+*           that are passed over without reading them.
+*/
+static void aws_backfill_start(struct aws_control_blk *cblkp)
+{
+    int64_t now_ms;
+    int raw_skipped, minute_skipped;
+
+    cblkp->backfill_ref_ts = 0;
+    if (date_time_now(&now_ms))
+    {
+        // without the time there is no telling what is old, publish the raw tier only
+        LOG_WRN("Time unknown, publishing raw telemetry only");
+        return;
+    }
+    cblkp->backfill_ref_ts = (uint32_t)(now_ms / MSEC_PER_SEC);
+
+    raw_skipped = tele_log_skip(TELE_TIER_RAW, cblkp->backfill_ref_ts - CONFIG_TELE_LOG_RAW_BACKFILL_S);
+    minute_skipped = tele_log_skip(TELE_TIER_MINUTE, cblkp->backfill_ref_ts - CONFIG_TELE_LOG_MINUTE_BACKFILL_S);
+    if (raw_skipped || minute_skipped)
+        LOG_INF("Backfill from rollups, skipped %d raw and %d minute records", raw_skipped, minute_skipped);
+}
+
+/**  
+* @brief    aws_backfill_end - Time from which the records of a tier are covered by a finer tier
+*
+* @param    cblkp - control block pointer
+* @param    tier - tier of the log
+*
+* @return   unix time, records of the tier from then on are not published
+*/
+static uint32_t aws_backfill_end(struct aws_control_blk *cblkp, enum tele_log_tier tier)
+{
+    switch (tier)
+    {
+        case    TELE_TIER_MINUTE:
+        return cblkp->backfill_ref_ts - CONFIG_TELE_LOG_RAW_BACKFILL_S;
+
+        case    TELE_TIER_HOUR:
+        return cblkp->backfill_ref_ts - CONFIG_TELE_LOG_MINUTE_BACKFILL_S;
+
+        default:
+        return UINT32_MAX;
+    }
+}
+
+/**  
+* @brief    aws_drain_tier - Publish the oldest batch of records of one tier of the telemetry log
+*
+* @param    cblkp - control block pointer
+* @param    tier - tier of the log
+*
+* @return   true if a message was published, false if the tier had nothing to publish or the send failed
+*
+* @note     Once published, the rollups of coarser tiers whose whole period has now been published in
+*           more detail are marked as sent too. Tiers are drained coarsest first so the rollups wanted
+*           for the backfill are already sent by then, only those covered by this session remain.
+*/
+static bool aws_drain_tier(struct aws_control_blk *cblkp, enum tele_log_tier tier)
+{
+    struct tele_record *recsp = cblkp->drain_recs;
+    uint32_t end_ts, covered_ts;
+    int num_recs, num_sel;
+    int num_pub;
+    int coarser;
+
+    // the cycle wrote what was buffered in RAM to flash when it started, records logged since wait for the next
+    num_recs = tele_log_peek(tier, recsp, ARRAY_SIZE(cblkp->drain_recs));
+    if (num_recs == 0)
+        return false;
+
+    end_ts = aws_backfill_end(cblkp, tier);
+    for (num_sel = 0; num_sel < num_recs && recsp[num_sel].timestamp < end_ts; num_sel++)
+        ;
+    if (num_sel == 0)
+        return false;
+
+    num_pub = aws_publish_telemetry(cblkp, AWS_LANE_NORMAL, tier, num_sel, 0, 0);
+    if (num_pub < 0)
+        return false;
+
+    tele_log_consume(tier, recsp[num_pub - 1].seq);
+    aws_lane_sent(AWS_LANE_NORMAL, recsp, num_pub, tier_period_s[tier]);
+    LOG_DBG("Published %d %s telemetry records, last seq: %u", num_pub, tier == TELE_TIER_RAW ? "raw" : "rollup",
+        recsp[num_pub - 1].seq);
+
+    // everything up to the end of the last record is now covered
+    covered_ts = recsp[num_pub - 1].timestamp + MAX(tier_period_s[tier], 1);
+    if (recsp[num_pub - 1].timestamp == 0)
+        return true;
+
+    for (coarser = tier + 1; coarser < TELE_TIER_NUM; coarser++)
+    {
+        if (covered_ts >= tier_period_s[coarser])
+            tele_log_consume_before(coarser, covered_ts - tier_period_s[coarser] + 1);
+    }
+
+    return true;
+}
+
+/**  
+* @brief    aws_drain_urgent - Publish the alarms waiting in the urgent lane
+*
+* @param    cblkp - control block pointer
+*
+* @return   true if a message was published, false if the lane is empty or the send failed
+*/
+static bool aws_drain_urgent(struct aws_control_blk *cblkp)
+{
+    struct tele_record *recsp = cblkp->drain_recs;
+    int max_recs = ARRAY_SIZE(cblkp->drain_recs);
+    int num_recs;
+    int num_pub;
+
+#if defined(CONFIG_AWS_OUTBOX)
+    // the lane forgets the alarms once sent, the outbox keeps this many of them until the PUBACK
+    max_recs = MIN(max_recs, CONFIG_AWS_OUTBOX_ALARM_RECS);
+#endif
+
+    num_recs = aws_lane_urgent_peek(recsp, max_recs);
+    if (num_recs == 0)
+        return false;
+
+    // their sequence numbers must be in flash before they leave, or a reset would hand them out again
+    tele_log_sync();
+
+    num_pub = aws_publish_telemetry(cblkp, AWS_LANE_URGENT, TELE_TIER_RAW, num_recs, 0, 0);
+    if (num_pub < 0)
+        return false;
+
+    aws_lane_urgent_consume(recsp[num_pub - 1].seq);
+    aws_lane_sent(AWS_LANE_URGENT, recsp, num_pub, 0);
+    LOG_DBG("Published %d alarms, last seq: %u", num_pub, recsp[num_pub - 1].seq);
+
+    return true;
+}
+
+#if defined(CONFIG_AWS_OUTBOX)
+/**  
+* @brief    aws_drain_outbox - Publish again the oldest message of the outbox whose PUBACK did not come in
+*
+* @param    cblkp - control block pointer
+*
+* @return   true if a message was published, false if none is due or the send failed
+*
+* @note     Same records, same sequence numbers, the backend drops the ones it already has
+*/
+static bool aws_drain_outbox(struct aws_control_blk *cblkp)
+{
+    enum aws_lane lane;
+    enum tele_log_tier tier;
+    uint16_t msg_id;
+    int num_recs;
+    int format;
+
+    num_recs = aws_outbox_resend(cblkp->drain_recs, ARRAY_SIZE(cblkp->drain_recs), &lane, &tier, &format, &msg_id);
+    if (num_recs == 0)
+        return false;
+
+    if (aws_publish_telemetry(cblkp, lane, tier, num_recs, msg_id, format) < 0)
+        return false;
+
+    LOG_DBG("Published again %d records, seq %u to %u", num_recs, cblkp->drain_recs[0].seq,
+        cblkp->drain_recs[num_recs - 1].seq);
+
+    return true;
+}
+#endif
+
+/**  
+* @brief    aws_drain_tele_log - Publish the next message of records from the telemetry log
+*
+* @param    cblkp - control block pointer
+*
+* @return   true if a message was published, false once there is nothing left to publish
+*
+* @note     The records are only marked as sent once the message is handed to the mqtt client. The
+*           tiers go coarsest first, a requested history replay (bulk lane) only once they are empty.
+*/
+static bool aws_drain_tele_log(struct aws_control_blk *cblkp)
+{
+    int tier;
+
+    for (tier = TELE_TIER_NUM - 1; tier >= TELE_TIER_RAW; tier--)
+    {
+        if (tele_log_is_empty(tier))
+            continue;
+
+        // rollups can only be placed against the raw records when the time is known
+        if (tier != TELE_TIER_RAW && cblkp->backfill_ref_ts == 0)
+            continue;
+
+        if (aws_drain_tier(cblkp, tier))
+            return true;
+    }
+
+    if (atomic_get(&cblkp->replay_state) == AWS_REPLAY_RUNNING)
+    {
+        aws_replay_history(cblkp);
+        return true;
+    }
+
+    return false;
+}
+
+/**  
+* @brief    aws_publish_cycle - Send the next message of the publish cycle, starting a cycle if none is active
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     One message per drain event so other events are handled in between, but the next event is
+*           queued right away so the messages go out back to back while the radio is up. The cycle ends
+*           when the log has nothing more to publish or a send fails, records not sent are tried again in
+*           the next cycle.
+*
+*           The urgent lane is checked before every message, so an alarm waits for one message at most. It
+*           does not wait for the log to be written to flash either, and the rest of the cycle then rides on
+*           the radio being up for it.
+*/
+static void aws_publish_cycle(struct aws_control_blk *cblkp)
+{
+    atomic_clear(&cblkp->drain_pending);
+
+    if (aws_drain_urgent(cblkp))
+    {
+        aws_drain_request();
+        return;
+    }
+
+    if (!cblkp->pub_active)
+    {
+        // everything logged up to now goes out in this cycle
+        tele_log_sync();
+        cblkp->pub_active = true;
+        cblkp->pub_msgs = 0;
+
+        // on demand, the session is the connection and started when it was ready
+        if (IS_ENABLED(CONFIG_AWS_CONNECT_ALWAYS))
+            aws_session_begin();
+
+#if defined(CONFIG_AWS_REPORTED)
+        // what changed in the reported state goes out first, in the same radio wake as the telemetry
+        if (aws_reported_publish() > 0)
+            cblkp->pub_msgs++;
+#endif
+    }
+
+#if defined(CONFIG_AWS_OUTBOX)
+    // what was not acknowledged goes before anything new
+    if (aws_drain_outbox(cblkp))
+    {
+        cblkp->pub_msgs++;
+        aws_drain_request();
+        return;
+    }
+#endif
+
+    if (aws_drain_tele_log(cblkp))
+    {
+        cblkp->pub_msgs++;
+        aws_drain_request();
+        return;
+    }
+
+    if (cblkp->pub_msgs > 0)
+        LOG_INF("Publish cycle done, %u messages", cblkp->pub_msgs);
+
+    cblkp->pub_active = false;
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+    // the connection closes once the cycle is acknowledged, the timer is started again then
+    aws_session_done();
+#else
+    // read every time so a new interval from the shadow applies from the next cycle
+    k_timer_start(&cblkp->drain_timer, K_SECONDS(config_get_int16(DEV_CONFIG_PUB_INTERVAL_S)), K_NO_WAIT);
+#endif
+}
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+/**  
+* @brief    aws_session_due - Check if there is a reason to open a session
+*
+* @param    cblkp - control block pointer
+*
+* @return   true if something waits to be published or the shadow is due for a sync
+*/
+static bool aws_session_due(struct aws_control_blk *cblkp)
+{
+    int tier;
+
+    if (aws_lane_urgent_peek(cblkp->drain_recs, 1) > 0)
+        return true;
+
+    if (atomic_get(&cblkp->replay_state) != AWS_REPLAY_IDLE)
+        return true;
+
+    // what is still buffered in RAM counts too
+    tele_log_sync();
+    for (tier = TELE_TIER_RAW; tier < TELE_TIER_NUM; tier++)
+    {
+        if (!tele_log_is_empty(tier))
+            return true;
+    }
+
+    return aws_session_sync_due();
+}
+
+/**  
+* @brief    aws_session_open - A publish cycle is due while offline, connect for it
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     Goes through the reconnect scheduler, an attempt put off (PDP context down, handshake budget used up)
+*           comes back as AWS_EVENT_RECONNECT. During the backoff of failed attempts the backoff is kept.
+*/
+static void aws_session_open(struct aws_control_blk *cblkp)
+{
+    atomic_clear(&cblkp->drain_pending);
+
+    if (aws_reconnect_scheduled())
+        return;
+
+    if (!aws_session_due(cblkp))
+    {
+        LOG_DBG("Nothing to publish, no session");
+        k_timer_start(&cblkp->drain_timer, K_SECONDS(config_get_int16(DEV_CONFIG_PUB_INTERVAL_S)), K_NO_WAIT);
+        return;
+    }
+
+    if (aws_reconnect_attempt())
+        cblkp->state = AWS_STATE_CONNECTING;
+}
+#endif
+#endif
+
+/**  
+* @brief    aws_connector_replay - Publish a time range of the telemetry history again
+*
+* @param    from_ts - unix time of the first record wanted
+* @param    to_ts - unix time of the last record wanted
+*
+* @return   0 on success, -EBUSY if a replay is already running, -ENOENT if nothing is that recent,
+*           -ENOTSUP without the telemetry log
+*
+* @note     Can be called from any thread. The range is published in a publish cycle started right away
+*           if the connection is ready, after the records not sent yet (bulk lane), and is not marked as sent.
+*/
+int aws_connector_replay(uint32_t from_ts, uint32_t to_ts)
+{
+#if defined(CONFIG_TELE_LOG)
+    struct aws_control_blk *cblkp = &aws_cblk;
+    int err;
+
+    if (!atomic_cas(&cblkp->replay_state, AWS_REPLAY_IDLE, AWS_REPLAY_SETUP))
+        return -EBUSY;
+
+    err = tele_log_seek_time(TELE_TIER_RAW, from_ts, &cblkp->replay_cur);
+    if (err)
+    {
+        atomic_set(&cblkp->replay_state, AWS_REPLAY_IDLE);
+        return err;
+    }
+
+    cblkp->replay_start_ts = from_ts;
+    cblkp->replay_end_ts = to_ts;
+    atomic_set(&cblkp->replay_state, AWS_REPLAY_RUNNING);
+
+    // ignored unless ready, the replay then waits for the first cycle after connecting
+    aws_drain_request();
+
+    LOG_INF("History replay requested, %u to %u", from_ts, to_ts);
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+/**  
+* @brief    aws_connector_alarm - Publish an alarm ahead of the telemetry log and any history replay
+*
+* @param    type - what raised the alarm
+* @param    value - the value that raised it
+*
+* @return   0 on success, -ENOBUFS if the urgent lane or the telemetry log was full and an alarm was
+*           dropped, -EAGAIN before the telemetry log is initialized, -ENOTSUP without the telemetry log
+*
+* @note     Never blocks, can be called from any thread or an ISR. Published right away if the connection
+*           is ready, otherwise first thing once it is.
+*/
+int aws_connector_alarm(enum tele_rec_type type, int32_t value)
+{
+#if defined(CONFIG_TELE_LOG)
+    struct tele_record rec;
+    int64_t now_ms;
+    int err;
+
+    rec.timestamp = 0;
+    if (date_time_now(&now_ms) == 0)
+        rec.timestamp = (uint32_t)(now_ms / MSEC_PER_SEC);
+
+    rec.type = type;
+    rec.count = 1;
+    rec.value = value;
+    rec.min = value;
+    rec.max = value;
+
+    err = aws_lane_urgent_put(&rec);
+
+    // ignored unless ready, the lane then waits for the first cycle after connecting
+    aws_drain_request();
+
+    return err;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+/**  
+* @brief    aws_connector_stats_print - Print the statistics of the outbound lanes, the event queue and the receive path
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_connector_stats_print(void)
+{
+    struct aws_control_blk *cblkp = &aws_cblk;
+
+    printk("\nAWS connector statistics:\n\n");
+    printk("State: %s, Events queued: %u, Events dropped: %u\n", state_to_string(cblkp->state),
+        k_msgq_num_used_get(&cblkp->connector_event_queue), cblkp->event_drops);
+
+#if defined(CONFIG_TELE_LOG)
+    printk("Publish cycle: %s, History replay: %s\n", cblkp->pub_active ? "active" : "idle",
+        atomic_get(&cblkp->replay_state) == AWS_REPLAY_IDLE ? "idle" : "running");
+    aws_lanes_stats_print();
+#if defined(CONFIG_AWS_OUTBOX)
+    aws_outbox_stats_print();
+#endif
+#endif
+#if defined(CONFIG_AWS_REPORTED)
+    aws_reported_stats_print();
+#endif
+#if defined(CONFIG_AWS_KEEPALIVE)
+    aws_keepalive_stats_print();
+#endif
+    aws_reconnect_stats_print();
+#if defined(CONFIG_AWS_DNS_CACHE)
+    aws_dns_stats_print();
+#endif
+    aws_session_stats_print();
+    aws_rx_stats_print();
+}
+
+/**  
+* @brief    aws_lte_event - LTE event callback, hand the PDP context changes to the state machine
+*
+* @param    event - what happened, see lte_subscribe()
+* @param    userp - not used
+*
+* @return   nothing
+*
+* @note     Runs in the context of the modem callbacks. The radio waking up is not worth an event, anything
+*           that can wait for a wake is told right away.
+*/
+static void aws_lte_event(enum lte_event event, void *userp)
+{
+    if (event == LTE_EVT_RRC_CONNECTED)
+    {
+#if defined(CONFIG_AWS_KEEPALIVE)
+        aws_keepalive_radio_awake();
+#endif
+        return;
+    }
+
+    aws_queue_event_data(LTE_EVENT, (void *)(uintptr_t)event);
+}
+
+/**  
+* @brief    aws_pdp_down - The PDP context went down, stop using the connection right away
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     Without a bearer the connection is dead, but the mqtt client would only find out when a ping
+*           or a PUBACK times out, minutes later. It is closed now, the disconnect that follows is handled
+*           by the state we are in and the reconnect waits for the PDP context to come back.
+*/
+static void aws_pdp_down(struct aws_control_blk *cblkp)
+{
+    int err;
+
+    LOG_WRN("PDP context down, closing the connection");
+
+    // nothing more is handed to the mqtt client, the records stay in the log until the next connection
+    cblkp->pdp_down = true;
+#if defined(CONFIG_TELE_LOG)
+    k_timer_stop(&cblkp->drain_timer);
+    cblkp->pub_active = false;
+#endif
+
+    err = aws_iot_disconnect();
+    if (err)
+        LOG_ERR("aws_iot_disconnect, error: %d", err);
+}
+
+/**  
+* @brief    aws_ready - The connection is ready, start everything that runs while ready
+*
+* @param    cblkp - control block pointer
+*
+* @return   nothing
+*
+* @note     Normally from the connected state, but the client may get to ready before we saw it connected
+*/
+static void aws_ready(struct aws_control_blk *cblkp)
+{
+    // For now skip the FOTA handling. 
+    // I am leaving this old shitty code here to show roughly what needs to be done but will recode properly
+    // see ticket: https://github.com/Reliance-Foundry/levaware_gen3/issues/8 
+
+    /** Successfully connected to AWS IoT broker, mark image as
+     *  working to avoid reverting to the former image upon reboot.
+     */
+    // boot_write_img_confirmed();
+
+    /** Send version number to AWS IoT broker to verify that the
+     *  FOTA update worked.
+     */
+    // k_work_submit(&shadow_update_version_work);
+
+    /*
+    *   Now that aws is now READY, request the shadow topic to kick things off
+    */
+    aws_shadow_request();
+
+    // Our new state is Ready
+    cblkp->state = AWS_STATE_READY;
+    cblkp->pdp_down = false;
+
+    // backoff starts over, and the LTE manager knows the application layer is up
+    aws_reconnect_ready();
+    aws_session_ready();
+    lte_application_conn_up(true);
+
+#if defined(CONFIG_AWS_OUTBOX)
+    aws_outbox_ready();
+#endif
+
+#if defined(CONFIG_AWS_KEEPALIVE)
+    aws_keepalive_start();
+#endif
+
+#if defined(CONFIG_TELE_LOG)
+    // first publish cycle right away for whatever the telemetry log buffered while we were offline
+    aws_backfill_start(cblkp);
+    atomic_clear(&cblkp->drain_pending);
+    cblkp->pub_active = false;
+    k_timer_start(&cblkp->drain_timer, K_NO_WAIT, K_NO_WAIT);
+#endif
+}
+
+/**  
+* @brief    aws_connect_failed - The connection attempt did not get to ready, back to offline until the next one
+*
+* @param    cblkp - control block pointer
+* @param    timeout - the attempt ran out of time, the client is still at it
+*
+* @return   nothing
+*/
+static void aws_connect_failed(struct aws_control_blk *cblkp, bool timeout)
+{
+    int err;
+
+    if (timeout)
+    {
+        LOG_WRN("Not ready after %d s, giving up the attempt", CONFIG_AWS_RECONNECT_TIMEOUT_S);
+        err = aws_iot_disconnect();
+        if (err)
+            LOG_ERR("aws_iot_disconnect, error: %d", err);
+    }
+
+#if defined(CONFIG_AWS_DNS_CACHE)
+    aws_dns_connect_failed();
+#endif
+    aws_reconnect_failed(timeout);
+    cblkp->state = AWS_STATE_OFFLINE;
+}
+
 /**  
 * @brief    aws_offline_state - Process events when in offline state
 *
@@ -249,12 +1214,36 @@ void aws_offline_state(struct aws_control_blk *cblkp, struct event_msg *evtp)
         break;
 
         case    AWS_EVENT_READY:
-        cblkp->state = AWS_EVENT_READY;
+        aws_ready(cblkp);
         break;
 
-        case    AWS_IOT_SHADOW_RECEIVED:
+        case    AWS_EVENT_RECONNECT:
+        // put off if the PDP context is down or the handshake budget is used up, the scheduler tries again
+        if (aws_reconnect_attempt())
+            cblkp->state = AWS_STATE_CONNECTING;
+        break;
+
+        // late news of an attempt we already gave up on
+        case    AWS_EVENT_CONNECT_FAILED:
         case    AWS_EVENT_DISCONNECTED:
+        break;
+
+        case    AWS_EVENT_DRAIN_LOG:
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+        aws_session_open(cblkp);
+#endif
+        break;
+
         case    LTE_EVENT:
+        // the bearer is back, no point waiting out the backoff
+        if ((uintptr_t)evtp->msgp == LTE_EVT_PDP_UP)
+            aws_reconnect_pdp_up();
+        break;
+
+        case    AWS_IOT_SHADOW_RECEIVED:
+        case    AWS_EVENT_KEEPALIVE:
+        case    AWS_EVENT_SESSION_END:
+        case    AWS_EVENT_PUB_INTERVAL:
 
         break;
 
@@ -285,14 +1274,29 @@ void aws_connecting_state(struct aws_control_blk *cblkp, struct event_msg *evtp)
 
         case    AWS_EVENT_READY:
         // push out shadow update
+        aws_ready(cblkp);
+        break;
 
-        // and start timer for periodic shadow updates WHY????
-        cblkp->state = AWS_EVENT_READY;
+        case    AWS_EVENT_CONNECT_FAILED:
+        case    AWS_EVENT_DISCONNECTED:
+        aws_connect_failed(cblkp, false);
+        break;
+
+        case    AWS_EVENT_RECONNECT:
+        aws_connect_failed(cblkp, true);
         break;
         
+        case    LTE_EVENT:
+        // the attempt cannot get through, the disconnect that follows fails it
+        if ((uintptr_t)evtp->msgp == LTE_EVT_PDP_DOWN)
+            aws_pdp_down(cblkp);
+        break;
+
        case     AWS_IOT_SHADOW_RECEIVED:
-       case     AWS_EVENT_DISCONNECTED:
-       case    LTE_EVENT:
+       case     AWS_EVENT_DRAIN_LOG:
+       case     AWS_EVENT_KEEPALIVE:
+       case     AWS_EVENT_SESSION_END:
+       case     AWS_EVENT_PUB_INTERVAL:
         break;
     }
 }
@@ -320,35 +1324,29 @@ void aws_connected_state(struct aws_control_blk *cblkp, struct event_msg *evtp)
         break;
 
         case    AWS_EVENT_READY:
+        aws_ready(cblkp);
+        // and start timer for periodic shadow updates WHY????
+        break;
 
-        // For now skip the FOTA handling. 
-        // I am leaving this old shitty code here to show roughly what needs to be done but will recode properly
-        // see ticket: https://github.com/Reliance-Foundry/levaware_gen3/issues/8 
-
-        /** Successfully connected to AWS IoT broker, mark image as
-         *  working to avoid reverting to the former image upon reboot.
-         */
-        // boot_write_img_confirmed();
-
-        /** Send version number to AWS IoT broker to verify that the
-         *  FOTA update worked.
-         */
-        // k_work_submit(&shadow_update_version_work);
-
-        /*
-        *   Now that aws is now READY, request the shadow topic to kick things off
-        */
-        aws_shadow_request();
-
-        // Our new state is Ready
-        cblkp->state = AWS_STATE_READY;
+        case    AWS_EVENT_CONNECT_FAILED:
+        case    AWS_EVENT_DISCONNECTED:
+        aws_connect_failed(cblkp, false);
+        break;
 
-        // and start timer for periodic shadow updates WHY????
+        case    AWS_EVENT_RECONNECT:
+        aws_connect_failed(cblkp, true);
         break;
         
-        case    AWS_IOT_SHADOW_RECEIVED:
-        case    AWS_EVENT_DISCONNECTED:
         case    LTE_EVENT:
+        if ((uintptr_t)evtp->msgp == LTE_EVT_PDP_DOWN)
+            aws_pdp_down(cblkp);
+        break;
+
+        case    AWS_IOT_SHADOW_RECEIVED:
+        case    AWS_EVENT_DRAIN_LOG:
+        case    AWS_EVENT_KEEPALIVE:
+        case    AWS_EVENT_SESSION_END:
+        case    AWS_EVENT_PUB_INTERVAL:
         break;
     }
 }
@@ -363,7 +1361,77 @@ void aws_connected_state(struct aws_control_blk *cblkp, struct event_msg *evtp)
 */
 void aws_ready_state(struct aws_control_blk *cblkp, struct event_msg *evtp)
 {
+    switch(evtp->event)
+    {
+        case    AWS_EVENT_DRAIN_LOG:
+#if defined(CONFIG_TELE_LOG)
+        if (!cblkp->pdp_down)
+            aws_publish_cycle(cblkp);
+#endif
+        break;
+
+        case    LTE_EVENT:
+        if ((uintptr_t)evtp->msgp == LTE_EVT_PDP_DOWN)
+        {
+            aws_pdp_down(cblkp);
+        }
+        else if ((uintptr_t)evtp->msgp == LTE_EVT_PDP_UP && cblkp->pdp_down)
+        {
+            // the connection outlived the bearer (the disconnect failed), carry on with it
+            cblkp->pdp_down = false;
+#if defined(CONFIG_TELE_LOG)
+            aws_drain_request();
+#endif
+        }
+        break;
+
+        case    AWS_EVENT_KEEPALIVE:
+#if defined(CONFIG_AWS_KEEPALIVE)
+        aws_keepalive_run();
+#endif
+        break;
 
+        case    AWS_EVENT_SESSION_END:
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+        aws_session_close(cblkp->pub_active);
+#endif
+        break;
+
+        case    AWS_EVENT_DISCONNECTED:
+#if defined(CONFIG_AWS_KEEPALIVE)
+        aws_keepalive_stop();
+#endif
+#if defined(CONFIG_TELE_LOG)
+        // nothing can be published until we are ready again, the log keeps buffering
+        k_timer_stop(&cblkp->drain_timer);
+        atomic_clear(&cblkp->drain_pending);
+        cblkp->pub_active = false;
+#endif
+        cblkp->state = AWS_STATE_OFFLINE;
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+        if (aws_session_closed())
+        {
+            // we closed it, the next session is opened for the next publish cycle
+            k_timer_start(&cblkp->drain_timer, K_SECONDS(config_get_int16(DEV_CONFIG_PUB_INTERVAL_S)), K_NO_WAIT);
+            break;
+        }
+#endif
+
+        // the first attempt waits for its jitter too, the whole cell may have dropped with us
+        lte_application_conn_up(false);
+        aws_reconnect_dropped();
+        break;
+
+        case    AWS_EVENT_CONNECTING:
+        case    AWS_EVENT_CONNECTED:
+        case    AWS_EVENT_READY:
+        case    AWS_IOT_SHADOW_RECEIVED:
+        case    AWS_EVENT_CONNECT_FAILED:
+        case    AWS_EVENT_RECONNECT:
+        case    AWS_EVENT_PUB_INTERVAL:
+        break;
+    }
 }
 
 /**  
@@ -379,6 +1447,24 @@ void aws_disconnecting_state(struct aws_control_blk *cblkp, struct event_msg *ev
 
 }
 
+/**  
+* @brief    aws_shadow_received - Decode a shadow document handed over by the mqtt callback
+*
+* @param    cblkp - control block pointer
+* @param    bufp - receive buffer holding the document
+*
+* @return   nothing
+*
+* @note     Done whatever the state, the document is good as soon as it arrives. The config changes it
+*           carries are saved to flash from this thread, never from the mqtt callback.
+*/
+static void aws_shadow_received(struct aws_control_blk *cblkp, struct aws_rx_buf *bufp)
+{
+    LOG_DBG("Shadow message, %d bytes", bufp->len);
+
+    aws_decode_shadow_msg(bufp->data, bufp->len);
+}
+
 /** 
 * @brief   aws_process_event - Process events to the aws_connector thread 
 *
@@ -401,6 +1487,15 @@ static void aws_process_event(struct aws_control_blk *cblkp, struct event_msg *e
 
 	current_state = cblkp->state; // save current/previous state
 
+    if (eventp->event == AWS_IOT_SHADOW_RECEIVED && eventp->msgp != NULL)
+        aws_shadow_received(cblkp, eventp->msgp);
+
+#if defined(CONFIG_TELE_LOG)
+    // the same in every state, the timer only runs while waiting for the next publish cycle
+    if (eventp->event == AWS_EVENT_PUB_INTERVAL)
+        aws_pub_interval_apply(cblkp);
+#endif
+
        // let's process by first dispatching on the current state, 
        // the state handler will do the reset of the processing based on the event
         switch (cblkp->state)
@@ -428,6 +1523,10 @@ static void aws_process_event(struct aws_control_blk *cblkp, struct event_msg *e
         }
         	new_state = cblkp->state;	// save new state
 
+    // the receive buffer came with the event, it goes back to the pool whatever the state did with it
+    if (eventp->event == AWS_IOT_SHADOW_RECEIVED && eventp->msgp != NULL)
+        aws_rx_buf_free(eventp->msgp);
+
 	// unified logging for all states/events
 	current_state_str = state_to_string(current_state);
 	new_state_str = state_to_string(new_state);
@@ -477,13 +1576,11 @@ static void aws_connector_task_entry(void *p1, int unused2, int32_t unused3)
         erabort("aws_connect - aws_iot_init failed");
 
     /*
-    *   Now we are all initialized, bring up the aws connection and enter 
+    *   Now we are all initialized, schedule the first connection attempt and enter 
     *   the forever loop of waiting/blocking on events and processing them. 
+    *   The reconnect scheduler retries until the connection is ready
     */
-
-   err = aws_iot_connect(&aws_iot);
-   if (err)
-    LOG_ERR("aws_iot_connect error: %d", err); // need to handle retries: https://github.com/Reliance-Foundry/levaware_gen3/issues/9
+    aws_reconnect_start(&aws_iot);
 
     while (1)
     {
@@ -509,8 +1606,8 @@ void aws_connector_init(void)
     struct aws_control_blk *cblkp;
     cblkp = &aws_cblk;
 
-    // create a message queue for the sensor threads to queue data on
-    // k_msgq_init(&tele_msg_que, tele_msg_buffer, sizeof(struct tele_message), TELEMETRY_DAQ_MSG_QUEUE);
+    // sensor threads don't queue to the connector, they append their records to the telemetry log
+    // (tele_log_append_sample()) which buffers them until the next publish cycle
 
     // create and initialize the aws connector thread event queue
     k_msgq_init(&cblkp->connector_event_queue, connector_event_buffer, sizeof(struct event_msg), MSG_QUEUE_SZ);
@@ -518,6 +1615,30 @@ void aws_connector_init(void)
     // initial state is offline
     cblkp->state = AWS_STATE_OFFLINE;
 
+#if defined(CONFIG_TELE_LOG)
+    k_timer_init(&cblkp->drain_timer, aws_drain_tmr_exp, NULL);
+
+    // a new interval applies to the wait for the next publish cycle already under way
+    if (config_subscribe(DEV_CONFIG_MASK(DEV_CONFIG_PUB_INTERVAL_S), aws_pub_interval_changed, NULL))
+        erabort("aws_connector - config_subscribe failed");
+#endif
+    aws_reconnect_init();
+    aws_session_init();
+#if defined(CONFIG_AWS_DNS_CACHE)
+    aws_dns_init();
+#endif
+#if defined(CONFIG_AWS_OUTBOX)
+    aws_outbox_init();
+#endif
+#if defined(CONFIG_AWS_KEEPALIVE)
+    aws_keepalive_init();
+#endif
+
+    // the PDP context changes drive the reconnect, the radio waking up the keepalive
+    if (lte_subscribe(LTE_EVT_MASK(LTE_EVT_PDP_UP) | LTE_EVT_MASK(LTE_EVT_PDP_DOWN) |
+            LTE_EVT_MASK(LTE_EVT_RRC_CONNECTED), aws_lte_event, NULL))
+        erabort("aws_connector - lte_subscribe failed");
+
     // do other task initialization that needs to occur before the tasks start
 
     /* 
@@ -9,6 +9,23 @@
 #ifndef AWSCONN_H_
 #define AWSCONN_H_
 
+#include <zephyr.h>
+#include "encoding/telemetry.h"
+
+/*
+*   Lanes of outbound messages. A lane is only served once every lane above it is empty.
+*/
+enum aws_lane
+{
+    AWS_LANE_URGENT = 0,            // alarms, see aws_connector_alarm()
+    AWS_LANE_NORMAL,                // the telemetry log
+    AWS_LANE_BULK,                  // history replay, see aws_connector_replay()
+    AWS_LANE_NUM
+};
+
 void    aws_connector_init();       // initialize and start the AWS connector 
+int     aws_connector_replay(uint32_t from_ts, uint32_t to_ts);    // publish a range of the telemetry history again
+int     aws_connector_alarm(enum tele_rec_type type, int32_t value);   // publish an alarm ahead of everything else
+void    aws_connector_stats_print(void);    // print the lane, event queue and receive statistics
 
 #endif /* AWSCONN_H_*/
\ No newline at end of file
@@ -0,0 +1,323 @@
+/**
+ * @brief: 	aws_dns.c - Cache of the address of the AWS IoT broker
+ *
+ * @notes:  Every connection attempt resolves CONFIG_AWS_IOT_BROKER_HOST_NAME again, a radio round trip to the
+ *          DNS server of the network, and the attempt fails with it whenever DNS is flaky. The aws iot client
+ *          resolves it with getaddrinfo(), which is wrapped at link time (-Wl,--wrap=zsock_getaddrinfo and
+ *          zsock_freeaddrinfo) to answer the broker host name from the cache. Any other name goes through.
+ *
+ *          The modem resolver does not report the TTL of the records, the address is good for
+ *          CONFIG_AWS_DNS_CACHE_TTL_S. Once that is up it is resolved again, and if that fails the old address
+ *          is used still, up to CONFIG_AWS_DNS_CACHE_STALE_S. A connection attempt that fails also sends the
+ *          next one to the resolver, in case the broker moved.
+ *
+ *          The address is kept in RAM that is not cleared at startup (__noinit), protected by a CRC, along
+ *          with the unix time it was resolved. After a reset it is fresh if the time is known and within the
+ *          TTL, otherwise it is only good as a fallback.
+ *
+ *          Runs in the thread that connects to aws iot.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <net/socket.h>
+#include <date_time.h>
+#include <string.h>
+#include <sys/crc.h>
+
+// includes for application
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_dns);           // register the logging package
+
+#define DNS_MAGIC                   0x31534e44      // "DNS1" when viewed as bytes in RAM
+
+/*
+*   What is kept across a reset
+*/
+struct dns_retained
+{
+    uint32_t    magic;
+    uint32_t    resolved_ts;            // unix time it was resolved, 0 if the time was not known
+    int         family;                 // of the address, AF_UNSPEC if none
+    int         socktype;
+    int         protocol;
+    socklen_t   addrlen;
+    struct sockaddr addr;
+    uint32_t    crc;                    // crc32 of everything above
+};
+
+static __noinit struct dns_retained dns_ram;
+
+/*
+*   DNS cache control block
+*/
+struct dns_blk
+{
+    bool        resolved;               // resolved since startup, resolved_ms is valid
+    int64_t     resolved_ms;            // uptime it was resolved
+    bool        expired;                // a connection attempt failed, resolve again
+    struct zsock_addrinfo ai;           // what a cached lookup returns, freeaddrinfo() leaves it alone
+    struct sockaddr ai_addr;
+
+    // statistics
+    uint32_t    hits;                   // answered from the cache
+    uint32_t    misses;                 // resolved
+    uint32_t    stale;                  // resolver failed, answered with an expired address
+    uint32_t    errors;                 // resolver failed, nothing to fall back on
+    uint32_t    flushes;                // connection attempts failed with a cached address
+    uint32_t    restored;               // an address was found at startup
+};
+
+static struct dns_blk dns_blk;
+
+int __real_zsock_getaddrinfo(const char *host, const char *service, const struct zsock_addrinfo *hints,
+        struct zsock_addrinfo **res);
+void __real_zsock_freeaddrinfo(struct zsock_addrinfo *ai);
+
+/**
+* @brief    aws_dns_crc - Calculate the CRC of the retained address
+*
+* @param    none
+*
+* @return   crc32 value
+*/
+static uint32_t aws_dns_crc(void)
+{
+    return crc32_ieee((const uint8_t *)&dns_ram, offsetof(struct dns_retained, crc));
+}
+
+/**
+* @brief    aws_dns_fresh - Check if the cached address is within its TTL
+*
+* @param    blkp - control block pointer
+*
+* @return   true if it can be used without asking the resolver
+*/
+static bool aws_dns_fresh(struct dns_blk *blkp)
+{
+    int64_t now_ms;
+
+    if (dns_ram.family == AF_UNSPEC || blkp->expired)
+        return false;
+
+    if (blkp->resolved)
+        return k_uptime_get() - blkp->resolved_ms < (int64_t)CONFIG_AWS_DNS_CACHE_TTL_S * MSEC_PER_SEC;
+
+    // from before the reset, only the time tells its age
+    if (dns_ram.resolved_ts == 0 || date_time_now(&now_ms))
+        return false;
+
+    return now_ms / MSEC_PER_SEC - dns_ram.resolved_ts < CONFIG_AWS_DNS_CACHE_TTL_S;
+}
+
+/**
+* @brief    aws_dns_usable - Check if the cached address is good as a fallback when the resolver fails
+*
+* @param    blkp - control block pointer
+*
+* @return   true if it is within CONFIG_AWS_DNS_CACHE_STALE_S, or its age is unknown
+*/
+static bool aws_dns_usable(struct dns_blk *blkp)
+{
+    int64_t now_ms;
+
+    if (dns_ram.family == AF_UNSPEC)
+        return false;
+
+    if (blkp->resolved)
+        return k_uptime_get() - blkp->resolved_ms < (int64_t)CONFIG_AWS_DNS_CACHE_STALE_S * MSEC_PER_SEC;
+
+    // better an old address than none
+    if (dns_ram.resolved_ts == 0 || date_time_now(&now_ms))
+        return true;
+
+    return now_ms / MSEC_PER_SEC - dns_ram.resolved_ts < CONFIG_AWS_DNS_CACHE_STALE_S;
+}
+
+/**
+* @brief    aws_dns_store - Keep the first address the resolver returned
+*
+* @param    blkp - control block pointer
+* @param    aip - result of the resolver
+*
+* @return   nothing
+*/
+static void aws_dns_store(struct dns_blk *blkp, const struct zsock_addrinfo *aip)
+{
+    int64_t now_ms;
+
+    if (aip == NULL || aip->ai_addrlen > sizeof(dns_ram.addr))
+        return;
+
+    dns_ram.family = aip->ai_family;
+    dns_ram.socktype = aip->ai_socktype;
+    dns_ram.protocol = aip->ai_protocol;
+    dns_ram.addrlen = aip->ai_addrlen;
+    memcpy(&dns_ram.addr, aip->ai_addr, aip->ai_addrlen);
+    dns_ram.resolved_ts = date_time_now(&now_ms) ? 0 : (uint32_t)(now_ms / MSEC_PER_SEC);
+    dns_ram.crc = aws_dns_crc();
+
+    blkp->resolved = true;
+    blkp->resolved_ms = k_uptime_get();
+    blkp->expired = false;
+}
+
+/**
+* @brief    aws_dns_answer - Answer a lookup from the cache
+*
+* @param    blkp - control block pointer
+* @param    hints - what the caller asked for, may be NULL
+* @param    res - returns the result
+*
+* @return   0 on success, DNS_EAI_FAMILY if the cached address is not of the family asked for
+*/
+static int aws_dns_answer(struct dns_blk *blkp, const struct zsock_addrinfo *hints, struct zsock_addrinfo **res)
+{
+    if (hints != NULL && hints->ai_family != AF_UNSPEC && hints->ai_family != dns_ram.family)
+        return DNS_EAI_FAMILY;
+
+    memset(&blkp->ai, 0, sizeof(blkp->ai));
+    memcpy(&blkp->ai_addr, &dns_ram.addr, dns_ram.addrlen);
+    blkp->ai.ai_family = dns_ram.family;
+    blkp->ai.ai_socktype = dns_ram.socktype;
+    blkp->ai.ai_protocol = dns_ram.protocol;
+    blkp->ai.ai_addrlen = dns_ram.addrlen;
+    blkp->ai.ai_addr = &blkp->ai_addr;
+
+    *res = &blkp->ai;
+    return 0;
+}
+
+/**
+* @brief    __wrap_zsock_getaddrinfo - Answer the lookups of the broker host name from the cache
+*
+* @param    host - name to resolve
+* @param    service - port, may be NULL
+* @param    hints - what the caller asks for, may be NULL
+* @param    res - returns the result, freed with freeaddrinfo()
+*
+* @return   0 on success, a DNS_EAI_ error code otherwise
+*
+* @note     Linked in place of zsock_getaddrinfo(), see CMakelists.txt. The aws iot client asks without
+*           a service, so a cached answer does not carry a port.
+*/
+int __wrap_zsock_getaddrinfo(const char *host, const char *service, const struct zsock_addrinfo *hints,
+        struct zsock_addrinfo **res)
+{
+    struct dns_blk *blkp = &dns_blk;
+    int err;
+
+    if (host == NULL || service != NULL || strcmp(host, CONFIG_AWS_IOT_BROKER_HOST_NAME) != 0)
+        return __real_zsock_getaddrinfo(host, service, hints, res);
+
+    if (aws_dns_fresh(blkp) && aws_dns_answer(blkp, hints, res) == 0)
+    {
+        blkp->hits++;
+        return 0;
+    }
+
+    err = __real_zsock_getaddrinfo(host, service, hints, res);
+    if (err == 0)
+    {
+        blkp->misses++;
+        aws_dns_store(blkp, *res);
+        return 0;
+    }
+
+    // the resolver is flaky more often than the broker moves
+    if (aws_dns_usable(blkp) && aws_dns_answer(blkp, hints, res) == 0)
+    {
+        blkp->stale++;
+        LOG_WRN("Resolving %s failed: %d, using the cached address", host, err);
+        return 0;
+    }
+
+    blkp->errors++;
+    return err;
+}
+
+/**
+* @brief    __wrap_zsock_freeaddrinfo - Free the result of a lookup, unless it came from the cache
+*
+* @param    ai - result of getaddrinfo()
+*
+* @return   nothing
+*/
+void __wrap_zsock_freeaddrinfo(struct zsock_addrinfo *ai)
+{
+    if (ai == &dns_blk.ai)
+        return;
+
+    __real_zsock_freeaddrinfo(ai);
+}
+
+/**
+* @brief    aws_dns_connect_failed - A connection attempt failed, resolve the broker again next time
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     The cached address is still the fallback if the resolver fails
+*/
+void aws_dns_connect_failed(void)
+{
+    struct dns_blk *blkp = &dns_blk;
+
+    if (dns_ram.family == AF_UNSPEC || blkp->expired)
+        return;
+
+    blkp->expired = true;
+    blkp->flushes++;
+}
+
+/**
+* @brief    aws_dns_stats_print - Print the statistics of the broker address cache
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_dns_stats_print(void)
+{
+    struct dns_blk *blkp = &dns_blk;
+
+    printk("Broker DNS cache - hits: %u, misses: %u, stale answers: %u, errors: %u, flushed: %u, restored: %u\n",
+        blkp->hits, blkp->misses, blkp->stale, blkp->errors, blkp->flushes, blkp->restored);
+
+    if (blkp->resolved)
+        printk("Broker address resolved %lld s ago\n", (k_uptime_get() - blkp->resolved_ms) / MSEC_PER_SEC);
+    else if (dns_ram.family != AF_UNSPEC)
+        printk("Broker address from before the reset, resolved at %u\n", dns_ram.resolved_ts);
+}
+
+/**
+* @brief    aws_dns_init - Pick up the address left by the last reset, or start with an empty cache
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from aws_connector_init(), before the connector thread starts
+*/
+void aws_dns_init(void)
+{
+    if (dns_ram.magic != DNS_MAGIC || dns_ram.crc != aws_dns_crc() || dns_ram.addrlen > sizeof(dns_ram.addr))
+    {
+        memset(&dns_ram, 0, sizeof(dns_ram));
+        dns_ram.magic = DNS_MAGIC;
+        dns_ram.family = AF_UNSPEC;
+        dns_ram.crc = aws_dns_crc();
+        return;
+    }
+
+    if (dns_ram.family != AF_UNSPEC)
+        dns_blk.restored++;
+}
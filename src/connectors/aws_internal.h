@@ -10,6 +10,8 @@
 #ifndef AWSINTERN_H_
 #define AWSINTERN_H_
 
+#include "storage/tele_log.h"
+
 /*
 * define various event codes to drive the aws connector state machine
 */
@@ -19,12 +21,98 @@ enum event_code {
     AWS_EVENT_CONNECTED,
     AWS_EVENT_READY,
     AWS_EVENT_DISCONNECTED,
-    AWS_IOT_SHADOW_RECEIVED,
-    LTE_EVENT       // future
+    AWS_IOT_SHADOW_RECEIVED,    // msgp is the struct aws_rx_buf of the message
+    AWS_EVENT_DRAIN_LOG,    // time to publish the next message of a publish cycle
+    AWS_EVENT_KEEPALIVE,    // the keepalive has something to do, see aws_keepalive.c
+    AWS_EVENT_CONNECT_FAILED,   // the connection attempt failed before ready
+    AWS_EVENT_RECONNECT,    // time for the next connection attempt, or the attempt ran out of time
+    AWS_EVENT_SESSION_END,  // connect on demand, check if the session can be closed
+    AWS_EVENT_PUB_INTERVAL, // pub_interval_s changed, the drain timer waiting on the old one is started again
+    LTE_EVENT       // msgp is the enum lte_event, see aws_lte_event()
 };
 
 
+/*
+*   A message received from AWS IoT. The mqtt callback copies it in a buffer of the receive pool and hands
+*   the buffer over with the event, the connector thread owns it from then on and frees it once processed.
+*/
+struct aws_rx_buf {
+    uint32_t    rx_cyc;                         // cycle count when received, to time how long the buffer is held
+    size_t      len;                            // length of the message
+    char        data[CONFIG_AWS_RX_BUF_SIZE + 1];   // the message, null terminated
+};
+
 void    aws_iot_event_handler(const struct aws_iot_evt *const evtp);
-void    aws_queue_event(enum event_code event);
+int     aws_queue_event(enum event_code event);
+int     aws_queue_event_data(enum event_code event, void *msgp);
+int     aws_send(const struct aws_iot_data *tx_datap);
+void    aws_drain_request(void);
+
+// aws_callbacks.c
+void    aws_rx_buf_free(struct aws_rx_buf *bufp);
+void    aws_rx_stats_print(void);
+
+// aws_dns.c
+void    aws_dns_init(void);
+void    aws_dns_connect_failed(void);
+void    aws_dns_stats_print(void);
+
+// aws_keepalive.c
+void    aws_keepalive_init(void);
+void    aws_keepalive_start(void);
+void    aws_keepalive_stop(void);
+void    aws_keepalive_tx(void);
+void    aws_keepalive_run(void);
+void    aws_keepalive_pingresp(void);
+void    aws_keepalive_radio_awake(void);
+int     aws_keepalive_learned_s(void);
+void    aws_keepalive_stats_print(void);
+
+// aws_lanes.c
+int     aws_lane_urgent_put(struct tele_record *recp);
+int     aws_lane_urgent_peek(struct tele_record *recsp, int max_recs);
+void    aws_lane_urgent_consume(uint32_t last_seq);
+void    aws_lane_sent(enum aws_lane lane, const struct tele_record *recsp, int num_recs, uint32_t period_s);
+void    aws_lanes_stats_print(void);
+
+// aws_outbox.c
+void    aws_outbox_init(void);
+void    aws_outbox_ready(void);
+int     aws_outbox_add(enum aws_lane lane, enum tele_log_tier tier, const struct tele_record *recsp, int num_recs,
+            int format);
+void    aws_outbox_cancel(uint16_t msg_id);
+void    aws_outbox_puback(uint16_t msg_id);
+int     aws_outbox_resend(struct tele_record *recsp, int max_recs, enum aws_lane *lanep, enum tele_log_tier *tierp,
+            int *formatp, uint16_t *msg_idp);
+void    aws_outbox_stats_print(void);
+
+// aws_reconnect.c
+void    aws_reconnect_init(void);
+void    aws_reconnect_start(struct aws_iot_config *configp);
+bool    aws_reconnect_attempt(void);
+void    aws_reconnect_pdp_up(void);
+bool    aws_reconnect_scheduled(void);
+void    aws_reconnect_failed(bool timeout);
+void    aws_reconnect_ready(void);
+void    aws_reconnect_dropped(void);
+void    aws_reconnect_stats_print(void);
+
+// aws_session.c
+void    aws_session_init(void);
+void    aws_session_begin(void);
+void    aws_session_ready(void);
+void    aws_session_tx(const struct aws_iot_data *tx_datap);
+void    aws_session_rx(size_t len);
+void    aws_session_puback(void);
+bool    aws_session_sync_due(void);
+void    aws_session_done(void);
+bool    aws_session_close(bool busy);
+bool    aws_session_closed(void);
+void    aws_session_stats_print(void);
+
+// aws_reported.c
+int     aws_reported_publish(void);
+void    aws_reported_puback(uint16_t message_id);
+void    aws_reported_stats_print(void);
 
 #endif // AWSINTERN_H_
\ No newline at end of file
@@ -0,0 +1,631 @@
+/**
+ * @brief: 	aws_keepalive.c - Adaptive keepalive of the AWS IoT connection
+ *
+ * @notes:  The mqtt client pings after CONFIG_MQTT_KEEPALIVE seconds without sending anything, but the carrier
+ *          NAT in front of us may forget the connection well before that and we only find out the next time
+ *          we publish. This module learns the longest idle time the network keeps the connection open for and
+ *          pings just often enough to keep it.
+ *
+ *          The idle time is probed up by CONFIG_AWS_KEEPALIVE_STEP_S after each ping answered, until a ping
+ *          goes unanswered. That idle time is the ceiling, the next probes split the gap between the learned
+ *          value and the ceiling until it is smaller than a step. A ping that fails at the learned value
+ *          itself lowers it. The learned value and the ceiling are saved per PLMN (config_blob_write()), only
+ *          when they change, so a device that reboots or moves between networks starts from what it knows.
+ *
+ *          A ping only answers for the idle time before it if nothing was sent in between, anything we send
+ *          restarts the idle time (aws_keepalive_tx()). When the radio wakes for something else and most of
+ *          the idle time has gone by, a ping goes out right away rather than waking the radio again later.
+ *          Those pings don't probe anything.
+ *
+ *          The mqtt client keepalive can't be changed once connected, CONFIG_MQTT_KEEPALIVE stays the
+ *          longest interval and the client still pings by itself after that long.
+ *
+ *          Runs in the aws connector thread, except the functions that only signal it (timers, mqtt callback,
+ *          LTE handler).
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <ctype.h>
+#include <string.h>
+
+// includes for application
+#include "bsp/modem.h"
+#include "config/config.h"
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_keepalive);     // register the logging package
+
+#define KEEPALIVE_BLOB_NAME         "keepalive"     // blob of the learned values, see config_blob_write()
+#define KEEPALIVE_BLOB_VERSION      1
+#define KEEPALIVE_PLMN_LEN          8               // MCC and MNC, 6 digits at most
+#define KEEPALIVE_OPERATOR_LEN      24              // what the modem may return when it is not registered
+
+// longest idle time probed, the mqtt client pings by itself at CONFIG_MQTT_KEEPALIVE
+#define KEEPALIVE_MAX_S             (CONFIG_MQTT_KEEPALIVE - CONFIG_AWS_KEEPALIVE_RESP_TIMEOUT_S)
+
+// pings answered at the learned value after which the ceiling is forgotten and probed again
+#define KEEPALIVE_CEILING_CONFIRMS  24
+
+BUILD_ASSERT(CONFIG_AWS_KEEPALIVE_MIN_S <= CONFIG_AWS_KEEPALIVE_INITIAL_S, "initial idle time below the minimum");
+BUILD_ASSERT(CONFIG_AWS_KEEPALIVE_INITIAL_S <= KEEPALIVE_MAX_S, "initial idle time above the mqtt keepalive");
+
+/*
+*   What tells the connector thread to run the keepalive, several can be pending for one event
+*/
+#define KEEPALIVE_FLAG_IDLE         BIT(0)          // the idle timer expired
+#define KEEPALIVE_FLAG_RESP         BIT(1)          // a PINGRESP came in
+#define KEEPALIVE_FLAG_TIMEOUT      BIT(2)          // the PINGRESP did not come in time
+#define KEEPALIVE_FLAG_WAKE         BIT(3)          // the radio woke up for something else
+
+/*
+*   Learned values of one network, as saved in flash
+*/
+struct keepalive_plmn
+{
+    char        plmn[KEEPALIVE_PLMN_LEN];   // MCC and MNC, empty if the entry is free
+    uint16_t    learned_s;                  // longest idle time a ping was answered after
+    uint16_t    ceiling_s;                  // shortest idle time a ping went unanswered after, 0 if none
+};
+
+struct keepalive_store
+{
+    uint16_t    version;
+    uint16_t    next;                       // entry taken by the next network not seen before
+    struct keepalive_plmn plmns[CONFIG_AWS_KEEPALIVE_PLMNS];
+};
+
+/*
+*   Keepalive control block
+*/
+struct keepalive_blk
+{
+    struct keepalive_store store;           // copy of the blob
+    bool        loaded;                     // the blob was read
+    struct keepalive_plmn *plmnp;           // entry of the network we are on, NULL if not known
+
+    bool        active;                     // connection is ready
+    uint16_t    learned_s;
+    uint16_t    ceiling_s;
+    uint16_t    target_s;                   // idle time the next ping goes out after
+    uint16_t    confirms;                   // pings answered at the learned value since the last change
+    int64_t     last_tx_ms;                 // uptime of the last message or ping sent
+    bool        ping_out;                   // waiting for the PINGRESP
+    bool        ping_probe;                 // the ping out went after target_s of idle time
+    int64_t     ping_ms;                    // uptime the ping went out
+
+    struct k_timer idle_timer;
+    struct k_timer resp_timer;
+    atomic_t    flags;                      // KEEPALIVE_FLAG_xxx
+    atomic_t    queued;                     // an AWS_EVENT_KEEPALIVE is queued
+
+    // statistics
+    uint32_t    probes;                     // pings after target_s of idle time
+    uint32_t    probe_fails;                // of those, not answered
+    uint32_t    wake_pings;                 // pings sent on a radio wake
+    uint32_t    wake_fails;
+    uint32_t    saves;                      // writes of the blob
+    uint32_t    max_rtt_ms;                 // longest ping round trip
+};
+
+static struct keepalive_blk keepalive_blk;
+
+/**
+* @brief    aws_keepalive_signal - Tell the connector thread the keepalive has something to do
+*
+* @param    flag - KEEPALIVE_FLAG_xxx
+*
+* @return   nothing
+*
+* @note     Can be called from an ISR. Only one event is queued at a time, it handles every flag set
+*/
+static void aws_keepalive_signal(atomic_val_t flag)
+{
+    struct keepalive_blk *blkp = &keepalive_blk;
+
+    atomic_or(&blkp->flags, flag);
+
+    if (atomic_set(&blkp->queued, 1))
+        return;
+
+    // if it did not fit the next signal tries again
+    if (aws_queue_event(AWS_EVENT_KEEPALIVE))
+        atomic_clear(&blkp->queued);
+}
+
+/**
+* @brief    aws_keepalive_idle_tmr_exp - Idle timer expiry, maybe time to ping
+*
+* @param    timerp - pointer to the timer
+*
+* @return   nothing
+*
+* @note     runs in ISR context
+*/
+static void aws_keepalive_idle_tmr_exp(struct k_timer *timerp)
+{
+    aws_keepalive_signal(KEEPALIVE_FLAG_IDLE);
+}
+
+/**
+* @brief    aws_keepalive_resp_tmr_exp - Response timer expiry, the ping was not answered
+*
+* @param    timerp - pointer to the timer
+*
+* @return   nothing
+*
+* @note     runs in ISR context
+*/
+static void aws_keepalive_resp_tmr_exp(struct k_timer *timerp)
+{
+    aws_keepalive_signal(KEEPALIVE_FLAG_TIMEOUT);
+}
+
+/**
+* @brief    aws_keepalive_plmn_find - Find the entry of a network, take one for it if it is not known
+*
+* @param    blkp - control block pointer
+* @param    plmnp - MCC and MNC
+*
+* @return   the entry
+*
+* @note     A new network takes the entries in turn, the oldest one seen is forgotten
+*/
+static struct keepalive_plmn *aws_keepalive_plmn_find(struct keepalive_blk *blkp, const char *plmnp)
+{
+    struct keepalive_store *storep = &blkp->store;
+    struct keepalive_plmn *entryp;
+    int i;
+
+    for (i = 0; i < CONFIG_AWS_KEEPALIVE_PLMNS; i++)
+    {
+        if (strcmp(storep->plmns[i].plmn, plmnp) == 0)
+            return &storep->plmns[i];
+    }
+
+    entryp = &storep->plmns[storep->next];
+    storep->next = (storep->next + 1) % CONFIG_AWS_KEEPALIVE_PLMNS;
+
+    strcpy(entryp->plmn, plmnp);
+    entryp->learned_s = CONFIG_AWS_KEEPALIVE_INITIAL_S;
+    entryp->ceiling_s = 0;
+
+    return entryp;
+}
+
+/**
+* @brief    aws_keepalive_plmn_get - Find the entry of the network we are on
+*
+* @param    blkp - control block pointer
+*
+* @return   the entry, NULL if the modem did not give us a PLMN
+*/
+static struct keepalive_plmn *aws_keepalive_plmn_get(struct keepalive_blk *blkp)
+{
+    char oper[KEEPALIVE_OPERATOR_LEN];
+    int len;
+    int i;
+
+    if (!blkp->loaded)
+    {
+        // nothing saved yet (or from another layout), every entry is free
+        if (config_blob_read(KEEPALIVE_BLOB_NAME, &blkp->store, sizeof(blkp->store)) != sizeof(blkp->store) ||
+            blkp->store.version != KEEPALIVE_BLOB_VERSION || blkp->store.next >= CONFIG_AWS_KEEPALIVE_PLMNS)
+        {
+            memset(&blkp->store, 0, sizeof(blkp->store));
+            blkp->store.version = KEEPALIVE_BLOB_VERSION;
+        }
+        blkp->loaded = true;
+    }
+
+    memset(oper, 0, sizeof(oper));
+    modem_get_operator(oper, sizeof(oper) - 1);
+
+    // the modem gives the MCC and MNC, 5 or 6 digits, while registered
+    len = strlen(oper);
+    if (len < 5 || len >= KEEPALIVE_PLMN_LEN)
+        return NULL;
+
+    for (i = 0; i < len; i++)
+    {
+        if (!isdigit((unsigned char)oper[i]))
+            return NULL;
+    }
+
+    return aws_keepalive_plmn_find(blkp, oper);
+}
+
+/**
+* @brief    aws_keepalive_save - Save what was learned about the network we are on
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*
+* @note     Only writes the flash if something changed
+*/
+static void aws_keepalive_save(struct keepalive_blk *blkp)
+{
+    if (blkp->plmnp == NULL)
+        return;
+
+    if (blkp->plmnp->learned_s == blkp->learned_s && blkp->plmnp->ceiling_s == blkp->ceiling_s)
+        return;
+
+    blkp->plmnp->learned_s = blkp->learned_s;
+    blkp->plmnp->ceiling_s = blkp->ceiling_s;
+
+    config_blob_write(KEEPALIVE_BLOB_NAME, &blkp->store, sizeof(blkp->store));
+    blkp->saves++;
+}
+
+/**
+* @brief    aws_keepalive_next_target - Idle time the next ping goes out after
+*
+* @param    blkp - control block pointer
+*
+* @return   idle time in seconds
+*
+* @note     Steps up while no ceiling is known, then halves the gap to the ceiling until it is smaller than a step
+*/
+static uint16_t aws_keepalive_next_target(const struct keepalive_blk *blkp)
+{
+    uint32_t next_s;
+
+    if (blkp->ceiling_s == 0)
+        next_s = blkp->learned_s + CONFIG_AWS_KEEPALIVE_STEP_S;
+    else if (blkp->ceiling_s > blkp->learned_s + CONFIG_AWS_KEEPALIVE_STEP_S)
+        next_s = (blkp->learned_s + blkp->ceiling_s) / 2;
+    else
+        next_s = blkp->learned_s;
+
+    return MIN(next_s, KEEPALIVE_MAX_S);
+}
+
+/**
+* @brief    aws_keepalive_idle_restart - Start the idle timer for what is left of the idle time
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*/
+static void aws_keepalive_idle_restart(struct keepalive_blk *blkp)
+{
+    int64_t left_ms;
+
+    left_ms = blkp->last_tx_ms + (int64_t)blkp->target_s * MSEC_PER_SEC - k_uptime_get();
+
+    k_timer_start(&blkp->idle_timer, K_MSEC(MAX(left_ms, 0)), K_NO_WAIT);
+}
+
+/**
+* @brief    aws_keepalive_ping - Send a ping and wait for the PINGRESP
+*
+* @param    blkp - control block pointer
+* @param    probe - the ping goes out after target_s of idle time
+*
+* @return   nothing
+*
+* @note     If the ping can't be sent the connection is going down, the disconnect event follows
+*/
+static void aws_keepalive_ping(struct keepalive_blk *blkp, bool probe)
+{
+    int err;
+
+    err = aws_iot_ping();
+    if (err)
+    {
+        LOG_ERR("aws_iot_ping, error: %d", err);
+        return;
+    }
+
+    blkp->ping_out = true;
+    blkp->ping_probe = probe;
+    blkp->ping_ms = k_uptime_get();
+    blkp->last_tx_ms = blkp->ping_ms;
+
+    k_timer_stop(&blkp->idle_timer);
+    k_timer_start(&blkp->resp_timer, K_SECONDS(CONFIG_AWS_KEEPALIVE_RESP_TIMEOUT_S), K_NO_WAIT);
+
+    LOG_DBG("Ping, %s", probe ? "probing" : "radio awake");
+}
+
+/**
+* @brief    aws_keepalive_resp - The ping was answered, learn from it
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*/
+static void aws_keepalive_resp(struct keepalive_blk *blkp)
+{
+    k_timer_stop(&blkp->resp_timer);
+    blkp->ping_out = false;
+
+    blkp->max_rtt_ms = MAX(blkp->max_rtt_ms, (uint32_t)(k_uptime_get() - blkp->ping_ms));
+
+    if (blkp->ping_probe)
+    {
+        if (blkp->target_s > blkp->learned_s)
+        {
+            blkp->learned_s = blkp->target_s;
+            blkp->confirms = 0;
+            LOG_INF("Keepalive, %u s idle is safe", blkp->learned_s);
+        }
+        else if (blkp->ceiling_s != 0 && ++blkp->confirms >= KEEPALIVE_CEILING_CONFIRMS)
+        {
+            // the failure may have been a bad moment of the radio, or the network changed since
+            blkp->ceiling_s = 0;
+            blkp->confirms = 0;
+        }
+
+        aws_keepalive_save(blkp);
+        blkp->target_s = aws_keepalive_next_target(blkp);
+    }
+
+    aws_keepalive_idle_restart(blkp);
+}
+
+/**
+* @brief    aws_keepalive_timeout - The ping was not answered, the connection is gone
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*
+* @note     A probe above the learned value sets the ceiling, at the learned value it lowers it
+*/
+static void aws_keepalive_timeout(struct keepalive_blk *blkp)
+{
+    int err;
+
+    blkp->ping_out = false;
+
+    if (blkp->ping_probe)
+    {
+        blkp->probe_fails++;
+
+        if (blkp->target_s > blkp->learned_s)
+        {
+            blkp->ceiling_s = blkp->target_s;
+        }
+        else
+        {
+            blkp->ceiling_s = blkp->learned_s;
+            blkp->learned_s = MAX(blkp->learned_s * 3 / 4, CONFIG_AWS_KEEPALIVE_MIN_S);
+        }
+
+        blkp->confirms = 0;
+        aws_keepalive_save(blkp);
+        blkp->target_s = blkp->learned_s;
+
+        LOG_WRN("Keepalive, no answer after %u s idle, back to %u s", blkp->ceiling_s, blkp->learned_s);
+    }
+    else
+    {
+        blkp->wake_fails++;
+        LOG_WRN("Keepalive, no answer to a ping");
+    }
+
+    // whatever the socket says, nothing gets through any more
+    err = aws_iot_disconnect();
+    if (err)
+        LOG_ERR("aws_iot_disconnect, error: %d", err);
+}
+
+/**
+* @brief    aws_keepalive_start - Start keeping the connection alive, once it is ready
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Picks up what was learned about the network we are on
+*/
+void aws_keepalive_start(void)
+{
+    struct keepalive_blk *blkp = &keepalive_blk;
+
+    blkp->plmnp = aws_keepalive_plmn_get(blkp);
+    if (blkp->plmnp != NULL)
+    {
+        blkp->learned_s = CLAMP(blkp->plmnp->learned_s, CONFIG_AWS_KEEPALIVE_MIN_S, KEEPALIVE_MAX_S);
+        blkp->ceiling_s = blkp->plmnp->ceiling_s;
+    }
+    else
+    {
+        blkp->learned_s = CONFIG_AWS_KEEPALIVE_INITIAL_S;
+        blkp->ceiling_s = 0;
+    }
+
+    // confirm what we know first, the connection is new
+    blkp->target_s = blkp->learned_s;
+    blkp->confirms = 0;
+    blkp->ping_out = false;
+    blkp->last_tx_ms = k_uptime_get();
+    atomic_clear(&blkp->flags);
+    atomic_clear(&blkp->queued);
+    blkp->active = true;
+
+    aws_keepalive_idle_restart(blkp);
+
+    LOG_INF("Keepalive on %s, %u s idle (ceiling %u s)", blkp->plmnp ? blkp->plmnp->plmn : "unknown network",
+        blkp->learned_s, blkp->ceiling_s);
+}
+
+/**
+* @brief    aws_keepalive_stop - Stop keeping the connection alive, it is gone
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_keepalive_stop(void)
+{
+    struct keepalive_blk *blkp = &keepalive_blk;
+
+    blkp->active = false;
+    blkp->ping_out = false;
+    k_timer_stop(&blkp->idle_timer);
+    k_timer_stop(&blkp->resp_timer);
+}
+
+/**
+* @brief    aws_keepalive_tx - Something was sent, the idle time starts again
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Call after every successful aws_iot_send(). The idle timer is not touched, when it expires the
+*           idle time is checked again
+*/
+void aws_keepalive_tx(void)
+{
+    keepalive_blk.last_tx_ms = k_uptime_get();
+}
+
+/**
+* @brief    aws_keepalive_run - Handle an AWS_EVENT_KEEPALIVE
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Only while ready, the event is ignored in the other states
+*/
+void aws_keepalive_run(void)
+{
+    struct keepalive_blk *blkp = &keepalive_blk;
+    atomic_val_t flags;
+    int64_t idle_ms;
+
+    atomic_clear(&blkp->queued);
+    flags = atomic_clear(&blkp->flags);
+
+    if (!blkp->active)
+        return;
+
+    // the client pings by itself too, only the answer to our ping counts
+    if ((flags & KEEPALIVE_FLAG_RESP) && blkp->ping_out)
+        aws_keepalive_resp(blkp);
+
+    if ((flags & KEEPALIVE_FLAG_TIMEOUT) && blkp->ping_out)
+    {
+        aws_keepalive_timeout(blkp);
+        return;
+    }
+
+    if (blkp->ping_out)
+        return;
+
+    idle_ms = k_uptime_get() - blkp->last_tx_ms;
+
+    if (idle_ms >= (int64_t)blkp->target_s * MSEC_PER_SEC)
+    {
+        blkp->probes++;
+        aws_keepalive_ping(blkp, true);
+    }
+    else if ((flags & KEEPALIVE_FLAG_WAKE) && CONFIG_AWS_KEEPALIVE_WAKE_PCT < 100 &&
+        idle_ms * 100 >= (int64_t)blkp->target_s * MSEC_PER_SEC * CONFIG_AWS_KEEPALIVE_WAKE_PCT)
+    {
+        blkp->wake_pings++;
+        aws_keepalive_ping(blkp, false);
+    }
+    else if (flags & KEEPALIVE_FLAG_IDLE)
+    {
+        // something was sent since the timer started
+        aws_keepalive_idle_restart(blkp);
+    }
+}
+
+/**
+* @brief    aws_keepalive_pingresp - A PINGRESP came in
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from the mqtt callback
+*/
+void aws_keepalive_pingresp(void)
+{
+    aws_keepalive_signal(KEEPALIVE_FLAG_RESP);
+}
+
+/**
+* @brief    aws_keepalive_radio_awake - The radio woke up, a ping would cost next to nothing now
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from the LTE handler
+*/
+void aws_keepalive_radio_awake(void)
+{
+    if (keepalive_blk.active)
+        aws_keepalive_signal(KEEPALIVE_FLAG_WAKE);
+}
+
+/**
+* @brief    aws_keepalive_learned_s - Idle time learned for the network we are on
+*
+* @param    none
+*
+* @return   seconds, 0 if not connected yet
+*/
+int aws_keepalive_learned_s(void)
+{
+    return keepalive_blk.active ? keepalive_blk.learned_s : 0;
+}
+
+/**
+* @brief    aws_keepalive_stats_print - Print what was learned and the statistics of the keepalive
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_keepalive_stats_print(void)
+{
+    struct keepalive_blk *blkp = &keepalive_blk;
+    const struct keepalive_plmn *entryp;
+    int i;
+
+    printk("Keepalive: %s, Idle: %u s, Ceiling: %u s, Next ping after: %u s\n", blkp->active ? "active" : "idle",
+        blkp->learned_s, blkp->ceiling_s, blkp->target_s);
+    printk("Probes: %u, Not answered: %u, Radio wake pings: %u, Not answered: %u, Saves: %u, Longest RTT: %u ms\n",
+        blkp->probes, blkp->probe_fails, blkp->wake_pings, blkp->wake_fails, blkp->saves, blkp->max_rtt_ms);
+
+    if (!blkp->loaded)
+        return;
+
+    for (i = 0; i < CONFIG_AWS_KEEPALIVE_PLMNS; i++)
+    {
+        entryp = &blkp->store.plmns[i];
+        if (entryp->plmn[0] != '\0')
+            printk("  PLMN %s: %u s idle, ceiling %u s\n", entryp->plmn, entryp->learned_s, entryp->ceiling_s);
+    }
+}
+
+/**
+* @brief    aws_keepalive_init - Init the keepalive timers
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from aws_connector_init(), before the connector thread starts
+*/
+void aws_keepalive_init(void)
+{
+    k_timer_init(&keepalive_blk.idle_timer, aws_keepalive_idle_tmr_exp, NULL);
+    k_timer_init(&keepalive_blk.resp_timer, aws_keepalive_resp_tmr_exp, NULL);
+}
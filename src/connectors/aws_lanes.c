@@ -0,0 +1,352 @@
+/**
+ * @brief: 	aws_lanes.c - Lanes of outbound messages of the AWS connector
+ *
+ * @notes: 	Everything the connector publishes goes through one of three lanes, served in strict order of
+ *          priority: a lane only gets a message out once every lane above it is empty, checked again before
+ *          every message.
+ *
+ *          urgent  alarms (threshold crossings, tamper), a small ring in RAM. Each alarm is also appended to
+ *                  the telemetry log, which numbers it. When the ring is full the overflow policy picked in
+ *                  Kconfig applies: coalesce, drop the oldest or leave it to the telemetry log.
+ *          normal  the telemetry log. It is its own overflow policy, records spill to flash and only the
+ *                  oldest unsent are lost once the log wraps.
+ *          bulk    a history replay. Only one at a time, a second request is refused.
+ *
+ *          Memory per lane is fixed at build time, a full lane never blocks the producer and never resets
+ *          the unit, it is counted here instead.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <date_time.h>
+#include <string.h>
+
+// includes for application
+#include "storage/tele_log.h"
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_lanes);     // register with logging package
+
+/*
+*   An alarm waiting in the urgent lane
+*/
+struct aws_urgent_entry
+{
+    struct tele_record  rec;
+    uint32_t            queued_ms;  // uptime it was queued, for the latency
+};
+
+/*
+*   Statistics of one lane
+*/
+struct aws_lane_stats
+{
+    uint32_t    enqueued;           // records put in the lane
+    uint32_t    sent;               // records handed to the mqtt client
+    uint32_t    msgs;               // messages published
+    uint32_t    dropped;            // records lost because the lane was full
+    uint32_t    coalesced;          // records merged into one already queued
+    uint32_t    spilled;            // records left to the telemetry log
+    uint32_t    max_depth;          // most records waiting at once
+    uint32_t    latency_max_ms;     // longest wait from queued to sent
+    uint64_t    latency_sum_ms;
+    uint32_t    latency_count;
+};
+
+/*
+*   Lanes control block
+*/
+struct aws_lanes_blk
+{
+    // ring of the urgent lane, a spinlock so alarms can be raised from any context
+    struct k_spinlock       lock;
+    struct aws_urgent_entry urgent[CONFIG_AWS_URGENT_LANE_DEPTH];
+    int                     urgent_first;
+    int                     urgent_count;
+
+    struct aws_lane_stats   stats[AWS_LANE_NUM];    // protected by the lock too
+};
+
+// allocate storage for the control block
+static struct aws_lanes_blk lanes_cblk;
+
+static const char *const lane_names[AWS_LANE_NUM] = {
+    [AWS_LANE_URGENT] = "urgent",
+    [AWS_LANE_NORMAL] = "normal",
+    [AWS_LANE_BULK] = "bulk",
+};
+
+/**
+* @brief    aws_lane_latency - Account for the wait of one record
+*
+* @param    statsp      statistics of the lane
+* @param    latency_ms  time from queued to sent
+*
+* @return   none
+*
+* @note     Call with the lock held
+*/
+static void aws_lane_latency(struct aws_lane_stats *statsp, uint32_t latency_ms)
+{
+    statsp->latency_sum_ms += latency_ms;
+    statsp->latency_count++;
+    statsp->latency_max_ms = MAX(statsp->latency_max_ms, latency_ms);
+}
+
+#if defined(CONFIG_AWS_URGENT_LANE_COALESCE)
+/**
+* @brief    aws_lane_coalesce - Merge an alarm into the newest one of the same type in the urgent lane
+*
+* @param    cblkp   control block pointer
+* @param    recp    alarm to merge
+*
+* @return   true if merged, false if no alarm of that type is queued
+*
+* @note     Call with the lock held. The queued alarm keeps its sequence number and time stamp, so it may
+*           already be in the message being published and the merge is then lost with it.
+*/
+static bool aws_lane_coalesce(struct aws_lanes_blk *cblkp, const struct tele_record *recp)
+{
+    struct tele_record *queuedp;
+    int i;
+
+    for (i = cblkp->urgent_count - 1; i >= 0; i--)
+    {
+        queuedp = &cblkp->urgent[(cblkp->urgent_first + i) % CONFIG_AWS_URGENT_LANE_DEPTH].rec;
+        if (queuedp->type != recp->type)
+            continue;
+
+        queuedp->value = recp->value;
+        queuedp->min = MIN(queuedp->min, recp->min);
+        queuedp->max = MAX(queuedp->max, recp->max);
+        queuedp->count = MIN((uint32_t)queuedp->count + recp->count, UINT16_MAX);
+        return true;
+    }
+
+    return false;
+}
+#endif
+
+/**
+* @brief    aws_lane_urgent_put - Queue an alarm in the urgent lane
+*
+* @param    recp    the alarm, the sequence number is filled in
+*
+* @return   0 if queued (or coalesced or spilled to make room), -ENOBUFS if something was dropped for it,
+*           -EAGAIN if the telemetry log is not initialized
+*
+* @note     Never blocks, can be called from any thread or an ISR. The caller asks for a publish.
+*           The alarm goes in the telemetry log first, for a sequence number that does not repeat after a
+*           reset, so the normal lane publishes it again later and the backend drops that copy by its
+*           sequence number. Done under the lock so the lane stays in sequence order.
+*/
+int aws_lane_urgent_put(struct tele_record *recp)
+{
+    struct aws_lanes_blk *cblkp = &lanes_cblk;
+    struct aws_lane_stats *statsp = &cblkp->stats[AWS_LANE_URGENT];
+    struct aws_urgent_entry *entp;
+    k_spinlock_key_t key;
+    int err = 0;
+
+    key = k_spin_lock(&cblkp->lock);
+
+    statsp->enqueued++;
+
+    if (cblkp->urgent_count == CONFIG_AWS_URGENT_LANE_DEPTH)
+    {
+#if defined(CONFIG_AWS_URGENT_LANE_COALESCE)
+        if (aws_lane_coalesce(cblkp, recp))
+        {
+            statsp->coalesced++;
+            tele_log_append_alarm(recp);
+            k_spin_unlock(&cblkp->lock, key);
+            return 0;
+        }
+        // nothing of that type queued, make room like drop-oldest
+#endif
+
+#if defined(CONFIG_AWS_URGENT_LANE_SPILL)
+        // it is in the telemetry log already, it goes out in order with the rest
+        statsp->spilled++;
+#else
+        statsp->dropped++;
+        err = -ENOBUFS;
+#endif
+        cblkp->urgent_first = (cblkp->urgent_first + 1) % CONFIG_AWS_URGENT_LANE_DEPTH;
+        cblkp->urgent_count--;
+    }
+
+    // never blocks either, it only fails when the log's own RAM buffer is full
+    if (tele_log_append_alarm(recp))
+    {
+        statsp->dropped++;
+        k_spin_unlock(&cblkp->lock, key);
+        LOG_WRN("Telemetry log full, alarm dropped");
+        return err ? err : -ENOBUFS;
+    }
+
+    entp = &cblkp->urgent[(cblkp->urgent_first + cblkp->urgent_count) % CONFIG_AWS_URGENT_LANE_DEPTH];
+    entp->rec = *recp;
+    entp->queued_ms = k_uptime_get_32();
+    cblkp->urgent_count++;
+    statsp->max_depth = MAX(statsp->max_depth, cblkp->urgent_count);
+
+    k_spin_unlock(&cblkp->lock, key);
+
+    if (err)
+        LOG_WRN("Urgent lane full, alarm dropped");
+
+    return err;
+}
+
+/**
+* @brief    aws_lane_urgent_peek - Copy the oldest alarms of the urgent lane without taking them out
+*
+* @param    recsp       where to copy the alarms
+* @param    max_recs    max number of alarms to copy
+*
+* @return   number of alarms copied, 0 if the lane is empty
+*
+* @note     Take them out with aws_lane_urgent_consume() once published
+*/
+int aws_lane_urgent_peek(struct tele_record *recsp, int max_recs)
+{
+    struct aws_lanes_blk *cblkp = &lanes_cblk;
+    k_spinlock_key_t key;
+    int num, i;
+
+    key = k_spin_lock(&cblkp->lock);
+
+    num = MIN(max_recs, cblkp->urgent_count);
+    for (i = 0; i < num; i++)
+        recsp[i] = cblkp->urgent[(cblkp->urgent_first + i) % CONFIG_AWS_URGENT_LANE_DEPTH].rec;
+
+    k_spin_unlock(&cblkp->lock, key);
+
+    return num;
+}
+
+/**
+* @brief    aws_lane_urgent_consume - Take the published alarms out of the urgent lane
+*
+* @param    last_seq    sequence number of the last alarm published
+*
+* @return   none
+*
+* @note     Goes by sequence number, alarms may have been dropped to make room since they were peeked
+*/
+void aws_lane_urgent_consume(uint32_t last_seq)
+{
+    struct aws_lanes_blk *cblkp = &lanes_cblk;
+    struct aws_lane_stats *statsp = &cblkp->stats[AWS_LANE_URGENT];
+    struct aws_urgent_entry *entp;
+    k_spinlock_key_t key;
+    uint32_t now_ms;
+
+    key = k_spin_lock(&cblkp->lock);
+
+    now_ms = k_uptime_get_32();
+    while (cblkp->urgent_count > 0)
+    {
+        entp = &cblkp->urgent[cblkp->urgent_first];
+        if ((int32_t)(entp->rec.seq - last_seq) > 0)
+            break;
+
+        aws_lane_latency(statsp, now_ms - entp->queued_ms);
+        cblkp->urgent_first = (cblkp->urgent_first + 1) % CONFIG_AWS_URGENT_LANE_DEPTH;
+        cblkp->urgent_count--;
+    }
+
+    k_spin_unlock(&cblkp->lock, key);
+}
+
+/**
+* @brief    aws_lane_sent - Account for a message published from a lane
+*
+* @param    lane        lane the records came from
+* @param    recsp       records in the message
+* @param    num_recs    number of records
+* @param    period_s    period a record covers, 0 for a single sample
+*
+* @return   none
+*
+* @note     The latency of the normal lane is measured from the end of the period of each record, which
+*           needs the time. The urgent lane measures its own in aws_lane_urgent_consume() and a replay is
+*           old by definition.
+*/
+void aws_lane_sent(enum aws_lane lane, const struct tele_record *recsp, int num_recs, uint32_t period_s)
+{
+    struct aws_lane_stats *statsp = &lanes_cblk.stats[lane];
+    k_spinlock_key_t key;
+    int64_t now_ms;
+    uint32_t end_ts;
+    bool now_known;
+    int i;
+
+    now_known = lane == AWS_LANE_NORMAL && date_time_now(&now_ms) == 0;
+
+    key = k_spin_lock(&lanes_cblk.lock);
+
+    statsp->msgs++;
+    statsp->sent += num_recs;
+
+    for (i = 0; now_known && i < num_recs; i++)
+    {
+        end_ts = recsp[i].timestamp + period_s;
+        if (recsp[i].timestamp != 0 && end_ts <= now_ms / MSEC_PER_SEC)
+            aws_lane_latency(statsp, (uint32_t)MIN(now_ms - (int64_t)end_ts * MSEC_PER_SEC, UINT32_MAX));
+    }
+
+    k_spin_unlock(&lanes_cblk.lock, key);
+}
+
+/**
+* @brief    aws_lanes_stats_print - Print the statistics of the outbound lanes
+*
+* @param    none
+*
+* @return   none
+*
+* @note     The depth and drops of the normal lane are those of the telemetry log, summed over the tiers
+*/
+void aws_lanes_stats_print(void)
+{
+    struct aws_lanes_blk *cblkp = &lanes_cblk;
+    struct aws_lane_stats stats[AWS_LANE_NUM];
+    uint32_t depth[AWS_LANE_NUM] = { 0 };
+    k_spinlock_key_t key;
+    int lane, tier;
+
+    key = k_spin_lock(&cblkp->lock);
+    memcpy(stats, cblkp->stats, sizeof(stats));
+    depth[AWS_LANE_URGENT] = cblkp->urgent_count;
+    k_spin_unlock(&cblkp->lock, key);
+
+    for (tier = 0; tier < TELE_TIER_NUM; tier++)
+    {
+        depth[AWS_LANE_NORMAL] += tele_log_queued(tier);
+        stats[AWS_LANE_NORMAL].dropped += tele_log_dropped(tier);
+    }
+
+    printk("\nOutbound lanes:\n");
+    printk("Urgent lane depth: %d, overflow policy: %s\n", CONFIG_AWS_URGENT_LANE_DEPTH,
+        IS_ENABLED(CONFIG_AWS_URGENT_LANE_COALESCE) ? "coalesce" :
+        IS_ENABLED(CONFIG_AWS_URGENT_LANE_SPILL) ? "spill to telemetry log" : "drop oldest");
+
+    for (lane = 0; lane < AWS_LANE_NUM; lane++)
+    {
+        printk("\n%s lane, queued: %u, max queued: %u\n", lane_names[lane], depth[lane], stats[lane].max_depth);
+        printk("Enqueued: %u, Sent: %u, Messages: %u\n", stats[lane].enqueued, stats[lane].sent, stats[lane].msgs);
+        printk("Dropped: %u, Coalesced: %u, Spilled: %u\n", stats[lane].dropped, stats[lane].coalesced,
+            stats[lane].spilled);
+        printk("Latency avg: %u ms, max: %u ms\n",
+            stats[lane].latency_count ? (uint32_t)(stats[lane].latency_sum_ms / stats[lane].latency_count) : 0,
+            stats[lane].latency_max_ms);
+    }
+}
@@ -0,0 +1,546 @@
+/**
+ * @brief: 	aws_outbox.c - Persistent outbox of the QoS1 telemetry messages waiting for their PUBACK
+ *
+ * @notes:  The records of a telemetry message are marked as sent in the telemetry log as soon as the message
+ *          is handed to the mqtt client. If the connection drops or the unit resets (erabort()) before the
+ *          PUBACK, the message is lost. The outbox keeps a reference to the records of every message until its
+ *          PUBACK comes in: the tier and the range of sequence numbers, the records themselves are still in the
+ *          log. Alarms are kept whole, the urgent lane forgets them once sent.
+ *
+ *          The outbox is in RAM that is not cleared at startup (__noinit), so it survives a reset but not a
+ *          power cycle. Every entry has a CRC of its own: a change only recomputes the CRC of the entry that
+ *          changed, which keeps it short under the lock the PUBACK callback takes too. At the next publish
+ *          cycle a message whose PUBACK did not come in on its connection (or within
+ *          CONFIG_AWS_OUTBOX_ACK_TIMEOUT_S) is published again, from the records read back from the log. The
+ *          records keep their sequence numbers, the backend drops what it already has. A message published
+ *          CONFIG_AWS_OUTBOX_MAX_TRIES times is given up.
+ *
+ *          While the outbox is full nothing new is published, the records wait in the log. A PUBACK that
+ *          makes room starts the publish cycle again.
+ *
+ *          Only runs in the aws connector thread, except aws_outbox_puback() (mqtt callback).
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <string.h>
+#include <sys/crc.h>
+
+// includes for application
+#include "storage/tele_log.h"
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_outbox);        // register the logging package
+
+#define OUTBOX_MAGIC                0x3158424f      // "OBX1" when viewed as bytes in RAM
+#define OUTBOX_MSG_ID_BASE          0x4000          // message ids of the outbox, below those of the reported state
+#define OUTBOX_FREE                 0               // message id of a free entry
+
+/*
+*   A message waiting for its PUBACK
+*/
+struct outbox_entry
+{
+    uint16_t    msg_id;                 // message id it was last published with, OUTBOX_FREE if the entry is free
+    uint8_t     lane;                   // enum aws_lane
+    uint8_t     tier;                   // enum tele_log_tier of the records
+    uint8_t     tries;                  // times it was published
+    uint8_t     num_recs;               // records of an alarm message, kept in recs[]
+    uint8_t     format;                 // enum pub_format it was first published in
+    uint32_t    conn;                   // connection it was last published on, 0 before the last reset
+    uint32_t    sent_ms;                // uptime it was last published
+    uint32_t    first_seq;              // range of the records in the log
+    uint32_t    last_seq;
+    struct tele_record recs[CONFIG_AWS_OUTBOX_ALARM_RECS];
+    uint32_t    crc;                    // crc32 of everything above
+};
+
+/*
+*   What is kept across a reset
+*/
+struct outbox_retained
+{
+    uint32_t    magic;
+    uint16_t    next_id;
+    uint32_t    crc;                    // crc32 of the two above, each entry has its own
+    struct outbox_entry entries[CONFIG_AWS_OUTBOX_ENTRIES];
+};
+
+static __noinit struct outbox_retained outbox_ram;
+
+/*
+*   Outbox control block
+*/
+struct outbox_blk
+{
+    struct k_spinlock lock;             // the PUBACK comes in from the mqtt callback
+    uint32_t    conn;                   // current connection, counted from 1
+    atomic_t    full;                   // a message could not be published, the outbox was full
+
+    // statistics
+    uint32_t    restored;               // messages found in the outbox at startup
+    uint32_t    added;                  // messages published the first time
+    uint32_t    acked;                  // PUBACKs of outbox messages
+    uint32_t    resent;                 // messages published again
+    uint32_t    given_up;               // messages given up after CONFIG_AWS_OUTBOX_MAX_TRIES
+    uint32_t    gone;                   // messages whose records were erased from the log before they were resent
+    uint32_t    full_waits;             // messages held back, the outbox was full
+};
+
+static struct outbox_blk outbox_blk;
+
+/**
+* @brief    aws_outbox_crc - Calculate the CRC of the header of the retained outbox
+*
+* @param    none
+*
+* @return   crc32 value
+*/
+static uint32_t aws_outbox_crc(void)
+{
+    return crc32_ieee((const uint8_t *)&outbox_ram, offsetof(struct outbox_retained, crc));
+}
+
+/**
+* @brief    aws_outbox_entry_crc - Calculate the CRC of an entry of the retained outbox
+*
+* @param    entp - the entry
+*
+* @return   crc32 value
+*/
+static uint32_t aws_outbox_entry_crc(const struct outbox_entry *entp)
+{
+    return crc32_ieee((const uint8_t *)entp, offsetof(struct outbox_entry, crc));
+}
+
+/**
+* @brief    aws_outbox_free - Release an entry
+*
+* @param    entp - the entry
+*
+* @return   nothing
+*
+* @note     Call with the lock held
+*/
+static void aws_outbox_free(struct outbox_entry *entp)
+{
+    entp->msg_id = OUTBOX_FREE;
+    entp->crc = aws_outbox_entry_crc(entp);
+}
+
+/**
+* @brief    aws_outbox_find - Find the entry of a message
+*
+* @param    msg_id - message id it was published with
+*
+* @return   the entry, NULL if the message is not in the outbox
+*
+* @note     Call with the lock held
+*/
+static struct outbox_entry *aws_outbox_find(uint16_t msg_id)
+{
+    int i;
+
+    for (i = 0; i < CONFIG_AWS_OUTBOX_ENTRIES; i++)
+    {
+        if (outbox_ram.entries[i].msg_id == msg_id)
+            return &outbox_ram.entries[i];
+    }
+
+    return NULL;
+}
+
+/**
+* @brief    aws_outbox_new_id - Message id for the next publish of an entry
+*
+* @param    none
+*
+* @return   message id, never OUTBOX_FREE
+*
+* @note     Call with the lock held
+*/
+static uint16_t aws_outbox_new_id(void)
+{
+    uint16_t msg_id = OUTBOX_MSG_ID_BASE | (outbox_ram.next_id++ & (OUTBOX_MSG_ID_BASE - 1));
+
+    outbox_ram.crc = aws_outbox_crc();
+    return msg_id;
+}
+
+/**
+* @brief    aws_outbox_add - Put a message in the outbox before it is published the first time
+*
+* @param    lane - lane the records come from
+* @param    tier - tier of the log the records come from
+* @param    recsp - records of the message
+* @param    num_recs - number of records
+* @param    format - enum pub_format they are encoded in
+*
+* @return   message id to publish it with, -ENOBUFS if the outbox is full
+*
+* @note     Before publishing, the PUBACK can come in before aws_send() returns
+*/
+int aws_outbox_add(enum aws_lane lane, enum tele_log_tier tier, const struct tele_record *recsp, int num_recs,
+        int format)
+{
+    struct outbox_blk *blkp = &outbox_blk;
+    struct outbox_entry *entp;
+    k_spinlock_key_t key;
+    int msg_id;
+
+    key = k_spin_lock(&blkp->lock);
+
+    entp = aws_outbox_find(OUTBOX_FREE);
+    if (entp == NULL)
+    {
+        atomic_set(&blkp->full, 1);
+        blkp->full_waits++;
+        k_spin_unlock(&blkp->lock, key);
+        return -ENOBUFS;
+    }
+
+    memset(entp, 0, sizeof(*entp));
+    entp->lane = lane;
+    entp->tier = tier;
+    entp->format = format;
+    entp->tries = 1;
+    entp->conn = blkp->conn;
+    entp->sent_ms = k_uptime_get_32();
+    entp->first_seq = recsp[0].seq;
+    entp->last_seq = recsp[num_recs - 1].seq;
+
+    // the urgent lane does not keep the alarms it sent
+    if (lane == AWS_LANE_URGENT)
+    {
+        entp->num_recs = MIN(num_recs, CONFIG_AWS_OUTBOX_ALARM_RECS);
+        memcpy(entp->recs, recsp, entp->num_recs * sizeof(struct tele_record));
+    }
+
+    entp->msg_id = aws_outbox_new_id();
+    entp->crc = aws_outbox_entry_crc(entp);
+    msg_id = entp->msg_id;
+    blkp->added++;
+
+    k_spin_unlock(&blkp->lock, key);
+
+    return msg_id;
+}
+
+/**
+* @brief    aws_outbox_cancel - Take a message out of the outbox, it could not be published the first time
+*
+* @param    msg_id - message id aws_outbox_add() returned
+*
+* @return   nothing
+*
+* @note     The records were not marked as sent, they are published again from the log
+*/
+void aws_outbox_cancel(uint16_t msg_id)
+{
+    struct outbox_blk *blkp = &outbox_blk;
+    struct outbox_entry *entp;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&blkp->lock);
+
+    entp = aws_outbox_find(msg_id);
+    if (entp != NULL)
+    {
+        aws_outbox_free(entp);
+        blkp->added--;
+    }
+
+    k_spin_unlock(&blkp->lock, key);
+}
+
+/**
+* @brief    aws_outbox_puback - A PUBACK came in, release the message
+*
+* @param    msg_id - message id of the PUBACK
+*
+* @return   nothing
+*
+* @note     Called from the mqtt callback. A PUBACK of a message published again since (or of something
+*           else, the reported state) finds nothing.
+*/
+void aws_outbox_puback(uint16_t msg_id)
+{
+    struct outbox_blk *blkp = &outbox_blk;
+    struct outbox_entry *entp;
+    k_spinlock_key_t key;
+
+    if (msg_id == OUTBOX_FREE)
+        return;
+
+    key = k_spin_lock(&blkp->lock);
+
+    entp = aws_outbox_find(msg_id);
+    if (entp == NULL)
+    {
+        k_spin_unlock(&blkp->lock, key);
+        return;
+    }
+
+    aws_outbox_free(entp);
+    blkp->acked++;
+
+    k_spin_unlock(&blkp->lock, key);
+
+    // the publish cycle stopped for the room
+    if (atomic_clear(&blkp->full))
+        aws_drain_request();
+}
+
+/**
+* @brief    aws_outbox_due - Find the oldest message due to be published again
+*
+* @param    blkp - control block pointer
+*
+* @return   the entry, NULL if none is due
+*
+* @note     Call with the lock held. Due if it was published on an earlier connection (or before the last
+*           reset), or on this one and the PUBACK is late.
+*/
+static struct outbox_entry *aws_outbox_due(struct outbox_blk *blkp)
+{
+    struct outbox_entry *entp;
+    struct outbox_entry *oldestp = NULL;
+    uint32_t now_ms = k_uptime_get_32();
+    int i;
+
+    for (i = 0; i < CONFIG_AWS_OUTBOX_ENTRIES; i++)
+    {
+        entp = &outbox_ram.entries[i];
+        if (entp->msg_id == OUTBOX_FREE)
+            continue;
+
+        if (entp->conn == blkp->conn && now_ms - entp->sent_ms < CONFIG_AWS_OUTBOX_ACK_TIMEOUT_S * MSEC_PER_SEC)
+            continue;
+
+        // oldest first, sent_ms is 0 for everything restored after a reset
+        if (oldestp == NULL || (int32_t)(entp->sent_ms - oldestp->sent_ms) < 0)
+            oldestp = entp;
+    }
+
+    return oldestp;
+}
+
+/**
+* @brief    aws_outbox_read - Read the records of a message back from the log
+*
+* @param    entp - entry of the message
+* @param    recsp - array to read the records into
+* @param    max_recs - size of the array
+*
+* @return   number of records read, 0 if they are no longer in the log
+*/
+static int aws_outbox_read(const struct outbox_entry *entp, struct tele_record *recsp, int max_recs)
+{
+    struct tele_log_cursor cur;
+    int num_recs, num_sel = 0;
+    int i;
+
+    if (tele_log_seek_seq(entp->tier, entp->first_seq, &cur))
+        return 0;
+
+    num_recs = tele_log_read(&cur, recsp, max_recs);
+
+    // the cursor moves on to the oldest record if the range was erased, keep only the range
+    for (i = 0; i < num_recs; i++)
+    {
+        if ((int32_t)(recsp[i].seq - entp->first_seq) >= 0 && (int32_t)(recsp[i].seq - entp->last_seq) <= 0)
+            recsp[num_sel++] = recsp[i];
+    }
+
+    return num_sel;
+}
+
+/**
+* @brief    aws_outbox_resend - Take the oldest message due to be published again
+*
+* @param    recsp - array to read its records into
+* @param    max_recs - size of the array
+* @param    lanep - returns the lane of the records
+* @param    tierp - returns the tier of the records
+* @param    formatp - returns the enum pub_format to encode them in, the one they were first published in
+* @param    msg_idp - returns the message id to publish it with
+*
+* @return   number of records, 0 if nothing is due
+*
+* @note     The message stays in the outbox under the new message id. Messages published too many times, or
+*           whose records are gone from the log, are given up on the way.
+*/
+int aws_outbox_resend(struct tele_record *recsp, int max_recs, enum aws_lane *lanep, enum tele_log_tier *tierp,
+        int *formatp, uint16_t *msg_idp)
+{
+    struct outbox_blk *blkp = &outbox_blk;
+    struct outbox_entry *entp;
+    struct outbox_entry ent;
+    k_spinlock_key_t key;
+    int num_recs;
+
+    while (1)
+    {
+        key = k_spin_lock(&blkp->lock);
+
+        entp = aws_outbox_due(blkp);
+        if (entp == NULL)
+        {
+            k_spin_unlock(&blkp->lock, key);
+            return 0;
+        }
+
+        if (entp->tries >= CONFIG_AWS_OUTBOX_MAX_TRIES)
+        {
+            LOG_WRN("Message of seq %u to %u given up after %u tries", entp->first_seq, entp->last_seq, entp->tries);
+            aws_outbox_free(entp);
+            blkp->given_up++;
+            k_spin_unlock(&blkp->lock, key);
+            continue;
+        }
+
+        ent = *entp;
+        k_spin_unlock(&blkp->lock, key);
+
+        // the log is read without the lock, the PUBACK may still come in meanwhile
+        if (ent.lane == AWS_LANE_URGENT)
+        {
+            num_recs = MIN(ent.num_recs, max_recs);
+            memcpy(recsp, ent.recs, num_recs * sizeof(struct tele_record));
+        }
+        else
+        {
+            num_recs = aws_outbox_read(&ent, recsp, max_recs);
+        }
+
+        key = k_spin_lock(&blkp->lock);
+
+        entp = aws_outbox_find(ent.msg_id);
+        if (entp == NULL)
+        {
+            // acknowledged after all
+            k_spin_unlock(&blkp->lock, key);
+            continue;
+        }
+
+        if (num_recs == 0)
+        {
+            aws_outbox_free(entp);
+            blkp->gone++;
+            k_spin_unlock(&blkp->lock, key);
+            continue;
+        }
+
+        entp->tries++;
+        entp->conn = blkp->conn;
+        entp->sent_ms = k_uptime_get_32();
+        entp->msg_id = aws_outbox_new_id();
+        entp->crc = aws_outbox_entry_crc(entp);
+        blkp->resent++;
+
+        *lanep = entp->lane;
+        *tierp = entp->tier;
+        *formatp = entp->format;
+        *msg_idp = entp->msg_id;
+
+        k_spin_unlock(&blkp->lock, key);
+
+        return num_recs;
+    }
+}
+
+/**
+* @brief    aws_outbox_ready - A new connection is ready
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     What was published on the connection before and not acknowledged is now due
+*/
+void aws_outbox_ready(void)
+{
+    outbox_blk.conn++;
+}
+
+/**
+* @brief    aws_outbox_stats_print - Print the statistics of the outbox
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_outbox_stats_print(void)
+{
+    struct outbox_blk *blkp = &outbox_blk;
+    int num = 0;
+    int i;
+
+    for (i = 0; i < CONFIG_AWS_OUTBOX_ENTRIES; i++)
+    {
+        if (outbox_ram.entries[i].msg_id != OUTBOX_FREE)
+            num++;
+    }
+
+    printk("Outbox: %d of %d waiting for PUBACK, Restored at startup: %u, Published: %u, Acknowledged: %u\n",
+        num, CONFIG_AWS_OUTBOX_ENTRIES, blkp->restored, blkp->added, blkp->acked);
+    printk("Published again: %u, Given up: %u, Gone from the log: %u, Held back (full): %u\n",
+        blkp->resent, blkp->given_up, blkp->gone, blkp->full_waits);
+}
+
+/**
+* @brief    aws_outbox_init - Pick up the outbox left by the last reset, or start an empty one
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from aws_connector_init(), before the connector thread starts
+*/
+void aws_outbox_init(void)
+{
+    struct outbox_blk *blkp = &outbox_blk;
+    struct outbox_entry *entp;
+    int i;
+
+    if (outbox_ram.magic != OUTBOX_MAGIC || outbox_ram.crc != aws_outbox_crc())
+    {
+        // power on (or the RAM was lost), nothing to pick up
+        memset(&outbox_ram, 0, sizeof(outbox_ram));
+        outbox_ram.magic = OUTBOX_MAGIC;
+        outbox_ram.crc = aws_outbox_crc();
+        for (i = 0; i < CONFIG_AWS_OUTBOX_ENTRIES; i++)
+            aws_outbox_free(&outbox_ram.entries[i]);
+        return;
+    }
+
+    // uptime restarted, everything left is due on the first connection
+    for (i = 0; i < CONFIG_AWS_OUTBOX_ENTRIES; i++)
+    {
+        entp = &outbox_ram.entries[i];
+        if (entp->crc != aws_outbox_entry_crc(entp))
+        {
+            // cut short by the reset
+            memset(entp, 0, sizeof(*entp));
+            aws_outbox_free(entp);
+            continue;
+        }
+
+        if (entp->msg_id == OUTBOX_FREE)
+            continue;
+
+        entp->conn = 0;
+        entp->sent_ms = 0;
+        entp->crc = aws_outbox_entry_crc(entp);
+        blkp->restored++;
+    }
+
+    if (blkp->restored > 0)
+        LOG_INF("%u messages waiting for their PUBACK since before the reset", blkp->restored);
+}
@@ -0,0 +1,378 @@
+/**
+ * @brief: 	aws_reconnect.c - Reconnect scheduler of the AWS connector
+ *
+ * @notes:  Decides when the next connection attempt goes out, the connector state machine decides that one is
+ *          needed (at startup, after a failed attempt or after a ready connection dropped).
+ *
+ *          When a whole cell loses its connection every device finds out at about the same moment, if they all
+ *          reconnect at once the broker and the cell see a storm of TLS handshakes, again and again. So:
+ *
+ *          - the wait doubles after each failed attempt, from CONFIG_AWS_RECONNECT_BASE_S up to
+ *            CONFIG_AWS_RECONNECT_MAX_S, and resets once the connection is ready
+ *          - half of the wait is random, each device draws its own, so the devices spread out (the first
+ *            attempt after a drop too)
+ *          - no attempt while the PDP context is down, it could only fail. The PDP context is checked again
+ *            every CONFIG_AWS_RECONNECT_PDP_POLL_S, that does not count as a failure. When the LTE manager
+ *            reports it back up the wait is cut short to a jitter of CONFIG_AWS_RECONNECT_PDP_UP_JITTER_MS
+ *          - at most CONFIG_AWS_RECONNECT_MAX_PER_HOUR attempts (TLS handshakes) in any hour, whatever the
+ *            backoff says
+ *
+ *          An attempt that is not ready after CONFIG_AWS_RECONNECT_TIMEOUT_S is given up.
+ *
+ *          Runs in the aws connector thread, the timer only queues AWS_EVENT_RECONNECT.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <random/rand32.h>
+
+// includes for application
+#include "cell/lte_connect_mgr.h"
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_reconnect);     // register the logging package
+
+#define RECONNECT_BUDGET_WINDOW_S   3600        // window of the handshake budget
+#define RECONNECT_MAX_SHIFT         16          // doubling the base wait more than this is past the max anyway
+
+BUILD_ASSERT(CONFIG_AWS_RECONNECT_BASE_S <= CONFIG_AWS_RECONNECT_MAX_S, "base wait longer than the max");
+
+/*
+*   Reconnect control block
+*/
+struct reconnect_blk
+{
+    struct aws_iot_config *configp;     // client config handed to aws_iot_connect()
+    struct k_timer timer;               // wait before the next attempt, or time given to the attempt running
+    atomic_t    queued;                 // an AWS_EVENT_RECONNECT is queued
+    uint32_t    fails;                  // failed attempts in a row
+    int64_t     down_ms;                // uptime the connection went down (or startup)
+
+    // uptime (s) of the last attempts, oldest first from hs_next, for the handshake budget
+    uint32_t    hs_time_s[CONFIG_AWS_RECONNECT_MAX_PER_HOUR];
+    uint32_t    hs_num;
+    uint32_t    hs_next;
+
+    // statistics
+    uint32_t    attempts;               // aws_iot_connect() calls
+    uint32_t    successes;              // attempts that got to ready
+    uint32_t    failures;               // attempts that did not
+    uint32_t    timeouts;               // of those, given up after CONFIG_AWS_RECONNECT_TIMEOUT_S
+    uint32_t    drops;                  // ready connections lost
+    uint32_t    pdp_waits;              // attempts put off, PDP context down
+    uint32_t    pdp_ups;                // waits cut short, PDP context back up
+    uint32_t    budget_waits;           // attempts put off, handshake budget used up
+    uint32_t    last_ttr_ms;            // time to reconnect, from down to ready
+    uint32_t    max_ttr_ms;
+    uint64_t    sum_ttr_ms;
+};
+
+static struct reconnect_blk reconnect_blk;
+
+/**
+* @brief    aws_reconnect_tmr_exp - Reconnect timer expiry, time to attempt or the attempt ran out of time
+*
+* @param    timerp - pointer to the timer
+*
+* @return   nothing
+*
+* @note     runs in ISR context
+*/
+static void aws_reconnect_tmr_exp(struct k_timer *timerp)
+{
+    if (atomic_set(&reconnect_blk.queued, 1))
+        return;
+
+    // if it did not fit, try again shortly rather than never
+    if (aws_queue_event(AWS_EVENT_RECONNECT))
+    {
+        atomic_clear(&reconnect_blk.queued);
+        k_timer_start(timerp, K_SECONDS(1), K_NO_WAIT);
+    }
+}
+
+/**
+* @brief    aws_reconnect_wait_ms - Wait before the next attempt, backoff and jitter
+*
+* @param    blkp - control block pointer
+*
+* @return   wait in milliseconds
+*
+* @note     Half of the backoff is fixed, the other half random
+*/
+static uint32_t aws_reconnect_wait_ms(const struct reconnect_blk *blkp)
+{
+    uint32_t backoff_ms;
+
+    backoff_ms = MIN((uint32_t)CONFIG_AWS_RECONNECT_BASE_S << MIN(blkp->fails, RECONNECT_MAX_SHIFT),
+                    CONFIG_AWS_RECONNECT_MAX_S) * MSEC_PER_SEC;
+
+    return backoff_ms / 2 + sys_rand32_get() % (backoff_ms / 2 + 1);
+}
+
+/**
+* @brief    aws_reconnect_budget_wait_s - Time until the handshake budget allows another attempt
+*
+* @param    blkp - control block pointer
+*
+* @return   seconds, 0 if an attempt can go now
+*/
+static uint32_t aws_reconnect_budget_wait_s(const struct reconnect_blk *blkp)
+{
+    uint32_t now_s = k_uptime_get() / MSEC_PER_SEC;
+    uint32_t age_s;
+
+    if (blkp->hs_num < CONFIG_AWS_RECONNECT_MAX_PER_HOUR)
+        return 0;
+
+    // the oldest attempt has to leave the window first
+    age_s = now_s - blkp->hs_time_s[blkp->hs_next];
+    if (age_s >= RECONNECT_BUDGET_WINDOW_S)
+        return 0;
+
+    return RECONNECT_BUDGET_WINDOW_S - age_s;
+}
+
+/**
+* @brief    aws_reconnect_schedule - Start the wait before the next attempt
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*/
+static void aws_reconnect_schedule(struct reconnect_blk *blkp)
+{
+    uint32_t wait_ms = aws_reconnect_wait_ms(blkp);
+
+    atomic_clear(&blkp->queued);
+    k_timer_start(&blkp->timer, K_MSEC(wait_ms), K_NO_WAIT);
+
+    LOG_INF("Reconnect in %u ms (%u failed attempts)", wait_ms, blkp->fails);
+}
+
+/**
+* @brief    aws_reconnect_start - Connect for the first time, at startup
+*
+* @param    configp - client config handed to aws_iot_connect()
+*
+* @return   nothing
+*
+* @note     Goes through the jitter too, a power cut brings a whole area back up at the same time
+*/
+void aws_reconnect_start(struct aws_iot_config *configp)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+
+    blkp->configp = configp;
+    blkp->fails = 0;
+    blkp->down_ms = k_uptime_get();
+
+    aws_reconnect_schedule(blkp);
+}
+
+/**
+* @brief    aws_reconnect_attempt - Handle an AWS_EVENT_RECONNECT while offline, try to connect
+*
+* @param    none
+*
+* @return   true if an attempt started, false if it was put off
+*/
+bool aws_reconnect_attempt(void)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+    uint32_t wait_s;
+    int err;
+
+    atomic_clear(&blkp->queued);
+
+    if (!lte_check_pdp_context())
+    {
+        blkp->pdp_waits++;
+        k_timer_start(&blkp->timer, K_SECONDS(CONFIG_AWS_RECONNECT_PDP_POLL_S), K_NO_WAIT);
+        return false;
+    }
+
+    wait_s = aws_reconnect_budget_wait_s(blkp);
+    if (wait_s > 0)
+    {
+        blkp->budget_waits++;
+        LOG_WRN("Handshake budget used up, reconnect in %u s", wait_s);
+        k_timer_start(&blkp->timer, K_SECONDS(wait_s), K_NO_WAIT);
+        return false;
+    }
+
+    // every attempt counts against the budget, even one that fails right away
+    blkp->hs_time_s[blkp->hs_next] = k_uptime_get() / MSEC_PER_SEC;
+    blkp->hs_next = (blkp->hs_next + 1) % CONFIG_AWS_RECONNECT_MAX_PER_HOUR;
+    blkp->hs_num = MIN(blkp->hs_num + 1, CONFIG_AWS_RECONNECT_MAX_PER_HOUR);
+    blkp->attempts++;
+
+    err = aws_iot_connect(blkp->configp);
+    if (err)
+    {
+        LOG_ERR("aws_iot_connect error: %d", err);
+        aws_reconnect_failed(false);
+        return false;
+    }
+
+    // time given to the attempt, the timer expiring in a connecting state is a timeout
+    k_timer_start(&blkp->timer, K_SECONDS(CONFIG_AWS_RECONNECT_TIMEOUT_S), K_NO_WAIT);
+
+    return true;
+}
+
+/**
+* @brief    aws_reconnect_pdp_up - The PDP context came back up, attempt now rather than at the end of the wait
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Only while offline with an attempt coming. The backoff starts over, the failures were the bearer's.
+*           The devices of a cell come back together, they still spread out over the jitter, and the
+*           handshake budget still applies.
+*/
+void aws_reconnect_pdp_up(void)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+    uint32_t wait_ms;
+
+    // none coming (connect on demand between sessions), or the attempt is already queued
+    if (k_timer_remaining_get(&blkp->timer) == 0 || atomic_get(&blkp->queued))
+        return;
+
+    wait_ms = sys_rand32_get() % (CONFIG_AWS_RECONNECT_PDP_UP_JITTER_MS + 1);
+    if (wait_ms >= k_timer_remaining_get(&blkp->timer))
+        return;
+
+    blkp->fails = 0;
+    blkp->pdp_ups++;
+    k_timer_start(&blkp->timer, K_MSEC(wait_ms), K_NO_WAIT);
+
+    LOG_INF("PDP context up, reconnect in %u ms", wait_ms);
+}
+
+/**
+* @brief    aws_reconnect_scheduled - An attempt is already coming, or running
+*
+* @param    none
+*
+* @return   true if the reconnect timer is running or its event is queued
+*
+* @note     Connect on demand, a session wanted during the backoff waits for it
+*/
+bool aws_reconnect_scheduled(void)
+{
+    return k_timer_remaining_get(&reconnect_blk.timer) > 0 || atomic_get(&reconnect_blk.queued);
+}
+
+/**
+* @brief    aws_reconnect_failed - The attempt running did not get to ready, schedule the next one
+*
+* @param    timeout - given up after CONFIG_AWS_RECONNECT_TIMEOUT_S
+*
+* @return   nothing
+*/
+void aws_reconnect_failed(bool timeout)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+
+    blkp->failures++;
+    if (timeout)
+        blkp->timeouts++;
+
+    blkp->fails++;
+    aws_reconnect_schedule(blkp);
+}
+
+/**
+* @brief    aws_reconnect_ready - The connection is ready, the backoff starts over
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_reconnect_ready(void)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+    uint32_t ttr_ms;
+
+    k_timer_stop(&blkp->timer);
+    atomic_clear(&blkp->queued);
+
+    ttr_ms = (uint32_t)(k_uptime_get() - blkp->down_ms);
+    blkp->last_ttr_ms = ttr_ms;
+    blkp->max_ttr_ms = MAX(blkp->max_ttr_ms, ttr_ms);
+    blkp->sum_ttr_ms += ttr_ms;
+    blkp->successes++;
+    blkp->fails = 0;
+
+    LOG_INF("Ready %u ms after the connection went down", ttr_ms);
+}
+
+/**
+* @brief    aws_reconnect_dropped - A ready connection dropped, schedule the first attempt
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_reconnect_dropped(void)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+
+    blkp->drops++;
+    blkp->down_ms = k_uptime_get();
+    blkp->fails = 0;
+
+    aws_reconnect_schedule(blkp);
+}
+
+/**
+* @brief    aws_reconnect_stats_print - Print the statistics of the reconnect scheduler
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_reconnect_stats_print(void)
+{
+    struct reconnect_blk *blkp = &reconnect_blk;
+    uint32_t now_s = k_uptime_get() / MSEC_PER_SEC;
+    uint32_t recent = 0;
+    int i;
+
+    for (i = 0; i < blkp->hs_num; i++)
+    {
+        if (now_s - blkp->hs_time_s[i] < RECONNECT_BUDGET_WINDOW_S)
+            recent++;
+    }
+
+    printk("Connect attempts: %u, Ready: %u, Failed: %u (timed out: %u), Dropped: %u, Failed in a row: %u\n",
+        blkp->attempts, blkp->successes, blkp->failures, blkp->timeouts, blkp->drops, blkp->fails);
+    printk("Put off - PDP down: %u, handshake budget: %u, Handshakes in the last hour: %u of %u\n",
+        blkp->pdp_waits, blkp->budget_waits, recent, CONFIG_AWS_RECONNECT_MAX_PER_HOUR);
+    printk("Reconnects brought forward by the PDP context coming up: %u\n", blkp->pdp_ups);
+    printk("Time to reconnect - last: %u ms, longest: %u ms, average: %u ms\n", blkp->last_ttr_ms,
+        blkp->max_ttr_ms, blkp->successes ? (uint32_t)(blkp->sum_ttr_ms / blkp->successes) : 0);
+}
+
+/**
+* @brief    aws_reconnect_init - Init the reconnect timer
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from aws_connector_init(), before the connector thread starts
+*/
+void aws_reconnect_init(void)
+{
+    k_timer_init(&reconnect_blk.timer, aws_reconnect_tmr_exp, NULL);
+}
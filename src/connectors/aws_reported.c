@@ -0,0 +1,402 @@
+/**
+ * @brief: 	aws_reported.c - Reported state of the AWS device shadow, only the fields that changed
+ *
+ * @notes:  Keeps the last value of every field the cloud has acknowledged (PUBACK of the shadow update) and at
+ *          the start of each publish cycle sends one update with only the fields that moved by at least their
+ *          threshold. The update rides on the radio being up for the telemetry, it never wakes it by itself.
+ *
+ *          The fields are the attributes of the config datastore that have a shadow key (any change is
+ *          reported), the firmware version and the device values of device_fields[] below. Nothing is known
+ *          to be acknowledged after a reboot, so the first update carries everything. An update that is not
+ *          acknowledged by the next cycle is not tracked any more, its fields are still different from the
+ *          acknowledged values so they simply go in the next update.
+ *
+ *          Only runs in the aws connector thread, except aws_reported_puback() (mqtt callback).
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <stdlib.h>
+#include <string.h>
+
+// includes for application
+#include "bsp/modem.h"
+#include "cell/lte_connect_mgr.h"
+#include "config/config.h"
+#include "encoding/aws_encoding.h"
+#include "sensors/battery.h"
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_reported);      // register the logging package
+
+#define REPORTED_MSG_ID_BASE        0x8000      // message ids of our updates, telemetry leaves the id to the client
+
+/*
+*   A device value reported in the shadow, read when the update is prepared
+*/
+struct reported_field
+{
+    const char  *keyp;                          // key in state.reported.attributes
+    int         (*get_fn)(int arg, int32_t *valp);  // reads the value, 0 if there is one
+    int         arg;                            // handed to get_fn
+    int32_t     threshold;                      // smallest change worth reporting
+};
+
+static int aws_reported_battery(int arg, int32_t *valp);
+static int aws_reported_rsrp(int arg, int32_t *valp);
+static int aws_reported_lte(int arg, int32_t *valp);
+#if defined(CONFIG_AWS_KEEPALIVE)
+static int aws_reported_keepalive(int arg, int32_t *valp);
+#endif
+
+static const struct reported_field device_fields[] = {
+    { "battery_mv", aws_reported_battery, 0, CONFIG_AWS_REPORTED_BATTERY_MV },
+    { "rsrp_dbm", aws_reported_rsrp, 0, CONFIG_AWS_REPORTED_RSRP_DB },
+    { "lte_home_reg", aws_reported_lte, LTE_COUNTER_HOME_REG, CONFIG_AWS_REPORTED_LTE_COUNT },
+    { "lte_roam_reg", aws_reported_lte, LTE_COUNTER_ROAM_REG, CONFIG_AWS_REPORTED_LTE_COUNT },
+    { "lte_lost_reg", aws_reported_lte, LTE_COUNTER_LOST_REG, CONFIG_AWS_REPORTED_LTE_COUNT },
+    { "lte_cell_chg", aws_reported_lte, LTE_COUNTER_CELL_CHG, CONFIG_AWS_REPORTED_LTE_COUNT },
+    { "lte_pdp_up", aws_reported_lte, LTE_COUNTER_PDP_UP, CONFIG_AWS_REPORTED_LTE_COUNT },
+    { "lte_pdp_down", aws_reported_lte, LTE_COUNTER_PDP_DOWN, CONFIG_AWS_REPORTED_LTE_COUNT },
+    { "lte_link_down", aws_reported_lte, LTE_COUNTER_LINK_DOWN, CONFIG_AWS_REPORTED_LTE_COUNT },
+#if defined(CONFIG_AWS_KEEPALIVE)
+    { "keepalive_s", aws_reported_keepalive, 0, 1 },
+#endif
+};
+
+#define NUM_DEVICE_FIELDS           ARRAY_SIZE(device_fields)
+#define REPORTED_FW_BIT             BIT(NUM_DEVICE_FIELDS)      // firmware version, in the device field masks
+
+BUILD_ASSERT(NUM_DEVICE_FIELDS < 32, "device field masks are too small");
+
+/*
+*   Reported state control block
+*/
+struct reported_blk
+{
+    struct dev_config_values acked_cfg;     // attribute values the cloud has acknowledged
+    struct dev_config_values sent_cfg;      // attribute values of the update waiting for its PUBACK
+    int32_t     acked_dev[NUM_DEVICE_FIELDS];
+    int32_t     sent_dev[NUM_DEVICE_FIELDS];
+    uint32_t    acked_cfg_mask;             // attributes with an acknowledged value, DEV_CONFIG_MASK() bits
+    uint32_t    acked_dev_mask;             // device fields with an acknowledged value, plus REPORTED_FW_BIT
+    uint32_t    sent_cfg_mask;              // fields in the update waiting for its PUBACK
+    uint32_t    sent_dev_mask;
+    uint32_t    valid_dev_mask;             // device fields read successfully this cycle, plus REPORTED_FW_BIT
+    uint16_t    msg_id;                     // of the update waiting for its PUBACK, 0 if none
+    uint16_t    next_id;
+    atomic_t    puback;                     // set by the mqtt callback when the PUBACK of msg_id comes in
+
+    // working storage to encode the update
+    struct aws_reported_val vals[NUM_DEVICE_FIELDS + 1];
+    char        payload[CONFIG_AWS_REPORTED_BUFFER_SIZE];
+
+    // statistics
+    uint32_t    updates;                    // updates published
+    uint32_t    acks;                       // updates acknowledged
+    uint32_t    lost;                       // updates not acknowledged by the next cycle
+    uint32_t    fields_sent;                // fields published
+    uint32_t    fields_held;                // changes under their threshold, not published
+    uint32_t    bytes_sent;                 // size of the updates published
+    uint32_t    bytes_full;                 // size the same updates would have been with every field
+};
+
+static struct reported_blk reported_blk;
+
+/**
+* @brief    aws_reported_battery - Read the battery voltage
+*
+* @param    arg - not used
+* @param    valp - returns the voltage in mV
+*
+* @return   0 on success, -ENODATA if the battery can't be measured
+*/
+static int aws_reported_battery(int arg, int32_t *valp)
+{
+    *valp = sensor_get_battery_mV();
+
+    return *valp > 0 ? 0 : -ENODATA;
+}
+
+/**
+* @brief    aws_reported_rsrp - Read the last RSRP reported by the modem
+*
+* @param    arg - not used
+* @param    valp - returns the RSRP in dBm
+*
+* @return   0 on success, -ENODATA if the modem did not report one yet
+*/
+static int aws_reported_rsrp(int arg, int32_t *valp)
+{
+    *valp = modem_get_rsrp_dbm();
+
+    return *valp != 0 ? 0 : -ENODATA;
+}
+
+/**
+* @brief    aws_reported_lte - Read a counter of the LTE connection manager
+*
+* @param    arg - enum lte_counter
+* @param    valp - returns the counter
+*
+* @return   0
+*/
+static int aws_reported_lte(int arg, int32_t *valp)
+{
+    *valp = lte_counter_get(arg);
+
+    return 0;
+}
+
+#if defined(CONFIG_AWS_KEEPALIVE)
+/**
+* @brief    aws_reported_keepalive - Read the idle time learned for the network we are on
+*
+* @param    arg - not used
+* @param    valp - returns the idle time in seconds
+*
+* @return   0 on success, -ENODATA if nothing is learned yet
+*/
+static int aws_reported_keepalive(int arg, int32_t *valp)
+{
+    *valp = aws_keepalive_learned_s();
+
+    return *valp > 0 ? 0 : -ENODATA;
+}
+#endif
+
+/**
+* @brief    aws_reported_ack_check - Take the fields of the last update as acknowledged if its PUBACK came in
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*/
+static void aws_reported_ack_check(struct reported_blk *blkp)
+{
+    const struct dev_config_attr_desc *descp;
+    enum dev_config_shadow_id_t attr;
+    int i;
+
+    if (blkp->msg_id == 0)
+        return;
+
+    blkp->msg_id = 0;
+    if (!atomic_clear(&blkp->puback))
+    {
+        // the fields are still different from the acknowledged values, they go in the next update
+        blkp->lost++;
+        return;
+    }
+
+    blkp->acks++;
+
+    for (attr = 0; attr < DEV_CONFIG_NUM; attr++)
+    {
+        if (!(blkp->sent_cfg_mask & DEV_CONFIG_MASK(attr)))
+            continue;
+
+        descp = config_get_attr_desc(attr);
+        memcpy((uint8_t *)&blkp->acked_cfg + descp->offset, (uint8_t *)&blkp->sent_cfg + descp->offset, descp->size);
+    }
+    blkp->acked_cfg_mask |= blkp->sent_cfg_mask;
+
+    for (i = 0; i < NUM_DEVICE_FIELDS; i++)
+    {
+        if (blkp->sent_dev_mask & BIT(i))
+            blkp->acked_dev[i] = blkp->sent_dev[i];
+    }
+    blkp->acked_dev_mask |= blkp->sent_dev_mask;
+}
+
+/**
+* @brief    aws_reported_read - Take the current value of every field
+*
+* @param    blkp - control block pointer
+*
+* @return   nothing
+*
+* @note     The attributes go in sent_cfg, the device values in sent_dev and valid_dev_mask
+*/
+static void aws_reported_read(struct reported_blk *blkp)
+{
+    int i;
+
+    config_snapshot(&blkp->sent_cfg);
+
+    blkp->valid_dev_mask = REPORTED_FW_BIT;
+    for (i = 0; i < NUM_DEVICE_FIELDS; i++)
+    {
+        if (device_fields[i].get_fn(device_fields[i].arg, &blkp->sent_dev[i]) == 0)
+            blkp->valid_dev_mask |= BIT(i);
+    }
+}
+
+/**
+* @brief    aws_reported_select - Select the fields that changed since they were last acknowledged
+*
+* @param    blkp - control block pointer
+* @param    all - true to take every field, to size a full report
+*
+* @return   number of device values (and firmware version) in vals[]
+*
+* @note     The attributes selected are left in sent_cfg_mask, the device values in sent_dev_mask
+*/
+static int aws_reported_select(struct reported_blk *blkp, bool all)
+{
+    const struct dev_config_attr_desc *descp;
+    enum dev_config_shadow_id_t attr;
+    int32_t val;
+    int num_vals = 0;
+    int i;
+
+    blkp->sent_cfg_mask = 0;
+    for (attr = 0; attr < DEV_CONFIG_NUM; attr++)
+    {
+        descp = config_get_attr_desc(attr);
+        if (descp->shadow_key == NULL)
+            continue;
+
+        if (all || !(blkp->acked_cfg_mask & DEV_CONFIG_MASK(attr)) ||
+            memcmp((uint8_t *)&blkp->acked_cfg + descp->offset, (uint8_t *)&blkp->sent_cfg + descp->offset,
+                descp->size) != 0)
+        {
+            blkp->sent_cfg_mask |= DEV_CONFIG_MASK(attr);
+        }
+    }
+
+    blkp->sent_dev_mask = 0;
+    if (all || !(blkp->acked_dev_mask & REPORTED_FW_BIT))
+    {
+        blkp->vals[num_vals].keyp = DEV_SHADOW_ATTR_FW_V;
+        blkp->vals[num_vals].strp = config_get_fw_version_str();
+        num_vals++;
+        blkp->sent_dev_mask |= REPORTED_FW_BIT;
+    }
+
+    for (i = 0; i < NUM_DEVICE_FIELDS; i++)
+    {
+        if (!(blkp->valid_dev_mask & BIT(i)))
+            continue;
+
+        val = blkp->sent_dev[i];
+        if (!all && (blkp->acked_dev_mask & BIT(i)) &&
+            abs(val - blkp->acked_dev[i]) < MAX(device_fields[i].threshold, 1))
+        {
+            if (val != blkp->acked_dev[i])
+                blkp->fields_held++;
+            continue;
+        }
+
+        blkp->sent_dev_mask |= BIT(i);
+        blkp->vals[num_vals].keyp = device_fields[i].keyp;
+        blkp->vals[num_vals].strp = NULL;
+        blkp->vals[num_vals].val = val;
+        num_vals++;
+    }
+
+    return num_vals;
+}
+
+/**
+* @brief    aws_reported_publish - Publish the fields of the reported state that changed
+*
+* @param    none
+*
+* @return   1 if an update was published, 0 if nothing changed, negative error code otherwise
+*
+* @note     Called at the start of a publish cycle, in the aws connector thread
+*/
+int aws_reported_publish(void)
+{
+    struct reported_blk *blkp = &reported_blk;
+    struct aws_iot_data tx_data = { 0 };
+    int num_vals;
+    int full_len, len;
+    int err;
+
+    aws_reported_ack_check(blkp);
+    aws_reported_read(blkp);
+
+    // what a full report would take, for the statistics
+    num_vals = aws_reported_select(blkp, true);
+    full_len = aws_encode_reported(&blkp->sent_cfg, blkp->sent_cfg_mask, blkp->vals, num_vals, blkp->payload,
+                sizeof(blkp->payload));
+    if (full_len < 0)
+    {
+        LOG_ERR("Reported state does not fit: %d", full_len);
+        return full_len;
+    }
+
+    num_vals = aws_reported_select(blkp, false);
+    if (num_vals == 0 && blkp->sent_cfg_mask == 0)
+        return 0;
+
+    len = aws_encode_reported(&blkp->sent_cfg, blkp->sent_cfg_mask, blkp->vals, num_vals, blkp->payload,
+                sizeof(blkp->payload));
+    if (len < 0)
+        return len;
+
+    // set before sending, the PUBACK can come in before aws_send() returns
+    blkp->msg_id = REPORTED_MSG_ID_BASE | (blkp->next_id++ & (REPORTED_MSG_ID_BASE - 1));
+    atomic_clear(&blkp->puback);
+
+    tx_data.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+    tx_data.message_id = blkp->msg_id;
+    tx_data.topic.type = AWS_IOT_SHADOW_TOPIC_UPDATE;
+    tx_data.ptr = blkp->payload;
+    tx_data.len = len;
+
+    err = aws_send(&tx_data);
+    if (err)
+    {
+        LOG_ERR("aws_iot_send reported state, error: %d", err);
+        blkp->msg_id = 0;
+        return err;
+    }
+
+    blkp->updates++;
+    blkp->fields_sent += popcount(blkp->sent_cfg_mask) + num_vals;
+    blkp->bytes_sent += len;
+    blkp->bytes_full += full_len;
+    LOG_DBG("Reported state update, %d bytes", len);
+
+    return 1;
+}
+
+/**
+* @brief    aws_reported_puback - Note the acknowledgement of a published message
+*
+* @param    message_id - id of the message acknowledged
+*
+* @return   nothing
+*
+* @note     Called from the mqtt callback, the fields are taken as acknowledged at the next publish cycle
+*/
+void aws_reported_puback(uint16_t message_id)
+{
+    if (message_id != 0 && message_id == reported_blk.msg_id)
+        atomic_set(&reported_blk.puback, 1);
+}
+
+/**
+* @brief    aws_reported_stats_print - Print the statistics of the reported state
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_reported_stats_print(void)
+{
+    struct reported_blk *blkp = &reported_blk;
+
+    printk("Reported state updates: %u, Acknowledged: %u, Lost: %u\n", blkp->updates, blkp->acks, blkp->lost);
+    printk("Reported fields sent: %u, Changes under threshold: %u\n", blkp->fields_sent, blkp->fields_held);
+    printk("Reported bytes sent: %u, Full reports would be: %u\n", blkp->bytes_sent, blkp->bytes_full);
+}
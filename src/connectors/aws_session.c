@@ -0,0 +1,344 @@
+/**
+ * @brief: 	aws_session.c - What a session with AWS IoT costs, and the end of a connect-on-demand session
+ *
+ * @notes:  A session is one publish cycle when the connection stays up (CONFIG_AWS_CONNECT_ALWAYS) and one
+ *          connection when it is only opened for the publish cycle (CONFIG_AWS_CONNECT_ON_DEMAND). The bytes
+ *          sent and received and the time the radio was RRC connected are added up from the first session on,
+ *          so the averages per session of both modes can be compared on the same device. The bytes are the
+ *          payloads and topics, the TLS, TCP and MQTT framing is not counted. The radio time includes
+ *          everything between the sessions (keepalive pings, the RRC inactivity tail).
+ *
+ *          In the connect-on-demand mode, once the publish cycle is done the connection stays up until every
+ *          QoS1 message sent was acknowledged and for CONFIG_AWS_ON_DEMAND_LINGER_S more, for the shadow get
+ *          response and any delta to come in, then it is closed.
+ *
+ *          With CONFIG_AWS_TLS_SESSION_CACHE the modem keeps the TLS session of the CONFIG_AWS_IOT_SEC_TAG
+ *          credentials and resumes it on the next connection, an abbreviated handshake without the certificate
+ *          exchange. The aws iot client does not let us set socket options, mqtt_connect() is wrapped at link
+ *          time (-Wl,--wrap=mqtt_connect) to turn the session cache on in its TLS config.
+ *
+ *          Runs in the aws connector thread, except aws_session_puback() and aws_session_rx() (mqtt callback).
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <net/aws_iot.h>
+#include <net/mqtt.h>
+#include <net/socket.h>
+
+// includes for application
+#include "cell/lte_connect_mgr.h"
+#include "aws_connector.h"
+#include "aws_internal.h"
+
+LOG_MODULE_REGISTER(aws_session);       // register the logging package
+
+/*
+*   Session control block
+*/
+struct session_blk
+{
+    atomic_t    unacked;                // QoS1 messages sent and not acknowledged yet
+    int64_t     radio_base_ms;          // radio on time when the first session started
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+    struct k_timer close_timer;         // time to check if the session can be closed
+    atomic_t    queued;                 // an AWS_EVENT_SESSION_END is queued
+    bool        closing;                // the connection is being closed by us
+    int64_t     done_ms;                // uptime the publish cycle of the session was done
+    int64_t     sync_ms;                // uptime of the last shadow sync, 0 if none yet
+#endif
+
+    // statistics
+    uint32_t    sessions;
+    uint32_t    tx_msgs;                // messages sent
+    uint64_t    tx_bytes;               // payload and topic bytes sent
+    atomic_t    rx_bytes;               // bytes received
+    uint32_t    ack_closes;             // sessions closed with everything acknowledged
+    uint32_t    timeout_closes;         // sessions closed with PUBACKs missing
+};
+
+static struct session_blk session_blk;
+
+/**
+* @brief    aws_session_begin - A session starts, count it
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     At the start of each publish cycle when always connected, when the connection is ready otherwise
+*/
+void aws_session_begin(void)
+{
+    struct session_blk *blkp = &session_blk;
+
+    if (blkp->sessions == 0)
+        blkp->radio_base_ms = lte_radio_on_ms();
+
+    blkp->sessions++;
+}
+
+/**
+* @brief    aws_session_ready - The connection is ready, nothing is waiting for a PUBACK on it yet
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     The shadow is requested each time the connection is ready, that is the sync
+*/
+void aws_session_ready(void)
+{
+    struct session_blk *blkp = &session_blk;
+
+    atomic_clear(&blkp->unacked);
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+    blkp->closing = false;
+    blkp->sync_ms = k_uptime_get();
+    aws_session_begin();
+#endif
+}
+
+/**
+* @brief    aws_session_tx - A message was handed to the mqtt client
+*
+* @param    tx_datap - the message
+*
+* @return   nothing
+*/
+void aws_session_tx(const struct aws_iot_data *tx_datap)
+{
+    struct session_blk *blkp = &session_blk;
+
+    blkp->tx_msgs++;
+    blkp->tx_bytes += tx_datap->len + tx_datap->topic.len;
+
+    if (tx_datap->qos == MQTT_QOS_1_AT_LEAST_ONCE)
+        atomic_inc(&blkp->unacked);
+}
+
+/**
+* @brief    aws_session_rx - A message came in
+*
+* @param    len - length of the message
+*
+* @return   nothing
+*
+* @note     Called from the mqtt callback
+*/
+void aws_session_rx(size_t len)
+{
+    atomic_add(&session_blk.rx_bytes, len);
+}
+
+/**
+* @brief    aws_session_puback - A PUBACK came in
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from the mqtt callback
+*/
+void aws_session_puback(void)
+{
+    atomic_t *unackedp = &session_blk.unacked;
+    atomic_val_t num;
+
+    // a PUBACK of a message sent before a reconnect is not ours to count
+    do
+    {
+        num = atomic_get(unackedp);
+        if (num == 0)
+            return;
+    } while (!atomic_cas(unackedp, num, num - 1));
+}
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+/**
+* @brief    aws_session_close_tmr_exp - Close timer expiry, check if the session can be closed
+*
+* @param    timerp - pointer to the timer
+*
+* @return   nothing
+*
+* @note     runs in ISR context
+*/
+static void aws_session_close_tmr_exp(struct k_timer *timerp)
+{
+    if (atomic_set(&session_blk.queued, 1))
+        return;
+
+    // if it did not fit, check again shortly rather than never
+    if (aws_queue_event(AWS_EVENT_SESSION_END))
+    {
+        atomic_clear(&session_blk.queued);
+        k_timer_start(timerp, K_SECONDS(1), K_NO_WAIT);
+    }
+}
+
+/**
+* @brief    aws_session_sync_due - The shadow was not synced for CONFIG_AWS_ON_DEMAND_SYNC_S
+*
+* @param    none
+*
+* @return   true if a session should be opened for it
+*/
+bool aws_session_sync_due(void)
+{
+    struct session_blk *blkp = &session_blk;
+
+    return blkp->sync_ms == 0 || k_uptime_get() - blkp->sync_ms >= (int64_t)CONFIG_AWS_ON_DEMAND_SYNC_S * MSEC_PER_SEC;
+}
+
+/**
+* @brief    aws_session_done - The publish cycle of the session is done, close once it is all acknowledged
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_session_done(void)
+{
+    struct session_blk *blkp = &session_blk;
+
+    blkp->done_ms = k_uptime_get();
+
+    atomic_clear(&blkp->queued);
+    k_timer_start(&blkp->close_timer, K_SECONDS(CONFIG_AWS_ON_DEMAND_LINGER_S), K_NO_WAIT);
+}
+
+/**
+* @brief    aws_session_close - Handle an AWS_EVENT_SESSION_END, close the session if it is all acknowledged
+*
+* @param    busy - a publish cycle is running, it calls aws_session_done() again when it is done
+*
+* @return   true if the connection is being closed
+*/
+bool aws_session_close(bool busy)
+{
+    struct session_blk *blkp = &session_blk;
+    int64_t waited_ms;
+    int err;
+
+    atomic_clear(&blkp->queued);
+
+    if (busy || blkp->closing)
+        return false;
+
+    waited_ms = k_uptime_get() - blkp->done_ms;
+
+    if (atomic_get(&blkp->unacked) == 0)
+    {
+        blkp->ack_closes++;
+    }
+    else if (waited_ms < (int64_t)CONFIG_AWS_ON_DEMAND_PUBACK_TIMEOUT_S * MSEC_PER_SEC)
+    {
+        k_timer_start(&blkp->close_timer, K_SECONDS(1), K_NO_WAIT);
+        return false;
+    }
+    else
+    {
+        // QoS1, the broker may have it anyway. What matters is not holding the radio up
+        blkp->timeout_closes++;
+        LOG_WRN("Closing the session, %ld PUBACKs missing", atomic_get(&blkp->unacked));
+    }
+
+    blkp->closing = true;
+
+    err = aws_iot_disconnect();
+    if (err)
+    {
+        LOG_ERR("aws_iot_disconnect, error: %d", err);
+        blkp->closing = false;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* @brief    aws_session_closed - The connection dropped, tell if it was us closing it
+*
+* @param    none
+*
+* @return   true if the session was closed by aws_session_close(), false if the connection was lost
+*/
+bool aws_session_closed(void)
+{
+    struct session_blk *blkp = &session_blk;
+    bool closing = blkp->closing;
+
+    k_timer_stop(&blkp->close_timer);
+    blkp->closing = false;
+
+    return closing;
+}
+#endif
+
+#if defined(CONFIG_AWS_TLS_SESSION_CACHE)
+int __real_mqtt_connect(struct mqtt_client *clientp);
+
+/**
+* @brief    __wrap_mqtt_connect - Turn the TLS session cache on before the aws iot client connects
+*
+* @param    clientp - mqtt client of the aws iot client
+*
+* @return   what mqtt_connect() returns
+*
+* @note     Linked in place of mqtt_connect(), see CMakelists.txt
+*/
+int __wrap_mqtt_connect(struct mqtt_client *clientp)
+{
+    if (clientp->transport.type == MQTT_TRANSPORT_SECURE)
+        clientp->transport.tls.config.session_cache = TLS_SESSION_CACHE_ENABLED;
+
+    return __real_mqtt_connect(clientp);
+}
+#endif
+
+/**
+* @brief    aws_session_stats_print - Print what a session costs on average
+*
+* @param    none
+*
+* @return   nothing
+*/
+void aws_session_stats_print(void)
+{
+    struct session_blk *blkp = &session_blk;
+    uint32_t sessions = MAX(blkp->sessions, 1);
+
+    printk("Sessions (%s): %u, Messages sent: %u, Waiting for PUBACK: %ld\n",
+        IS_ENABLED(CONFIG_AWS_CONNECT_ON_DEMAND) ? "connect on demand" : "publish cycles", blkp->sessions,
+        blkp->tx_msgs, atomic_get(&blkp->unacked));
+    printk("Per session - sent: %u bytes, received: %u bytes, radio on: %u ms\n",
+        (uint32_t)(blkp->tx_bytes / sessions), (uint32_t)atomic_get(&blkp->rx_bytes) / sessions,
+        blkp->sessions ? (uint32_t)((lte_radio_on_ms() - blkp->radio_base_ms) / sessions) : 0);
+
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+    printk("Sessions closed - all acknowledged: %u, PUBACKs missing: %u\n", blkp->ack_closes, blkp->timeout_closes);
+#endif
+}
+
+/**
+* @brief    aws_session_init - Init the close timer
+*
+* @param    none
+*
+* @return   nothing
+*
+* @note     Called from aws_connector_init(), before the connector thread starts
+*/
+void aws_session_init(void)
+{
+#if defined(CONFIG_AWS_CONNECT_ON_DEMAND)
+    k_timer_init(&session_blk.close_timer, aws_session_close_tmr_exp, NULL);
+#endif
+}
@@ -1,8 +1,11 @@
 /**
  * @brief: 	aws_decoding.c - JSON decoding of AWS IoT messages
  *
- * @notes:    
- *  
+ * @notes:  Shadow documents are decoded in place in the MQTT receive buffer with the JSON scanner (see
+ *          json_scan.c), no tree is built and no heap is used. One pass over the document checks all of it
+ *          and finds the attributes to apply, only then are they applied, so nothing is taken from a
+ *          document that turns out to be malformed. Keys are looked up in a table sorted by key.
+ *
  * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
  *
  */
@@ -10,157 +13,269 @@
 // includes for nrf system
 #include <zephyr.h>
 #include <logging/log.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(CONFIG_CJSON_LIB)
 #include <cJSON.h>
 #include <cJSON_os.h>
+#endif
 
 // includes for application
 #include "bsp/sys_wrapper.h"
 #include "encoding/aws_encoding.h"
+#include "encoding/json_scan.h"
 #include "config/config.h"
 
+#define SHADOW_BENCH_LOOPS                  20      // decodes timed per document and decoder
+
+LOG_MODULE_REGISTER(aws_decoding);      // register the logging package
+
 /*
-*   Range checking constants to ensure data from aws is within range. Allows us to 'peg' the value if needed
+*   Where the attributes to apply were found in a shadow document
 */
-#define SECONDS_PER_MINUTE                   (60)
-#define MINUTES_PER_HOUR                     (60)
-#define HOURS_PER_DAY                        (24)
+enum shadow_attrs_from
+{
+    SHADOW_ATTRS_NONE = 0,
+    SHADOW_ATTRS_DELTA,             // state.delta.attributes, a shadow get response
+    SHADOW_ATTRS_STATE              // state.attributes, a delta update, wins over the other
+};
 
-#define MINUTE_SECONDS                      SECONDS_PER_MINUTE
-#define HOUR_SECONDS                        (SECONDS_PER_MINUTE * MINUTES_PER_HOUR)
-#define DAY_SECONDS                         (HOUR_SECONDS * HOURS_PER_DAY)
+struct shadow_doc
+{
+    struct json_scan        attrs;  // on the attributes object
+    enum shadow_attrs_from  from;
+    int32_t                 version;
+};
 
+/*
+*   The attributes taken from the shadow: ids of the attributes flagged DEV_CONFIG_FLAG_DESIRED in the attribute
+*   table (config.h), sorted by shadow key (strcmp order) so it can be searched with bsearch(). Built by
+*   encoding_init(), how each attribute is decoded and range checked comes from its descriptor.
+*/
+static uint8_t shadow_attrs[DEV_CONFIG_NUM];
+static int num_shadow_attrs;
 
-LOG_MODULE_REGISTER(aws_decoding);      // register the logging package
+/**
+* @brief    aws_decode_int - Decode an integer attribute
+*
+* @param    attr        attribute of the config datastore
+* @param    valp        position of the value in the document
+* @param    is_delta    the value is out of sync with ours and needs to be saved to flash
+*
+* @return   no value
+*
+* @note     Values out of range are pegged by the datastore, unless the attribute is flagged
+*           DEV_CONFIG_FLAG_STRICT (ex: enumerated types) in which case they are ignored
+*/
+static void aws_decode_int(enum dev_config_shadow_id_t attr, struct json_scan *valp, bool is_delta)
+{
+    const struct dev_config_attr_desc *descp = config_get_attr_desc(attr);
+    int32_t val;
+
+    if (json_scan_int(valp, &val))
+        return;
+
+    if ((descp->flags & DEV_CONFIG_FLAG_STRICT) && (val < descp->min_val || val > descp->max_val))
+    {
+        LOG_WRN("%s: %d out of range, ignored", log_strdup(descp->shadow_key), val);
+        return;
+    }
+
+    if (descp->val_type == DEV_CONFIG_VAL_TYPE_INT16)
+        config_set_int16(attr, val, is_delta);
+    else
+        config_set_int(attr, val, is_delta);
 
-// #ifdef IGNORE
+    config_save_attribute_to_file(attr);
+    LOG_INF("%s updated to %d", log_strdup(descp->shadow_key), val);
+}
 
-/** 
-* @brief    aws_decode_shadow_values - decode values from shadow json message
+/**
+* @brief    aws_decode_str - Decode a string attribute, ignored if empty or too long
 *
-* @param    attributes pointer to the attributes of json message
-* @param    version    version of the shadow message
-* @param    is_delta   indicates of is from delta message because then
-*                       we need to save values to flash
+* @param    attr        attribute of the config datastore
+* @param    valp        position of the value in the document
+* @param    is_delta    the value is out of sync with ours and needs to be saved to flash
 *
 * @return   no value
-*
-* @note     Parses the data to JSON then retrieves the value for each properties and saves in config system
 */
-static void aws_decode_shadow_values(cJSON *attributes, int32_t version, bool is_delta)
+static void aws_decode_str(enum dev_config_shadow_id_t attr, struct json_scan *valp, bool is_delta)
 {
-if (version > 0)
+    const struct dev_config_attr_desc *descp = config_get_attr_desc(attr);
+    char str_buf[DEV_CONFIG_STR_LEN_MAX];
+    struct json_str str;
+    int len;
+
+    if (json_scan_str(valp, &str))
+        return;
+
+    len = json_str_copy(&str, str_buf, descp->size);
+    if (len < 0)
     {
-        // use shadow service version number in state object to track shadow version
-        config_set_int(DEV_CONFIG_CONF_VERSION, version, true);
-        config_save_attribute_to_file(DEV_CONFIG_CONF_VERSION);
-        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_CONF_VERSION), version);
+        LOG_WRN("%s too long, ignored", log_strdup(descp->shadow_key));
+        return;
     }
+    if (len == 0)
+        return;
+
+    config_set_str(attr, str_buf, is_delta);
+    config_save_attribute_to_file(attr);
+    LOG_INF("%s updated to \"%s\"", log_strdup(descp->shadow_key), log_strdup(str_buf));
+}
+
+/**
+* @brief    aws_shadow_attr_cmp - Compare a key of the document with the shadow key of an attribute, for bsearch()
+*
+* @param    keyp    struct json_str of the key
+* @param    attrp   entry of shadow_attrs[]
+*
+* @return   <0, 0 or >0 like strcmp()
+*/
+static int aws_shadow_attr_cmp(const void *keyp, const void *attrp)
+{
+    return json_str_cmp(keyp, config_get_attr_desc(*(const uint8_t *)attrp)->shadow_key);
+}
+
+/**
+* @brief    aws_decode_attributes - Go through the attributes object and apply the attributes we know
+*
+* @param    scanp       position of the attributes object
+* @param    is_delta    the values are out of sync with ours and need to be saved to flash
+* @param    apply       false to only look the keys up (benchmark)
+*
+* @return   number of attributes known, negative error code if the object is malformed
+*
+* @note     Unknown attributes are ignored. The object was checked when the document was scanned.
+*/
+static int aws_decode_attributes(struct json_scan *scanp, bool is_delta, bool apply)
+{
+    const uint8_t *attrp;
+    struct json_scan val;
+    struct json_str key;
+    int index = 0;
+    int known = 0;
+    int err;
 
-    cJSON *item = cJSON_GetObjectItemCaseSensitive(attributes, DEV_SHADOW_ATTR_CONF_INTERVAL_S);
-    if (cJSON_IsNumber(item))
+    err = json_scan_object(scanp);
+    while (!err && (err = json_scan_member(scanp, &index, &key)) > 0)
     {
-        int val = item->valueint;
+        val = *scanp;
+        err = json_scan_skip(scanp);
 
-        // protect against too short or too long intervals
-        if (val < MINUTE_SECONDS) 
-        {
-            // don't request shadow more than once per minute
-            val = MINUTE_SECONDS;
-        }
-        else if (val > DAY_SECONDS) 
-        {
-            // request shadow update at lease once per day
-            val = DAY_SECONDS;
-        }
+        attrp = bsearch(&key, shadow_attrs, num_shadow_attrs, sizeof(shadow_attrs[0]), aws_shadow_attr_cmp);
+        if (attrp == NULL)
+            continue;
 
-        config_set_int16(DEV_CONFIG_CONF_UPDATE_INTERVAL_S, val, is_delta);
-        config_save_attribute_to_file(DEV_CONFIG_CONF_UPDATE_INTERVAL_S);
-        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_CONF_INTERVAL_S), val);
+        known++;
+        if (!apply)
+            continue;
+
+        if (config_get_attr_desc(*attrp)->val_type == DEV_CONFIG_VAL_TYPE_STRING)
+            aws_decode_str(*attrp, &val, is_delta);
+        else
+            aws_decode_int(*attrp, &val, is_delta);
     }
-    
-    item = cJSON_GetObjectItemCaseSensitive(attributes, DEV_SHADOW_ATTR_DAQ_INTERVAL_S);
-    if (cJSON_IsNumber(item))
-    {
-        int val = item->valueint;
 
-        // protect against too short or too long intervals
-        if (val < DAQ_INTERVAL_MINIMUM_S) 
+    return err < 0 ? err : known;
+}
+
+/**
+* @brief    aws_scan_state - Look for the attributes in the state object of a shadow document
+*
+* @param    scanp   position in the document, on the state object, moved past it
+* @param    docp    updated with where the attributes are
+*
+* @return   0 on success, negative error code if malformed
+*
+* @note     state.attributes in a delta update, state.delta.attributes in a get response. The desired and
+*           reported states are skipped: if an update is required for a device it must be in the delta,
+*           processing the desired state every time would write everything to flash and wear it out.
+*/
+static int aws_scan_state(struct json_scan *scanp, struct shadow_doc *docp)
+{
+    struct json_str key, delta_key;
+    int index = 0, delta_index = 0;
+    int err;
+
+    err = json_scan_object(scanp);
+    while (!err && (err = json_scan_member(scanp, &index, &key)) > 0)
+    {
+        if (json_str_cmp(&key, "attributes") == 0 && json_scan_peek(scanp) == JSON_TYPE_OBJECT)
         {
-            // don't daq more than once per minute
-            val = DAQ_INTERVAL_MINIMUM_S;
+            docp->attrs = *scanp;
+            docp->from = SHADOW_ATTRS_STATE;
+            err = json_scan_skip(scanp);
         }
-        else if (val > DAY_SECONDS) 
+        else if (json_str_cmp(&key, "delta") == 0 && json_scan_peek(scanp) == JSON_TYPE_OBJECT)
         {
-            // run daq at lease once per day
-            val = DAY_SECONDS;
+            err = json_scan_object(scanp);
+            while (!err && (err = json_scan_member(scanp, &delta_index, &delta_key)) > 0)
+            {
+                if (json_str_cmp(&delta_key, "attributes") == 0 && json_scan_peek(scanp) == JSON_TYPE_OBJECT &&
+                    docp->from < SHADOW_ATTRS_DELTA)
+                {
+                    docp->attrs = *scanp;
+                    docp->from = SHADOW_ATTRS_DELTA;
+                }
+                err = json_scan_skip(scanp);
+            }
+        }
+        else
+        {
+            err = json_scan_skip(scanp);
         }
-
-        config_set_int16(DEV_CONFIG_DAQ_INTERVAL_S, val, is_delta);
-        config_save_attribute_to_file(DEV_CONFIG_DAQ_INTERVAL_S);
-        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_DAQ_INTERVAL_S), val);
     }
-    
-    item = cJSON_GetObjectItemCaseSensitive(attributes, DEV_SHADOW_ATTR_PUB_INTERVAL_S);
-    if (cJSON_IsNumber(item))
-    {
-        int val = item->valueint;
 
-        // protect against too short or too long intervals
-        if (val < PUB_INTERVAL_MINIMUM_S) 
+    return err < 0 ? err : 0;
+}
+
+/**
+* @brief    aws_scan_shadow_doc - Check a shadow document and find the attributes to apply and the version
+*
+* @param    msgp    the document
+* @param    len     length of the document
+* @param    docp    returns where the attributes are and the version
+*
+* @return   0 on success, negative error code if malformed
+*/
+static int aws_scan_shadow_doc(const char *msgp, size_t len, struct shadow_doc *docp)
+{
+    struct json_scan scan;
+    struct json_str key;
+    int index = 0;
+    int err;
+
+    docp->from = SHADOW_ATTRS_NONE;
+    docp->version = 0;
+
+    json_scan_init(&scan, msgp, len);
+
+    err = json_scan_object(&scan);
+    while (!err && (err = json_scan_member(&scan, &index, &key)) > 0)
+    {
+        if (json_str_cmp(&key, "version") == 0)
         {
-            // don't try to publish more than once per minute
-            val = PUB_INTERVAL_MINIMUM_S;
+            err = json_scan_int(&scan, &docp->version);
+            if (err == -ENOMSG || err == -EINVAL)
+                err = 0;
         }
-        else if (val > DAY_SECONDS) 
+        else if (json_str_cmp(&key, "state") == 0 && json_scan_peek(&scan) == JSON_TYPE_OBJECT)
         {
-            // publish at lease once per day
-            val = DAY_SECONDS;
+            err = aws_scan_state(&scan, docp);
         }
-
-        config_set_int16(DEV_CONFIG_PUB_INTERVAL_S, val, is_delta);
-        config_save_attribute_to_file(DEV_CONFIG_PUB_INTERVAL_S);
-        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_PUB_INTERVAL_S), item->valueint);
-    }
-
-    item = cJSON_GetObjectItemCaseSensitive(attributes, DEV_SHADOW_ATTR_SENSOR_TYPE);
-    if (cJSON_IsNumber(item) 
-        && (enum external_sensor)item->valueint > EXT_SENSOR_UNKNOWN
-        && (enum external_sensor)item->valueint < EXT_SENSOR_INVALID)
-    {
-        config_set_int16(DEV_CONFIG_SENSOR_TYPE, item->valueint, is_delta);
-        config_save_attribute_to_file(DEV_CONFIG_SENSOR_TYPE);
-        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_SENSOR_TYPE), item->valueint);
-    }
-    item = cJSON_GetObjectItemCaseSensitive(attributes, DEV_SHADOW_ATTR_PUB_TOPIC);
-    if (cJSON_IsString(item) 
-        && strlen(item->valuestring) > 0)
-    {
-        config_set_str(DEV_CONFIG_PUB_TOPIC, item->valuestring, is_delta);
-        config_save_attribute_to_file(DEV_CONFIG_PUB_TOPIC);
-        LOG_INF("%s updated to \"%s\"", log_strdup(DEV_SHADOW_ATTR_PUB_TOPIC), log_strdup(item->valuestring));
-    }
-    item = cJSON_GetObjectItemCaseSensitive(attributes, DEV_SHADOW_ATTR_APP_TYPE);
-    if (cJSON_IsNumber(item) 
-        && (enum app_id_t)item->valueint > APP_ID_UNKNOWN 
-        && (enum app_id_t)item->valueint < APP_ID_NUM)
-    {
-        config_set_int16(DEV_CONFIG_APP_TYPE, item->valueint, is_delta);
-        config_save_attribute_to_file(DEV_CONFIG_APP_TYPE);
-        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_APP_TYPE), item->valueint);
-        
-        //check if app type has changed and reboot 
-        if(config_diff_flash_int16(DEV_CONFIG_APP_TYPE, item->valueint))
+        else
         {
-            // see issue: #7 here: 
-            // https://github.com/Reliance-Foundry/levaware_gen3/issues/7
-            LOG_INF("App_type changed to %d,...Needs a Reboot", item->valueint);
-
-            // lets not force a reboot here for now and have the user power off and on. 
+            err = json_scan_skip(&scan);
         }
     }
+
+    if (err < 0)
+        return err;
+
+    return json_scan_end(&scan);
 }
 
-/** 
+/**
 * @brief    aws_decode_shadow_msg - decode shadow messages from AWS IoT
 *
 * @param    char *msg_stringp - pointer to message string
@@ -168,77 +283,236 @@ if (version > 0)
 *
 * @return   no value
 *
-* @note     Parses the shadow message and calls helper to save values in the config system
+* @note     Decodes in place and saves the values in the config system. The message is not modified.
 */
 void aws_decode_shadow_msg(char *msg_stringp, size_t len)
 {
+    struct shadow_doc doc;
+    int err;
 
     LOG_DBG("Parsing shadow message from aws ");
-    
-    cJSON *root_obj = NULL;
-    int32_t version = 0;
 
-	root_obj = cJSON_ParseWithLength(msg_stringp, len);
-	if (root_obj == NULL) 
+    err = aws_scan_shadow_doc(msg_stringp, len, &doc);
+    if (err)
     {
-        LOG_ERR("cJSON Parse failure at root object");
-		goto clean_exit;
-	}
+        LOG_ERR("Malformed shadow message, discarding: %d", err);
+        return;
+    }
 
-    cJSON *state_obj = cJSON_GetObjectItemCaseSensitive(root_obj, "state");
-    if (!cJSON_IsObject(state_obj))
+    if (doc.from == SHADOW_ATTRS_NONE)
     {
-        LOG_ERR("cant get 'state' object");
-		goto clean_exit;
+        LOG_WRN("state.attributes and state.delta.attributes not found -> discarding");
+        return;
     }
-    
-    cJSON *item = cJSON_GetObjectItemCaseSensitive(root_obj, "version");
-    if (cJSON_IsNumber(item))
+
+    /* So the values in the delta state are out of sync with our internally stored data, and are saved.
+    *  This is very important to note.
+    */
+    if (doc.version > 0)
     {
-        version = item->valueint;
+        // use shadow service version number in state object to track shadow version
+        config_set_int(DEV_CONFIG_CONF_VERSION, doc.version, true);
+        config_save_attribute_to_file(DEV_CONFIG_CONF_VERSION);
+        LOG_INF("%s updated to %d", log_strdup(DEV_SHADOW_ATTR_CONF_VERSION), doc.version);
     }
-    
-    // if we are processing a delta update sub event, the delta state
-    //  attributes are in the state object
-    cJSON *attributes = cJSON_GetObjectItemCaseSensitive(state_obj, "attributes");
-    if (!cJSON_IsObject(attributes))
-    {
-        // if we are processing a shadow_get response, the delta state attributes are in the state.delta object
-        LOG_DBG("state.attributes not found, trying state.delta.attributes...");
 
-        cJSON *delta_obj = cJSON_GetObjectItemCaseSensitive(state_obj, "delta");
-        if (!cJSON_IsObject(delta_obj))
-        {
-            LOG_WRN("state.delta not found -> discarding");
-            goto clean_exit;
-        }
+    err = aws_decode_attributes(&doc.attrs, true, true);
+    LOG_INF("%d known attributes in %s", err, doc.from == SHADOW_ATTRS_STATE ? "state" : "state.delta");
+}
+
+/*
+*   Shadow documents as AWS IoT sends them, for the benchmark: a get response and a delta update
+*/
+static const char shadow_bench_get[] =
+    "{\"state\":{\"desired\":{\"attributes\":{\"config_interval_s\":3600,\"daq_interval_s\":60,"
+    "\"pub_interval_s\":900,\"sensor_type\":1,\"app_type\":1,\"pub_format\":1,"
+    "\"topic\":\"dt/levaware/3f6c2a10-8d4e-4b7a-9c1e-2a5b7d9e0f11\"}},"
+    "\"reported\":{\"attributes\":{\"config_interval_s\":3600,\"daq_interval_s\":60,\"pub_interval_s\":600,"
+    "\"sensor_type\":1,\"app_type\":1,\"pub_format\":0,\"topic\":\"dt/levaware/3f6c2a10-8d4e-4b7a-9c1e-2a5b7d9e0f11\","
+    "\"fw_version\":\"3.0.4\"}},"
+    "\"delta\":{\"attributes\":{\"pub_interval_s\":900,\"pub_format\":1}}},"
+    "\"metadata\":{\"desired\":{\"attributes\":{\"config_interval_s\":{\"timestamp\":1689990000},"
+    "\"daq_interval_s\":{\"timestamp\":1689990000},\"pub_interval_s\":{\"timestamp\":1690003000},"
+    "\"sensor_type\":{\"timestamp\":1689990000},\"app_type\":{\"timestamp\":1689990000},"
+    "\"pub_format\":{\"timestamp\":1690003000},\"topic\":{\"timestamp\":1689990000}}},"
+    "\"reported\":{\"attributes\":{\"config_interval_s\":{\"timestamp\":1689991000},"
+    "\"daq_interval_s\":{\"timestamp\":1689991000},\"pub_interval_s\":{\"timestamp\":1689991000},"
+    "\"sensor_type\":{\"timestamp\":1689991000},\"app_type\":{\"timestamp\":1689991000},"
+    "\"pub_format\":{\"timestamp\":1689991000},\"topic\":{\"timestamp\":1689991000},"
+    "\"fw_version\":{\"timestamp\":1689991000}}}},"
+    "\"version\":42,\"timestamp\":1690003600}";
+
+static const char shadow_bench_delta[] =
+    "{\"version\":43,\"timestamp\":1690007200,\"state\":{\"attributes\":{\"pub_interval_s\":1800,"
+    "\"daq_interval_s\":30}},\"metadata\":{\"attributes\":{\"pub_interval_s\":{\"timestamp\":1690007200},"
+    "\"daq_interval_s\":{\"timestamp\":1690007200}}}}";
+
+#if defined(CONFIG_CJSON_LIB)
+// heap taken by cJSON during the benchmark, see aws_bench_malloc()
+static size_t bench_heap_bytes;
+static size_t bench_heap_peak;
+
+#define BENCH_HEAP_HDR      8       // size kept in front of each block, keeps the 8 byte alignment
+
+/**
+* @brief    aws_bench_malloc - cJSON allocator for the benchmark, tracks the heap it takes
+*
+* @param    size    bytes wanted
+*
+* @return   the block, NULL if the heap is exhausted
+*/
+static void *aws_bench_malloc(size_t size)
+{
+    uint8_t *blockp = k_malloc(size + BENCH_HEAP_HDR);
+
+    if (blockp == NULL)
+        return NULL;
+
+    *(size_t *)blockp = size;
+    bench_heap_bytes += size;
+    bench_heap_peak = MAX(bench_heap_peak, bench_heap_bytes);
+    return blockp + BENCH_HEAP_HDR;
+}
+
+/**
+* @brief    aws_bench_free - cJSON free for the benchmark
+*
+* @param    ptr     block from aws_bench_malloc()
+*
+* @return   none
+*/
+static void aws_bench_free(void *ptr)
+{
+    uint8_t *blockp = ptr;
+
+    if (blockp == NULL)
+        return;
+
+    blockp -= BENCH_HEAP_HDR;
+    bench_heap_bytes -= *(size_t *)blockp;
+    k_free(blockp);
+}
+
+/**
+* @brief    aws_bench_cjson - Find the attributes with the cJSON tree, as the decoder did before
+*
+* @param    msgp    the document
+* @param    len     length of the document
+*
+* @return   number of attributes known, negative if the document was not decoded
+*/
+static int aws_bench_cjson(const char *msgp, size_t len)
+{
+    cJSON *root_obj, *state_obj, *attributes, *delta_obj;
+    int known = 0;
+    int i;
 
-        /* So if not delta object, we exited above. If we fell thru to here, then it's a delta object.
-        * This is very important to note as we then save the values in the delta state because they are out of 
-        * sync with our internally stored data.
-        */
+    root_obj = cJSON_ParseWithLength(msgp, len);
+    if (root_obj == NULL)
+        return -EBADMSG;
 
+    state_obj = cJSON_GetObjectItemCaseSensitive(root_obj, "state");
+    cJSON_GetObjectItemCaseSensitive(root_obj, "version");
+    attributes = cJSON_GetObjectItemCaseSensitive(state_obj, "attributes");
+    if (!cJSON_IsObject(attributes))
+    {
+        delta_obj = cJSON_GetObjectItemCaseSensitive(state_obj, "delta");
         attributes = cJSON_GetObjectItemCaseSensitive(delta_obj, "attributes");
-        if (!cJSON_IsObject(attributes))
-        {
-            LOG_ERR("state.delta.attributes not found -> discarding");
-            goto clean_exit;
-        }
     }
 
-   LOG_WRN("Saving new delta.attributes: %s", cJSON_PrintUnformatted(attributes));
-   
-     aws_decode_shadow_values(attributes, version, true);
+    for (i = 0; i < num_shadow_attrs; i++)
+    {
+        if (cJSON_GetObjectItemCaseSensitive(attributes, config_get_attr_desc(shadow_attrs[i])->shadow_key))
+            known++;
+    }
+
+    cJSON_Delete(root_obj);
+    return known;
+}
+#endif
+
+/**
+* @brief    aws_bench_scan - Find the attributes with the in-place decoder, without applying them
+*
+* @param    msgp    the document
+* @param    len     length of the document
+*
+* @return   number of attributes known, negative if the document was not decoded
+*/
+static int aws_bench_scan(const char *msgp, size_t len)
+{
+    struct shadow_doc doc;
+    int err;
+
+    err = aws_scan_shadow_doc(msgp, len, &doc);
+    if (err)
+        return err;
+
+    return aws_decode_attributes(&doc.attrs, true, false);
+}
+
+/**
+* @brief    aws_decode_bench - Compare the decode time and heap of the in-place decoder with cJSON
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Runs on the real shadow documents above. Nothing is applied to the config datastore. The
+*           in-place decoder takes no heap, its state is a few scan positions on the stack.
+*/
+void aws_decode_bench(void)
+{
+    static const struct {
+        const char *namep;
+        const char *docp;
+        size_t len;
+    } docs[] = {
+        { "get", shadow_bench_get, sizeof(shadow_bench_get) - 1 },
+        { "delta", shadow_bench_delta, sizeof(shadow_bench_delta) - 1 },
+    };
+    uint32_t start_cyc, scan_cyc;
+    int known = 0;
+    int d, i;
+#if defined(CONFIG_CJSON_LIB)
+    const cJSON_Hooks hooks = { .malloc_fn = aws_bench_malloc, .free_fn = aws_bench_free };
+    uint32_t cjson_cyc;
+    int cjson_known = 0;
+#endif
+
+    printk("\nShadow decode benchmark, %d decodes per document:\n\n", SHADOW_BENCH_LOOPS);
+
+    for (d = 0; d < ARRAY_SIZE(docs); d++)
+    {
+        start_cyc = k_cycle_get_32();
+        for (i = 0; i < SHADOW_BENCH_LOOPS; i++)
+            known = aws_bench_scan(docs[d].docp, docs[d].len);
+        scan_cyc = k_cycle_get_32() - start_cyc;
 
-    // DON'T PROCESS OTHER STATES - if an update is required for a device, it must be in the delta object
-    // if the desired state is always processed and we write everything to flash & it will wear out
+        printk("%-5s %4u bytes, in place: %5u us, heap peak 0 bytes, %d attributes\n", docs[d].namep,
+            (uint32_t)docs[d].len, k_cyc_to_us_floor32(scan_cyc) / SHADOW_BENCH_LOOPS, known);
 
-clean_exit:
-	cJSON_Delete(root_obj);
-    return;
+#if defined(CONFIG_CJSON_LIB)
+        bench_heap_bytes = 0;
+        bench_heap_peak = 0;
+        cJSON_InitHooks((cJSON_Hooks *)&hooks);
+
+        start_cyc = k_cycle_get_32();
+        for (i = 0; i < SHADOW_BENCH_LOOPS; i++)
+            cjson_known = aws_bench_cjson(docs[d].docp, docs[d].len);
+        cjson_cyc = k_cycle_get_32() - start_cyc;
+
+        // back to the system heap
+        cJSON_Init();
+
+        printk("%-5s %4u bytes, cJSON:    %5u us, heap peak %u bytes, %d attributes\n", docs[d].namep,
+            (uint32_t)docs[d].len, k_cyc_to_us_floor32(cjson_cyc) / SHADOW_BENCH_LOOPS, (uint32_t)bench_heap_peak,
+            cjson_known);
+#endif
+    }
 }
 
-/**  
+/**
 * @brief    encoding_init - Initialize the AWS encoding/decoding package
 *
 * @note     aborts if fails to initialize
@@ -249,6 +523,37 @@ clean_exit:
 */
 void encoding_init(void)
 {
-    // This package uses JSON encoding
+    const struct dev_config_attr_desc *descp;
+    enum dev_config_shadow_id_t attr;
+    int i;
+
+    // insertion sort of the attributes taken from the shadow by key, there are only a handful
+    num_shadow_attrs = 0;
+    for (attr = 0; attr < DEV_CONFIG_NUM; attr++)
+    {
+        descp = config_get_attr_desc(attr);
+        if (!(descp->flags & DEV_CONFIG_FLAG_DESIRED))
+            continue;
+
+        if (descp->shadow_key == NULL)
+            erabort("encoding_init - desired attribute without a shadow key");
+
+        for (i = num_shadow_attrs; i > 0; i--)
+        {
+            int cmp = strcmp(config_get_attr_desc(shadow_attrs[i - 1])->shadow_key, descp->shadow_key);
+
+            if (cmp == 0)
+                erabort("encoding_init - duplicate shadow key");
+            if (cmp < 0)
+                break;
+            shadow_attrs[i] = shadow_attrs[i - 1];
+        }
+        shadow_attrs[i] = (uint8_t)attr;
+        num_shadow_attrs++;
+    }
+
+#if defined(CONFIG_CJSON_LIB)
+    // AWS FOTA parses its job documents with cJSON, here it is only used by the decode benchmark
     cJSON_Init();
-}
\ No newline at end of file
+#endif
+}
@@ -0,0 +1,283 @@
+/**
+ * @brief: 	aws_encoding.c - JSON encoding of telemetry and reported state published to AWS IoT
+ *
+ * @notes:  Encodes straight into the caller's buffer, no heap is used. Records that don't fit are left
+ *          for the next message.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <stdio.h>
+#include <string.h>
+
+// includes for application
+#include "encoding/aws_encoding.h"
+#include "config/config.h"
+
+LOG_MODULE_REGISTER(aws_encoding);      // register the logging package
+
+#define TELE_JSON_TRAILER           "]}"    // closes the records array and the message
+
+/**
+* @brief    aws_encode_record - Encode one telemetry record as a JSON object
+*
+* @param    recp        record to encode
+* @param    bufp        where to encode
+* @param    buf_len     room left in the buffer
+*
+* @return   number of characters encoded, or buf_len (or more) if the record did not fit
+*
+* @note     min, max and the count are only encoded for records covering more than one sample
+*/
+static int aws_encode_record(const struct tele_record *recp, char *bufp, size_t buf_len)
+{
+    if (recp->count <= 1)
+    {
+        return snprintk(bufp, buf_len, "{\"seq\":%u,\"ts\":%u,\"type\":%u,\"val\":%d}",
+                    recp->seq, recp->timestamp, recp->type, recp->value);
+    }
+
+    return snprintk(bufp, buf_len, "{\"seq\":%u,\"ts\":%u,\"type\":%u,\"val\":%d,\"min\":%d,\"max\":%d,\"n\":%u}",
+                recp->seq, recp->timestamp, recp->type, recp->value, recp->min, recp->max, recp->count);
+}
+
+/**
+* @brief    aws_encode_telemetry - Encode telemetry records into a JSON message
+*
+* @param    recsp           records to encode, oldest first
+* @param    num_recs        number of records
+* @param    period_s        period each record covers for rollups, 0 for raw records
+* @param    bufp            buffer to encode into
+* @param    buf_len         size of the buffer
+* @param    num_encodedp    returns the number of records that fit in the message
+*
+* @return   length of the message, negative error code if not even one record fits
+*
+* @note     message format: {"sn":"<serial number>","recs":[{"seq":1,"ts":1690000000,"type":1,"val":3600},...]}
+*           rollups add the period after the serial number: {"sn":"<serial number>","per":60,"recs":[...]}
+*/
+int aws_encode_telemetry(const struct tele_record *recsp, int num_recs, uint32_t period_s, char *bufp,
+                size_t buf_len, int *num_encodedp)
+{
+    size_t room;
+    int len;
+    int pos;
+    int i;
+
+    *num_encodedp = 0;
+
+    // keep room for the trailer and the null
+    if (buf_len <= sizeof(TELE_JSON_TRAILER))
+        return -ENOMEM;
+    room = buf_len - sizeof(TELE_JSON_TRAILER);
+
+    if (period_s == 0)
+        pos = snprintk(bufp, room, "{\"sn\":\"%s\",\"recs\":[", config_get_serial_number());
+    else
+        pos = snprintk(bufp, room, "{\"sn\":\"%s\",\"per\":%u,\"recs\":[", config_get_serial_number(), period_s);
+    if (pos >= room)
+        return -ENOMEM;
+
+    for (i = 0; i < num_recs; i++)
+    {
+        // comma between records
+        if (i > 0)
+        {
+            if (pos + 1 >= room)
+                break;
+            bufp[pos++] = ',';
+        }
+
+        len = aws_encode_record(&recsp[i], &bufp[pos], room - pos);
+        if (len >= room - pos)
+        {
+            // did not fit, drop the comma and leave the record for the next message
+            if (i > 0)
+                pos--;
+            break;
+        }
+        pos += len;
+    }
+
+    if (i == 0)
+        return -ENOMEM;
+
+    strcpy(&bufp[pos], TELE_JSON_TRAILER);
+    pos += strlen(TELE_JSON_TRAILER);
+
+    *num_encodedp = i;
+    return pos;
+}
+
+/**
+* @brief    aws_encode_json_str - Encode a string as a JSON string, with the quotes
+*
+* @param    strp        string to encode
+* @param    bufp        where to encode
+* @param    buf_len     room left in the buffer
+*
+* @return   number of characters encoded, negative error code if it did not fit
+*
+* @note     quotes, backslashes and control characters are escaped, the rest is copied as is (UTF-8)
+*/
+static int aws_encode_json_str(const char *strp, char *bufp, size_t buf_len)
+{
+    size_t pos = 0;
+    int len;
+
+    if (buf_len < 2)
+        return -ENOMEM;
+    bufp[pos++] = '"';
+
+    for (; *strp != '\0'; strp++)
+    {
+        if (*strp == '"' || *strp == '\\')
+        {
+            if (pos + 2 >= buf_len)
+                return -ENOMEM;
+            bufp[pos++] = '\\';
+            bufp[pos++] = *strp;
+        }
+        else if ((uint8_t)*strp < 0x20)
+        {
+            len = snprintk(&bufp[pos], buf_len - pos, "\\u%04x", (uint8_t)*strp);
+            if (len >= buf_len - pos)
+                return -ENOMEM;
+            pos += len;
+        }
+        else
+        {
+            if (pos + 1 >= buf_len)
+                return -ENOMEM;
+            bufp[pos++] = *strp;
+        }
+    }
+
+    if (pos + 1 >= buf_len)
+        return -ENOMEM;
+    bufp[pos++] = '"';
+    bufp[pos] = '\0';
+
+    return pos;
+}
+
+/**
+* @brief    aws_encode_reported_val - Encode one member of the reported attributes
+*
+* @param    keyp        key of the member
+* @param    strp        string value, NULL for an integer value
+* @param    val         integer value
+* @param    first       true for the first member (no comma)
+* @param    bufp        where to encode
+* @param    buf_len     room left in the buffer
+*
+* @return   number of characters encoded, negative error code if it did not fit
+*/
+static int aws_encode_reported_val(const char *keyp, const char *strp, int32_t val, bool first, char *bufp,
+                size_t buf_len)
+{
+    int pos;
+    int len;
+
+    pos = snprintk(bufp, buf_len, "%s\"%s\":", first ? "" : ",", keyp);
+    if (pos >= buf_len)
+        return -ENOMEM;
+
+    if (strp != NULL)
+    {
+        len = aws_encode_json_str(strp, &bufp[pos], buf_len - pos);
+        if (len < 0)
+            return len;
+    }
+    else
+    {
+        len = snprintk(&bufp[pos], buf_len - pos, "%d", val);
+        if (len >= buf_len - pos)
+            return -ENOMEM;
+    }
+
+    return pos + len;
+}
+
+/**
+* @brief    aws_encode_reported - Encode a shadow reported state update
+*
+* @param    valuesp     values of the config datastore attributes
+* @param    mask        attributes to report, DEV_CONFIG_MASK() bits, the ones without a shadow key are skipped
+* @param    valsp       other values to report (not in the datastore), encoded after the attributes
+* @param    num_vals    number of other values
+* @param    bufp        buffer to encode into
+* @param    buf_len     size of the buffer
+*
+* @return   length of the message, negative error code if it does not fit
+*
+* @note     message format: {"state":{"reported":{"attributes":{"daq_interval_s":60,"topic":"dt/...",...}}}}
+*           Keys and types of the attributes come from the attribute table (config.h). Take the values with
+*           config_snapshot() so they are consistent.
+*/
+int aws_encode_reported(const struct dev_config_values *valuesp, uint32_t mask, const struct aws_reported_val *valsp,
+                int num_vals, char *bufp, size_t buf_len)
+{
+    static const char header[] = "{\"state\":{\"reported\":{\"attributes\":{";
+    static const char trailer[] = "}}}}";
+    const struct dev_config_attr_desc *descp;
+    enum dev_config_shadow_id_t attr;
+    const uint8_t *valp;
+    size_t room;
+    int num_encoded = 0;
+    int pos;
+    int len;
+    int i;
+
+    // keep room for the trailer and the null
+    if (buf_len < sizeof(header) + sizeof(trailer))
+        return -ENOMEM;
+    room = buf_len - (sizeof(trailer) - 1);
+
+    strcpy(bufp, header);
+    pos = sizeof(header) - 1;
+
+    for (attr = 0; attr < DEV_CONFIG_NUM; attr++)
+    {
+        descp = config_get_attr_desc(attr);
+        if (descp->shadow_key == NULL || !(mask & DEV_CONFIG_MASK(attr)))
+            continue;
+
+        valp = (const uint8_t *)valuesp + descp->offset;
+
+        if (descp->val_type == DEV_CONFIG_VAL_TYPE_STRING)
+            len = aws_encode_reported_val(descp->shadow_key, (const char *)valp, 0, num_encoded == 0, &bufp[pos],
+                        room - pos);
+        else if (descp->val_type == DEV_CONFIG_VAL_TYPE_INT16)
+            len = aws_encode_reported_val(descp->shadow_key, NULL, *(const int16_t *)valp, num_encoded == 0,
+                        &bufp[pos], room - pos);
+        else
+            len = aws_encode_reported_val(descp->shadow_key, NULL, *(const int32_t *)valp, num_encoded == 0,
+                        &bufp[pos], room - pos);
+        if (len < 0)
+            return len;
+
+        pos += len;
+        num_encoded++;
+    }
+
+    for (i = 0; i < num_vals; i++)
+    {
+        len = aws_encode_reported_val(valsp[i].keyp, valsp[i].strp, valsp[i].val, num_encoded == 0, &bufp[pos],
+                    room - pos);
+        if (len < 0)
+            return len;
+
+        pos += len;
+        num_encoded++;
+    }
+
+    strcpy(&bufp[pos], trailer);
+    pos += sizeof(trailer) - 1;
+
+    return pos;
+}
@@ -2,7 +2,7 @@
  * @brief: 	aws_encoding.h - External definitions for the AWS encode/decode package
  *
  * @notes: 	This module drives JSON library to encode and decode the AWS
- *         IoT messages 
+ *         IoT messages. Telemetry can also be encoded in CBOR.
  *  
  * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
  *
@@ -11,8 +11,28 @@
 #define AWSENCODE_H_
 
 #include <zephyr.h>
+#include "encoding/telemetry.h"
+#include "config/config.h"
+
+/*
+*   A value reported in the device shadow that is not an attribute of the config datastore
+*/
+struct aws_reported_val
+{
+    const char  *keyp;          // key in state.reported.attributes
+    const char  *strp;          // string value, NULL for an integer value
+    int32_t     val;            // integer value
+};
 
 void encoding_init(void);           
 void aws_decode_shadow_msg( char *msg_stringp, size_t len);
+int  aws_encode_telemetry(const struct tele_record *recsp, int num_recs, uint32_t period_s, char *bufp,
+                size_t buf_len, int *num_encodedp);
+int  aws_encode_telemetry_cbor(const struct tele_record *recsp, int num_recs, uint32_t period_s, uint8_t *bufp,
+                size_t buf_len, int *num_encodedp);
+int  aws_encode_reported(const struct dev_config_values *valuesp, uint32_t mask, const struct aws_reported_val *valsp,
+                int num_vals, char *bufp, size_t buf_len);
+void aws_encode_bench(int num_recs);
+void aws_decode_bench(void);
 
 #endif /* AWSENCODE_H_*/
\ No newline at end of file
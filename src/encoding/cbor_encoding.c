@@ -0,0 +1,376 @@
+/**
+ * @brief: 	cbor_encoding.c - CBOR encoding of telemetry published to AWS IoT
+ *
+ * @notes:  Same messages as the JSON encoding but in CBOR (RFC 8949) with small integer keys, so a record
+ *          takes about a third of the bytes. Encodes straight into the caller's buffer, no heap is used.
+ *          Records that don't fit are left for the next message. Picked with the pub_format attribute.
+ *
+ *          message:    { 0: schema version, 1: serial number, [2: period of a record in s, rollups only,]
+ *                        3: [_ record, record, ... ] }
+ *          record:     { 0: seq, 1: ts, 2: type, 3: val, [4: min, 5: max, 6: n, more than one sample only] }
+ *
+ *          The records array is indefinite length so records can be added until the buffer is full. The first
+ *          byte of a message is a map (0xa3 or 0xa4), never '{', so the cloud can tell the two formats apart.
+ *          Only add keys, bump the schema version if the meaning of one changes.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+
+// includes for application
+#include "encoding/aws_encoding.h"
+#include "config/config.h"
+
+LOG_MODULE_REGISTER(cbor_encoding);     // register the logging package
+
+#define TELE_CBOR_SCHEMA_VERSION    1
+
+// keys of the message map
+#define TELE_CBOR_KEY_VERSION       0
+#define TELE_CBOR_KEY_SN            1
+#define TELE_CBOR_KEY_PERIOD        2
+#define TELE_CBOR_KEY_RECS          3
+
+// keys of a record map
+#define TELE_CBOR_KEY_SEQ           0
+#define TELE_CBOR_KEY_TS            1
+#define TELE_CBOR_KEY_TYPE          2
+#define TELE_CBOR_KEY_VAL           3
+#define TELE_CBOR_KEY_MIN           4
+#define TELE_CBOR_KEY_MAX           5
+#define TELE_CBOR_KEY_N             6
+
+// major types and simple values used
+#define CBOR_MAJOR_UINT             0
+#define CBOR_MAJOR_NINT             1
+#define CBOR_MAJOR_TEXT             3
+#define CBOR_MAJOR_ARRAY            4
+#define CBOR_MAJOR_MAP              5
+#define CBOR_INDEFINITE             31      // additional info of an indefinite length item
+#define CBOR_BREAK                  0xff    // ends an indefinite length item
+
+#define ENCODE_BENCH_MAX_RECS       64      // records the benchmark can encode
+#define ENCODE_BENCH_LOOPS          20      // encodes timed per format
+#define ENCODE_BENCH_PERIOD_S       60      // period of the rollups encoded
+
+/*
+*   Where the message is being encoded. Writes past the end are not done, only flagged.
+*/
+struct cbor_buf
+{
+    uint8_t     *bufp;
+    size_t      len;
+    size_t      pos;
+    bool        overflow;
+};
+
+/**
+* @brief    cbor_put_byte - Append one byte
+*
+* @param    cbp     message being encoded
+* @param    byte    byte to append
+*
+* @return   none
+*/
+static inline void cbor_put_byte(struct cbor_buf *cbp, uint8_t byte)
+{
+    if (cbp->pos >= cbp->len)
+    {
+        cbp->overflow = true;
+        return;
+    }
+    cbp->bufp[cbp->pos++] = byte;
+}
+
+/**
+* @brief    cbor_put_head - Append the head of an item, the major type and its argument in the fewest bytes
+*
+* @param    cbp     message being encoded
+* @param    major   major type
+* @param    val     argument (value, length or number of items)
+*
+* @return   none
+*/
+static void cbor_put_head(struct cbor_buf *cbp, uint8_t major, uint32_t val)
+{
+    major <<= 5;
+
+    if (val < 24)
+    {
+        cbor_put_byte(cbp, major | val);
+    }
+    else if (val <= UINT8_MAX)
+    {
+        cbor_put_byte(cbp, major | 24);
+        cbor_put_byte(cbp, val);
+    }
+    else if (val <= UINT16_MAX)
+    {
+        cbor_put_byte(cbp, major | 25);
+        cbor_put_byte(cbp, val >> 8);
+        cbor_put_byte(cbp, val);
+    }
+    else
+    {
+        cbor_put_byte(cbp, major | 26);
+        cbor_put_byte(cbp, val >> 24);
+        cbor_put_byte(cbp, val >> 16);
+        cbor_put_byte(cbp, val >> 8);
+        cbor_put_byte(cbp, val);
+    }
+}
+
+/**
+* @brief    cbor_put_int - Append a signed integer
+*
+* @param    cbp     message being encoded
+* @param    val     value
+*
+* @return   none
+*/
+static void cbor_put_int(struct cbor_buf *cbp, int32_t val)
+{
+    if (val >= 0)
+        cbor_put_head(cbp, CBOR_MAJOR_UINT, val);
+    else
+        cbor_put_head(cbp, CBOR_MAJOR_NINT, (uint32_t)(-1 - val));
+}
+
+/**
+* @brief    cbor_put_text - Append a text string
+*
+* @param    cbp     message being encoded
+* @param    strp    null terminated string
+*
+* @return   none
+*/
+static void cbor_put_text(struct cbor_buf *cbp, const char *strp)
+{
+    size_t len = strlen(strp);
+
+    cbor_put_head(cbp, CBOR_MAJOR_TEXT, len);
+    if (cbp->pos + len > cbp->len)
+    {
+        cbp->overflow = true;
+        return;
+    }
+    memcpy(&cbp->bufp[cbp->pos], strp, len);
+    cbp->pos += len;
+}
+
+/**
+* @brief    cbor_encode_record - Encode one telemetry record as a CBOR map
+*
+* @param    cbp     message being encoded
+* @param    recp    record to encode
+*
+* @return   none
+*
+* @note     min, max and the count are only encoded for records covering more than one sample
+*/
+static void cbor_encode_record(struct cbor_buf *cbp, const struct tele_record *recp)
+{
+    cbor_put_head(cbp, CBOR_MAJOR_MAP, recp->count <= 1 ? 4 : 7);
+
+    cbor_put_int(cbp, TELE_CBOR_KEY_SEQ);
+    cbor_put_head(cbp, CBOR_MAJOR_UINT, recp->seq);
+    cbor_put_int(cbp, TELE_CBOR_KEY_TS);
+    cbor_put_head(cbp, CBOR_MAJOR_UINT, recp->timestamp);
+    cbor_put_int(cbp, TELE_CBOR_KEY_TYPE);
+    cbor_put_head(cbp, CBOR_MAJOR_UINT, recp->type);
+    cbor_put_int(cbp, TELE_CBOR_KEY_VAL);
+    cbor_put_int(cbp, recp->value);
+
+    if (recp->count <= 1)
+        return;
+
+    cbor_put_int(cbp, TELE_CBOR_KEY_MIN);
+    cbor_put_int(cbp, recp->min);
+    cbor_put_int(cbp, TELE_CBOR_KEY_MAX);
+    cbor_put_int(cbp, recp->max);
+    cbor_put_int(cbp, TELE_CBOR_KEY_N);
+    cbor_put_head(cbp, CBOR_MAJOR_UINT, recp->count);
+}
+
+/**
+* @brief    aws_encode_telemetry_cbor - Encode telemetry records into a CBOR message
+*
+* @param    recsp           records to encode, oldest first
+* @param    num_recs        number of records
+* @param    period_s        period each record covers for rollups, 0 for raw records
+* @param    bufp            buffer to encode into
+* @param    buf_len         size of the buffer
+* @param    num_encodedp    returns the number of records that fit in the message
+*
+* @return   length of the message, negative error code if not even one record fits
+*
+* @note     Same arguments as aws_encode_telemetry(). The message is binary, it is not null terminated.
+*/
+int aws_encode_telemetry_cbor(const struct tele_record *recsp, int num_recs, uint32_t period_s, uint8_t *bufp,
+                size_t buf_len, int *num_encodedp)
+{
+    struct cbor_buf cb;
+    size_t rec_pos;
+    int i;
+
+    *num_encodedp = 0;
+
+    // keep room for the break that ends the records array
+    if (buf_len < 1)
+        return -ENOMEM;
+    cb.bufp = bufp;
+    cb.len = buf_len - 1;
+    cb.pos = 0;
+    cb.overflow = false;
+
+    cbor_put_head(&cb, CBOR_MAJOR_MAP, period_s == 0 ? 3 : 4);
+    cbor_put_int(&cb, TELE_CBOR_KEY_VERSION);
+    cbor_put_int(&cb, TELE_CBOR_SCHEMA_VERSION);
+    cbor_put_int(&cb, TELE_CBOR_KEY_SN);
+    cbor_put_text(&cb, config_get_serial_number());
+    if (period_s != 0)
+    {
+        cbor_put_int(&cb, TELE_CBOR_KEY_PERIOD);
+        cbor_put_head(&cb, CBOR_MAJOR_UINT, period_s);
+    }
+    cbor_put_int(&cb, TELE_CBOR_KEY_RECS);
+    cbor_put_byte(&cb, (CBOR_MAJOR_ARRAY << 5) | CBOR_INDEFINITE);
+    if (cb.overflow)
+        return -ENOMEM;
+
+    for (i = 0; i < num_recs; i++)
+    {
+        rec_pos = cb.pos;
+        cbor_encode_record(&cb, &recsp[i]);
+        if (cb.overflow)
+        {
+            // did not fit, leave the record for the next message
+            cb.pos = rec_pos;
+            break;
+        }
+    }
+
+    if (i == 0)
+        return -ENOMEM;
+
+    // the room was kept for it
+    bufp[cb.pos++] = CBOR_BREAK;
+
+    *num_encodedp = i;
+    return cb.pos;
+}
+
+/**
+* @brief    aws_encode_bench_one - Time the encoding of a batch of records in one format
+*
+* @param    format      enum pub_format
+* @param    recsp       records to encode
+* @param    num_recs    number of records
+* @param    period_s    period of a record, 0 for raw records
+* @param    bufp        buffer to encode into, CONFIG_TELEMETRY_PAYLOAD_BUFFER_SIZE bytes
+*
+* @return   none
+*/
+static void aws_encode_bench_one(enum pub_format format, const struct tele_record *recsp, int num_recs,
+                uint32_t period_s, char *bufp)
+{
+    uint32_t start_cyc, cyc;
+    int num_encoded = 0;
+    int len = 0;
+    int i;
+
+    start_cyc = k_cycle_get_32();
+    for (i = 0; i < ENCODE_BENCH_LOOPS; i++)
+    {
+        if (format == PUB_FORMAT_CBOR)
+            len = aws_encode_telemetry_cbor(recsp, num_recs, period_s, (uint8_t *)bufp,
+                        CONFIG_TELEMETRY_PAYLOAD_BUFFER_SIZE, &num_encoded);
+        else
+            len = aws_encode_telemetry(recsp, num_recs, period_s, bufp, CONFIG_TELEMETRY_PAYLOAD_BUFFER_SIZE,
+                        &num_encoded);
+    }
+    cyc = k_cycle_get_32() - start_cyc;
+
+    if (len < 0)
+    {
+        printk("%-6s %-6s encode failed: %d\n", format == PUB_FORMAT_CBOR ? "CBOR" : "JSON",
+            period_s ? "rollup" : "raw", len);
+        return;
+    }
+
+    printk("%-6s %-6s %5d bytes, %3d records, %3d bytes/record, %5u us/message\n",
+        format == PUB_FORMAT_CBOR ? "CBOR" : "JSON", period_s ? "rollup" : "raw", len, num_encoded,
+        len / num_encoded, k_cyc_to_us_floor32(cyc) / ENCODE_BENCH_LOOPS);
+}
+
+/**
+* @brief    aws_encode_bench - Compare the size and encode time of the JSON and CBOR messages
+*
+* @param    num_recs    number of records to encode
+*
+* @return   none
+*
+* @note     Typical records: a distance, the battery and the RSRP every 20 s, raw and as minute rollups.
+*           One message is the size of the payload buffer so the records per message are compared as well.
+*/
+void aws_encode_bench(int num_recs)
+{
+    static struct tele_record recs[ENCODE_BENCH_MAX_RECS];
+    static char buf[CONFIG_TELEMETRY_PAYLOAD_BUFFER_SIZE];
+    struct tele_record *recp;
+    int i;
+
+    num_recs = MAX(MIN(num_recs, ENCODE_BENCH_MAX_RECS), 1);
+
+    for (i = 0; i < num_recs; i++)
+    {
+        recp = &recs[i];
+        recp->seq = 120000 + i;
+        recp->timestamp = 1690000000 + (i / 3) * 20;
+        recp->count = 1;
+
+        switch (i % 3)
+        {
+            case 0:
+            recp->type = TELE_TYPE_DISTANCE_MM;
+            recp->value = 1520 + (i % 7) * 3;
+            break;
+
+            case 1:
+            recp->type = TELE_TYPE_BATTERY_MV;
+            recp->value = 3612 - i / 3;
+            break;
+
+            default:
+            recp->type = TELE_TYPE_RSRP_DBM;
+            recp->value = -97 - (i % 5);
+            break;
+        }
+        recp->min = recp->value;
+        recp->max = recp->value;
+    }
+
+    printk("\nEncoding benchmark, %d records, %d byte payload buffer:\n\n", num_recs,
+        CONFIG_TELEMETRY_PAYLOAD_BUFFER_SIZE);
+
+    aws_encode_bench_one(PUB_FORMAT_JSON, recs, num_recs, 0, buf);
+    aws_encode_bench_one(PUB_FORMAT_CBOR, recs, num_recs, 0, buf);
+
+    // same records as minute rollups of 3 samples
+    for (i = 0; i < num_recs; i++)
+    {
+        recp = &recs[i];
+        recp->timestamp -= recp->timestamp % ENCODE_BENCH_PERIOD_S;
+        recp->count = 3;
+        recp->min = recp->value - 4;
+        recp->max = recp->value + 2;
+    }
+
+    aws_encode_bench_one(PUB_FORMAT_JSON, recs, num_recs, ENCODE_BENCH_PERIOD_S, buf);
+    aws_encode_bench_one(PUB_FORMAT_CBOR, recs, num_recs, ENCODE_BENCH_PERIOD_S, buf);
+}
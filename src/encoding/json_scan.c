@@ -0,0 +1,615 @@
+/**
+ * @brief: 	json_scan.c - In-place JSON scanner
+ *
+ * @notes:  Walks a JSON document (RFC 8259) where it lies, the MQTT receive buffer for a shadow message, without
+ *          building a tree, allocating or writing to the document. The caller moves through it one value at a
+ *          time: enter an object, go through its members, read the values it wants and skip the others.
+ *          Skipping a value checks it fully, so walking the whole document once also validates it.
+ *
+ *          Strings are handed back as they are in the document, json_str_copy() takes the escapes out. Keys
+ *          are compared as written, a key spelt with escapes does not match.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <string.h>
+
+// includes for application
+#include "encoding/json_scan.h"
+
+/*
+*   What json_scan_skip() expects next
+*/
+enum json_skip_state
+{
+    JSON_SKIP_VALUE,                // a value
+    JSON_SKIP_VALUE_OR_END,         // a value or the end of the array just opened
+    JSON_SKIP_KEY,                  // the key of a member
+    JSON_SKIP_KEY_OR_END,           // the key of a member or the end of the object just opened
+    JSON_SKIP_AFTER_VALUE           // a comma or the end of the object or array
+};
+
+/**
+* @brief    json_scan_ws - Move past white space
+*
+* @param    scanp   position in the document
+*
+* @return   none
+*/
+static inline void json_scan_ws(struct json_scan *scanp)
+{
+    while (scanp->posp < scanp->endp &&
+            (*scanp->posp == ' ' || *scanp->posp == '\t' || *scanp->posp == '\n' || *scanp->posp == '\r'))
+        scanp->posp++;
+}
+
+/**
+* @brief    json_scan_char - Take the next character if it is the one expected, after white space
+*
+* @param    scanp   position in the document
+* @param    c       character expected
+*
+* @return   true if it was taken
+*/
+static inline bool json_scan_char(struct json_scan *scanp, char c)
+{
+    json_scan_ws(scanp);
+    if (scanp->posp < scanp->endp && *scanp->posp == c)
+    {
+        scanp->posp++;
+        return true;
+    }
+    return false;
+}
+
+/**
+* @brief    json_hex - Value of a hex digit
+*
+* @param    c   the digit
+*
+* @return   0 to 15, negative if not a hex digit
+*/
+static int json_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+* @brief    json_scan_literal - Move past true, false or null
+*
+* @param    scanp   position in the document, on the literal
+* @param    litp    the literal expected
+*
+* @return   0 on success, -EBADMSG if it is not there
+*/
+static int json_scan_literal(struct json_scan *scanp, const char *litp)
+{
+    size_t len = strlen(litp);
+
+    if (scanp->endp - scanp->posp < len || memcmp(scanp->posp, litp, len) != 0)
+        return -EBADMSG;
+    scanp->posp += len;
+    return 0;
+}
+
+/**
+* @brief    json_scan_number - Move past a number, checking it
+*
+* @param    scanp   position in the document, on the number
+*
+* @return   0 on success, -EBADMSG if it is not a valid number
+*/
+static int json_scan_number(struct json_scan *scanp)
+{
+    const char *p = scanp->posp;
+    const char *endp = scanp->endp;
+
+    if (p < endp && *p == '-')
+        p++;
+
+    // no leading zeros
+    if (p < endp && *p == '0')
+        p++;
+    else if (p < endp && *p >= '1' && *p <= '9')
+        while (p < endp && *p >= '0' && *p <= '9')
+            p++;
+    else
+        return -EBADMSG;
+
+    if (p < endp && *p == '.')
+    {
+        if (++p >= endp || *p < '0' || *p > '9')
+            return -EBADMSG;
+        while (p < endp && *p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (p < endp && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        if (p < endp && (*p == '+' || *p == '-'))
+            p++;
+        if (p >= endp || *p < '0' || *p > '9')
+            return -EBADMSG;
+        while (p < endp && *p >= '0' && *p <= '9')
+            p++;
+    }
+
+    scanp->posp = p;
+    return 0;
+}
+
+/**
+* @brief    json_scan_string - Move past a string, checking it
+*
+* @param    scanp   position in the document, on the opening quote
+* @param    strp    returns the string between the quotes, may be NULL
+*
+* @return   0 on success, -EBADMSG if it is not a valid string
+*/
+static int json_scan_string(struct json_scan *scanp, struct json_str *strp)
+{
+    const char *p = scanp->posp + 1;
+    const char *startp = p;
+    int i;
+
+    while (p < scanp->endp && *p != '"')
+    {
+        if ((uint8_t)*p < 0x20)
+            return -EBADMSG;
+
+        if (*p++ != '\\')
+            continue;
+
+        if (p >= scanp->endp)
+            return -EBADMSG;
+
+        switch (*p++)
+        {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            break;
+
+            case 'u':
+            for (i = 0; i < 4; i++)
+            {
+                if (p >= scanp->endp || json_hex(*p++) < 0)
+                    return -EBADMSG;
+            }
+            break;
+
+            default:
+            return -EBADMSG;
+        }
+    }
+
+    if (p >= scanp->endp)
+        return -EBADMSG;
+
+    if (strp)
+    {
+        strp->strp = startp;
+        strp->len = p - startp;
+    }
+    scanp->posp = p + 1;
+    return 0;
+}
+
+/**
+* @brief    json_scan_init - Start scanning a document
+*
+* @param    scanp   returns the position at the start of the document
+* @param    bufp    the document, does not need a null
+* @param    len     length of the document
+*
+* @return   none
+*/
+void json_scan_init(struct json_scan *scanp, const char *bufp, size_t len)
+{
+    scanp->posp = bufp;
+    scanp->endp = bufp + len;
+}
+
+/**
+* @brief    json_scan_peek - Type of the next value, without moving past it
+*
+* @param    scanp   position in the document, moved past white space
+*
+* @return   type of the value, JSON_TYPE_INVALID if there is no value there
+*
+* @note     Only the first character is looked at, the value itself is checked when read or skipped
+*/
+enum json_type json_scan_peek(struct json_scan *scanp)
+{
+    json_scan_ws(scanp);
+    if (scanp->posp >= scanp->endp)
+        return JSON_TYPE_INVALID;
+
+    switch (*scanp->posp)
+    {
+        case '{':
+        return JSON_TYPE_OBJECT;
+
+        case '[':
+        return JSON_TYPE_ARRAY;
+
+        case '"':
+        return JSON_TYPE_STRING;
+
+        case 't':
+        return JSON_TYPE_TRUE;
+
+        case 'f':
+        return JSON_TYPE_FALSE;
+
+        case 'n':
+        return JSON_TYPE_NULL;
+
+        default:
+        if (*scanp->posp == '-' || (*scanp->posp >= '0' && *scanp->posp <= '9'))
+            return JSON_TYPE_NUMBER;
+        return JSON_TYPE_INVALID;
+    }
+}
+
+/**
+* @brief    json_scan_skip - Move past the next value, checking all of it
+*
+* @param    scanp   position in the document
+*
+* @return   0 on success, -EBADMSG if the value is not valid JSON, -E2BIG if it nests too deep
+*
+* @note     No recursion, what is open is a bit per level (set for an object)
+*/
+int json_scan_skip(struct json_scan *scanp)
+{
+    enum json_skip_state state = JSON_SKIP_VALUE;
+    uint32_t objects = 0;
+    int depth = 0;
+    int err = 0;
+
+    while (1)
+    {
+        json_scan_ws(scanp);
+        if (scanp->posp >= scanp->endp)
+            return -EBADMSG;
+
+        switch (state)
+        {
+            case JSON_SKIP_VALUE_OR_END:
+            if (*scanp->posp == ']')
+            {
+                scanp->posp++;
+                depth--;
+                state = JSON_SKIP_AFTER_VALUE;
+                break;
+            }
+            // fall through
+
+            case JSON_SKIP_VALUE:
+            switch (json_scan_peek(scanp))
+            {
+                case JSON_TYPE_OBJECT:
+                case JSON_TYPE_ARRAY:
+                if (depth >= JSON_SCAN_MAX_DEPTH)
+                    return -E2BIG;
+                WRITE_BIT(objects, depth, *scanp->posp == '{');
+                depth++;
+                state = *scanp->posp == '{' ? JSON_SKIP_KEY_OR_END : JSON_SKIP_VALUE_OR_END;
+                scanp->posp++;
+                continue;
+
+                case JSON_TYPE_STRING:
+                err = json_scan_string(scanp, NULL);
+                break;
+
+                case JSON_TYPE_NUMBER:
+                err = json_scan_number(scanp);
+                break;
+
+                case JSON_TYPE_TRUE:
+                err = json_scan_literal(scanp, "true");
+                break;
+
+                case JSON_TYPE_FALSE:
+                err = json_scan_literal(scanp, "false");
+                break;
+
+                case JSON_TYPE_NULL:
+                err = json_scan_literal(scanp, "null");
+                break;
+
+                default:
+                return -EBADMSG;
+            }
+            if (err)
+                return err;
+            state = JSON_SKIP_AFTER_VALUE;
+            break;
+
+            case JSON_SKIP_KEY_OR_END:
+            if (*scanp->posp == '}')
+            {
+                scanp->posp++;
+                depth--;
+                state = JSON_SKIP_AFTER_VALUE;
+                break;
+            }
+            // fall through
+
+            case JSON_SKIP_KEY:
+            if (*scanp->posp != '"' || json_scan_string(scanp, NULL) || !json_scan_char(scanp, ':'))
+                return -EBADMSG;
+            state = JSON_SKIP_VALUE;
+            break;
+
+            case JSON_SKIP_AFTER_VALUE:
+            if (*scanp->posp == ',')
+            {
+                state = (objects & BIT(depth - 1)) ? JSON_SKIP_KEY : JSON_SKIP_VALUE;
+            }
+            else if (*scanp->posp == ((objects & BIT(depth - 1)) ? '}' : ']'))
+            {
+                depth--;
+            }
+            else
+            {
+                return -EBADMSG;
+            }
+            scanp->posp++;
+            break;
+        }
+
+        if (state == JSON_SKIP_AFTER_VALUE && depth == 0)
+            return 0;
+    }
+}
+
+/**
+* @brief    json_scan_object - Enter the object that is the next value
+*
+* @param    scanp   position in the document, moved inside the object
+*
+* @return   0 on success, -ENOMSG if the next value is not an object
+*
+* @note     Go through the members with json_scan_member()
+*/
+int json_scan_object(struct json_scan *scanp)
+{
+    return json_scan_char(scanp, '{') ? 0 : -ENOMSG;
+}
+
+/**
+* @brief    json_scan_member - Move to the value of the next member of the object entered
+*
+* @param    scanp   position in the document, inside the object
+* @param    indexp  number of members gone through, set to 0 after entering the object
+* @param    keyp    returns the key of the member
+*
+* @return   1 if positioned on the value of a member, 0 past the end of the object, -EBADMSG if not valid JSON
+*
+* @note     The value of the member has to be read or skipped before asking for the next one
+*/
+int json_scan_member(struct json_scan *scanp, int *indexp, struct json_str *keyp)
+{
+    if (json_scan_char(scanp, '}'))
+        return 0;
+
+    if (*indexp > 0 && !json_scan_char(scanp, ','))
+        return -EBADMSG;
+
+    if (json_scan_peek(scanp) != JSON_TYPE_STRING || json_scan_string(scanp, keyp) || !json_scan_char(scanp, ':'))
+        return -EBADMSG;
+
+    (*indexp)++;
+    return 1;
+}
+
+/**
+* @brief    json_scan_int - Read the next value as an integer
+*
+* @param    scanp   position in the document, moved past the value
+* @param    valp    returns the value, a fraction is cut off and values out of range are pegged
+*
+* @return   0 on success, -ENOMSG if the value is valid but not a number (skipped), -EINVAL if the number
+*           has an exponent, -EBADMSG if not valid JSON
+*/
+int json_scan_int(struct json_scan *scanp, int32_t *valp)
+{
+    const char *p;
+    bool negative = false;
+    int64_t val = 0;
+    int err;
+
+    if (json_scan_peek(scanp) != JSON_TYPE_NUMBER)
+    {
+        err = json_scan_skip(scanp);
+        return err ? err : -ENOMSG;
+    }
+
+    p = scanp->posp;
+    err = json_scan_number(scanp);
+    if (err)
+        return err;
+
+    if (*p == '-')
+    {
+        negative = true;
+        p++;
+    }
+
+    for (; p < scanp->posp && *p >= '0' && *p <= '9'; p++)
+        val = MIN(val * 10 + (*p - '0'), (int64_t)INT32_MAX + 1);
+
+    for (; p < scanp->posp; p++)
+    {
+        if (*p == 'e' || *p == 'E')
+            return -EINVAL;
+    }
+
+    if (negative)
+        val = -val;
+    *valp = (int32_t)MAX(MIN(val, INT32_MAX), INT32_MIN);
+    return 0;
+}
+
+/**
+* @brief    json_scan_str - Read the next value as a string
+*
+* @param    scanp   position in the document, moved past the value
+* @param    strp    returns the string as it is in the document
+*
+* @return   0 on success, -ENOMSG if the value is valid but not a string (skipped), -EBADMSG if not valid JSON
+*/
+int json_scan_str(struct json_scan *scanp, struct json_str *strp)
+{
+    int err;
+
+    if (json_scan_peek(scanp) != JSON_TYPE_STRING)
+    {
+        err = json_scan_skip(scanp);
+        return err ? err : -ENOMSG;
+    }
+
+    return json_scan_string(scanp, strp);
+}
+
+/**
+* @brief    json_scan_end - Check nothing but white space follows
+*
+* @param    scanp   position in the document, after the top value
+*
+* @return   0 if at the end of the document, -EBADMSG otherwise
+*/
+int json_scan_end(struct json_scan *scanp)
+{
+    json_scan_ws(scanp);
+    return scanp->posp == scanp->endp ? 0 : -EBADMSG;
+}
+
+/**
+* @brief    json_str_copy - Copy a string out of the document, taking the escapes out
+*
+* @param    strp    string returned by json_scan_str()
+* @param    bufp    where to copy, null terminated
+* @param    buf_len size of the buffer
+*
+* @return   length of the string, -ENOMEM if it does not fit
+*
+* @note     The string was checked when scanned. A \u escape is written in UTF-8, a lone surrogate as U+FFFD.
+*/
+int json_str_copy(const struct json_str *strp, char *bufp, size_t buf_len)
+{
+    const char *p = strp->strp;
+    const char *endp = strp->strp + strp->len;
+    uint32_t cp, low;
+    size_t pos = 0;
+    char c;
+
+    while (p < endp)
+    {
+        // keep room for the null
+        if (pos + 1 >= buf_len)
+            return -ENOMEM;
+
+        c = *p++;
+        if (c != '\\')
+        {
+            bufp[pos++] = c;
+            continue;
+        }
+
+        c = *p++;
+        switch (c)
+        {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': break;
+            default: break;     // " \ and / stand for themselves
+        }
+
+        if (c != 'u')
+        {
+            bufp[pos++] = c;
+            continue;
+        }
+
+        cp = json_hex(p[0]) << 12 | json_hex(p[1]) << 8 | json_hex(p[2]) << 4 | json_hex(p[3]);
+        p += 4;
+
+        if (cp >= 0xd800 && cp <= 0xdbff && endp - p >= 6 && p[0] == '\\' && p[1] == 'u')
+        {
+            low = json_hex(p[2]) << 12 | json_hex(p[3]) << 8 | json_hex(p[4]) << 4 | json_hex(p[5]);
+            if (low >= 0xdc00 && low <= 0xdfff)
+            {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                p += 6;
+            }
+        }
+        if (cp >= 0xd800 && cp <= 0xdfff)
+            cp = 0xfffd;
+
+        // up to 4 bytes of UTF-8 and the null
+        if (pos + 5 > buf_len)
+            return -ENOMEM;
+
+        if (cp < 0x80)
+        {
+            bufp[pos++] = cp;
+        }
+        else if (cp < 0x800)
+        {
+            bufp[pos++] = 0xc0 | (cp >> 6);
+            bufp[pos++] = 0x80 | (cp & 0x3f);
+        }
+        else if (cp < 0x10000)
+        {
+            bufp[pos++] = 0xe0 | (cp >> 12);
+            bufp[pos++] = 0x80 | ((cp >> 6) & 0x3f);
+            bufp[pos++] = 0x80 | (cp & 0x3f);
+        }
+        else
+        {
+            bufp[pos++] = 0xf0 | (cp >> 18);
+            bufp[pos++] = 0x80 | ((cp >> 12) & 0x3f);
+            bufp[pos++] = 0x80 | ((cp >> 6) & 0x3f);
+            bufp[pos++] = 0x80 | (cp & 0x3f);
+        }
+    }
+
+    if (pos >= buf_len)
+        return -ENOMEM;
+
+    bufp[pos] = '\0';
+    return pos;
+}
+
+/**
+* @brief    json_str_cmp - Compare a string of the document with a C string, as written
+*
+* @param    strp    string of the document
+* @param    cstrp   null terminated string
+*
+* @return   <0, 0 or >0 like strcmp()
+*/
+int json_str_cmp(const struct json_str *strp, const char *cstrp)
+{
+    int cmp = strncmp(strp->strp, cstrp, strp->len);
+
+    if (cmp != 0)
+        return cmp;
+
+    // same start, the shorter one goes first
+    return cstrp[strp->len] == '\0' ? 0 : -1;
+}
@@ -0,0 +1,60 @@
+/**
+ * @brief: 	json_scan.h - External definitions for the in-place JSON scanner
+ *
+ * @notes: 	See json_scan.c for more information
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef JSON_SCAN_H_
+#define JSON_SCAN_H_
+
+#include <zephyr.h>
+
+#define JSON_SCAN_MAX_DEPTH     32      // nesting of objects and arrays a document may have
+
+/*
+*   Position in a JSON document. Plain data, copy it to come back to a value later.
+*/
+struct json_scan
+{
+    const char  *posp;              // next character to scan
+    const char  *endp;              // end of the document
+};
+
+/*
+*   A string as it is in the document, between the quotes and with its escapes
+*/
+struct json_str
+{
+    const char  *strp;
+    size_t      len;
+};
+
+/*
+*   Type of a value, from its first character
+*/
+enum json_type
+{
+    JSON_TYPE_INVALID = 0,
+    JSON_TYPE_OBJECT,
+    JSON_TYPE_ARRAY,
+    JSON_TYPE_STRING,
+    JSON_TYPE_NUMBER,
+    JSON_TYPE_TRUE,
+    JSON_TYPE_FALSE,
+    JSON_TYPE_NULL
+};
+
+void            json_scan_init(struct json_scan *scanp, const char *bufp, size_t len);
+enum json_type  json_scan_peek(struct json_scan *scanp);
+int             json_scan_skip(struct json_scan *scanp);
+int             json_scan_object(struct json_scan *scanp);
+int             json_scan_member(struct json_scan *scanp, int *indexp, struct json_str *keyp);
+int             json_scan_int(struct json_scan *scanp, int32_t *valp);
+int             json_scan_str(struct json_scan *scanp, struct json_str *strp);
+int             json_scan_end(struct json_scan *scanp);
+int             json_str_copy(const struct json_str *strp, char *bufp, size_t buf_len);
+int             json_str_cmp(const struct json_str *strp, const char *cstrp);
+
+#endif /* JSON_SCAN_H_ */
@@ -0,0 +1,44 @@
+/**
+ * @brief: 	telemetry.h - Definition of the telemetry records produced by the device
+ *
+ * @notes: 	A telemetry record is the unit that is buffered in the telemetry log (see storage/tele_log.c)
+ *          and published to the cloud. Records are fixed size so the log can store them without any
+ *          filesystem metadata.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <zephyr.h>
+
+/*
+*   What a record is measuring. Values are stored in flash and published, only append new types.
+*/
+enum tele_rec_type
+{
+    TELE_TYPE_UNKNOWN = 0,
+    TELE_TYPE_BATTERY_MV,           // battery voltage in mV
+    TELE_TYPE_ALARM_THRESHOLD,      // a level crossed its alarm threshold, value is the level
+    TELE_TYPE_ALARM_TAMPER,         // the enclosure was opened, value is the tamper input
+    TELE_TYPE_DISTANCE_MM,          // distance to the surface measured by the level sensor in mm
+    TELE_TYPE_RSRP_DBM,             // LTE reference signal received power in dBm
+    TELE_TYPE_NUM
+};
+
+/*
+*   A telemetry record. For a single sample min, max and value are the same and count is 1.
+*/
+struct tele_record
+{
+    uint32_t    seq;                // sequence number, assigned by the telemetry log
+    uint32_t    timestamp;          // unix time in seconds, 0 if the time was not known yet
+    uint16_t    type;               // enum tele_rec_type
+    uint16_t    count;              // number of samples the record covers
+    int32_t     value;              // value of the sample (mean if more than one sample)
+    int32_t     min;                // smallest sample
+    int32_t     max;                // largest sample
+} __packed;
+
+#endif /* TELEMETRY_H_ */
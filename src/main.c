@@ -18,9 +18,35 @@
 #include "cell/lte_connect_mgr.h"		// LTE connection manager
 #include "connectors/aws_connector.h"	// AWS connector 
 #include "bsp/led.h"
+#include "bsp/spi_sched.h"				// scheduler of the shared SPI bus
+#include "bsp/ext_flash.h"				// deep power-down of the external flash
+#include "sensors/battery.h"			// battery voltage, logged as telemetry
+#include "storage/tele_log.h"			// store-and-forward telemetry log
+#include "storage/sd_capture.h"			// raw data capture to the SD card
 
 LOG_MODULE_REGISTER(main); // set the logging package name
 
+static k_tid_t main_tid;		// the main loop, woken up when its interval changes
+
+/** 
+* @brief	main_config_changed - Apply configuration changes received from the device shadow
+*
+* @param	changed_mask	attributes that changed value
+* @param	userp			not used
+*		
+* @return	none
+*
+* @note		Runs on the system work queue. Changes are applied on the fly, no reboot (see issue #7).
+*			The main loop sleeps for the old interval, wake it up so the new one applies right away.
+*			The publish interval is the connector's, it subscribes to it on its own.
+*/
+static void main_config_changed(uint32_t changed_mask, void *userp)
+{
+	LOG_INF("New data acquisition interval: %d s", config_get_int16(DEV_CONFIG_DAQ_INTERVAL_S));
+
+	k_wakeup(main_tid);
+}
+
 /** 
 * @brief	main - main application function called from OS at start-up 
 *
@@ -52,8 +78,30 @@ void main(void)
 	*/
 	modem_info_init();
 
+#if defined(CONFIG_EXT_FLASH_PM)
+	// before anything touches the external flash, it sleeps whenever nobody uses it
+	ext_flash_init();
+#endif
+
 	// init the config datastore as the datastore is required by the rest of the system
 	config_init();
+	main_tid = k_current_get();
+	config_subscribe(DEV_CONFIG_MASK(DEV_CONFIG_DAQ_INTERVAL_S), main_config_changed, NULL);
+
+#if defined(CONFIG_SPI_SCHED)
+	// the telemetry log and the SD card only use the bus through the scheduler
+	spi_sched_init();
+#endif
+
+#if defined(CONFIG_TELE_LOG)
+	// the telemetry log takes over the littlefs the datastore was on, config_init() has migrated off it by now
+	tele_log_init();
+#endif
+
+#if defined(CONFIG_SD_CAPTURE)
+	// the card is optional, captures are refused without one
+	sd_capture_init();
+#endif
 
 	// Initialize the Encode/Decode package
 	encoding_init();
@@ -75,7 +123,7 @@ void main(void)
 	aws_connector_init();
 
 	/* 
-	* One day, start up the application threads here
+	* One day, start up the application threads here, they subscribe to app_type to switch it on the fly
 	*/
 	
 	/*
@@ -83,12 +131,21 @@ void main(void)
 	*/
 	while (1)
 	{
-		k_msleep(60 * 1000);					// sleep for 60 seconds
+		// sleep for the data acquisition interval, read every time and cut short by main_config_changed()
+		// so a new interval from the shadow applies right away
+		k_sleep(K_SECONDS(config_get_int16(DEV_CONFIG_DAQ_INTERVAL_S)));
 		
 		// get the current time so we can output it
 		// err = date_time_now(&current_time);
 		LOG_DBG("Main loop pulse");
 
+#if defined(CONFIG_TELE_LOG)
+		// until the application threads exist, log the battery voltage so there is telemetry to forward
+		int16_t batt_mv = sensor_get_battery_mV();
+
+		if (batt_mv > 0)
+			tele_log_append_sample(TELE_TYPE_BATTERY_MV, batt_mv);
+#endif
 	}
 
 }
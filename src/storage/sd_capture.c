@@ -0,0 +1,743 @@
+/**
+ * @brief: 	sd_capture.c - Raw data capture to the SD card
+ *
+ * @notes:  Captures raw sensor streams (audio, vibration) to the SD card for minutes at a time. The card is
+ *          used raw through disk_access, see sd_capture_internal.h for the container layout: a directory
+ *          sector and one contiguous extent per capture, reserved when the capture starts.
+ *
+ *          The producer copies samples into one of two block buffers while the other is sent to the card as
+ *          a single multi-block write (CMD25), so the SPI transfer overlaps the next block being filled. A
+ *          full buffer is queued straight to the SPI scheduler, at high priority as the card shares spi3
+ *          with the W25Q32JV, so a second full buffer is written back to back with the first. If the card
+ *          falls behind and both buffers are full the new data is dropped and counted, the producer never
+ *          waits.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+#include <string.h>
+#include <sys/crc.h>
+#include <storage/disk_access.h>
+#include <date_time.h>
+
+// includes for application
+#include "bsp/spi_sched.h"
+#include "sd_capture.h"
+#include "sd_capture_internal.h"
+
+LOG_MODULE_REGISTER(sd_capture);    // register with logging package
+
+/*
+*   Internal defines for the capture buffers
+*/
+#define SD_CAP_NUM_BUFS             2
+#define SD_CAP_BLOCK_SIZE           (CONFIG_SD_CAPTURE_BLOCK_SECTORS * SD_CAP_SECTOR_SIZE)
+#define SD_CAP_HDR_SIZE             sizeof(struct sd_cap_block_hdr)
+#define SD_CAP_PAYLOAD_SIZE         (SD_CAP_BLOCK_SIZE - SD_CAP_HDR_SIZE)
+
+#define SD_CAP_STOP_TIMEOUT_S       5
+
+#define SD_CAP_BENCH_CHUNK          256     // bytes per sd_capture_write() in the benchmark
+#define SD_CAP_BENCH_MAX_BPS        (5 * 1024 * 1024)   // 40 MHz SPI, no capture can go faster
+
+/*
+*   State of the capture
+*/
+enum sd_cap_state {
+    SD_CAP_IDLE,
+    SD_CAP_RUNNING,
+    SD_CAP_STOPPING
+};
+
+/*
+*   Statistics of the SD capture
+*/
+struct sd_cap_stats {
+    uint32_t    captures;           // captures started
+    uint32_t    blocks_written;     // multi-block writes done
+    uint32_t    write_errors;       // failed block writes
+    uint32_t    bytes_written;      // captured bytes written to the card
+    uint32_t    dropped;            // captured bytes dropped because both buffers were full
+    uint32_t    max_write_us;       // slowest block write
+    uint64_t    write_cycles;       // time spent in block writes, including waiting on the SPI
+
+    // results of the last capture
+    uint32_t    last_bytes;
+    uint32_t    last_ms;
+    uint32_t    last_sched_us;      // cpu time of the SPI scheduler, which does the block writes
+    uint32_t    last_copy_us;       // cpu time of the producer copying into the buffers
+};
+
+/*
+*   SD capture control block
+*/
+struct sd_cap_blk {
+    bool        ready;              // the card is there
+    bool        formatted;          // the card holds a valid container
+    uint32_t    card_sectors;
+    uint32_t    data_start;         // first sector of the first extent
+
+    enum sd_cap_state state;
+    int         capture;            // directory entry of the capture in progress
+    uint32_t    max_blocks;         // blocks reserved for it
+    int64_t     start_ms;
+    uint64_t    start_sched_cycles;
+
+    // producer side, only used by the one thread writing to the capture
+    int         fill_buf;           // buffer being filled, -1 if both are waiting to be written
+    uint32_t    fill_len;           // bytes in the buffer after the header
+    uint32_t    fill_uptime_ms;
+    uint32_t    next_seq;           // sequence number of the next block queued
+    uint32_t    dropped;            // bytes dropped since the last block was queued
+    uint64_t    copy_cycles;
+
+    // buffers queued to the SPI scheduler or being written
+    struct k_spinlock buf_lock;
+    bool        buf_busy[SD_CAP_NUM_BUFS];
+
+    struct spi_sched_req write_reqs[SD_CAP_NUM_BUFS];  // one per buffer
+    struct spi_sched_req close_req; // queued behind the last block to close the capture
+    struct k_sem    stop_sem;       // the capture is closed
+
+    struct sd_cap_stats stats;
+};
+
+// allocate storage for the control block
+static struct sd_cap_blk cap_cblk;
+
+// the block buffers, and the directory as written to the card
+static uint8_t __aligned(4) cap_bufs[SD_CAP_NUM_BUFS][SD_CAP_BLOCK_SIZE];
+static union {
+    struct sd_cap_dir dir;
+    uint8_t sector[SD_CAP_SECTOR_SIZE];
+} __aligned(4) dir_sector;
+
+/**
+* @brief    sd_cap_dir_write_fn - Write the directory to the card
+*
+* @param    argp    not used
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Runs in the SPI scheduler thread
+*/
+static int sd_cap_dir_write_fn(void *argp)
+{
+    struct sd_cap_dir *dirp = &dir_sector.dir;
+    int err;
+
+    dirp->crc = crc32_ieee((const uint8_t *)dirp, offsetof(struct sd_cap_dir, crc));
+
+    err = disk_access_write(CONFIG_SD_CAPTURE_DISK_NAME, dir_sector.sector, CONFIG_SD_CAPTURE_START_SECTOR, 1);
+    if (err == 0)
+        err = disk_access_ioctl(CONFIG_SD_CAPTURE_DISK_NAME, DISK_IOCTL_CTRL_SYNC, NULL);
+
+    if (err)
+        LOG_ERR("Unable to write the capture directory: %d", err);
+
+    return err;
+}
+
+/**
+* @brief    sd_cap_dir_write - Write the directory to the card through the SPI scheduler and wait for it
+*
+* @param    none
+*
+* @return   0 on success, negative error code otherwise
+*/
+static int sd_cap_dir_write(void)
+{
+    return spi_sched_run(SPI_SCHED_DEV_SD, SPI_SCHED_PRIO_HIGH, sd_cap_dir_write_fn, NULL);
+}
+
+/**
+* @brief    sd_cap_dir_valid - Check the directory read from the card
+*
+* @param    none
+*
+* @return   true if it is a container this firmware can append to
+*/
+static bool sd_cap_dir_valid(void)
+{
+    struct sd_cap_dir *dirp = &dir_sector.dir;
+
+    return dirp->magic == SD_CAP_DIR_MAGIC
+        && dirp->version == SD_CAP_VERSION
+        && dirp->block_sectors == CONFIG_SD_CAPTURE_BLOCK_SECTORS
+        && dirp->num_entries <= SD_CAP_MAX_CAPTURES
+        && dirp->crc == crc32_ieee((const uint8_t *)dirp, offsetof(struct sd_cap_dir, crc));
+}
+
+/**
+* @brief    sd_cap_queue_buf - Hand the buffer being filled to the writer
+*
+* @param    cblkp   control block
+*
+* @return   none
+*
+* @note     Producer side. Fills in the block header, the SPI scheduler only writes the buffer out.
+*/
+static void sd_cap_queue_buf(struct sd_cap_blk *cblkp)
+{
+    struct sd_cap_block_hdr *hdrp = (struct sd_cap_block_hdr *)cap_bufs[cblkp->fill_buf];
+    k_spinlock_key_t key;
+    int buf = cblkp->fill_buf;
+
+    hdrp->magic = SD_CAP_BLOCK_MAGIC;
+    hdrp->capture = cblkp->capture;
+    hdrp->hdr_len = SD_CAP_HDR_SIZE;
+    hdrp->seq = cblkp->next_seq++;
+    hdrp->payload_len = cblkp->fill_len;
+    hdrp->uptime_ms = cblkp->fill_uptime_ms;
+    hdrp->dropped = cblkp->dropped;
+    hdrp->reserved = 0;
+    hdrp->crc = crc32_ieee((const uint8_t *)hdrp, offsetof(struct sd_cap_block_hdr, crc));
+
+    key = k_spin_lock(&cblkp->buf_lock);
+    cblkp->buf_busy[buf] = true;
+    k_spin_unlock(&cblkp->buf_lock, key);
+
+    // cannot fail, the scheduler is up before any capture starts
+    spi_sched_submit(&cblkp->write_reqs[buf]);
+
+    cblkp->fill_buf = -1;
+    cblkp->fill_len = 0;
+    cblkp->dropped = 0;
+}
+
+/**
+* @brief    sd_cap_get_buf - Find a free buffer to fill
+*
+* @param    cblkp   control block
+*
+* @return   true if fill_buf is set
+*/
+static bool sd_cap_get_buf(struct sd_cap_blk *cblkp)
+{
+    k_spinlock_key_t key;
+    int buf;
+
+    if (cblkp->fill_buf >= 0)
+        return true;
+
+    key = k_spin_lock(&cblkp->buf_lock);
+    for (buf = 0; buf < SD_CAP_NUM_BUFS; buf++)
+    {
+        if (!cblkp->buf_busy[buf])
+        {
+            cblkp->fill_buf = buf;
+            cblkp->fill_len = 0;
+            cblkp->fill_uptime_ms = k_uptime_get_32();
+            break;
+        }
+    }
+    k_spin_unlock(&cblkp->buf_lock, key);
+
+    return cblkp->fill_buf >= 0;
+}
+
+/**
+* @brief    sd_cap_close_fn - Close the capture in progress
+*
+* @param    argp    control block
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Runs in the SPI scheduler thread once every block of the capture is written
+*/
+static int sd_cap_close_fn(void *argp)
+{
+    struct sd_cap_blk *cblkp = argp;
+    struct sd_cap_entry *entp = &dir_sector.dir.entries[cblkp->capture];
+    int err;
+
+    entp->used_blocks = cblkp->next_seq;
+    entp->flags |= SD_CAP_FLAG_COMPLETE;
+    err = sd_cap_dir_write();
+
+    cblkp->stats.last_ms = (uint32_t)(k_uptime_get() - cblkp->start_ms);
+    cblkp->stats.last_sched_us = (uint32_t)k_cyc_to_us_floor64(spi_sched_cpu_cycles() - cblkp->start_sched_cycles);
+    cblkp->stats.last_copy_us = (uint32_t)k_cyc_to_us_floor64(cblkp->copy_cycles);
+
+    LOG_INF("Capture %d closed, %u blocks", cblkp->capture, entp->used_blocks);
+    return err;
+}
+
+/**
+* @brief    sd_cap_close_done - The capture is closed, wake up the thread stopping it
+*
+* @param    reqp    the close transaction
+*
+* @return   none
+*
+* @note     Back to idle only here, a capture can't start before every request of the last one is done
+*/
+static void sd_cap_close_done(struct spi_sched_req *reqp)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+
+    cblkp->stats.last_bytes = cblkp->stats.bytes_written - cblkp->stats.last_bytes;
+    cblkp->state = SD_CAP_IDLE;
+
+    k_sem_give(&cblkp->stop_sem);
+}
+
+/**
+* @brief    sd_cap_write_fn - Write one block to the card
+*
+* @param    argp    the block buffer
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Runs in the SPI scheduler thread
+*/
+static int sd_cap_write_fn(void *argp)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    struct sd_cap_block_hdr *hdrp = argp;
+    uint32_t start_cyc, cycles, us;
+    uint32_t sector;
+    int err;
+
+    sector = dir_sector.dir.entries[cblkp->capture].start_sector + hdrp->seq * CONFIG_SD_CAPTURE_BLOCK_SECTORS;
+
+    start_cyc = k_cycle_get_32();
+    err = disk_access_write(CONFIG_SD_CAPTURE_DISK_NAME, argp, sector, CONFIG_SD_CAPTURE_BLOCK_SECTORS);
+    cycles = k_cycle_get_32() - start_cyc;
+
+    if (err)
+    {
+        cblkp->stats.write_errors++;
+        LOG_ERR("Unable to write capture block %u: %d", hdrp->seq, err);
+    }
+    else
+    {
+        cblkp->stats.blocks_written++;
+        cblkp->stats.bytes_written += hdrp->payload_len;
+    }
+
+    cblkp->stats.write_cycles += cycles;
+    us = k_cyc_to_us_floor32(cycles);
+    cblkp->stats.max_write_us = MAX(cblkp->stats.max_write_us, us);
+
+    return err;
+}
+
+/**
+* @brief    sd_cap_write_done - Give a written buffer back to the producer
+*
+* @param    reqp    the write transaction of the buffer
+*
+* @return   none
+*/
+static void sd_cap_write_done(struct spi_sched_req *reqp)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&cblkp->buf_lock);
+    cblkp->buf_busy[reqp - cblkp->write_reqs] = false;
+    k_spin_unlock(&cblkp->buf_lock, key);
+}
+
+/**
+* @brief    sd_capture_write - Add captured data to the capture in progress
+*
+* @param    datap   captured bytes
+* @param    len     number of bytes
+*
+* @return   0 on success, -ENOBUFS if some data was dropped because the card fell behind, -ENOSPC once
+*           the space reserved for the capture is full, -EINVAL if no capture is running
+*
+* @note     Never blocks. Only one thread at a time may write to a capture, and it has to stop writing
+*           before calling sd_capture_stop().
+*/
+int sd_capture_write(const void *datap, size_t len)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    const uint8_t *bytep = datap;
+    uint32_t start_cyc = k_cycle_get_32();
+    size_t num;
+    int err = 0;
+
+    if (cblkp->state != SD_CAP_RUNNING)
+        return -EINVAL;
+
+    while (len > 0)
+    {
+        if (cblkp->next_seq >= cblkp->max_blocks)
+        {
+            err = -ENOSPC;
+            break;
+        }
+
+        if (!sd_cap_get_buf(cblkp))
+        {
+            cblkp->dropped += len;
+            cblkp->stats.dropped += len;
+            err = -ENOBUFS;
+            break;
+        }
+
+        num = MIN(len, SD_CAP_PAYLOAD_SIZE - cblkp->fill_len);
+        memcpy(&cap_bufs[cblkp->fill_buf][SD_CAP_HDR_SIZE + cblkp->fill_len], bytep, num);
+        cblkp->fill_len += num;
+        bytep += num;
+        len -= num;
+
+        if (cblkp->fill_len == SD_CAP_PAYLOAD_SIZE)
+            sd_cap_queue_buf(cblkp);
+    }
+
+    cblkp->copy_cycles += k_cycle_get_32() - start_cyc;
+
+    return err;
+}
+
+/**
+* @brief    sd_capture_start - Start a new capture
+*
+* @param    max_bytes       longest the capture can get, this much is reserved on the card
+* @param    sample_rate_hz  recorded in the directory for the reader
+* @param    sample_size     bytes per sample, recorded in the directory for the reader
+*
+* @return   index of the capture in the directory, negative error code otherwise
+*/
+int sd_capture_start(uint32_t max_bytes, uint32_t sample_rate_hz, uint16_t sample_size)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    struct sd_cap_dir *dirp = &dir_sector.dir;
+    struct sd_cap_entry *entp;
+    uint32_t blocks, sectors;
+    int64_t now_ms;
+    int err;
+
+    if (!cblkp->ready)
+        return -ENODEV;
+
+    if (!cblkp->formatted)
+        return -ENOENT;
+
+    if (cblkp->state != SD_CAP_IDLE)
+        return -EBUSY;
+
+    if (dirp->num_entries >= SD_CAP_MAX_CAPTURES)
+        return -ENOSPC;
+
+    blocks = DIV_ROUND_UP(max_bytes, SD_CAP_PAYLOAD_SIZE);
+    sectors = blocks * CONFIG_SD_CAPTURE_BLOCK_SECTORS;
+    if (blocks == 0 || dirp->next_sector + sectors > cblkp->card_sectors)
+        return -ENOSPC;
+
+    // reserve the extent
+    entp = &dirp->entries[dirp->num_entries];
+    memset(entp, 0, sizeof(*entp));
+    entp->start_sector = dirp->next_sector;
+    entp->num_sectors = sectors;
+    entp->sample_rate_hz = sample_rate_hz;
+    entp->sample_size = sample_size;
+    if (date_time_now(&now_ms) == 0)
+        entp->start_ts = (uint32_t)(now_ms / MSEC_PER_SEC);
+
+    dirp->num_entries++;
+    dirp->next_sector += sectors;
+
+    err = sd_cap_dir_write();
+    if (err)
+    {
+        dirp->num_entries--;
+        dirp->next_sector -= sectors;
+        return err;
+    }
+
+    cblkp->capture = dirp->num_entries - 1;
+    cblkp->max_blocks = blocks;
+    cblkp->fill_buf = -1;
+    cblkp->fill_len = 0;
+    cblkp->next_seq = 0;
+    cblkp->dropped = 0;
+    cblkp->copy_cycles = 0;
+    cblkp->stats.captures++;
+
+    cblkp->start_sched_cycles = spi_sched_cpu_cycles();
+    cblkp->start_ms = k_uptime_get();
+
+    // bytes written so far, made into the bytes of this capture when it stops
+    cblkp->stats.last_bytes = cblkp->stats.bytes_written;
+
+    cblkp->state = SD_CAP_RUNNING;
+
+    LOG_INF("Capture %d started, %u KB reserved at sector %u", cblkp->capture, sectors / 2, entp->start_sector);
+    return cblkp->capture;
+}
+
+/**
+* @brief    sd_capture_stop - Stop the capture in progress
+*
+* @param    none
+*
+* @return   0 on success, -EAGAIN if the capture is still closing after SD_CAP_STOP_TIMEOUT_S, negative
+*           error code otherwise
+*
+* @note     Blocks until the last block and the directory are written. If that takes too long the capture
+*           stays stopping, and no other can start, until the SPI scheduler gets to close it.
+*/
+int sd_capture_stop(void)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    int err;
+
+    if (cblkp->state != SD_CAP_RUNNING)
+        return -EINVAL;
+
+    cblkp->state = SD_CAP_STOPPING;
+
+    // the partly filled block goes too
+    if (cblkp->fill_buf >= 0 && cblkp->fill_len > 0)
+        sd_cap_queue_buf(cblkp);
+
+    // same device and priority as the blocks, so it runs after the last of them
+    k_sem_reset(&cblkp->stop_sem);
+    spi_sched_submit(&cblkp->close_req);
+
+    err = k_sem_take(&cblkp->stop_sem, K_SECONDS(SD_CAP_STOP_TIMEOUT_S));
+    if (err)
+    {
+        LOG_ERR("Capture %d not closed yet after %d s", cblkp->capture, SD_CAP_STOP_TIMEOUT_S);
+        return -EAGAIN;
+    }
+
+    return cblkp->close_req.result;
+}
+
+/**
+* @brief    sd_capture_format - Write an empty capture container to the card
+*
+* @param    none
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Every capture on the card is lost. The card is used raw, a filesystem on it is overwritten.
+*/
+int sd_capture_format(void)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    struct sd_cap_dir *dirp = &dir_sector.dir;
+    int err;
+
+    if (!cblkp->ready)
+        return -ENODEV;
+
+    if (cblkp->state != SD_CAP_IDLE)
+        return -EBUSY;
+
+    memset(&dir_sector, 0, sizeof(dir_sector));
+    dirp->magic = SD_CAP_DIR_MAGIC;
+    dirp->version = SD_CAP_VERSION;
+    dirp->block_sectors = CONFIG_SD_CAPTURE_BLOCK_SECTORS;
+    dirp->next_sector = cblkp->data_start;
+
+    err = sd_cap_dir_write();
+    cblkp->formatted = (err == 0);
+
+    return err;
+}
+
+/**
+* @brief    sd_capture_bench - Capture a synthetic stream as fast as the card takes it
+*
+* @param    seconds     how long to run
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Runs in the calling thread, which fills the buffers and waits a tick whenever both are full.
+*           The capture is kept on the card like any other, format to reclaim the space.
+*/
+int sd_capture_bench(uint32_t seconds)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    uint8_t chunk[SD_CAP_BENCH_CHUNK];
+    int64_t end_ms;
+    uint32_t count = 0;
+    int err;
+    int i;
+
+    err = sd_capture_start(MIN((uint64_t)seconds * SD_CAP_BENCH_MAX_BPS, UINT32_MAX), 0, sizeof(chunk[0]));
+    if (err < 0)
+        return err;
+
+    end_ms = k_uptime_get() + seconds * MSEC_PER_SEC;
+    while (k_uptime_get() < end_ms)
+    {
+        // wait for the card rather than drop data
+        if (!sd_cap_get_buf(cblkp))
+        {
+            k_sleep(K_TICKS(1));
+            continue;
+        }
+
+        for (i = 0; i < sizeof(chunk); i++)
+            chunk[i] = (uint8_t)(count + i);
+        count += sizeof(chunk);
+
+        if (sd_capture_write(chunk, sizeof(chunk)) == -ENOSPC)
+            break;
+    }
+
+    err = sd_capture_stop();
+    sd_capture_stats_print();
+
+    return err;
+}
+
+/**
+* @brief    sd_capture_list - Print the captures on the card
+*
+* @param    none
+*
+* @return   none
+*/
+void sd_capture_list(void)
+{
+    struct sd_cap_dir *dirp = &dir_sector.dir;
+    struct sd_cap_entry *entp;
+    int i;
+
+    if (!cap_cblk.formatted)
+    {
+        printk("No capture container on the card\n");
+        return;
+    }
+
+    printk("\n%3s %10s %10s %8s %10s %8s %6s %s\n", "#", "sector", "reserved", "blocks", "time", "rate", "size",
+        "state");
+    for (i = 0; i < dirp->num_entries; i++)
+    {
+        entp = &dirp->entries[i];
+        printk("%3d %10u %9uK %8u %10u %8u %6u %s\n", i, entp->start_sector, entp->num_sectors / 2,
+            entp->used_blocks, entp->start_ts, entp->sample_rate_hz, entp->sample_size,
+            (entp->flags & SD_CAP_FLAG_COMPLETE) ? "complete" : "open");
+    }
+    printk("Next free sector: %u of %u\n", dirp->next_sector, cap_cblk.card_sectors);
+}
+
+/**
+* @brief    sd_capture_stats_print - Print the statistics of the SD capture
+*
+* @param    none
+*
+* @return   none
+*
+* @note     CPU load is the SPI scheduler thread plus the copying done by the producer over the last capture.
+*           The scheduler time includes any flash transactions it ran during the capture.
+*/
+void sd_capture_stats_print(void)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    struct sd_cap_stats *statsp = &cblkp->stats;
+    uint32_t kbps = 0;
+    uint32_t load_permille = 0;
+
+    if (statsp->last_ms > 0)
+    {
+        kbps = (uint32_t)((uint64_t)statsp->last_bytes * MSEC_PER_SEC / 1024 / statsp->last_ms);
+        load_permille = (uint32_t)(((uint64_t)statsp->last_sched_us + statsp->last_copy_us)
+                            / statsp->last_ms);
+    }
+
+    printk("\nSD capture statistics:\n\n");
+    printk("Card: %s, %u MB, block: %u bytes\n", cblkp->ready ? "present" : "absent",
+        cblkp->card_sectors / 2048, SD_CAP_BLOCK_SIZE);
+    printk("Captures: %u, Blocks written: %u, Write errors: %u\n", statsp->captures, statsp->blocks_written,
+        statsp->write_errors);
+    printk("Bytes written: %u, Dropped: %u, Slowest block: %u us, Avg block: %u us\n", statsp->bytes_written,
+        statsp->dropped, statsp->max_write_us, statsp->blocks_written ?
+        (uint32_t)(k_cyc_to_us_floor64(statsp->write_cycles) / statsp->blocks_written) : 0);
+    printk("Last capture: %u bytes in %u ms, %u KB/s sustained\n", statsp->last_bytes, statsp->last_ms, kbps);
+    printk("CPU load: %u.%u%% (SPI scheduler: %u us, copying: %u us)\n", load_permille / 10, load_permille % 10,
+        statsp->last_sched_us, statsp->last_copy_us);
+}
+
+/**
+* @brief    sd_cap_probe_fn - Init the card and read the capture directory
+*
+* @param    argp    control block
+*
+* @return   0 on success, negative error code if there is no usable card
+*
+* @note     Runs in the SPI scheduler thread
+*/
+static int sd_cap_probe_fn(void *argp)
+{
+    struct sd_cap_blk *cblkp = argp;
+    uint32_t sector_size;
+    int err;
+
+    err = disk_access_init(CONFIG_SD_CAPTURE_DISK_NAME);
+    if (err)
+    {
+        LOG_WRN("No SD card: %d", err);
+        return err;
+    }
+
+    if (disk_access_ioctl(CONFIG_SD_CAPTURE_DISK_NAME, DISK_IOCTL_GET_SECTOR_COUNT, &cblkp->card_sectors)
+        || disk_access_ioctl(CONFIG_SD_CAPTURE_DISK_NAME, DISK_IOCTL_GET_SECTOR_SIZE, &sector_size)
+        || sector_size != SD_CAP_SECTOR_SIZE)
+    {
+        LOG_ERR("Unsupported SD card");
+        return -ENOTSUP;
+    }
+
+    // extents start on a block boundary after the directory
+    cblkp->data_start = ROUND_UP(CONFIG_SD_CAPTURE_START_SECTOR + 1, CONFIG_SD_CAPTURE_BLOCK_SECTORS);
+    cblkp->ready = true;
+
+    err = disk_access_read(CONFIG_SD_CAPTURE_DISK_NAME, dir_sector.sector, CONFIG_SD_CAPTURE_START_SECTOR, 1);
+    cblkp->formatted = (err == 0 && sd_cap_dir_valid());
+
+    return 0;
+}
+
+/**
+* @brief    sd_capture_init - Init the SD card and read the capture directory
+*
+* @param    none
+*
+* @return   0 on success, negative error code if there is no usable card
+*
+* @note     The card is optional, without one captures are refused. Call after spi_sched_init().
+*/
+int sd_capture_init(void)
+{
+    struct sd_cap_blk *cblkp = &cap_cblk;
+    int err;
+    int buf;
+
+    k_sem_init(&cblkp->stop_sem, 0, 1);
+
+    // blocks are written at high priority, data is dropped when the card falls behind
+    for (buf = 0; buf < SD_CAP_NUM_BUFS; buf++)
+    {
+        cblkp->write_reqs[buf] = (struct spi_sched_req) {
+            .dev = SPI_SCHED_DEV_SD, .prio = SPI_SCHED_PRIO_HIGH,
+            .fn = sd_cap_write_fn, .done = sd_cap_write_done, .argp = cap_bufs[buf]
+        };
+    }
+    cblkp->close_req = (struct spi_sched_req) {
+        .dev = SPI_SCHED_DEV_SD, .prio = SPI_SCHED_PRIO_HIGH,
+        .fn = sd_cap_close_fn, .done = sd_cap_close_done, .argp = cblkp
+    };
+
+    err = spi_sched_run(SPI_SCHED_DEV_SD, SPI_SCHED_PRIO_NORMAL, sd_cap_probe_fn, cblkp);
+    if (err)
+        return err;
+
+    LOG_INF("SD card: %u MB, %s", cblkp->card_sectors / 2048,
+        cblkp->formatted ? "capture container found" : "no capture container, format to use");
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+/**
+ * @brief: 	sd_capture.h - External definitions for raw data capture to the SD card
+ *
+ * @notes: 	See sd_capture.c for more information
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef SD_CAPTURE_H_
+#define SD_CAPTURE_H_
+
+#include <zephyr.h>
+
+int     sd_capture_init(void);
+int     sd_capture_format(void);
+int     sd_capture_start(uint32_t max_bytes, uint32_t sample_rate_hz, uint16_t sample_size);
+int     sd_capture_write(const void *datap, size_t len);
+int     sd_capture_stop(void);
+int     sd_capture_bench(uint32_t seconds);
+void    sd_capture_list(void);
+void    sd_capture_stats_print(void);
+
+#endif /* SD_CAPTURE_H_ */
@@ -0,0 +1,80 @@
+/**
+ * @brief: 	sd_capture_internal.h - Layout of the capture container on the SD card
+ *
+ * @note:   Only to be included by the storage module. The card is used raw, without a filesystem, so a
+ *          capture can be written with large multi-block writes into space reserved for it up front.
+ *
+ *           Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef SD_CAPTURE_INTERN_H_
+#define SD_CAPTURE_INTERN_H_
+
+#include <zephyr.h>
+
+#define SD_CAP_SECTOR_SIZE          512         // SD cards always use 512 byte blocks over SPI
+#define SD_CAP_DIR_MAGIC            0x50414356  // "VCAP"
+#define SD_CAP_BLOCK_MAGIC          0x4B4C4256  // "VBLK"
+#define SD_CAP_VERSION              1
+#define SD_CAP_MAX_CAPTURES         16
+
+/*
+*   Container layout, starting at CONFIG_SD_CAPTURE_START_SECTOR:
+*
+*       directory sector | pad to a block | capture 0 extent | capture 1 extent | ...
+*
+*   Every capture gets a contiguous extent of whole blocks when it starts, sized for the longest it can
+*   run. A block is written with a single multi-block write: a header followed by the captured bytes.
+*   Blocks are numbered so block n of a capture is always at start_sector + n * block_sectors, and a
+*   capture cut short by a reset can be recovered by reading block headers until the sequence breaks.
+*/
+
+#define SD_CAP_FLAG_COMPLETE        0x0001      // stopped cleanly, used_blocks is valid
+
+/*
+*   One capture in the directory
+*/
+struct sd_cap_entry
+{
+    uint32_t    start_sector;       // first sector of the extent
+    uint32_t    num_sectors;        // sectors reserved for the capture
+    uint32_t    used_blocks;        // blocks written, only valid once SD_CAP_FLAG_COMPLETE is set
+    uint32_t    start_ts;           // unix time the capture started, 0 if not known
+    uint32_t    sample_rate_hz;     // as given by the producer, for the reader
+    uint16_t    sample_size;        // bytes per sample (all channels), for the reader
+    uint16_t    flags;              // SD_CAP_FLAG_*
+} __packed;
+
+/*
+*   The directory, one sector
+*/
+struct sd_cap_dir
+{
+    uint32_t    magic;              // SD_CAP_DIR_MAGIC
+    uint16_t    version;            // SD_CAP_VERSION
+    uint16_t    num_entries;        // captures in use
+    uint32_t    next_sector;        // first sector not reserved yet
+    uint32_t    block_sectors;      // sectors per block, fixed when the container is formatted
+    struct sd_cap_entry entries[SD_CAP_MAX_CAPTURES];
+    uint32_t    crc;                // crc32 (ieee) of everything above
+} __packed;
+
+/*
+*   Header at the start of every block
+*/
+struct sd_cap_block_hdr
+{
+    uint32_t    magic;              // SD_CAP_BLOCK_MAGIC
+    uint16_t    capture;            // index of the capture in the directory
+    uint16_t    hdr_len;            // sizeof(struct sd_cap_block_hdr), data follows
+    uint32_t    seq;                // block number in the capture, from 0
+    uint32_t    payload_len;        // bytes of data in the block
+    uint32_t    uptime_ms;          // uptime when the first byte of the block was captured
+    uint32_t    dropped;            // bytes dropped since the previous block because the card fell behind
+    uint32_t    reserved;
+    uint32_t    crc;                // crc32 (ieee) of the header up to here
+} __packed;
+
+BUILD_ASSERT(sizeof(struct sd_cap_dir) <= SD_CAP_SECTOR_SIZE, "directory must fit in a sector");
+
+#endif // SD_CAPTURE_INTERN_H_
@@ -0,0 +1,1453 @@
+/**
+ * @brief: 	tele_log.c - Store-and-forward telemetry log on the external flash
+ *
+ * @notes:  Telemetry records are appended to a circular log in a dedicated region of the external W25Q32JV so
+ *          measurements survive while the AWS connection is down (for days if need be) and are published in
+ *          order once it is back. The region is used raw, without a filesystem, see tele_log_internal.h for
+ *          the layout.
+ *
+ *          Appending only copies the record to a RAM buffer, it never waits on the flash. The buffered records
+ *          are written by the log's own work queue a page at a time, either as soon as there is a page worth
+ *          or after CONFIG_TELE_LOG_FLUSH_DELAY_MS. Records still in RAM are lost on a power failure, records
+ *          in flash are not: every entry carries a CRC so a torn write is skipped on the next boot.
+ *
+ *          When the log wraps, the oldest sector is erased, dropping whatever was not sent from it.
+ *
+ *          The region is split into tiers, each its own ring: raw records, then per-minute and per-hour
+ *          rollups of them (see tele_rollup.c). The raw ring covers hours at a fast DAQ interval, the
+ *          rollup rings take far fewer records per day so they go back weeks and months.
+ *
+ *          Everything still in flash, sent or not, is the sample history. A summary of every sector (its first
+ *          sequence number and time stamp) is kept in RAM so a record can be found by sequence number or time
+ *          with a binary search over the sectors and then within one sector, a handful of flash reads instead
+ *          of scanning the whole tier over SPI.
+ *
+ *          The flash shares spi3 with the SD card, every flash operation goes through the SPI scheduler which
+ *          also puts the flash in deep power-down between them.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <device.h>
+#include <storage/flash_map.h>
+#include <logging/log.h>
+#include <string.h>
+#include <sys/crc.h>
+#include <date_time.h>
+
+// includes for application
+#include "bsp/sys_wrapper.h"
+#include "bsp/spi_sched.h"
+#include "config/config.h"
+#include "tele_log.h"
+#include "tele_log_internal.h"
+
+LOG_MODULE_REGISTER(tele_log);      // register with logging package
+
+/*
+*   Internal defines for the telemetry log work queue
+*/
+#define TELE_LOG_STACK_SIZE         1024    // flash writes only, no encoding done here
+#define TELE_LOG_WORKQ_PRIORITY     7       // below the aws connector, flushing is never urgent
+
+#define TELE_LOG_NO_SECTOR          (-1)
+#define TELE_LOG_NO_SEQ             0       // sequence numbers start at 1
+
+#define TELE_LOG_ROLLUP_PENDING     4       // rollup records buffered in RAM, there is at most one per type a minute
+
+/*
+*   The tiers share the tele_log partition (pm_static.yml): raw first, then the minute and hour rollups
+*/
+#define TELE_LOG_FLASH_SIZE         FLASH_AREA_SIZE(tele_log)
+#define TELE_LOG_RAW_SIZE           (TELE_LOG_FLASH_SIZE - CONFIG_TELE_LOG_MINUTE_SIZE - CONFIG_TELE_LOG_HOUR_SIZE)
+#define TELE_LOG_RAW_OFFSET         0
+#define TELE_LOG_MINUTE_OFFSET      (TELE_LOG_RAW_OFFSET + TELE_LOG_RAW_SIZE)
+#define TELE_LOG_HOUR_OFFSET        (TELE_LOG_MINUTE_OFFSET + CONFIG_TELE_LOG_MINUTE_SIZE)
+
+#define TELE_LOG_RAW_SECTORS        (TELE_LOG_RAW_SIZE / TELE_LOG_SECTOR_SIZE)
+#define TELE_LOG_MINUTE_SECTORS     (CONFIG_TELE_LOG_MINUTE_SIZE / TELE_LOG_SECTOR_SIZE)
+#define TELE_LOG_HOUR_SECTORS       (CONFIG_TELE_LOG_HOUR_SIZE / TELE_LOG_SECTOR_SIZE)
+
+BUILD_ASSERT(FLASH_AREA_OFFSET(tele_log) % TELE_LOG_SECTOR_SIZE == 0, "log partition must start on a sector");
+BUILD_ASSERT(TELE_LOG_FLASH_SIZE % TELE_LOG_SECTOR_SIZE == 0, "log partition must be whole sectors");
+BUILD_ASSERT(CONFIG_TELE_LOG_MINUTE_SIZE % TELE_LOG_SECTOR_SIZE == 0, "minute tier must be whole sectors");
+BUILD_ASSERT(CONFIG_TELE_LOG_HOUR_SIZE % TELE_LOG_SECTOR_SIZE == 0, "hour tier must be whole sectors");
+BUILD_ASSERT(TELE_LOG_FLASH_SIZE > CONFIG_TELE_LOG_MINUTE_SIZE + CONFIG_TELE_LOG_HOUR_SIZE,
+            "rollup tiers leave no room for raw records");
+BUILD_ASSERT(TELE_LOG_RAW_SECTORS >= 2 && TELE_LOG_MINUTE_SECTORS >= 2 && TELE_LOG_HOUR_SECTORS >= 2,
+            "every tier needs at least two sectors to wrap");
+
+/*
+*   Statistics of one tier of the telemetry log
+*/
+struct tele_log_stats {
+    uint32_t    appended;           // records accepted by tele_log_append_tier()
+    uint32_t    pages_written;      // flash program operations
+    uint32_t    sectors_erased;     // flash erase operations
+    uint32_t    sent;               // records marked as published
+    uint32_t    skipped;            // records passed over by tele_log_skip()
+    uint32_t    dropped_full;       // records refused because the RAM buffer was full
+    uint32_t    dropped_wrap;       // unsent records erased when the log wrapped
+    uint32_t    corrupt;            // entries skipped because of a bad crc (torn write)
+    uint32_t    flash_errors;       // failed flash operations
+    uint32_t    entry_reads;        // entries read from flash
+};
+
+/*
+*   Summary of one sector of the log, kept in RAM. The entries of a sector hold consecutive sequence
+*   numbers (a torn entry still used up its number) so the first one is enough to locate any record.
+*/
+struct tele_log_sector_sum {
+    uint32_t    first_seq;          // sequence number of the first entry, TELE_LOG_NO_SEQ if the sector is erased
+    uint32_t    first_ts;           // first time stamp known in the sector, 0 if none
+};
+
+/*
+*   One tier of the log, a ring of sectors with its own head, tail and sequence numbers
+*/
+struct tele_tier_blk {
+    const char  *namep;
+    uint32_t    base;               // offset of the tier in the tele_log partition
+    uint32_t    size;               // size of the tier, offsets below are relative to base
+    int         num_sectors;
+
+    // serializes flash access to the tier and the head and tail offsets
+    struct k_mutex  log_lock;
+    uint32_t        head_off;       // offset where the next entry is written
+    uint32_t        tail_off;       // offset of the oldest entry not sent yet, same as head_off if none
+
+    // records waiting to be written to flash, a ring protected by a spinlock so any context can append
+    struct k_spinlock   pend_lock;
+    struct tele_record  *pendingp;
+    int                 pend_size;
+    int                 pend_first;
+    int                 pend_count;
+    uint32_t            next_seq;   // sequence number of the next record appended
+
+    // summary of every sector, protected by log_lock
+    struct tele_log_sector_sum *indexp;
+
+    struct tele_log_stats stats;
+};
+
+/*
+*   Telemetry log control block
+*/
+struct tele_log_blk {
+    const struct flash_area *fap;   // tele_log partition of the external flash
+    struct tele_tier_blk tiers[TELE_TIER_NUM];
+    bool            ready;          // recovered from flash and accepting records
+};
+
+// storage for the RAM buffers and sector indexes of the tiers
+static struct tele_record raw_pending[CONFIG_TELE_LOG_PENDING_RECORDS];
+static struct tele_record minute_pending[TELE_LOG_ROLLUP_PENDING];
+static struct tele_record hour_pending[TELE_LOG_ROLLUP_PENDING];
+static struct tele_log_sector_sum raw_index[TELE_LOG_RAW_SECTORS];
+static struct tele_log_sector_sum minute_index[TELE_LOG_MINUTE_SECTORS];
+static struct tele_log_sector_sum hour_index[TELE_LOG_HOUR_SECTORS];
+
+// allocate storage for the control block
+static struct tele_log_blk log_cblk = {
+    .tiers = {
+        [TELE_TIER_RAW] = {
+            .namep = "raw", .base = TELE_LOG_RAW_OFFSET, .size = TELE_LOG_RAW_SIZE,
+            .num_sectors = TELE_LOG_RAW_SECTORS, .pendingp = raw_pending, .pend_size = ARRAY_SIZE(raw_pending),
+            .indexp = raw_index,
+        },
+        [TELE_TIER_MINUTE] = {
+            .namep = "minute", .base = TELE_LOG_MINUTE_OFFSET, .size = CONFIG_TELE_LOG_MINUTE_SIZE,
+            .num_sectors = TELE_LOG_MINUTE_SECTORS, .pendingp = minute_pending,
+            .pend_size = ARRAY_SIZE(minute_pending), .indexp = minute_index,
+        },
+        [TELE_TIER_HOUR] = {
+            .namep = "hour", .base = TELE_LOG_HOUR_OFFSET, .size = CONFIG_TELE_LOG_HOUR_SIZE,
+            .num_sectors = TELE_LOG_HOUR_SECTORS, .pendingp = hour_pending, .pend_size = ARRAY_SIZE(hour_pending),
+            .indexp = hour_index,
+        },
+    },
+};
+
+// one page of entries being written to flash, only used by the work queue
+static struct tele_log_entry page_buf[TELE_LOG_ENTRIES_PER_PAGE];
+
+// work queue that writes the log to flash, and storage for its stack
+static struct k_work_q tele_log_workq;
+K_THREAD_STACK_DEFINE(tele_log_stack_area, TELE_LOG_STACK_SIZE);
+
+static void tele_log_flush_work_fn(struct k_work *workp);
+
+// delayed work to write the buffered records, lets records batch up into pages
+static K_WORK_DELAYABLE_DEFINE(tele_log_flush_work, tele_log_flush_work_fn);
+
+/*
+*   One flash operation, run by the SPI scheduler
+*/
+enum tele_log_io_op
+{
+    TELE_LOG_IO_READ,
+    TELE_LOG_IO_WRITE,
+    TELE_LOG_IO_ERASE
+};
+
+struct tele_log_io
+{
+    enum tele_log_io_op op;
+    off_t               off;        // offset in the tele_log partition
+    void                *bufp;      // not used to erase
+    size_t              len;
+};
+
+/**
+* @brief    tele_log_io_fn - Do one flash operation
+*
+* @param    argp    the operation, struct tele_log_io
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Runs in the SPI scheduler thread
+*/
+static int tele_log_io_fn(void *argp)
+{
+    struct tele_log_io *iop = argp;
+
+    switch (iop->op)
+    {
+    case TELE_LOG_IO_READ:
+        return flash_area_read(log_cblk.fap, iop->off, iop->bufp, iop->len);
+    case TELE_LOG_IO_WRITE:
+        return flash_area_write(log_cblk.fap, iop->off, iop->bufp, iop->len);
+    case TELE_LOG_IO_ERASE:
+        return flash_area_erase(log_cblk.fap, iop->off, iop->len);
+    }
+
+    return -EINVAL;
+}
+
+/**
+* @brief    tele_log_flash_io - Do one flash operation through the SPI scheduler and wait for it
+*
+* @param    op      what to do
+* @param    off     offset in the tele_log partition
+* @param    bufp    data to write or buffer to read into, NULL to erase
+* @param    len     number of bytes
+*
+* @return   0 on success, negative error code otherwise
+*/
+static int tele_log_flash_io(enum tele_log_io_op op, off_t off, void *bufp, size_t len)
+{
+    struct tele_log_io io = {.op = op, .off = off, .bufp = bufp, .len = len};
+
+    return spi_sched_run(SPI_SCHED_DEV_NOR, SPI_SCHED_PRIO_NORMAL, tele_log_io_fn, &io);
+}
+
+/**
+* @brief    tele_log_next_off - Offset of the entry following the one at off, wrapping at the end of the tier
+*
+* @param    tierp   tier of the log
+* @param    off     offset of an entry
+*
+* @return   offset of the next entry
+*/
+static inline uint32_t tele_log_next_off(struct tele_tier_blk *tierp, uint32_t off)
+{
+    return (off + TELE_LOG_ENTRY_SIZE) % tierp->size;
+}
+
+/**
+* @brief    tele_log_read_entry - Read one entry from flash
+*
+* @param    tierp   tier of the log
+* @param    off     offset of the entry in the tier
+* @param    entp    entry to read into
+*
+* @return   0 on success, negative error code otherwise
+*/
+static int tele_log_read_entry(struct tele_tier_blk *tierp, uint32_t off, struct tele_log_entry *entp)
+{
+    int err;
+
+    tierp->stats.entry_reads++;
+    err = tele_log_flash_io(TELE_LOG_IO_READ, tierp->base + off, entp, sizeof(*entp));
+    if (err)
+    {
+        tierp->stats.flash_errors++;
+        LOG_ERR("Unable to read %s entry at 0x%x: %d", tierp->namep, off, err);
+    }
+
+    return err;
+}
+
+/**
+* @brief    tele_log_entry_erased - Check if an entry slot has never been written since the last erase
+*
+* @param    entp    entry read from flash
+*
+* @return   true if every byte is still erased
+*/
+static bool tele_log_entry_erased(const struct tele_log_entry *entp)
+{
+    const uint8_t *bytep = (const uint8_t *)entp;
+    size_t i;
+
+    for (i = 0; i < sizeof(*entp); i++)
+    {
+        if (bytep[i] != 0xFF)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+* @brief    tele_log_entry_valid - Check the crc of an entry
+*
+* @param    entp    entry read from flash
+*
+* @return   true if the record was completely written
+*/
+static bool tele_log_entry_valid(const struct tele_log_entry *entp)
+{
+    return crc32_ieee((const uint8_t *)&entp->rec, sizeof(entp->rec)) == entp->crc;
+}
+
+/**
+* @brief    tele_log_summarize_sector - Build the RAM summary of a sector from flash
+*
+* @param    tierp   tier of the log
+* @param    sector  sector number in the tier
+* @param    entp    returns the first valid entry of the sector
+*
+* @return   true if the sector holds at least one valid entry
+*
+* @note     Normally only the first entry is read, the following ones only if it is torn
+*/
+static bool tele_log_summarize_sector(struct tele_tier_blk *tierp, int sector, struct tele_log_entry *entp)
+{
+    struct tele_log_sector_sum *sump = &tierp->indexp[sector];
+    uint32_t off = sector * TELE_LOG_SECTOR_SIZE;
+    int i;
+
+    sump->first_seq = TELE_LOG_NO_SEQ;
+    sump->first_ts = 0;
+
+    for (i = 0; i < TELE_LOG_ENTRIES_PER_SECTOR; i++, off += TELE_LOG_ENTRY_SIZE)
+    {
+        if (tele_log_read_entry(tierp, off, entp) || tele_log_entry_erased(entp))
+            return false;
+
+        if (tele_log_entry_valid(entp))
+        {
+            sump->first_seq = entp->rec.seq - i;
+            sump->first_ts = entp->rec.timestamp;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+* @brief    tele_log_find_ends - Find the head and tail of a tier from flash and build its sector index
+*
+* @param    tierp       tier of the log
+* @param    headp       returns the offset where the next entry goes
+* @param    tailp       returns the offset of the oldest entry not sent, same as the head if none
+* @param    last_seqp   returns the sequence number of the newest entry
+*
+* @return   false if the tier is empty
+*
+* @note     Called with log_lock held, or before the log is ready. Only the first entry of every sector is
+*           read plus at most a couple of sectors entry by entry, so this stays quick even with a full log.
+*           Sent flags are set in order, which is what allows finding the tail from the first entry of each
+*           sector.
+*/
+static bool tele_log_find_ends(struct tele_tier_blk *tierp, uint32_t *headp, uint32_t *tailp, uint32_t *last_seqp)
+{
+    struct tele_log_entry ent;
+    int sector, k;
+    int head_sector = TELE_LOG_NO_SECTOR;
+    int first_sector = TELE_LOG_NO_SECTOR;
+    int last_sent_sector = TELE_LOG_NO_SECTOR;
+    uint32_t head_seq = 0;
+    uint32_t last_seq;
+    uint32_t off;
+    int i;
+
+    // the sector starting with the highest sequence number holds the head
+    for (sector = 0; sector < tierp->num_sectors; sector++)
+    {
+        if (!tele_log_summarize_sector(tierp, sector, &ent))
+            continue;
+
+        if (head_sector == TELE_LOG_NO_SECTOR || tierp->indexp[sector].first_seq > head_seq)
+        {
+            head_sector = sector;
+            head_seq = tierp->indexp[sector].first_seq;
+        }
+    }
+
+    if (head_sector == TELE_LOG_NO_SECTOR)
+        return false;
+
+    // the head is the first erased slot of the head sector (or the start of the next one if it is full)
+    off = head_sector * TELE_LOG_SECTOR_SIZE;
+    last_seq = head_seq;
+    for (i = 0; i < TELE_LOG_ENTRIES_PER_SECTOR; i++, off += TELE_LOG_ENTRY_SIZE)
+    {
+        if (tele_log_read_entry(tierp, off, &ent) || tele_log_entry_erased(&ent))
+            break;
+
+        if (tele_log_entry_valid(&ent))
+        {
+            last_seq = ent.rec.seq;
+            if (tierp->indexp[head_sector].first_ts == 0)
+                tierp->indexp[head_sector].first_ts = ent.rec.timestamp;
+        }
+        else
+        {
+            tierp->stats.corrupt++;
+        }
+    }
+    *headp = off % tierp->size;
+    *last_seqp = last_seq;
+
+    // walk the sectors oldest first, the tail is at or after the start of the last sector starting with a sent record
+    for (k = 1; k <= tierp->num_sectors; k++)
+    {
+        sector = (head_sector + k) % tierp->num_sectors;
+
+        if (tierp->indexp[sector].first_seq == TELE_LOG_NO_SEQ)
+            continue;
+
+        if (first_sector == TELE_LOG_NO_SECTOR)
+            first_sector = sector;
+
+        if (tele_log_read_entry(tierp, sector * TELE_LOG_SECTOR_SIZE, &ent) == 0 && tele_log_entry_valid(&ent)
+            && ent.sent == TELE_LOG_SENT)
+            last_sent_sector = sector;
+    }
+
+    off = (last_sent_sector == TELE_LOG_NO_SECTOR ? first_sector : last_sent_sector) * TELE_LOG_SECTOR_SIZE;
+    *tailp = *headp;
+
+    // a wrapped tier with a full head sector has its head on the start of the oldest sector, which is where
+    // the walk starts then: go round the whole ring, not zero entries
+    do
+    {
+        if (!tele_log_read_entry(tierp, off, &ent) && tele_log_entry_valid(&ent) && ent.sent == TELE_LOG_UNSENT)
+        {
+            *tailp = off;
+            break;
+        }
+        off = tele_log_next_off(tierp, off);
+    } while (off != *headp);
+
+    return true;
+}
+
+/**
+* @brief    tele_log_recover - Find the head and tail of a tier after a boot and build its sector index
+*
+* @param    tierp   tier of the log
+*
+* @return   none
+*/
+static void tele_log_recover(struct tele_tier_blk *tierp)
+{
+    uint32_t last_seq;
+
+    if (!tele_log_find_ends(tierp, &tierp->head_off, &tierp->tail_off, &last_seq))
+    {
+        LOG_INF("Telemetry log %s tier is empty", tierp->namep);
+        tierp->head_off = 0;
+        tierp->tail_off = 0;
+        tierp->next_seq = 1;
+        return;
+    }
+    tierp->next_seq = last_seq + 1;
+
+    LOG_INF("Telemetry log %s tier recovered, head: 0x%x, tail: 0x%x, next seq: %u",
+        tierp->namep, tierp->head_off, tierp->tail_off, tierp->next_seq);
+}
+
+/**
+* @brief    tele_log_prepare_sector - Erase the sector the head is about to move into
+*
+* @param    tierp   tier of the log
+* @param    off     offset of the start of the sector
+*
+* @return   0 on success, negative error code otherwise
+*
+* @note     Called with log_lock held. If the tier is full the tail is in this sector, the unsent records
+*           left in it are dropped and the tail moves to the next sector.
+*/
+static int tele_log_prepare_sector(struct tele_tier_blk *tierp, uint32_t off)
+{
+    uint32_t next_sector_off;
+    int err;
+
+    next_sector_off = (off + TELE_LOG_SECTOR_SIZE) % tierp->size;
+
+    if (tierp->tail_off != tierp->head_off
+        && tierp->tail_off >= off && tierp->tail_off < off + TELE_LOG_SECTOR_SIZE)
+    {
+        uint32_t dropped = (off + TELE_LOG_SECTOR_SIZE - tierp->tail_off) / TELE_LOG_ENTRY_SIZE;
+
+        LOG_WRN("Telemetry log %s tier full, dropping %u unsent records", tierp->namep, dropped);
+        tierp->stats.dropped_wrap += dropped;
+        tierp->tail_off = next_sector_off;
+    }
+
+    // whatever the outcome of the erase, the history in this sector is gone
+    tierp->indexp[off / TELE_LOG_SECTOR_SIZE].first_seq = TELE_LOG_NO_SEQ;
+    tierp->indexp[off / TELE_LOG_SECTOR_SIZE].first_ts = 0;
+
+    err = tele_log_flash_io(TELE_LOG_IO_ERASE, tierp->base + off, NULL, TELE_LOG_SECTOR_SIZE);
+    if (err)
+    {
+        tierp->stats.flash_errors++;
+        LOG_ERR("Unable to erase %s sector at 0x%x: %d", tierp->namep, off, err);
+        return err;
+    }
+
+    tierp->stats.sectors_erased++;
+    return 0;
+}
+
+/**
+* @brief    tele_log_flush_tier - Write the buffered records of a tier to flash
+*
+* @param    tierp   tier of the log
+*
+* @return   none
+*
+* @note     runs in the telemetry log work queue. Each write fills the rest of the current page
+*/
+static void tele_log_flush_tier(struct tele_tier_blk *tierp)
+{
+    struct tele_log_sector_sum *sump;
+    k_spinlock_key_t key;
+    int num, i;
+    int err;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    // only this work item takes records out of the buffer, so the count can only grow under our feet
+    while (tierp->pend_count > 0)
+    {
+        if (tierp->head_off % TELE_LOG_SECTOR_SIZE == 0 && tele_log_prepare_sector(tierp, tierp->head_off))
+        {
+            // leave the records buffered, the next flush tries again
+            break;
+        }
+
+        // never write across a page boundary
+        num = (TELE_LOG_PAGE_SIZE - (tierp->head_off % TELE_LOG_PAGE_SIZE)) / TELE_LOG_ENTRY_SIZE;
+
+        key = k_spin_lock(&tierp->pend_lock);
+        num = MIN(num, tierp->pend_count);
+        for (i = 0; i < num; i++)
+        {
+            page_buf[i].rec = tierp->pendingp[tierp->pend_first];
+            tierp->pend_first = (tierp->pend_first + 1) % tierp->pend_size;
+        }
+        tierp->pend_count -= num;
+        k_spin_unlock(&tierp->pend_lock, key);
+
+        // keep the sector summary up to date, the first write into a sector sets its first sequence number
+        sump = &tierp->indexp[tierp->head_off / TELE_LOG_SECTOR_SIZE];
+        if (tierp->head_off % TELE_LOG_SECTOR_SIZE == 0)
+            sump->first_seq = page_buf[0].rec.seq;
+
+        for (i = 0; i < num; i++)
+        {
+            page_buf[i].sent = TELE_LOG_UNSENT;
+            page_buf[i].crc = crc32_ieee((const uint8_t *)&page_buf[i].rec, sizeof(page_buf[i].rec));
+
+            if (sump->first_ts == 0)
+                sump->first_ts = page_buf[i].rec.timestamp;
+        }
+
+        err = tele_log_flash_io(TELE_LOG_IO_WRITE, tierp->base + tierp->head_off, page_buf,
+                    num * TELE_LOG_ENTRY_SIZE);
+        if (err)
+        {
+            tierp->stats.flash_errors++;
+            LOG_ERR("Unable to write %d %s records at 0x%x: %d", num, tierp->namep, tierp->head_off, err);
+        }
+        else
+        {
+            tierp->stats.pages_written++;
+        }
+
+        // move on even after an error, the crc makes sure a bad entry is skipped
+        tierp->head_off = (tierp->head_off + num * TELE_LOG_ENTRY_SIZE) % tierp->size;
+    }
+
+    k_mutex_unlock(&tierp->log_lock);
+}
+
+/**
+* @brief    tele_log_flush_work_fn - Write the buffered records of every tier to flash
+*
+* @param    workp   pointer to work item - not used
+*
+* @return   none
+*
+* @note     runs in the telemetry log work queue
+*/
+static void tele_log_flush_work_fn(struct k_work *workp)
+{
+    int tier;
+
+    for (tier = 0; tier < TELE_TIER_NUM; tier++)
+        tele_log_flush_tier(&log_cblk.tiers[tier]);
+}
+
+/**
+* @brief    tele_log_append_tier - Append a record to one tier of the telemetry log
+*
+* @param    tier    tier to append to
+* @param    recp    record to append, the sequence number is filled in
+*
+* @return   0 on success, -ENOBUFS if the RAM buffer is full, -EAGAIN if the log is not initialized
+*
+* @note     Never blocks, can be called from any thread or an ISR
+*/
+int tele_log_append_tier(enum tele_log_tier tier, struct tele_record *recp)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    k_spinlock_key_t key;
+    int count;
+
+    if (!log_cblk.ready)
+        return -EAGAIN;
+
+    key = k_spin_lock(&tierp->pend_lock);
+
+    if (tierp->pend_count >= tierp->pend_size)
+    {
+        tierp->stats.dropped_full++;
+        k_spin_unlock(&tierp->pend_lock, key);
+        return -ENOBUFS;
+    }
+
+    recp->seq = tierp->next_seq++;
+    tierp->pendingp[(tierp->pend_first + tierp->pend_count) % tierp->pend_size] = *recp;
+    count = ++tierp->pend_count;
+    tierp->stats.appended++;
+
+    k_spin_unlock(&tierp->pend_lock, key);
+
+    // write right away once there is a page worth (or the buffer is full), otherwise let records batch up
+    if (count >= MIN(TELE_LOG_ENTRIES_PER_PAGE, tierp->pend_size))
+        k_work_reschedule_for_queue(&tele_log_workq, &tele_log_flush_work, K_NO_WAIT);
+    else
+        k_work_schedule_for_queue(&tele_log_workq, &tele_log_flush_work, K_MSEC(CONFIG_TELE_LOG_FLUSH_DELAY_MS));
+
+    return 0;
+}
+
+/**
+* @brief    tele_log_append - Append a record to the telemetry log
+*
+* @param    recp    record to append, the sequence number is filled in
+*
+* @return   0 on success, -ENOBUFS if the RAM buffer is full, -EAGAIN if the log is not initialized
+*
+* @note     Never blocks, can be called from any thread or an ISR. The record goes in the raw tier and
+*           into the rollups.
+*/
+int tele_log_append(struct tele_record *recp)
+{
+    int err;
+
+    err = tele_log_append_tier(TELE_TIER_RAW, recp);
+    if (err == 0)
+        tele_rollup_add(recp);
+
+    return err;
+}
+
+/**
+* @brief    tele_log_append_alarm - Append an alarm to the telemetry log
+*
+* @param    recp    the alarm, the sequence number is filled in
+*
+* @return   see tele_log_append()
+*
+* @note     Never blocks, can be called from any thread or an ISR. Raw tier only, the value that raised
+*           the alarm is usually logged as a sample as well and must not count twice in the rollups. The
+*           sequence number is unique across resets once the record is in flash, see tele_log_sync().
+*/
+int tele_log_append_alarm(struct tele_record *recp)
+{
+    return tele_log_append_tier(TELE_TIER_RAW, recp);
+}
+
+/**
+* @brief    tele_log_append_sample - Append a single sample, time stamped now
+*
+* @param    type    what was measured
+* @param    value   the measurement
+*
+* @return   see tele_log_append()
+*/
+int tele_log_append_sample(enum tele_rec_type type, int32_t value)
+{
+    struct tele_record rec;
+    int64_t now_ms;
+
+    rec.timestamp = 0;
+    if (date_time_now(&now_ms) == 0)
+        rec.timestamp = (uint32_t)(now_ms / MSEC_PER_SEC);
+
+    rec.type = type;
+    rec.count = 1;
+    rec.value = value;
+    rec.min = value;
+    rec.max = value;
+
+    return tele_log_append(&rec);
+}
+
+/**
+* @brief    tele_log_flush - Write the buffered records to flash now instead of waiting for the flush delay
+*
+* @param    none
+*
+* @return   none
+*
+* @note     asynchronous, the records are written by the log's work queue
+*/
+void tele_log_flush(void)
+{
+    if (log_cblk.ready)
+        k_work_reschedule_for_queue(&tele_log_workq, &tele_log_flush_work, K_NO_WAIT);
+}
+
+/**
+* @brief    tele_log_sync - Write the buffered records to flash and wait until they are
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Blocks on the log's work queue, thread context only
+*/
+void tele_log_sync(void)
+{
+    struct k_work_sync sync;
+
+    if (!log_cblk.ready)
+        return;
+
+    k_work_reschedule_for_queue(&tele_log_workq, &tele_log_flush_work, K_NO_WAIT);
+    k_work_flush_delayable(&tele_log_flush_work, &sync);
+}
+
+/**
+* @brief    tele_log_peek - Read the oldest records of a tier not sent yet, in order
+*
+* @param    tier        tier to read
+* @param    recsp       array to read the records into
+* @param    max_recs    size of the array
+*
+* @return   number of records read, 0 if there is nothing to send
+*
+* @note     The records stay in the log until tele_log_consume() is called
+*/
+int tele_log_peek(enum tele_log_tier tier, struct tele_record *recsp, int max_recs)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    struct tele_log_entry ent;
+    uint32_t off;
+    int num = 0;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    for (off = tierp->tail_off; off != tierp->head_off && num < max_recs; off = tele_log_next_off(tierp, off))
+    {
+        if (tele_log_read_entry(tierp, off, &ent))
+            break;
+
+        if (tele_log_entry_valid(&ent) && ent.sent == TELE_LOG_UNSENT)
+            recsp[num++] = ent.rec;
+    }
+
+    k_mutex_unlock(&tierp->log_lock);
+
+    return num;
+}
+
+/**
+* @brief    tele_log_consume - Mark records of a tier as sent, up to and including the given sequence number
+*
+* @param    tier        tier the records were read from
+* @param    last_seq    sequence number of the last record published
+*
+* @return   number of records marked as sent
+*/
+int tele_log_consume(enum tele_log_tier tier, uint32_t last_seq)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    struct tele_log_entry ent;
+    uint32_t sent = TELE_LOG_SENT;
+    uint32_t off;
+    int num = 0;
+    int err;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    for (off = tierp->tail_off; off != tierp->head_off; off = tele_log_next_off(tierp, off))
+    {
+        if (tele_log_read_entry(tierp, off, &ent))
+            break;
+
+        if (!tele_log_entry_valid(&ent))
+        {
+            tierp->stats.corrupt++;
+            continue;
+        }
+
+        if ((int32_t)(ent.rec.seq - last_seq) > 0)
+            break;
+
+        if (ent.sent == TELE_LOG_UNSENT)
+        {
+            // only clears bits, no erase needed
+            err = tele_log_flash_io(TELE_LOG_IO_WRITE, tierp->base + off + offsetof(struct tele_log_entry, sent),
+                        &sent, sizeof(sent));
+            if (err)
+            {
+                tierp->stats.flash_errors++;
+                LOG_ERR("Unable to mark %s record %u as sent: %d", tierp->namep, ent.rec.seq, err);
+                break;
+            }
+            num++;
+        }
+    }
+
+    tierp->tail_off = off;
+    tierp->stats.sent += num;
+
+    k_mutex_unlock(&tierp->log_lock);
+
+    return num;
+}
+
+/**
+* @brief    tele_log_history_sectors - Find the sectors of a tier holding its history
+*
+* @param    tierp       tier of the log
+* @param    oldestp     returns the oldest sector
+*
+* @return   number of sectors in the history, oldest to newest in ring order, 0 if the tier is empty
+*
+* @note     Called with log_lock held. Only looks at the RAM index, the newest sector is the one holding
+*           the entry just before the head and the oldest is the first one in use after it.
+*/
+static int tele_log_history_sectors(struct tele_tier_blk *tierp, int *oldestp)
+{
+    int newest, oldest;
+
+    newest = ((tierp->head_off + tierp->size - TELE_LOG_ENTRY_SIZE) % tierp->size) / TELE_LOG_SECTOR_SIZE;
+    if (tierp->indexp[newest].first_seq == TELE_LOG_NO_SEQ)
+        return 0;
+
+    // normally the very next sector once the tier has wrapped, sector 0 before that
+    oldest = (newest + 1) % tierp->num_sectors;
+    while (tierp->indexp[oldest].first_seq == TELE_LOG_NO_SEQ)
+        oldest = (oldest + 1) % tierp->num_sectors;
+
+    *oldestp = oldest;
+    return (newest + tierp->num_sectors - oldest) % tierp->num_sectors + 1;
+}
+
+/**
+* @brief    tele_log_sector_end - Offset just past the last entry of a sector that can hold a record
+*
+* @param    tierp   tier of the log
+* @param    sector  sector number in the tier
+*
+* @return   offset of the head if it is in the sector, the end of the sector otherwise
+*/
+static uint32_t tele_log_sector_end(struct tele_tier_blk *tierp, int sector)
+{
+    uint32_t start = sector * TELE_LOG_SECTOR_SIZE;
+
+    if (tierp->head_off > start && tierp->head_off < start + TELE_LOG_SECTOR_SIZE)
+        return tierp->head_off;
+
+    return start + TELE_LOG_SECTOR_SIZE;
+}
+
+/**
+* @brief    tele_log_seek_seq_locked - Position a cursor on a sequence number
+*
+* @param    tierp   tier of the log
+* @param    seq     sequence number to look for
+* @param    curp    cursor to position
+*
+* @return   0 on success, -ENOENT if there is no record at or after seq in flash
+*
+* @note     Called with log_lock held. Uses the RAM index only, no flash is read. If seq was already
+*           erased the cursor is put on the oldest record.
+*/
+static int tele_log_seek_seq_locked(struct tele_tier_blk *tierp, uint32_t seq, struct tele_log_cursor *curp)
+{
+    int oldest, count;
+    int lo, hi, mid;
+    int sector;
+    uint32_t off;
+
+    count = tele_log_history_sectors(tierp, &oldest);
+    if (count == 0)
+        return -ENOENT;
+
+    // first sector in age order starting after seq, the record is in the one before it
+    lo = 0;
+    hi = count;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if ((int32_t)(tierp->indexp[(oldest + mid) % tierp->num_sectors].first_seq - seq) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+    {
+        // older than anything left in the tier
+        curp->off = oldest * TELE_LOG_SECTOR_SIZE;
+        curp->seq = tierp->indexp[oldest].first_seq;
+        return 0;
+    }
+
+    sector = (oldest + lo - 1) % tierp->num_sectors;
+    off = sector * TELE_LOG_SECTOR_SIZE + (seq - tierp->indexp[sector].first_seq) * TELE_LOG_ENTRY_SIZE;
+    if (off >= tele_log_sector_end(tierp, sector))
+    {
+        // past the end of the sector, only possible past the head
+        return -ENOENT;
+    }
+
+    curp->off = off;
+    curp->seq = seq;
+    return 0;
+}
+
+/**
+* @brief    tele_log_ts_before - Check if the entry at off is older than a time stamp
+*
+* @param    tierp       tier of the log
+* @param    off         offset of the entry
+* @param    timestamp   time stamp to compare with
+*
+* @return   true if the entry is before the time stamp, false if it is at or after it or erased
+*
+* @note     Called with log_lock held. Torn entries and entries logged before the time was known count
+*           as before, the caller skips them anyway.
+*/
+static bool tele_log_ts_before(struct tele_tier_blk *tierp, uint32_t off, uint32_t timestamp)
+{
+    struct tele_log_entry ent;
+
+    if (tele_log_read_entry(tierp, off, &ent) || tele_log_entry_erased(&ent))
+        return false;
+
+    if (!tele_log_entry_valid(&ent))
+        return true;
+
+    return ent.rec.timestamp < timestamp;
+}
+
+/**
+* @brief    tele_log_seek_time_locked - Position a cursor on the first record at or after a time stamp
+*
+* @param    tierp       tier of the log
+* @param    timestamp   unix time in seconds
+* @param    curp        cursor to position
+*
+* @return   0 on success, -ENOENT if no record is that recent
+*
+* @note     Called with log_lock held. A binary search over the sector index then one over the entries of
+*           the sector found, around a dozen flash reads for a full tier. Assumes time stamps increase
+*           along the log, if the clock stepped back the cursor can land early but never late.
+*/
+static int tele_log_seek_time_locked(struct tele_tier_blk *tierp, uint32_t timestamp, struct tele_log_cursor *curp)
+{
+    struct tele_log_sector_sum *sump;
+    int oldest, count;
+    int lo, hi, mid;
+    int sector;
+    uint32_t start, end;
+
+    count = tele_log_history_sectors(tierp, &oldest);
+    if (count == 0)
+        return -ENOENT;
+
+    // first sector in age order starting after the time stamp, sectors without a time count as before
+    lo = 0;
+    hi = count;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (tierp->indexp[(oldest + mid) % tierp->num_sectors].first_ts <= timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    sector = (oldest + (lo > 0 ? lo - 1 : 0)) % tierp->num_sectors;
+    sump = &tierp->indexp[sector];
+    start = sector * TELE_LOG_SECTOR_SIZE;
+    end = tele_log_sector_end(tierp, sector);
+
+    // first entry of the sector at or after the time stamp
+    lo = 0;
+    hi = (end - start) / TELE_LOG_ENTRY_SIZE;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (tele_log_ts_before(tierp, start + mid * TELE_LOG_ENTRY_SIZE, timestamp))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    curp->off = (start + lo * TELE_LOG_ENTRY_SIZE) % tierp->size;
+    curp->seq = sump->first_seq + lo;
+
+    return curp->off == tierp->head_off ? -ENOENT : 0;
+}
+
+/**
+* @brief    tele_log_scan_time_locked - Linear search for the first record at or after a time stamp
+*
+* @param    tierp       tier of the log
+* @param    timestamp   unix time in seconds
+* @param    curp        cursor to position
+*
+* @return   0 on success, -ENOENT if no record is that recent
+*
+* @note     Called with log_lock held. Reads the history entry by entry from the oldest record, only used
+*           to benchmark tele_log_seek_time_locked() against.
+*/
+static int tele_log_scan_time_locked(struct tele_tier_blk *tierp, uint32_t timestamp, struct tele_log_cursor *curp)
+{
+    struct tele_log_entry ent;
+    int oldest;
+    uint32_t off;
+
+    if (tele_log_history_sectors(tierp, &oldest) == 0)
+        return -ENOENT;
+
+    for (off = oldest * TELE_LOG_SECTOR_SIZE; off != tierp->head_off; off = tele_log_next_off(tierp, off))
+    {
+        if (tele_log_read_entry(tierp, off, &ent))
+            return -EIO;
+
+        if (tele_log_entry_valid(&ent) && ent.rec.timestamp >= timestamp)
+        {
+            curp->off = off;
+            curp->seq = ent.rec.seq;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/**
+* @brief    tele_log_seek_seq - Position a cursor on a record of the history by sequence number
+*
+* @param    tier    tier to search
+* @param    seq     sequence number to look for
+* @param    curp    cursor to position
+*
+* @return   0 on success, -ENOENT if there is no record at or after seq in flash
+*
+* @note     Lets the uploader resume where a partial upload stopped. If seq has already been erased
+*           the cursor starts at the oldest record, check the sequence numbers read.
+*/
+int tele_log_seek_seq(enum tele_log_tier tier, uint32_t seq, struct tele_log_cursor *curp)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    int err;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+    curp->tier = tier;
+    err = tele_log_seek_seq_locked(tierp, seq, curp);
+    k_mutex_unlock(&tierp->log_lock);
+
+    return err;
+}
+
+/**
+* @brief    tele_log_seek_time - Position a cursor on the first record of the history at or after a time
+*
+* @param    tier        tier to search
+* @param    timestamp   unix time in seconds
+* @param    curp        cursor to position
+*
+* @return   0 on success, -ENOENT if no record is that recent
+*/
+int tele_log_seek_time(enum tele_log_tier tier, uint32_t timestamp, struct tele_log_cursor *curp)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    int err;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+    curp->tier = tier;
+    err = tele_log_seek_time_locked(tierp, timestamp, curp);
+    k_mutex_unlock(&tierp->log_lock);
+
+    return err;
+}
+
+/**
+* @brief    tele_log_read - Read the history from a cursor, sent or not, and move the cursor past it
+*
+* @param    curp        cursor set by tele_log_seek_seq() or tele_log_seek_time()
+* @param    recsp       array to read the records into
+* @param    max_recs    size of the array
+*
+* @return   number of records read, 0 once the cursor reaches the newest record in flash
+*
+* @note     The cursor can be kept across calls. If the log wrapped over it in the meantime it moves on
+*           to the oldest record still in flash.
+*/
+int tele_log_read(struct tele_log_cursor *curp, struct tele_record *recsp, int max_recs)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[curp->tier];
+    struct tele_log_sector_sum *sump;
+    struct tele_log_entry ent;
+    int num = 0;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    // the sector under the cursor has to still hold the sequence number the cursor expects
+    sump = &tierp->indexp[curp->off / TELE_LOG_SECTOR_SIZE];
+    if (sump->first_seq == TELE_LOG_NO_SEQ
+        || curp->seq - sump->first_seq != (curp->off % TELE_LOG_SECTOR_SIZE) / TELE_LOG_ENTRY_SIZE)
+    {
+        if (tele_log_seek_seq_locked(tierp, curp->seq, curp))
+            curp->off = tierp->head_off;
+    }
+
+    while (curp->off != tierp->head_off && num < max_recs)
+    {
+        if (tele_log_read_entry(tierp, curp->off, &ent) || tele_log_entry_erased(&ent))
+            break;
+
+        if (tele_log_entry_valid(&ent))
+        {
+            recsp[num++] = ent.rec;
+            curp->seq = ent.rec.seq;
+        }
+
+        curp->seq++;
+        curp->off = tele_log_next_off(tierp, curp->off);
+    }
+
+    k_mutex_unlock(&tierp->log_lock);
+
+    return num;
+}
+
+/**
+* @brief    tele_log_skip - Pass over the unsent records of a tier older than a time stamp
+*
+* @param    tier        tier to skip records in
+* @param    timestamp   unix time in seconds, records before it are skipped
+*
+* @return   number of records skipped
+*
+* @note     For records another tier covers, so the uploader does not have to read them. Only the
+*           tail moves, the records are not marked as sent: after a reboot they are skipped again.
+*/
+int tele_log_skip(enum tele_log_tier tier, uint32_t timestamp)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    struct tele_log_cursor cur;
+    uint32_t tail_dist, new_dist;
+    int num = 0;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    if (tele_log_seek_time_locked(tierp, timestamp, &cur))
+        cur.off = tierp->head_off;
+
+    // only ever move the tail forward, towards the head
+    tail_dist = (tierp->head_off + tierp->size - tierp->tail_off) % tierp->size;
+    new_dist = (tierp->head_off + tierp->size - cur.off) % tierp->size;
+    if (new_dist < tail_dist)
+    {
+        num = (tail_dist - new_dist) / TELE_LOG_ENTRY_SIZE;
+        tierp->tail_off = cur.off;
+        tierp->stats.skipped += num;
+    }
+
+    k_mutex_unlock(&tierp->log_lock);
+
+    return num;
+}
+
+/**
+* @brief    tele_log_consume_before - Mark the records of a tier older than a time stamp as sent
+*
+* @param    tier        tier to mark records in
+* @param    timestamp   unix time in seconds, records before it are marked
+*
+* @return   number of records marked as sent
+*
+* @note     For rollups whose period has been published in finer detail by another tier
+*/
+int tele_log_consume_before(enum tele_log_tier tier, uint32_t timestamp)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+    struct tele_log_cursor cur;
+    uint32_t last_seq;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    if (tele_log_seek_time_locked(tierp, timestamp, &cur))
+        last_seq = tierp->next_seq - 1;
+    else
+        last_seq = cur.seq - 1;
+
+    k_mutex_unlock(&tierp->log_lock);
+
+    return tele_log_consume(tier, last_seq);
+}
+
+/**
+* @brief    tele_log_bench - Compare finding a time stamp in the raw tier with the index and with a scan
+*
+* @param    timestamp   unix time in seconds to look for
+*
+* @return   none
+*
+* @note     Prints the flash reads and time taken by each. Holds the log lock for the whole linear scan,
+*           which takes seconds on a full log, so only for use from the shell.
+*/
+void tele_log_bench(uint32_t timestamp)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[TELE_TIER_RAW];
+    struct tele_log_cursor index_cur = { 0 }, scan_cur = { 0 };
+    uint32_t start_cyc, index_cyc, scan_cyc;
+    uint32_t start_reads, index_reads, scan_reads;
+    int index_err, scan_err;
+    int oldest, count;
+
+    k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+    count = tele_log_history_sectors(tierp, &oldest);
+
+    start_reads = tierp->stats.entry_reads;
+    start_cyc = k_cycle_get_32();
+    index_err = tele_log_seek_time_locked(tierp, timestamp, &index_cur);
+    index_cyc = k_cycle_get_32() - start_cyc;
+    index_reads = tierp->stats.entry_reads - start_reads;
+
+    start_reads = tierp->stats.entry_reads;
+    start_cyc = k_cycle_get_32();
+    scan_err = tele_log_scan_time_locked(tierp, timestamp, &scan_cur);
+    scan_cyc = k_cycle_get_32() - start_cyc;
+    scan_reads = tierp->stats.entry_reads - start_reads;
+
+    k_mutex_unlock(&tierp->log_lock);
+
+    printk("\nHistory seek benchmark, %d sectors (%u KB) in use:\n\n", count,
+        count * TELE_LOG_SECTOR_SIZE / 1024);
+    printk("Indexed: %d, seq %u at 0x%x, %u reads, %u us\n", index_err, index_cur.seq, index_cur.off,
+        index_reads, k_cyc_to_us_floor32(index_cyc));
+    printk("Linear:  %d, seq %u at 0x%x, %u reads, %u us\n", scan_err, scan_cur.seq, scan_cur.off,
+        scan_reads, k_cyc_to_us_floor32(scan_cyc));
+}
+
+/**
+* @brief    tele_log_check - Check that recovering each tier from flash finds the head and tail it runs with
+*
+* @param    none
+*
+* @return   number of tiers whose recovery does not match
+*
+* @note     What a reboot would find, without the reboot. Everything buffered is flushed first. Meant to be
+*           run on a log that wrapped and is full of unsent records, with the head on a sector boundary,
+*           which is where a reboot used to drop the whole backlog. Holds the log lock of each tier while it
+*           is read back, so only for use from the shell.
+*/
+int tele_log_check(void)
+{
+    struct tele_tier_blk *tierp;
+    uint32_t head_off, tail_off, last_seq;
+    bool wrapped;
+    int tier, sector;
+    int bad = 0;
+
+    if (!log_cblk.ready)
+        return 0;
+
+    tele_log_sync();
+
+    printk("\nTelemetry log recovery check:\n\n");
+    for (tier = 0; tier < TELE_TIER_NUM; tier++)
+    {
+        tierp = &log_cblk.tiers[tier];
+
+        k_mutex_lock(&tierp->log_lock, K_FOREVER);
+
+        wrapped = true;
+        for (sector = 0; sector < tierp->num_sectors; sector++)
+        {
+            if (tierp->indexp[sector].first_seq == TELE_LOG_NO_SEQ)
+                wrapped = false;
+        }
+
+        // rebuilds the sector index from flash as well, it comes out the same
+        if (!tele_log_find_ends(tierp, &head_off, &tail_off, &last_seq))
+        {
+            head_off = 0;
+            tail_off = 0;
+        }
+
+        printk("%s: head 0x%x, tail 0x%x%s%s, recovered head 0x%x, tail 0x%x: %s\n", tierp->namep,
+            tierp->head_off, tierp->tail_off, wrapped ? ", wrapped" : "",
+            tierp->head_off % TELE_LOG_SECTOR_SIZE == 0 ? ", head on a sector boundary" : "", head_off, tail_off,
+            head_off == tierp->head_off && tail_off == tierp->tail_off ? "ok" : "MISMATCH");
+
+        if (head_off != tierp->head_off || tail_off != tierp->tail_off)
+            bad++;
+
+        k_mutex_unlock(&tierp->log_lock);
+    }
+
+    return bad;
+}
+
+/**
+* @brief    tele_log_is_empty - Check if there is anything in a tier waiting to be sent
+*
+* @param    tier    tier to check
+*
+* @return   true if every record has been sent (or nothing was ever logged)
+*
+* @note     records still in the RAM buffer count as waiting
+*/
+bool tele_log_is_empty(enum tele_log_tier tier)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+
+    return tierp->tail_off == tierp->head_off && tierp->pend_count == 0;
+}
+
+/**
+* @brief    tele_log_queued - Number of records of a tier waiting to be sent
+*
+* @param    tier    tier to check
+*
+* @return   records in flash not sent yet plus the records still in the RAM buffer
+*
+* @note     Torn entries in flash are counted too, the number is for statistics
+*/
+uint32_t tele_log_queued(enum tele_log_tier tier)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+
+    return ((tierp->head_off + tierp->size - tierp->tail_off) % tierp->size) / TELE_LOG_ENTRY_SIZE +
+        tierp->pend_count;
+}
+
+/**
+* @brief    tele_log_dropped - Number of records of a tier lost before they were sent
+*
+* @param    tier    tier to check
+*
+* @return   records refused because the RAM buffer was full plus unsent records erased when the log wrapped
+*/
+uint32_t tele_log_dropped(enum tele_log_tier tier)
+{
+    struct tele_tier_blk *tierp = &log_cblk.tiers[tier];
+
+    return tierp->stats.dropped_full + tierp->stats.dropped_wrap;
+}
+
+/**
+* @brief    tele_log_stats_print - Print the statistics of the telemetry log
+*
+* @param    none
+*
+* @return   none
+*/
+void tele_log_stats_print(void)
+{
+    struct tele_tier_blk *tierp;
+    struct tele_log_stats *statsp;
+    uint32_t queued;
+    int tier;
+
+    printk("\nTelemetry log statistics:\n");
+
+    for (tier = 0; tier < TELE_TIER_NUM; tier++)
+    {
+        tierp = &log_cblk.tiers[tier];
+        statsp = &tierp->stats;
+        queued = tele_log_queued(tier) - tierp->pend_count;
+
+        printk("\n%s tier, region: 0x%x, size: %u KB, capacity: %u records\n", tierp->namep, tierp->base,
+            tierp->size / 1024, tierp->size / TELE_LOG_ENTRY_SIZE);
+        printk("Head: 0x%x, Tail: 0x%x, Next seq: %u\n", tierp->head_off, tierp->tail_off, tierp->next_seq);
+        printk("Queued in flash: %u, in RAM: %d\n", queued, tierp->pend_count);
+        printk("Appended: %u, Sent: %u, Skipped: %u\n", statsp->appended, statsp->sent, statsp->skipped);
+        printk("Pages written: %u, Sectors erased: %u\n", statsp->pages_written, statsp->sectors_erased);
+        printk("Dropped (RAM full): %u, Dropped (log wrapped): %u\n", statsp->dropped_full, statsp->dropped_wrap);
+        printk("Corrupt entries: %u, Flash errors: %u\n", statsp->corrupt, statsp->flash_errors);
+        printk("Entries read: %u\n", statsp->entry_reads);
+    }
+}
+
+/**
+* @brief    tele_log_init - Init the telemetry log and recover its state from flash
+*
+* @param    none
+*
+* @return   none
+*
+* @note     Call after spi_sched_init() and config_init(). The tele_log partition is the upper part of the
+*           old 4 MB littlefs_storage, it is only erased once the datastore is migrated off littlefs for
+*           good. Aborts if that is not the case, or if the partition or the flash is not available.
+*/
+void tele_log_init(void)
+{
+    struct tele_log_blk *cblkp = &log_cblk;
+    int tier;
+
+    // units in the field still have their config in the littlefs spanning the whole flash
+    if (!config_legacy_fs_retired())
+        erabort("tele_log_init - config not migrated off the external flash");
+
+    if (flash_area_open(FLASH_AREA_ID(tele_log), &cblkp->fap))
+        erabort("tele_log_init - no tele_log partition");
+
+    if (!device_is_ready(DEVICE_DT_GET(DT_NODELABEL(w25q32jv))))
+        erabort("tele_log_init - external flash not ready");
+
+    for (tier = 0; tier < TELE_TIER_NUM; tier++)
+    {
+        k_mutex_init(&cblkp->tiers[tier].log_lock);
+        tele_log_recover(&cblkp->tiers[tier]);
+    }
+
+    k_work_queue_start(&tele_log_workq, tele_log_stack_area, K_THREAD_STACK_SIZEOF(tele_log_stack_area),
+                    TELE_LOG_WORKQ_PRIORITY, NULL);
+    k_thread_name_set(&tele_log_workq.thread, "tele_log");
+
+    cblkp->ready = true;
+}
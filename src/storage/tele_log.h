@@ -0,0 +1,62 @@
+/**
+ * @brief: 	tele_log.h - External definitions for the store-and-forward telemetry log
+ *
+ * @notes: 	See tele_log.c for more information
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef TELE_LOG_H_
+#define TELE_LOG_H_
+
+#include <zephyr.h>
+#include "encoding/telemetry.h"
+
+/*
+*   Tiers of the log, each a ring of its own. Raw holds every record appended, the others hold rollups
+*   of it (mean, min, max and count) over a fixed period so they reach much further back.
+*/
+enum tele_log_tier
+{
+    TELE_TIER_RAW = 0,
+    TELE_TIER_MINUTE,
+    TELE_TIER_HOUR,
+    TELE_TIER_NUM
+};
+
+#define TELE_TIER_MINUTE_S          60      // period of a record in the minute tier
+#define TELE_TIER_HOUR_S            3600    // period of a record in the hour tier
+
+/*
+*   Position in the sample history, set by tele_log_seek_seq() or tele_log_seek_time() and moved on by
+*   tele_log_read(). Plain data, the caller owns it.
+*/
+struct tele_log_cursor
+{
+    uint32_t    tier;               // enum tele_log_tier
+    uint32_t    off;                // offset of the next entry to read in the tier
+    uint32_t    seq;                // sequence number expected there
+};
+
+void    tele_log_init(void);
+int     tele_log_append(struct tele_record *recp);
+int     tele_log_append_sample(enum tele_rec_type type, int32_t value);
+int     tele_log_append_alarm(struct tele_record *recp);
+void    tele_log_flush(void);
+void    tele_log_sync(void);
+int     tele_log_peek(enum tele_log_tier tier, struct tele_record *recsp, int max_recs);
+int     tele_log_consume(enum tele_log_tier tier, uint32_t last_seq);
+int     tele_log_consume_before(enum tele_log_tier tier, uint32_t timestamp);
+int     tele_log_skip(enum tele_log_tier tier, uint32_t timestamp);
+bool    tele_log_is_empty(enum tele_log_tier tier);
+uint32_t tele_log_queued(enum tele_log_tier tier);
+uint32_t tele_log_dropped(enum tele_log_tier tier);
+void    tele_log_stats_print(void);
+
+int     tele_log_seek_seq(enum tele_log_tier tier, uint32_t seq, struct tele_log_cursor *curp);
+int     tele_log_seek_time(enum tele_log_tier tier, uint32_t timestamp, struct tele_log_cursor *curp);
+int     tele_log_read(struct tele_log_cursor *curp, struct tele_record *recsp, int max_recs);
+void    tele_log_bench(uint32_t timestamp);
+int     tele_log_check(void);
+
+#endif /* TELE_LOG_H_ */
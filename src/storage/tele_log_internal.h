@@ -0,0 +1,51 @@
+/**
+ * @brief: 	tele_log_internal.h - Internal definitions for the telemetry log
+ *
+ * @note:   Only to be included by the storage module. Describes how the log is laid out in the
+ *          external flash.
+ *
+ *           Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+#ifndef TELE_LOG_INTERN_H_
+#define TELE_LOG_INTERN_H_
+
+#include "encoding/telemetry.h"
+#include "tele_log.h"
+
+#define TELE_LOG_SECTOR_SIZE        4096        // erase unit of the W25Q32JV
+#define TELE_LOG_PAGE_SIZE          256         // program unit of the W25Q32JV, writes never cross a page
+
+/*
+*   One entry in flash. The log region is a ring of erase sectors each holding a whole number of entries.
+*   There is no other metadata: on boot the sector holding the highest sequence number is the head and
+*   the first entry not yet sent is the tail.
+*
+*   The sent word is left erased (all ones) when the entry is written and is programmed to zero once the
+*   record is published. NOR flash can always clear bits without an erase so this never costs a sector
+*   erase, and the crc does not cover it.
+*/
+struct tele_log_entry
+{
+    struct tele_record  rec;            // the record
+    uint32_t            sent;           // TELE_LOG_UNSENT until the record has been published
+    uint32_t            crc;            // crc32 (ieee) of rec
+} __packed;
+
+#define TELE_LOG_UNSENT             0xFFFFFFFF
+#define TELE_LOG_SENT               0x00000000
+#define TELE_LOG_ERASED_WORD        0xFFFFFFFF
+
+#define TELE_LOG_ENTRY_SIZE         sizeof(struct tele_log_entry)
+#define TELE_LOG_ENTRIES_PER_PAGE   (TELE_LOG_PAGE_SIZE / TELE_LOG_ENTRY_SIZE)
+#define TELE_LOG_ENTRIES_PER_SECTOR (TELE_LOG_SECTOR_SIZE / TELE_LOG_ENTRY_SIZE)
+
+BUILD_ASSERT(TELE_LOG_PAGE_SIZE % sizeof(struct tele_log_entry) == 0, "entries must not straddle a page");
+
+// tele_log.c
+int     tele_log_append_tier(enum tele_log_tier tier, struct tele_record *recp);
+
+// tele_rollup.c
+void    tele_rollup_add(const struct tele_record *recp);
+
+#endif // TELE_LOG_INTERN_H_
@@ -0,0 +1,141 @@
+/**
+ * @brief: 	tele_rollup.c - Per-minute and per-hour rollups of the telemetry records
+ *
+ * @notes:  Every record with a time stamp appended to the raw tier is also folded into a running
+ *          aggregate (sum, min, max, count) for the minute and the hour it falls in, one per record type.
+ *          When a record arrives for a later period the aggregate is closed and appended to the matching
+ *          tier as a single record: time stamp at the start of the period, value the mean.
+ *
+ *          Both rollups are built from the raw records so the means are exact. The periods still open are
+ *          only in RAM and are lost on a reboot, the raw records of them are not.
+ *
+ * 			Copyright (c) 2023 Reliance Foundry Co. Ltd.
+ *
+ */
+
+// includes for nrf system
+#include <zephyr.h>
+#include <logging/log.h>
+
+// includes for application
+#include "tele_log.h"
+#include "tele_log_internal.h"
+
+LOG_MODULE_REGISTER(tele_rollup);   // register with logging package
+
+/*
+*   The rollup tiers, finest first
+*/
+static const struct tele_rollup_level {
+    enum tele_log_tier  tier;
+    uint32_t            period_s;
+} rollup_levels[] = {
+    { TELE_TIER_MINUTE, TELE_TIER_MINUTE_S },
+    { TELE_TIER_HOUR,   TELE_TIER_HOUR_S },
+};
+
+#define TELE_ROLLUP_LEVELS          ARRAY_SIZE(rollup_levels)
+
+/*
+*   Aggregate of the period being accumulated for one record type and tier
+*/
+struct tele_rollup_acc {
+    uint32_t    start_ts;           // start of the period
+    uint32_t    count;              // samples so far, 0 if nothing is accumulated
+    int64_t     sum;                // sum of the samples, for the mean
+    int32_t     min;
+    int32_t     max;
+};
+
+/*
+*   Rollup control block
+*/
+struct tele_rollup_blk {
+    struct k_spinlock       lock;   // records are appended from any context
+    struct tele_rollup_acc  acc[TELE_TYPE_NUM][TELE_ROLLUP_LEVELS];
+};
+
+// allocate storage for the control block
+static struct tele_rollup_blk rollup_cblk;
+
+/**
+* @brief    tele_rollup_close - Turn an aggregate into a record and reset it
+*
+* @param    accp    aggregate to close, holds at least one sample
+* @param    type    record type being aggregated
+* @param    recp    record to fill in
+*
+* @return   none
+*/
+static void tele_rollup_close(struct tele_rollup_acc *accp, uint16_t type, struct tele_record *recp)
+{
+    recp->timestamp = accp->start_ts;
+    recp->type = type;
+    recp->count = MIN(accp->count, UINT16_MAX);
+    recp->value = (int32_t)(accp->sum / accp->count);
+    recp->min = accp->min;
+    recp->max = accp->max;
+
+    accp->count = 0;
+}
+
+/**
+* @brief    tele_rollup_add - Fold a raw record into the rollups, appending those it closes
+*
+* @param    recp    record just appended to the raw tier
+*
+* @return   none
+*
+* @note     Never blocks, can be called from any context. Records without a time stamp are not rolled up.
+*/
+void tele_rollup_add(const struct tele_record *recp)
+{
+    struct tele_rollup_blk *cblkp = &rollup_cblk;
+    struct tele_rollup_acc *accp;
+    struct tele_record closed[TELE_ROLLUP_LEVELS];
+    enum tele_log_tier closed_tier[TELE_ROLLUP_LEVELS];
+    k_spinlock_key_t key;
+    uint32_t start_ts;
+    int num_closed = 0;
+    int level;
+    int i;
+
+    if (recp->timestamp == 0 || recp->type >= TELE_TYPE_NUM || recp->count == 0)
+        return;
+
+    key = k_spin_lock(&cblkp->lock);
+
+    for (level = 0; level < TELE_ROLLUP_LEVELS; level++)
+    {
+        accp = &cblkp->acc[recp->type][level];
+        start_ts = recp->timestamp - recp->timestamp % rollup_levels[level].period_s;
+
+        // a record for another period closes the one accumulated
+        if (accp->count > 0 && accp->start_ts != start_ts)
+        {
+            tele_rollup_close(accp, recp->type, &closed[num_closed]);
+            closed_tier[num_closed++] = rollup_levels[level].tier;
+        }
+
+        if (accp->count == 0)
+        {
+            accp->start_ts = start_ts;
+            accp->sum = 0;
+            accp->min = recp->min;
+            accp->max = recp->max;
+        }
+
+        accp->count += recp->count;
+        accp->sum += (int64_t)recp->value * recp->count;
+        accp->min = MIN(accp->min, recp->min);
+        accp->max = MAX(accp->max, recp->max);
+    }
+
+    k_spin_unlock(&cblkp->lock, key);
+
+    for (i = 0; i < num_closed; i++)
+    {
+        if (tele_log_append_tier(closed_tier[i], &closed[i]))
+            LOG_WRN("Rollup of type %u at %u lost", closed[i].type, closed[i].timestamp);
+    }
+}